@@ -17,6 +17,12 @@ public:
     Input<Buffer<int16_t>>  input{"input", 2};
     Output<Buffer<int16_t>> output{"output", 2};
 
+    // Schedule knobs for design space exploration.
+    GeneratorParam<int>  tile_size{"tile_size", 64};
+    GeneratorParam<bool> unroll_window{"unroll_window", true};
+    GeneratorParam<bool> linebuffer_blur{"linebuffer_blur", true};
+    GeneratorParam<int>  fifo_depth{"fifo_depth", 0};
+
     void generate() {
         /* THE ALGORITHM */
 
@@ -65,12 +71,20 @@ public:
           
           hw_output
             //            .compute_at(output, xo)
-            .tile(x, y, xo, yo, xi, yi, 64, 64)
+            .tile(x, y, xo, yo, xi, yi, tile_size, tile_size)
             .hw_accelerate(xi, xo);
 
-          blur_unnormalized.update().unroll(win.x).unroll(win.y);
-          
-          blur_unnormalized.linebuffer();
+          if (unroll_window) {
+            blur_unnormalized.update().unroll(win.x).unroll(win.y);
+          }
+
+          if (linebuffer_blur) {
+            blur_unnormalized.linebuffer();
+          }
+
+          if (fifo_depth > 0) {
+            hw_input.fifo_depth(blur_unnormalized, fifo_depth);
+          }
 
           //hw_output.accelerate({hw_input}, xi, xo);
           hw_input.stream_to_accelerator();
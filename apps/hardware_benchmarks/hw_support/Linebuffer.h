@@ -556,6 +556,103 @@ void linebuffer(stream<AxiPackedStencil<T, IN_EXTENT_0, IN_EXTENT_1, IN_EXTENT_2
 }
 
 
+/** Keeps every STRIDE-th window of a dense window stream (one window per
+ * input of a linebuffer, NUM_EXTENT windows in each dimension), and repeats
+ * each kept window HOLD_0 times along dimension 0 and each row of kept windows
+ * HOLD_1 times along dimension 1. It is the decimation and zero-order hold of
+ * the resampling linebuffers used by image pyramids.
+ */
+template <size_t NUM_EXTENT_0, size_t NUM_EXTENT_1, size_t NUM_EXTENT_2, size_t NUM_EXTENT_3,
+          size_t STRIDE_0, size_t STRIDE_1, size_t STRIDE_2, size_t STRIDE_3,
+          size_t HOLD_0, size_t HOLD_1,
+          typename STENCIL_T>
+void resample_windows(stream<STENCIL_T> &in_stream,
+                      stream<STENCIL_T> &out_stream) {
+#pragma HLS INLINE off
+    const size_t ROW_EXTENT = (NUM_EXTENT_0 + STRIDE_0 - 1) / STRIDE_0;
+    STENCIL_T row[ROW_EXTENT];  // the kept windows of the current row, for replay
+
+ RS_rows:for (size_t idx_3 = 0; idx_3 < NUM_EXTENT_3; idx_3++)
+    for (size_t idx_2 = 0; idx_2 < NUM_EXTENT_2; idx_2++)
+    for (size_t idx_1 = 0; idx_1 < NUM_EXTENT_1; idx_1++) {
+#pragma HLS LOOP_FLATTEN off
+        bool keep_row = idx_1 % STRIDE_1 == 0 && idx_2 % STRIDE_2 == 0 && idx_3 % STRIDE_3 == 0;
+        for (size_t idx_0 = 0; idx_0 < NUM_EXTENT_0; idx_0++) {
+#pragma HLS PIPELINE II=1
+            STENCIL_T window = in_stream.read();
+            if (keep_row && idx_0 % STRIDE_0 == 0) {
+                row[idx_0 / STRIDE_0] = window;
+                for (size_t hold_0 = 0; hold_0 < HOLD_0; hold_0++) {
+                    out_stream.write(window);
+                }
+            }
+        }
+        if (keep_row) {
+            for (size_t hold_1 = 1; hold_1 < HOLD_1; hold_1++)
+            for (size_t n = 0; n < ROW_EXTENT; n++)
+            for (size_t hold_0 = 0; hold_0 < HOLD_0; hold_0++) {
+#pragma HLS PIPELINE II=1
+                out_stream.write(row[n]);
+            }
+        }
+    }
+}
+
+/** A line buffer whose output windows step by STRIDE input stencils (a
+ * downsampling consumer only sees every STRIDE-th window), and are each
+ * repeated HOLD times (an upsampling consumer reuses a window for HOLD
+ * iterations). Only dimensions 0 and 1 can be upsampled. With all strides and
+ * holds equal to one, it is the same as linebuffer().
+ */
+template <size_t IMG_EXTENT_0, size_t IMG_EXTENT_1, size_t IMG_EXTENT_2, size_t IMG_EXTENT_3,
+          size_t STRIDE_0, size_t STRIDE_1, size_t STRIDE_2, size_t STRIDE_3,
+          size_t HOLD_0, size_t HOLD_1, size_t HOLD_2, size_t HOLD_3,
+	  size_t IN_EXTENT_0, size_t IN_EXTENT_1, size_t IN_EXTENT_2, size_t IN_EXTENT_3,
+	  size_t OUT_EXTENT_0, size_t OUT_EXTENT_1, size_t OUT_EXTENT_2, size_t OUT_EXTENT_3,
+	  typename T>
+void linebuffer_resample(stream<PackedStencil<T, IN_EXTENT_0, IN_EXTENT_1, IN_EXTENT_2, IN_EXTENT_3> > &in_stream,
+                         stream<PackedStencil<T, OUT_EXTENT_0, OUT_EXTENT_1, OUT_EXTENT_2, OUT_EXTENT_3> > &out_stream) {
+    static_assert(HOLD_2 == 1 && HOLD_3 == 1, "only dimensions 0 and 1 can be upsampled.");
+#pragma HLS INLINE off
+#pragma HLS DATAFLOW
+    stream<PackedStencil<T, OUT_EXTENT_0, OUT_EXTENT_1, OUT_EXTENT_2, OUT_EXTENT_3> > window_stream;
+#pragma HLS STREAM variable=window_stream depth=1
+#pragma HLS RESOURCE variable=window_stream core=FIFO_SRL
+
+    linebuffer<IMG_EXTENT_0, IMG_EXTENT_1, IMG_EXTENT_2, IMG_EXTENT_3>(in_stream, window_stream);
+    resample_windows<(IMG_EXTENT_0 - OUT_EXTENT_0) / IN_EXTENT_0 + 1,
+                     (IMG_EXTENT_1 - OUT_EXTENT_1) / IN_EXTENT_1 + 1,
+                     (IMG_EXTENT_2 - OUT_EXTENT_2) / IN_EXTENT_2 + 1,
+                     (IMG_EXTENT_3 - OUT_EXTENT_3) / IN_EXTENT_3 + 1,
+                     STRIDE_0, STRIDE_1, STRIDE_2, STRIDE_3,
+                     HOLD_0, HOLD_1>(window_stream, out_stream);
+}
+
+template <size_t IMG_EXTENT_0, size_t IMG_EXTENT_1, size_t IMG_EXTENT_2, size_t IMG_EXTENT_3,
+          size_t STRIDE_0, size_t STRIDE_1, size_t STRIDE_2, size_t STRIDE_3,
+          size_t HOLD_0, size_t HOLD_1, size_t HOLD_2, size_t HOLD_3,
+	  size_t IN_EXTENT_0, size_t IN_EXTENT_1, size_t IN_EXTENT_2, size_t IN_EXTENT_3,
+	  size_t OUT_EXTENT_0, size_t OUT_EXTENT_1, size_t OUT_EXTENT_2, size_t OUT_EXTENT_3,
+	  typename T>
+void linebuffer_resample(stream<AxiPackedStencil<T, IN_EXTENT_0, IN_EXTENT_1, IN_EXTENT_2, IN_EXTENT_3> > &in_axi_stream,
+                         stream<PackedStencil<T, OUT_EXTENT_0, OUT_EXTENT_1, OUT_EXTENT_2, OUT_EXTENT_3> > &out_stream) {
+    static_assert(HOLD_2 == 1 && HOLD_3 == 1, "only dimensions 0 and 1 can be upsampled.");
+#pragma HLS INLINE off
+#pragma HLS DATAFLOW
+    stream<PackedStencil<T, OUT_EXTENT_0, OUT_EXTENT_1, OUT_EXTENT_2, OUT_EXTENT_3> > window_stream;
+#pragma HLS STREAM variable=window_stream depth=1
+#pragma HLS RESOURCE variable=window_stream core=FIFO_SRL
+
+    linebuffer<IMG_EXTENT_0, IMG_EXTENT_1, IMG_EXTENT_2, IMG_EXTENT_3>(in_axi_stream, window_stream);
+    resample_windows<(IMG_EXTENT_0 - OUT_EXTENT_0) / IN_EXTENT_0 + 1,
+                     (IMG_EXTENT_1 - OUT_EXTENT_1) / IN_EXTENT_1 + 1,
+                     (IMG_EXTENT_2 - OUT_EXTENT_2) / IN_EXTENT_2 + 1,
+                     (IMG_EXTENT_3 - OUT_EXTENT_3) / IN_EXTENT_3 + 1,
+                     STRIDE_0, STRIDE_1, STRIDE_2, STRIDE_3,
+                     HOLD_0, HOLD_1>(window_stream, out_stream);
+}
+
+
 template <size_t IMG_EXTENT_0, size_t IMG_EXTENT_1=1, size_t IMG_EXTENT_2=1, size_t IMG_EXTENT_3=1,
 	  size_t IN_EXTENT_0, size_t IN_EXTENT_1, size_t IN_EXTENT_2, size_t IN_EXTENT_3,
           size_t OUT_EXTENT_0, size_t OUT_EXTENT_1, size_t OUT_EXTENT_2, size_t OUT_EXTENT_3,
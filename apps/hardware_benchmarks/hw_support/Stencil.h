@@ -333,4 +333,48 @@ void stream_to_subimage(const struct buffer_t *buf_noop,
 }
 
 
+// A sparse output streams records of (coordinates..., value) for the nonzero
+// pixels only, with TLAST on the record of the last pixel. Every other pixel
+// of the subimage is zero.
+template <typename T, size_t RECORD_SIZE>
+void records_to_subimage(const struct buffer_t *buf_noop,
+                         hls::stream<AxiPackedStencil<T, RECORD_SIZE, 1, 1, 1> > &stream,
+                         void *subimage,
+                         int stride_0, int subimage_extent_0,
+                         int stride_1 = 1, int subimage_extent_1 = 1,
+                         int stride_2 = 1, int subimage_extent_2 = 1,
+                         int stride_3 = 1, int subimage_extent_3 = 1) {
+    (void) buf_noop;  // avoid unused warnning
+    const int strides[4] = {stride_0, stride_1, stride_2, stride_3};
+    const int extents[4] = {subimage_extent_0, subimage_extent_1, subimage_extent_2, subimage_extent_3};
+    const size_t dims = RECORD_SIZE - 1;
+    assert(dims >= 1 && dims <= 4);
+
+    for(int idx_3 = 0; idx_3 < subimage_extent_3; idx_3++)
+    for(int idx_2 = 0; idx_2 < subimage_extent_2; idx_2++)
+    for(int idx_1 = 0; idx_1 < subimage_extent_1; idx_1++)
+    for(int idx_0 = 0; idx_0 < subimage_extent_0; idx_0++) {
+        int offset = idx_0 * stride_0 + idx_1 * stride_1 + idx_2 * stride_2 + idx_3 * stride_3;
+        *((T *)subimage + offset) = 0;
+    }
+
+    size_t num_records = 0;
+    while (true) {
+        AxiPackedStencil<T, RECORD_SIZE, 1, 1, 1> axi_record = stream.read();
+        Stencil<T, RECORD_SIZE, 1, 1, 1> record = axi_record;
+        int offset = 0;
+        for (size_t d = 0; d < dims; d++) {
+            int coord = (int)record(d);
+            assert(coord >= 0 && coord < extents[d]);
+            offset += coord * strides[d];
+        }
+        *((T *)subimage + offset) = record(dims);
+        num_records++;
+        if (axi_record.last == 1) {
+            break;
+        }
+    }
+    printf("received %zu sparse output records\n", num_records);
+}
+
 #endif
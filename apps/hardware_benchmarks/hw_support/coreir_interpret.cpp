@@ -3,6 +3,13 @@
 #include "coreir/simulator/interpreter.h"
 #include "coreir/libs/commonlib.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
 #include "coreir_interpret.h"
 
 using namespace std;
@@ -39,6 +46,11 @@ public:
     }
   }
 
+  // every pixel of the image has been written
+  bool full() const {
+    return current_z >= channels;
+  }
+
   elem_t read(uint x, uint y, uint z) {
     return image(x,y,z);
   }
@@ -60,12 +72,255 @@ private:
 };
 
 
+namespace {
+
+// Energy of each class of hardware in pJ: per output bit that toggles, and
+// per memory read and write. Can be overridden with $COREIR_ENERGY_TABLE.
+struct OpEnergy {
+  double toggle;
+  double read;
+  double write;
+};
+
+map<string, OpEnergy> default_energy_table() {
+  return {
+    {"add",        {0.004, 0,   0  }},
+    {"mul",        {0.050, 0,   0  }},
+    {"compare",    {0.003, 0,   0  }},
+    {"mux",        {0.002, 0,   0  }},
+    {"logic",      {0.001, 0,   0  }},
+    {"reg",        {0.002, 0,   0  }},
+    {"linebuffer", {0.001, 2.5, 2.5}},
+    {"sram",       {0.001, 5.0, 5.5}},
+  };
+}
+
+// Each line is "<class> <pJ per toggle> [<pJ per read> <pJ per write>]".
+map<string, OpEnergy> load_energy_table(string filename) {
+  map<string, OpEnergy> table = default_energy_table();
+  if (filename.empty()) {
+    return table;
+  }
+  ifstream fin(filename);
+  if (!fin.is_open()) {
+    cout << "Could not open energy table " << filename << ", using defaults" << endl;
+    return table;
+  }
+  string line;
+  while (getline(fin, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    istringstream fields(line);
+    string op_class;
+    OpEnergy energy = {0, 0, 0};
+    if (fields >> op_class >> energy.toggle) {
+      fields >> energy.read >> energy.write;
+      table[op_class] = energy;
+    }
+  }
+  return table;
+}
+
+string instance_kind(Instance* inst) {
+  Module* m = inst->getModuleRef();
+  if (m->isGenerated()) {
+    return m->getGenerator()->getRefName();
+  }
+  return m->getRefName();
+}
+
+bool is_memory_kind(string kind) {
+  return kind.find("mem") != string::npos ||
+    kind.find("ram") != string::npos ||
+    kind.find("rom") != string::npos ||
+    kind.find("fifo") != string::npos;
+}
+
+// Map a primitive of the flattened design to the class used for energy.
+// Primitives inside a linebuffer or a memory generator count towards that.
+string energy_class(string kind, string parent_kind) {
+  string op = kind.substr(kind.find(".") + 1);
+  if (parent_kind.find("linebuffer") != string::npos &&
+      (is_memory_kind(kind) || op == "reg" || op == "reg_arst")) {
+    return "linebuffer";
+  }
+  if (is_memory_kind(kind) || is_memory_kind(parent_kind)) { return "sram"; }
+  if (op == "add" || op == "sub" || op == "neg") { return "add"; }
+  if (op == "mul") { return "mul"; }
+  if (op == "reg" || op == "reg_arst") { return "reg"; }
+  if (op == "mux" || op == "muxn") { return "mux"; }
+  if (op == "eq" || op == "neq" || op == "ult" || op == "ule" || op == "ugt" || op == "uge" ||
+      op == "slt" || op == "sle" || op == "sgt" || op == "sge") { return "compare"; }
+  if (op == "const" || op == "wire" || op == "slice" || op == "concat" ||
+      op == "term" || op == "undriven" || op == "passthrough") { return ""; }
+  return "logic";
+}
+
+// Counts the bit toggles on every instance output of the flattened design,
+// along with memory reads and writes, and converts them to energy per
+// HWKernel using the "kernel" metadata that CodeGen_CoreIR attaches to the
+// instances of each accelerator module in DesignTop.
+class ActivityCounter {
+public:
+  struct Probe {
+    string wire;
+    string kernel;
+    string op_class;
+    uint64_t last_value;
+    uint64_t toggles;
+  };
+  struct MemoryProbe {
+    string enable_wire;
+    string kernel;
+    string op_class;
+    bool is_write;
+    uint64_t accesses;
+  };
+
+  // top_instances maps each instance of the unflattened accelerator modules
+  // (named as after flattening, e.g. "coreir_target$add_0") to its
+  // (kernel, generator) pair.
+  ActivityCounter(Module* flattened_top, const map<string, pair<string, string>> &top_instances) : cycles(0) {
+    for (auto inst_pair : flattened_top->getDef()->getInstances()) {
+      string inst_name = inst_pair.first;
+      Instance* inst = inst_pair.second;
+      // use the longest unflattened instance name that this came from
+      string top_name = inst_name.substr(0, inst_name.find("$"));
+      for (size_t pos = inst_name.find("$"); pos != string::npos; pos = inst_name.find("$", pos + 1)) {
+        if (top_instances.count(inst_name.substr(0, pos)) > 0) {
+          top_name = inst_name.substr(0, pos);
+        }
+      }
+      string kernel = "top";
+      string parent_kind;
+      if (top_instances.count(top_name) > 0) {
+        kernel = top_instances.at(top_name).first;
+        parent_kind = top_instances.at(top_name).second;
+      }
+      string kind = instance_kind(inst);
+      string op_class = energy_class(kind, parent_kind);
+      if (op_class.empty()) {
+        continue;
+      }
+
+      for (auto field : static_cast<RecordType*>(inst->getType())->getRecord()) {
+        string port = field.first;
+        Type* port_type = field.second;
+        if (port == "clk" || !port_type->isOutput()) {
+          continue;
+        }
+        if (port_type->getKind() == Type::TK_Array &&
+            static_cast<ArrayType*>(port_type)->getElemType()->getKind() != Type::TK_Bit) {
+          continue;
+        }
+        probes.push_back({inst_name + "." + port, kernel, op_class, 0, 0});
+      }
+
+      if (is_memory_kind(kind)) {
+        for (string enable : {"wen", "ren"}) {
+          if (static_cast<RecordType*>(inst->getType())->getRecord().count(enable) == 0) {
+            continue;
+          }
+          // read the enable through whatever drives it
+          for (Wireable* driver : inst->sel(enable)->getConnectedWireables()) {
+            memory_probes.push_back({driver->toString(), kernel, op_class, enable == "wen", 0});
+          }
+        }
+      }
+    }
+    cout << "counting switching activity on " << probes.size() << " wires" << endl;
+  }
+
+  void sample(SimulatorState &state) {
+    for (auto &probe : probes) {
+      BitVector bv = state.getBitVec(probe.wire);
+      if (bv.bitLength() > 64) {
+        continue;
+      }
+      uint64_t value = bv.to_type<uint64_t>();
+      if (cycles > 0) {
+        probe.toggles += __builtin_popcountll(value ^ probe.last_value);
+      }
+      probe.last_value = value;
+    }
+    for (auto &probe : memory_probes) {
+      if (state.getBitVec(probe.enable_wire).to_type<bool>()) {
+        probe.accesses++;
+      }
+    }
+    cycles++;
+  }
+
+  void report(string energy_table_file, string report_file) {
+    map<string, OpEnergy> table = load_energy_table(energy_table_file);
+    map<string, map<string, double>> energy;  // kernel -> class -> pJ
+    map<string, uint64_t> class_toggles;
+
+    for (auto &probe : probes) {
+      energy[probe.kernel][probe.op_class] += probe.toggles * table[probe.op_class].toggle;
+      class_toggles[probe.op_class] += probe.toggles;
+    }
+    for (auto &probe : memory_probes) {
+      const OpEnergy &e = table[probe.op_class];
+      energy[probe.kernel][probe.op_class] += probe.accesses * (probe.is_write ? e.write : e.read);
+    }
+
+    ofstream fout(report_file);
+    fout << "# energy per frame over " << cycles << " cycles (pJ)\n";
+    fout << left << setw(24) << "kernel";
+    for (auto &op : table) {
+      fout << setw(12) << op.first;
+    }
+    fout << "total\n";
+    double frame_total = 0;
+    for (auto &kernel : energy) {
+      double total = 0;
+      fout << setw(24) << kernel.first;
+      for (auto &op : table) {
+        double pj = kernel.second.count(op.first) ? kernel.second.at(op.first) : 0;
+        total += pj;
+        fout << setw(12) << pj;
+      }
+      fout << total << "\n";
+      frame_total += total;
+    }
+    fout << "# total " << frame_total << " pJ per frame\n";
+    fout << "# toggles per class:";
+    for (auto &op : class_toggles) {
+      fout << " " << op.first << "=" << op.second;
+    }
+    fout << "\n";
+
+    // per wire toggle counts, busiest first
+    vector<Probe> sorted_probes = probes;
+    sort(sorted_probes.begin(), sorted_probes.end(),
+         [](const Probe &a, const Probe &b) { return a.toggles > b.toggles; });
+    fout << "# wire toggles\n";
+    for (auto &probe : sorted_probes) {
+      fout << probe.wire << " " << probe.kernel << " " << probe.op_class << " " << probe.toggles << "\n";
+    }
+    fout.close();
+
+    cout << "total energy " << frame_total << " pJ per frame, report written to " << report_file << endl;
+  }
+
+private:
+  vector<Probe> probes;
+  vector<MemoryProbe> memory_probes;
+  uint64_t cycles;
+};
+
+}  // namespace
+
 template<typename T>
 void run_coreir_on_interpreter(string coreir_design,
                                Halide::Runtime::Buffer<T> input,
                                Halide::Runtime::Buffer<T> output,
                                string input_name,
-                               string output_name) {
+                               string output_name,
+                               TapValues taps,
+                               bool sparse_output) {
   // New context for coreir test
   Context* c = newContext();
   Namespace* g = c->getGlobal();
@@ -77,6 +332,29 @@ void run_coreir_on_interpreter(string coreir_design,
     c->die();
   }
 
+  // Remember which kernel each instance belongs to before flattening.
+  map<string, pair<string, string>> top_instances;
+  Module* design_top = g->getModule("DesignTop");
+  if (design_top != nullptr && design_top->hasDef()) {
+    for (auto inst_pair : design_top->getDef()->getInstances()) {
+      auto &metadata = inst_pair.second->getMetaData();
+      string kernel = metadata.count("kernel") ? metadata["kernel"].get<string>() : "top";
+      top_instances[inst_pair.first] = {kernel, instance_kind(inst_pair.second)};
+
+      // each accelerator dag is a module of its own inside DesignTop
+      Module* accelerator = inst_pair.second->getModuleRef();
+      if (accelerator->isGenerated() || !accelerator->hasDef() ||
+          accelerator->getNamespace() != g) {
+        continue;
+      }
+      for (auto kernel_inst : accelerator->getDef()->getInstances()) {
+        auto &kernel_metadata = kernel_inst.second->getMetaData();
+        string inner_kernel = kernel_metadata.count("kernel") ? kernel_metadata["kernel"].get<string>() : "top";
+        top_instances[inst_pair.first + "$" + kernel_inst.first] = {inner_kernel, instance_kind(kernel_inst.second)};
+      }
+    }
+  }
+
   c->runPasses({"rungenerators", "flattentypes", "flatten", "wireclocks-coreir"});
 
   Module* m = g->getModule("DesignTop");
@@ -139,45 +417,163 @@ void run_coreir_on_interpreter(string coreir_design,
 //  state.setValue(input_name, BitVector(16));
 //  state.setValue("self.reset", BitVector(1));
 //  state.setClock("self.clk", 0, 1);
+
+  // program the taps, which hold their value for the whole frame
+  for (auto tap : taps) {
+    Type* tap_type = m->getDef()->sel(tap.first)->getType();
+    uint tap_bitwidth = tap_type->getKind() == Type::TK_Array ?
+      static_cast<ArrayType*>(tap_type)->getLen() : 1;
+    state.setValue(tap.first, BitVector(tap_bitwidth, tap.second));
+    cout << "set tap " << tap.first << " to " << tap.second << endl;
+  }
   cout << "starting coreir simulation" << endl;  
   state.resetCircuit();
 
   //state.setClock("self.clk", 0, 1);
 
-  ImageWriter<T> coreir_img_writer(output);
-
-  for (int y = 0; y < input.height(); y++) {
-    for (int x = 0; x < input.width(); x++) {
-      for (int c = 0; c < input.channels(); c++) {
-        // set input value
-        //state.setValue(input_name, BitVector(16, input(x,y,c) & 0xff));
-        state.setValue(input_name, BitVector(16, input(x,y,c)));
-
-        // propogate to all wires
-        state.exeCombinational();
+  // Frames stream back to back with no reset in between, so the output of
+  // one frame is still draining while the next one fills.
+  int num_frames = stream_frame_count();
+  vector<Halide::Runtime::Buffer<T>> frame_outputs = {output};
+  vector<ImageWriter<T>> coreir_img_writers = {ImageWriter<T>(output)};
+  for (int f = 1; f < num_frames; f++) {
+    frame_outputs.push_back(Halide::Runtime::Buffer<T>::make_with_shape_of(output));
+    coreir_img_writers.push_back(ImageWriter<T>(frame_outputs.back()));
+  }
+  int output_frame = 0;
+  uint64_t cycles = 0;
+
+  // a sparse output only sends the nonzero pixels
+  uint64_t sparse_records = 0;
+  if (sparse_output) {
+    if (!uses_valid) {
+      cout << "a sparse output needs the output valid to mark its records" << endl;
+      exit(1);
+    }
+    for (auto &frame_output : frame_outputs) {
+      frame_output.fill(0);
+    }
+  }
 
-        // read output wire
-        if (uses_valid) {
-          bool valid_value = state.getBitVec("self.valid").to_type<bool>();
+  // Switching activity is only counted when a report is requested.
+  const char *energy_report = getenv("COREIR_ENERGY_REPORT");
+  ActivityCounter *activity = nullptr;
+  if (energy_report && energy_report[0]) {
+    activity = new ActivityCounter(m, top_instances);
+  }
 
-          if (valid_value) {
+  // reads the output of this cycle if the valid marks one, and remembers
+  // the cycle so the latency after the last input is counted too
+  uint64_t last_output_cycle = 0;
+  auto capture_valid_output = [&]() {
+    bool valid_value = state.getBitVec("self.valid").to_type<bool>();
+    if (!valid_value || output_frame >= num_frames) {
+      return false;
+    }
+    if (sparse_output) {
+      vector<int> record;
+      for (int d = 0; d <= output.dimensions(); d++) {
+        record.push_back(state.getBitVec(output_name + "_" + std::to_string(d)).to_type<int>());
+      }
+      sparse_records++;
+      if (scatter_sparse_record(frame_outputs[output_frame], record)) {
+        output_frame++;
+      }
+    } else {
+      coreir_img_writers[output_frame].write(state.getBitVec(output_name).to_type<T>());
+      if (coreir_img_writers[output_frame].full()) {
+        output_frame++;
+      }
+    }
+    last_output_cycle = cycles + 1;
+    return true;
+  };
+
+  auto start_time = std::chrono::steady_clock::now();
+  for (int frame = 0; frame < num_frames; frame++) {
+    Halide::Runtime::Buffer<T> frame_input = stream_frame(input, frame);
+    for (int y = 0; y < frame_input.height(); y++) {
+      for (int x = 0; x < frame_input.width(); x++) {
+        for (int c = 0; c < frame_input.channels(); c++) {
+          // set input value
+          //state.setValue(input_name, BitVector(16, frame_input(x,y,c) & 0xff));
+          state.setValue(input_name, BitVector(16, frame_input(x,y,c)));
+
+          // propogate to all wires
+          state.exeCombinational();
+
+          // read output wire
+          if (uses_valid) {
+            if (capture_valid_output() && !sparse_output) {
+              T output_value = state.getBitVec(output_name).to_type<T>();
+              std::cout << "y=" << y << ",x=" << x << " " << hex << "in=" << (frame_input(x,y,c) & 0xff) << " out=" << output_value << dec << endl;
+            }
+          } else {
             T output_value = state.getBitVec(output_name).to_type<T>();
-            coreir_img_writer.write(output_value);
-            std::cout << "y=" << y << ",x=" << x << " " << hex << "in=" << (input(x,y,c) & 0xff) << " out=" << output_value << dec << endl;
+            frame_outputs[frame](x,y,c) = state.getBitVec(output_name).to_type<T>();
+            std::cout << "y=" << y << ",x=" << x << " " << hex << "in=" << (frame_input(x,y,c) & 0xff) << " out=" << output_value << dec << endl;
           }
-        } else {
-          T output_value = state.getBitVec(output_name).to_type<T>();
-          output(x,y,c) = state.getBitVec(output_name).to_type<T>();
-          std::cout << "y=" << y << ",x=" << x << " " << hex << "in=" << (input(x,y,c) & 0xff) << " out=" << output_value << dec << endl;
-        }
         
-        // give another rising edge (execute seq)
-        state.exeSequential();
+          // give another rising edge (execute seq)
+          state.exeSequential();
+          cycles++;
+
+          if (activity) {
+            activity->sample(state);
+          }
 
+        }
       }
     }
   }
-  coreir_img_writer.print_coords();
+
+  // the pipeline still holds the last outputs after the last input, so
+  // keep clocking until they come out (or as long again as the input took)
+  uint64_t input_cycles = cycles;
+  while (uses_valid && output_frame < num_frames && cycles < 2 * input_cycles) {
+    state.exeCombinational();
+    capture_valid_output();
+    state.exeSequential();
+    cycles++;
+    if (activity) {
+      activity->sample(state);
+    }
+  }
+  if (uses_valid) {
+    cout << "last output after " << last_output_cycle << " cycles, "
+         << input_cycles << " of them with input" << endl;
+  }
+
+  // design space exploration reads the cycles of the run from here
+  const char *cycles_file = getenv("HW_CYCLES_FILE");
+  if (cycles_file && cycles_file[0]) {
+    std::ofstream out(cycles_file);
+    out << (uses_valid ? last_output_cycle : cycles) << "\n";
+  }
+
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+  if (sparse_output) {
+    uint64_t pixels = (uint64_t)output.number_of_elements() * num_frames;
+    cout << "received " << sparse_records << " sparse output records for "
+         << pixels << " pixels" << endl;
+  } else {
+    for (auto &writer : coreir_img_writers) {
+      writer.print_coords();
+    }
+  }
+
+  if (num_frames > 1) {
+    check_stream_frames(frame_outputs);
+    report_frame_rate("coreir", num_frames, cycles, seconds);
+    // the last frame of the input image went through after other frames
+    output.copy_from(frame_outputs[(num_frames - 1) & ~1]);
+  }
+
+  if (activity) {
+    const char *energy_table = getenv("COREIR_ENERGY_TABLE");
+    activity->report(energy_table ? energy_table : "", energy_report);
+    delete activity;
+  }
 
   deleteContext(c);
   printf("finished running CoreIR code\n");
@@ -189,16 +585,22 @@ template void run_coreir_on_interpreter<uint16_t>(std::string coreir_design,
                                                   Halide::Runtime::Buffer<uint16_t> input,
                                                   Halide::Runtime::Buffer<uint16_t> output,
                                                   std::string input_name,
-                                                  std::string output_name);
+                                                  std::string output_name,
+                                                  TapValues taps,
+                                                  bool sparse_output);
 
 template void run_coreir_on_interpreter<int16_t>(std::string coreir_design,
                                                  Halide::Runtime::Buffer<int16_t> input,
                                                  Halide::Runtime::Buffer<int16_t> output,
                                                  std::string input_name,
-                                                 std::string output_name);
+                                                 std::string output_name,
+                                                 TapValues taps,
+                                                 bool sparse_output);
 
 template void run_coreir_on_interpreter<bool>(std::string coreir_design,
                                               Halide::Runtime::Buffer<bool> input,
                                               Halide::Runtime::Buffer<bool> output,
                                               std::string input_name,
-                                              std::string output_name);
+                                              std::string output_name,
+                                              TapValues taps,
+                                              bool sparse_output);
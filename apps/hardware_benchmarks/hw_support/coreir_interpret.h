@@ -1,10 +1,127 @@
+#ifndef COREIR_INTERPRET_H
+#define COREIR_INTERPRET_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
 #include "HalideBuffer.h"
 
+// Values for the tap ports of DesignTop, by flattened port name
+// (e.g. "self.taps_p1" or "self.taps_weights_stencil_2_0").
+typedef std::map<std::string, int> TapValues;
+
+// The flattened ports of a stencil tap, in the order CoreIR selects them
+// (outermost dimension first). A scalar tap is a zero dimensional buffer.
+template<typename T>
+TapValues tap_ports(std::string tap_name, const Halide::Runtime::Buffer<T> &values) {
+  TapValues ports;
+  values.for_each_element([&](const int *pos) {
+      std::string port = "self.taps_" + tap_name;
+      for (int d = values.dimensions() - 1; d >= 0; d--) {
+        port += "_" + std::to_string(pos[d] - values.dim(d).min());
+      }
+      ports[port] = (int)values(pos);
+    });
+  return ports;
+}
+
+// Number of frames the simulators stream back to back, from $HW_FRAMES.
+inline int stream_frame_count() {
+  const char *frames = getenv("HW_FRAMES");
+  int num_frames = (frames && frames[0]) ? atoi(frames) : 1;
+  return num_frames > 0 ? num_frames : 1;
+}
+
+// The frame sequence used when streaming more than one frame. Even frames
+// are the input and odd frames are the input mirrored, so any halo kept from
+// the previous frame shows up as a difference between frames.
+template<typename T>
+Halide::Runtime::Buffer<T> stream_frame(const Halide::Runtime::Buffer<T> &input, int frame) {
+  if (frame % 2 == 0) {
+    return input;
+  }
+  Halide::Runtime::Buffer<T> mirrored = Halide::Runtime::Buffer<T>::make_with_shape_of(input);
+  mirrored.for_each_element([&](const int *pos) {
+      std::vector<int> src(pos, pos + input.dimensions());
+      src[0] = input.dim(0).max() - (pos[0] - input.dim(0).min());
+      mirrored(pos) = input(src.data());
+    });
+  return mirrored;
+}
+
+// Every frame has to match the first frame built from the same input.
+template<typename T>
+bool check_stream_frames(const std::vector<Halide::Runtime::Buffer<T>> &frames) {
+  bool matches = true;
+  for (size_t f = 2; f < frames.size(); f++) {
+    int mismatches = 0;
+    const Halide::Runtime::Buffer<T> &expected = frames[f % 2];
+    frames[f].for_each_element([&](const int *pos) {
+        if (frames[f](pos) != expected(pos)) {
+          mismatches++;
+        }
+      });
+    if (mismatches > 0) {
+      std::cout << "frame " << f << " differs from frame " << f % 2
+                << " in " << mismatches << " pixels" << std::endl;
+      matches = false;
+    }
+  }
+  if (matches) {
+    std::cout << "all " << frames.size() << " frames match" << std::endl;
+  }
+  return matches;
+}
+
+// Sustained frame rate at the clock in $HW_CLOCK_MHZ, along with how fast
+// the simulation itself ran.
+inline void report_frame_rate(std::string simulator, int frames, uint64_t cycles, double seconds) {
+  const char *clock = getenv("HW_CLOCK_MHZ");
+  double clock_mhz = (clock && clock[0]) ? atof(clock) : 200.0;
+  double cycles_per_frame = (double)cycles / frames;
+  std::cout << simulator << " streamed " << frames << " frames in " << cycles << " cycles: "
+            << cycles_per_frame << " cycles per frame, "
+            << clock_mhz * 1e6 / cycles_per_frame << " frames/s at " << clock_mhz << " MHz ("
+            << frames / seconds << " simulated frames/s)" << std::endl;
+}
+
+// Taps are set before the first pixel and held for the whole frame.
+// With $HW_FRAMES > 1, the frames from stream_frame are streamed back to
+// back after a single reset, and output holds the last frame of the input.
+// A sparse output (Func::sparse_output) sends records of (coordinates...,
+// value) on the lanes output_name_0, output_name_1, ..., so output_name is
+// the port without a lane (e.g. "self.out"), and the pixels that are not
+// sent are zero.
 template<typename T>
 void run_coreir_on_interpreter(std::string coreir_design,
                                Halide::Runtime::Buffer<T> input,
                                Halide::Runtime::Buffer<T> output,
                                std::string input_name,
-                               std::string output_name);
+                               std::string output_name,
+                               TapValues taps = TapValues(),
+                               bool sparse_output = false);
 
+// Store one record of a sparse output in output. Returns whether it is the
+// record of the last pixel, which ends the frame.
+template<typename T>
+bool scatter_sparse_record(Halide::Runtime::Buffer<T> &output, const std::vector<int> &record) {
+  int dims = output.dimensions();
+  std::vector<int> coord(dims);
+  bool last = true;
+  for (int d = 0; d < dims; d++) {
+    coord[d] = output.dim(d).min() + record[d];
+    last = last && coord[d] == output.dim(d).max();
+  }
+  if (output.contains(coord)) {
+    output(coord.data()) = (T)record[dims];
+  } else {
+    std::cout << "sparse output record is outside of the output" << std::endl;
+  }
+  return last;
+}
 
+#endif
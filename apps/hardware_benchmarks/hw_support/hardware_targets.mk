@@ -5,6 +5,8 @@
 #       run:       run cpu design with image
 #       compare:   compare two output images
 #       eval:      evaluate runtime
+#       energy-coreir: energy per frame report from the coreir simulator
+#       frames-coreir: stream HW_FRAMES frames back to back and report frames/s
 #       golden:    copy design and output image
 #       clean:     remove bin directory
 
@@ -19,8 +21,23 @@ HALIDE_SRC_PATH ?= ../../../..
 # set default to TESTNAME which forces failure
 TESTNAME ?= undefined_testname
 USE_COREIR_VALID ?= 0
-
-HLS_PROCESS_CXX_FLAGS = -DC_TEST -Wno-unknown-pragmas -Wno-unused-label -Wno-uninitialized -Wno-literal-suffix
+# stream frames back to back without a reset (needs USE_COREIR_VALID)
+USE_COREIR_CONTINUOUS ?= 0
+# extra GeneratorParams, e.g. "tile_size=32 unroll_window=false"
+GENERATOR_PARAMS ?=
+VERILATOR ?= verilator
+ENERGY_TABLE ?= $(HWSUPPORT)/energy_table.txt
+VERILATOR_THREADS ?= 1
+HW_FRAMES ?= 4
+HW_CLOCK_MHZ ?= 200
+
+# host stages scheduled async around the accelerator become omp tasks
+HLS_PROCESS_CXX_FLAGS = -DC_TEST -fopenmp -Wno-unknown-pragmas -Wno-unused-label -Wno-uninitialized -Wno-literal-suffix
+
+COREIR_VALID_TARGET = $(HL_TARGET)-coreir-coreir_valid
+ifneq ($(USE_COREIR_CONTINUOUS),0)
+COREIR_VALID_TARGET := $(COREIR_VALID_TARGET)-coreir_continuous
+endif
 
 THIS_MAKEFILE = $(realpath $(filter %Makefile, $(MAKEFILE_LIST)))
 ROOT_DIR = $(strip $(shell dirname $(THIS_MAKEFILE)))
@@ -40,6 +57,10 @@ $(HWSUPPORT)/$(BIN)/coreir_interpret.o: $(HWSUPPORT)/coreir_interpret.cpp
 	@#env LD_LIBRARY_PATH=$(COREIR_DIR)/lib $(CXX) $(CXXFLAGS) -I$(HWSUPPORT) -c $< -o $@ $(LDFLAGS)
 	$(CXX) $(CXXFLAGS) -I$(HWSUPPORT) -c $< -o $@ $(LDFLAGS)
 
+$(HWSUPPORT)/$(BIN)/verilator_simulate.o: $(HWSUPPORT)/verilator_simulate.cpp
+	@-mkdir -p $(HWSUPPORT)/$(BIN)
+	$(CXX) $(CXXFLAGS) -I$(HWSUPPORT) -c $< -o $@
+
 .PHONY: generator
 generator $(BIN)/$(TESTNAME).generator: $(TESTNAME)_generator.cpp $(GENERATOR_DEPS)
 	@-mkdir -p $(BIN)
@@ -48,7 +69,7 @@ generator $(BIN)/$(TESTNAME).generator: $(TESTNAME)_generator.cpp $(GENERATOR_DE
 
 design design-cpu $(BIN)/$(TESTNAME).a: $(BIN)/$(TESTNAME).generator
 	@-mkdir -p $(BIN)
-	$^ -g $(TESTNAME) -o $(BIN) -f $(TESTNAME) target=$(HL_TARGET)
+	$^ -g $(TESTNAME) -o $(BIN) -f $(TESTNAME) target=$(HL_TARGET) $(GENERATOR_PARAMS)
 
 design-coreir $(BIN)/design_top.json $(BIN)/design_top.txt:
 	@if [ $(USE_COREIR_VALID) -ne "0" ]; then \
@@ -59,13 +80,13 @@ design-coreir $(BIN)/design_top.json $(BIN)/design_top.txt:
 
 design-coreir-no_valid: $(BIN)/$(TESTNAME).generator
 	@-mkdir -p $(BIN)
-	@#env LD_LIBRARY_PATH=$(COREIR_DIR)/lib $^ -g $(TESTNAME) -o $(BIN) -f $(TESTNAME) target=$(HL_TARGET)-coreir -e coreir
-	$^ -g $(TESTNAME) -o $(BIN) -f $(TESTNAME) target=$(HL_TARGET)-coreir -e coreir
+	@#env LD_LIBRARY_PATH=$(COREIR_DIR)/lib $^ -g $(TESTNAME) -o $(BIN) -f $(TESTNAME) target=$(HL_TARGET)-coreir -e coreir $(GENERATOR_PARAMS)
+	$^ -g $(TESTNAME) -o $(BIN) -f $(TESTNAME) target=$(HL_TARGET)-coreir -e coreir $(GENERATOR_PARAMS)
 
 design-coreir-valid design-coreir_valid: $(BIN)/$(TESTNAME).generator
 	@-mkdir -p $(BIN)
-	@#env LD_LIBRARY_PATH=$(COREIR_DIR)/lib $^ -g $(TESTNAME) -o $(BIN) -f $(TESTNAME) target=$(HL_TARGET)-coreir-coreir_valid -e coreir
-	$^ -g $(TESTNAME) -o $(BIN) -f $(TESTNAME) target=$(HL_TARGET)-coreir-coreir_valid -e coreir
+	@#env LD_LIBRARY_PATH=$(COREIR_DIR)/lib $^ -g $(TESTNAME) -o $(BIN) -f $(TESTNAME) target=$(COREIR_VALID_TARGET) -e coreir $(GENERATOR_PARAMS)
+	$^ -g $(TESTNAME) -o $(BIN) -f $(TESTNAME) target=$(COREIR_VALID_TARGET) -e coreir $(GENERATOR_PARAMS)
 
 design-verilog $(BIN)/top.v: $(BIN)/design_top.json
 	@-mkdir -p $(BIN)
@@ -74,9 +95,9 @@ design-verilog $(BIN)/top.v: $(BIN)/design_top.json
 
 design-hls $(BIN)/vhls_target.cpp $(BIN)/$(TESTNAME)_vhls.cpp: $(BIN)/$(TESTNAME).generator
 	@-mkdir -p $(BIN)
-	$^ -g $(TESTNAME) -o $(BIN) -f $(TESTNAME) target=$(HL_TARGET)-hls-legacy_buffer_wrappers -e vhls
+	$^ -g $(TESTNAME) -o $(BIN) -f $(TESTNAME) target=$(HL_TARGET)-hls-legacy_buffer_wrappers -e vhls $(GENERATOR_PARAMS)
 
-$(BIN)/process: process.cpp $(BIN)/$(TESTNAME).a $(BIN)/vhls_target.cpp $(BIN)/$(TESTNAME)_vhls.cpp $(HWSUPPORT)/$(BIN)/hardware_process_helper.o $(HWSUPPORT)/$(BIN)/coreir_interpret.o
+$(BIN)/process: process.cpp $(BIN)/$(TESTNAME).a $(BIN)/vhls_target.cpp $(BIN)/$(TESTNAME)_vhls.cpp $(HWSUPPORT)/$(BIN)/hardware_process_helper.o $(HWSUPPORT)/$(BIN)/coreir_interpret.o $(HWSUPPORT)/$(BIN)/verilator_simulate.o
 	@-mkdir -p $(BIN)
 	@#env LD_LIBRARY_PATH=$(COREIR_DIR)/lib $(CXX) $(CXXFLAGS) -I$(BIN) -I$(HWSUPPORT) -I$(HWSUPPORT)/xilinx_hls_lib_2015_4 -Wall $(HLS_PROCESS_CXX_FLAGS)  -O3 $^ -o $@ $(LDFLAGS) $(IMAGE_IO_FLAGS)
 	$(CXX) $(CXXFLAGS) -I$(BIN) -I$(HWSUPPORT) -I$(HWSUPPORT)/xilinx_hls_lib_2015_4 -Wall $(HLS_PROCESS_CXX_FLAGS)  -O3 $^ -o $@ $(LDFLAGS) $(IMAGE_IO_FLAGS)
@@ -100,14 +121,11 @@ run-coreir $(BIN)/output_coreir.png: $(BIN)/process $(BIN)/design_top.json
 	@-mkdir -p $(BIN)
 	$(BIN)/process run coreir input.png
 
-run-verilog: $(BIN)/top.v $(BIN)/input.raw
+run-verilog $(BIN)/output_verilog.png: $(BIN)/process $(BIN)/top.v
 	@-mkdir -p $(BIN)
-	verilator --cc $(BIN)/top.v --exe $(COREIR_DIR)/tools/verilator/tb.cpp
-	cd obj_dir && \
-	make -f Vtop.mk CXXFLAGS="-std=c++11 -Wall -fPIC -I/nobackup/setter/h2h/coreir/include" CXX=g++-4.9 LINK=g++-4.9 && \
-	./Vtop -i ../$(BIN)/input.raw -o ../$(BIN)/output_verilog.raw
+	VERILATOR=$(VERILATOR) VERILATOR_THREADS=$(VERILATOR_THREADS) $(BIN)/process run verilog input.png
 
-run-vhls: $(BIN)/process
+run-vhls $(BIN)/output_vhls.png: $(BIN)/process
 	@-mkdir -p $(BIN)
 	$(BIN)/process run vhls input.png
 
@@ -122,6 +140,24 @@ eval-coreir: $(BIN)/process
 	@-mkdir -p $(BIN)
 	$(BIN)/process eval coreir input.png
 
+energy-coreir $(BIN)/energy_report.txt: $(BIN)/process $(BIN)/design_top.json
+	@-mkdir -p $(BIN)
+	COREIR_ENERGY_TABLE=$(ENERGY_TABLE) COREIR_ENERGY_REPORT=$(BIN)/energy_report.txt $(BIN)/process run coreir input.png
+
+frames-coreir: $(BIN)/process $(BIN)/design_top.json
+	@-mkdir -p $(BIN)
+	HW_FRAMES=$(HW_FRAMES) HW_CLOCK_MHZ=$(HW_CLOCK_MHZ) $(BIN)/process run coreir input.png
+
+frames-verilog: $(BIN)/process $(BIN)/top.v
+	@-mkdir -p $(BIN)
+	HW_FRAMES=$(HW_FRAMES) HW_CLOCK_MHZ=$(HW_CLOCK_MHZ) VERILATOR=$(VERILATOR) VERILATOR_THREADS=$(VERILATOR_THREADS) $(BIN)/process run verilog input.png
+
+compare-verilog compare-cpu-verilog compare-verilog-cpu: $(BIN)/output_verilog.png $(BIN)/output_cpu.png
+	$(BIN)/process compare $(BIN)/output_verilog.png $(BIN)/output_cpu.png
+
+compare-vhls compare-cpu-vhls compare-vhls-cpu: $(BIN)/output_vhls.png $(BIN)/output_cpu.png
+	$(BIN)/process compare $(BIN)/output_vhls.png $(BIN)/output_cpu.png
+
 update_golden updategolden golden: $(BIN)/output_cpu.png
 	@-mkdir -p $(GOLDEN)
 	cp $(BIN)/output_cpu.png $(GOLDEN)/golden_output.png
@@ -0,0 +1,395 @@
+#!/usr/bin/env python3
+"""Design space exploration over the GeneratorParams of a hardware app.
+
+Usage (from an app or test directory, e.g. apps/gaussian):
+  ../../hw_support/hw_dse.py --param tile_size=32,64 \\
+                             --param unroll_window=true,false \\
+                             --param linebuffer_blur=true,false \\
+                             --param fifo_depth=0,2,8 -j 8
+
+Each point of the cartesian product is compiled to CoreIR in its own
+directory under bin/dse/<hash>, where the hash covers the generator binary,
+the target and the parameter values. Points that already have a result are
+not rebuilt, so re-runs only compile what changed.
+
+For every point the resource usage is counted from design_top.json. The
+cycles are estimated from the stream width of DesignTop, the tile each run
+of the accelerator covers and the register stages (fifos included) and
+linebuffer fill on its longest path. With --simulate they are instead
+counted by running the point on the CoreIR interpreter, which writes them
+to <point>/cycles. Results are written to bin/dse/results.csv and the
+area/throughput Pareto front to bin/dse/pareto.csv.
+"""
+
+import argparse
+import concurrent.futures
+import csv
+import hashlib
+import itertools
+import json
+import os
+import subprocess
+import sys
+
+# Relative area of each class of instance. Memories are weighted by words.
+AREA_WEIGHTS = {
+    'pe': 1.0,
+    'reg': 0.25,
+    'mem_word': 1.0 / 64,
+    'const': 0.0,
+}
+
+PE_OPS = {
+    'add', 'sub', 'mul', 'udiv', 'sdiv', 'and', 'or', 'xor', 'not', 'neg',
+    'shl', 'lshr', 'ashr', 'mux', 'eq', 'neq', 'ult', 'ule', 'ugt', 'uge',
+    'slt', 'sle', 'sgt', 'sge', 'umin', 'umax', 'smin', 'smax', 'abs',
+    'absd', 'muxn', 'const_mul',
+}
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--testname', default=os.path.basename(os.getcwd()),
+                        help='generator name (defaults to the directory name)')
+    parser.add_argument('--param', action='append', default=[],
+                        help='name=v1,v2,... ; may be repeated')
+    parser.add_argument('--valid', action='store_true',
+                        help='compile with the coreir_valid target feature')
+    parser.add_argument('--hl-target', default=os.environ.get('HL_TARGET', 'host'))
+    parser.add_argument('--image-size', default='64x64',
+                        help='WxH of the frame used for cycle estimates')
+    parser.add_argument('-j', '--jobs', type=int, default=os.cpu_count())
+    parser.add_argument('--bin', default='bin')
+    parser.add_argument('--rebuild', action='store_true',
+                        help='ignore cached results')
+    parser.add_argument('--simulate', action='store_true',
+                        help='count the cycles on the CoreIR interpreter with input.png '
+                             'instead of estimating them')
+    return parser.parse_args()
+
+
+def parse_space(params):
+    names, values = [], []
+    for p in params:
+        if '=' not in p:
+            sys.exit('bad --param "%s", expected name=v1,v2' % p)
+        name, vals = p.split('=', 1)
+        names.append(name)
+        values.append(vals.split(','))
+    return [dict(zip(names, point)) for point in itertools.product(*values)]
+
+
+def file_digest(path):
+    h = hashlib.sha1()
+    with open(path, 'rb') as f:
+        for chunk in iter(lambda: f.read(1 << 20), b''):
+            h.update(chunk)
+    return h.hexdigest()
+
+
+def point_hash(generator_digest, target, point):
+    key = json.dumps({'generator': generator_digest, 'target': target,
+                      'params': point}, sort_keys=True)
+    return hashlib.sha1(key.encode()).hexdigest()[:16]
+
+
+def type_width(t):
+    """Number of 16 bit lanes in a CoreIR json type."""
+    if isinstance(t, list) and t and t[0] == 'Array':
+        inner = t[2]
+        if inner in ('Bit', 'BitIn', 'BitOut'):
+            return 1
+        return t[1] * type_width(inner)
+    if isinstance(t, list) and t and t[0] == 'Record':
+        return sum(type_width(field_type) for _, field_type in t[1])
+    return 1
+
+
+def count_resources(design):
+    modules = {}
+    for ns_name, ns in design.get('namespaces', {}).items():
+        for mod_name, mod in ns.get('modules', {}).items():
+            modules[ns_name + '.' + mod_name] = mod
+
+    counts = {'pe': 0, 'reg': 0, 'mem_word': 0, 'const': 0, 'other': 0}
+
+    def visit(mod, depth=0):
+        for inst in mod.get('instances', {}).values():
+            ref = inst.get('genref') or inst.get('modref') or ''
+            op = ref.split('.')[-1]
+            args = inst.get('genargs', {})
+            if ref in modules and depth < 32:
+                visit(modules[ref], depth + 1)
+            elif op in ('const', 'bitconst', 'const_array'):
+                counts['const'] += 1
+            elif op in ('reg', 'reg_arst', 'bitreg', 'reg_array'):
+                counts['reg'] += 1
+            elif op in ('ram2', 'rom2', 'mem', 'fifo', 'linebuffer'):
+                depth_arg = args.get('depth', ['Int', 0])
+                words = depth_arg[1] if isinstance(depth_arg, list) else 0
+                counts['mem_word'] += words if words else 64
+            elif op in PE_OPS:
+                counts['pe'] += 1
+            else:
+                counts['other'] += 1
+
+    top = design.get('top', 'global.DesignTop')
+    if top in modules:
+        visit(modules[top])
+    return counts
+
+
+OUTPUT_PORTS = {'out', 'rdata', 'valid', 'overflow', 'empty', 'full'}
+
+
+def type_dims(t):
+    """Dimensions of a CoreIR json array type, innermost (x) first, without
+    the bits of each word."""
+    if isinstance(t, list) and t and t[0] == 'CoreIRType':
+        t = t[1]
+    dims = []
+    while isinstance(t, list) and t and t[0] == 'Array' and \
+            t[2] not in ('Bit', 'BitIn', 'BitOut'):
+        dims.append(t[1])
+        t = t[2]
+    return list(reversed(dims))
+
+
+def product(values):
+    result = 1
+    for v in values:
+        result *= v
+    return result
+
+
+def linebuffer_fill(args):
+    """Cycles a linebuffer takes from its first input to its first window:
+    every earlier line of the window, and the rest of the current one."""
+    window = type_dims(args.get('output_type'))
+    lanes = type_dims(args.get('input_type'))
+    image = type_dims(args.get('image_type'))
+    pixels = 0
+    for d in range(min(len(window), len(image))):
+        pixels += (window[d] - 1) * product(image[:d])
+    return pixels // max(product(lanes), 1)
+
+
+def module_latency(modules, mod, memo, depth=0):
+    """Register stages on the longest path from self to self.out, counting a
+    linebuffer as its fill time. Feedback edges (counters, accumulators)
+    are skipped."""
+    instances = mod.get('instances', {})
+    weights = {'self': 0}
+    for name, inst in instances.items():
+        ref = inst.get('genref') or inst.get('modref') or ''
+        op = ref.split('.')[-1]
+        if ref in modules and depth < 32:
+            if ref not in memo:
+                memo[ref] = module_latency(modules, modules[ref], memo, depth + 1)
+            weights[name] = memo[ref]
+        elif op in ('reg', 'reg_arst', 'bitreg', 'reg_array'):
+            weights[name] = 1
+        elif op == 'linebuffer':
+            weights[name] = linebuffer_fill(inst.get('genargs', {}))
+        else:
+            weights[name] = 0
+
+    # connections are undirected in the json; a port is driven by its
+    # instance if it is one of the output ports (or an input of self)
+    edges = {}
+    sinks = set()
+    for a, b in mod.get('connections', []):
+        ends = []
+        for end in (a, b):
+            inst, port = (end.split('.') + [''])[:2]
+            drives = (port not in OUTPUT_PORTS) if inst == 'self' else (port in OUTPUT_PORTS)
+            ends.append((inst, port, drives))
+        (ia, pa, da), (ib, pb, db) = ends
+        if da and not db:
+            edges.setdefault(ia, set()).add(ib)
+            if ib == 'self' and pb == 'out':
+                sinks.add(ia)
+        elif db and not da:
+            edges.setdefault(ib, set()).add(ia)
+            if ia == 'self' and pa == 'out':
+                sinks.add(ib)
+
+    longest = {}
+    on_path = set()
+
+    def visit(node):
+        # longest delay from node to self.out, or None if out isn't reached
+        if node in longest:
+            return longest[node]
+        on_path.add(node)
+        best = 0 if node in sinks else None
+        for succ in edges.get(node, ()):
+            if succ in on_path or succ == 'self':
+                continue
+            rest = visit(succ)
+            if rest is not None and (best is None or rest > best):
+                best = rest
+        on_path.discard(node)
+        longest[node] = None if best is None else best + weights.get(node, 0)
+        return longest[node]
+
+    return visit('self') or 0
+
+
+def estimate_cycles(design, image_pixels):
+    """The input stream delivers one stencil per cycle, and each time the
+    accelerator runs (once per tile) it first fills its pipeline."""
+    modules = {}
+    for ns_name, ns in design.get('namespaces', {}).items():
+        for mod_name, mod in ns.get('modules', {}).items():
+            modules[ns_name + '.' + mod_name] = mod
+    top = modules.get(design.get('top', 'global.DesignTop'), {})
+
+    fields = top['type'][1] if top.get('type', [None])[0] == 'Record' else []
+    lanes = 1
+    for field_name, field_type in fields:
+        if field_name == 'in':
+            lanes = max(lanes, type_width(field_type))
+
+    # the largest linebuffer image is the tile the accelerator runs on
+    run_pixels = 0
+    for mod in modules.values():
+        for inst in mod.get('instances', {}).values():
+            if (inst.get('genref') or '').endswith('linebuffer'):
+                image = type_dims(inst.get('genargs', {}).get('image_type'))
+                run_pixels = max(run_pixels, product(image))
+    if run_pixels == 0 or run_pixels > image_pixels:
+        run_pixels = image_pixels
+    runs = -(-image_pixels // run_pixels)
+
+    latency = module_latency(modules, top, {})
+    return runs * (run_pixels // lanes + latency)
+
+
+def simulate_cycles(args, out_dir):
+    """Runs the design on the CoreIR interpreter from a scratch directory
+    that looks like the app directory, and returns the cycles it took."""
+    run_dir = os.path.join(out_dir, 'sim')
+    os.makedirs(run_dir, exist_ok=True)
+    for name, target in (('bin', os.path.abspath(out_dir)),
+                         ('input.png', os.path.abspath('input.png'))):
+        link = os.path.join(run_dir, name)
+        if not os.path.lexists(link):
+            os.symlink(target, link)
+    cycles_file = os.path.join(out_dir, 'cycles')
+    env = dict(os.environ, HW_CYCLES_FILE=os.path.abspath(cycles_file))
+    with open(os.path.join(out_dir, 'simulate.log'), 'w') as log:
+        subprocess.call([os.path.abspath(os.path.join(args.bin, 'process')),
+                         'run', 'coreir', 'input.png'],
+                        cwd=run_dir, env=env, stdout=log, stderr=subprocess.STDOUT)
+    if not os.path.exists(cycles_file):
+        return None
+    with open(cycles_file) as f:
+        return int(f.read().strip())
+
+
+def build_point(args, generator, generator_digest, target, point, image_pixels):
+    name = point_hash(generator_digest, target, point)
+    out_dir = os.path.join(args.bin, 'dse', name)
+    result_file = os.path.join(out_dir, 'result.json')
+    if os.path.exists(result_file) and not args.rebuild:
+        with open(result_file) as f:
+            cached = json.load(f)
+        # an estimate is not good enough once simulation is asked for
+        if not args.simulate or cached.get('cycles_source') != 'estimated':
+            return cached, True
+
+    os.makedirs(out_dir, exist_ok=True)
+    cmd = [generator, '-g', args.testname, '-o', out_dir, '-f', args.testname,
+           'target=' + target, '-e', 'coreir']
+    cmd += ['%s=%s' % kv for kv in sorted(point.items())]
+    with open(os.path.join(out_dir, 'build.log'), 'w') as log:
+        status = subprocess.call(cmd, stdout=log, stderr=subprocess.STDOUT)
+
+    result = dict(point)
+    result['point'] = name
+    design_file = os.path.join(out_dir, 'design_top.json')
+    if status != 0 or not os.path.exists(design_file):
+        result['status'] = 'failed'
+        return result, False
+
+    with open(design_file) as f:
+        design = json.load(f)
+    counts = count_resources(design)
+    result.update(counts)
+    result['area'] = sum(AREA_WEIGHTS.get(k, 0) * v for k, v in counts.items())
+
+    cycles = simulate_cycles(args, out_dir) if args.simulate else None
+    if cycles is not None:
+        result['cycles'] = cycles
+        result['cycles_source'] = 'simulated'
+    else:
+        result['cycles'] = estimate_cycles(design, image_pixels)
+        result['cycles_source'] = 'estimated'
+    result['status'] = 'ok'
+
+    with open(result_file, 'w') as f:
+        json.dump(result, f, indent=2, sort_keys=True)
+    return result, False
+
+
+def pareto_front(results):
+    ok = [r for r in results if r['status'] == 'ok']
+    front = []
+    for r in ok:
+        dominated = any(o['area'] <= r['area'] and o['cycles'] <= r['cycles'] and
+                        (o['area'] < r['area'] or o['cycles'] < r['cycles'])
+                        for o in ok)
+        if not dominated:
+            front.append(r)
+    return sorted(front, key=lambda r: (r['area'], r['cycles']))
+
+
+def write_csv(path, rows, param_names):
+    columns = param_names + ['point', 'status', 'area', 'cycles', 'cycles_source',
+                             'pe', 'reg', 'mem_word', 'const', 'other']
+    with open(path, 'w', newline='') as f:
+        writer = csv.DictWriter(f, fieldnames=columns, extrasaction='ignore')
+        writer.writeheader()
+        for r in rows:
+            writer.writerow(r)
+
+
+def main():
+    args = parse_args()
+    space = parse_space(args.param)
+    param_names = [p.split('=', 1)[0] for p in args.param]
+    width, height = (int(v) for v in args.image_size.split('x'))
+
+    # The generator is shared by every point, so build it once up front.
+    if subprocess.call(['make', '-s', 'generator']) != 0:
+        sys.exit('failed to build the %s generator' % args.testname)
+    if args.simulate and subprocess.call(['make', '-s', os.path.join(args.bin, 'process')]) != 0:
+        sys.exit('failed to build the %s process' % args.testname)
+    generator = os.path.join(args.bin, args.testname + '.generator')
+    generator_digest = file_digest(generator)
+    target = args.hl_target + '-coreir' + ('-coreir_valid' if args.valid else '')
+
+    results = []
+    with concurrent.futures.ThreadPoolExecutor(max_workers=args.jobs) as pool:
+        futures = [pool.submit(build_point, args, generator, generator_digest,
+                               target, point, width * height) for point in space]
+        for future in concurrent.futures.as_completed(futures):
+            result, cached = future.result()
+            results.append(result)
+            print('%-18s %-7s %s%s' % (result['point'], result['status'],
+                                       ' '.join('%s=%s' % (k, result[k]) for k in param_names),
+                                       ' (cached)' if cached else ''))
+
+    results.sort(key=lambda r: [str(r.get(k)) for k in param_names])
+    dse_dir = os.path.join(args.bin, 'dse')
+    write_csv(os.path.join(dse_dir, 'results.csv'), results, param_names)
+    front = pareto_front(results)
+    write_csv(os.path.join(dse_dir, 'pareto.csv'), front, param_names)
+    print('%d points, %d on the pareto front, see %s/pareto.csv'
+          % (len(results), len(front), dse_dir))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,366 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <vector>
+
+#include "verilator_simulate.h"
+
+using namespace std;
+
+namespace {
+
+// Verilator names the model after the prefix, not the verilog module.
+const string verilator_prefix = "Vtop";
+const string verilog_top_module = "DesignTop";
+
+// CoreIR refers to the top level ports through "self", while the verilog
+// module uses the bare port name.
+string strip_self(string port_name) {
+  if (port_name.find("self.") == 0) {
+    return port_name.substr(5);
+  }
+  return port_name;
+}
+
+string dirname_of(string path) {
+  size_t slash = path.find_last_of('/');
+  return slash == string::npos ? "." : path.substr(0, slash);
+}
+
+// The generated makefile runs from the -Mdir, so the testbench needs a path
+// that does not depend on the current directory.
+string absolute_path(string path) {
+  char *resolved = realpath(path.c_str(), nullptr);
+  if (!resolved) {
+    return path;
+  }
+  string result(resolved);
+  free(resolved);
+  return result;
+}
+
+string env_or_default(const char *name, string default_value) {
+  const char *value = getenv(name);
+  return (value && value[0]) ? string(value) : default_value;
+}
+
+void run_or_die(string cmd) {
+  cout << cmd << endl;
+  if (system(cmd.c_str()) != 0) {
+    cout << "verilator simulation failed running: " << cmd << endl;
+    exit(1);
+  }
+}
+
+// Collect the port names declared in the header of the top module.
+set<string> verilog_top_ports(string verilog_design) {
+  ifstream fin(verilog_design);
+  if (!fin.is_open()) {
+    cout << "Could not open " << verilog_design << endl;
+    exit(1);
+  }
+  stringstream contents;
+  contents << fin.rdbuf();
+  string text = contents.str();
+
+  size_t start = text.find("module " + verilog_top_module);
+  if (start == string::npos) {
+    cout << "Could not find module " << verilog_top_module
+         << " in " << verilog_design << endl;
+    exit(1);
+  }
+  size_t end = text.find(");", start);
+  string header = text.substr(start, end - start);
+
+  set<string> ports;
+  string token;
+  for (char c : header) {
+    if (isalnum(c) || c == '_') {
+      token += c;
+    } else {
+      if (!token.empty()) {
+        ports.insert(token);
+      }
+      token.clear();
+    }
+  }
+  return ports;
+}
+
+// The generated testbench mirrors the interpreter loop: drive one pixel,
+// settle the combinational logic, sample the output, then clock the design.
+// The records of a sparse output are written lane after lane.
+string testbench_source(string input_port, vector<string> output_ports, const TapValues &taps,
+                        bool uses_clk, bool uses_reset, bool uses_valid) {
+  ostringstream tb;
+  tb << "#include <cstdint>\n"
+     << "#include <cstdio>\n"
+     << "#include <vector>\n"
+     << "#include \"" << verilator_prefix << ".h\"\n"
+     << "#include \"verilated.h\"\n"
+     << "\n"
+     << "int main(int argc, char **argv) {\n"
+     << "  Verilated::commandArgs(argc, argv);\n"
+     << "  if (argc < 3) { fprintf(stderr, \"usage: %s input.raw output.raw\\n\", argv[0]); return 1; }\n"
+     << "  FILE *fin = fopen(argv[1], \"rb\");\n"
+     << "  uint32_t num_pixels = 0;\n"
+     << "  if (!fin || fread(&num_pixels, sizeof(num_pixels), 1, fin) != 1) return 1;\n"
+     << "  std::vector<uint16_t> in(num_pixels);\n"
+     << "  if (fread(in.data(), sizeof(uint16_t), num_pixels, fin) != num_pixels) return 1;\n"
+     << "  fclose(fin);\n"
+     << "\n"
+     << "  " << verilator_prefix << " *top = new " << verilator_prefix << ";\n";
+  for (auto tap : taps) {
+    tb << "  top->" << strip_self(tap.first) << " = " << tap.second << ";\n";
+  }
+  if (uses_clk) {
+    tb << "  top->clk = 0;\n";
+  }
+  if (uses_reset) {
+    tb << "  top->reset = 1;\n"
+       << "  top->eval();\n";
+    if (uses_clk) {
+      tb << "  top->clk = 1;\n"
+         << "  top->eval();\n"
+         << "  top->clk = 0;\n";
+    }
+    tb << "  top->reset = 0;\n";
+  }
+  tb << "\n"
+     << "  std::vector<uint16_t> out;\n"
+     << "  out.reserve(num_pixels);\n"
+     << "  for (uint32_t i = 0; i < num_pixels; i++) {\n"
+     << "    top->" << input_port << " = in[i];\n";
+  if (uses_clk) {
+    tb << "    top->clk = 0;\n";
+  }
+  tb << "    top->eval();\n";
+  if (uses_valid) {
+    tb << "    if (top->valid) {\n";
+    for (string output_port : output_ports) {
+      tb << "      out.push_back(top->" << output_port << ");\n";
+    }
+    tb << "    }\n";
+  } else {
+    tb << "    out.push_back(top->" << output_ports[0] << ");\n";
+  }
+  if (uses_clk) {
+    tb << "    top->clk = 1;\n"
+       << "    top->eval();\n";
+  }
+  tb << "  }\n"
+     << "  top->final();\n"
+     << "  delete top;\n"
+     << "\n"
+     << "  FILE *fout = fopen(argv[2], \"wb\");\n"
+     << "  uint32_t num_outputs = out.size();\n"
+     << "  if (!fout) return 1;\n"
+     << "  fwrite(&num_outputs, sizeof(num_outputs), 1, fout);\n"
+     << "  fwrite(out.data(), sizeof(uint16_t), num_outputs, fout);\n"
+     << "  fclose(fout);\n"
+     << "  printf(\"simulated %u cycles, %u outputs\\n\", num_pixels, num_outputs);\n"
+     << "  return 0;\n"
+     << "}\n";
+  return tb.str();
+}
+
+}  // namespace
+
+template<typename T>
+void run_verilator_on_design(string verilog_design,
+                             Halide::Runtime::Buffer<T> input,
+                             Halide::Runtime::Buffer<T> output,
+                             string input_name,
+                             string output_name,
+                             TapValues taps,
+                             bool sparse_output) {
+  string input_port = strip_self(input_name);
+  vector<string> output_ports = {strip_self(output_name)};
+  if (sparse_output) {
+    // one lane per coordinate, then the value
+    output_ports.clear();
+    for (int d = 0; d <= output.dimensions(); d++) {
+      output_ports.push_back(strip_self(output_name) + "_" + std::to_string(d));
+    }
+  }
+
+  set<string> ports = verilog_top_ports(verilog_design);
+  vector<string> used_ports = {input_port};
+  used_ports.insert(used_ports.end(), output_ports.begin(), output_ports.end());
+  for (auto tap : taps) {
+    used_ports.push_back(strip_self(tap.first));
+  }
+  for (string port : used_ports) {
+    if (ports.count(port) == 0) {
+      cout << "port " << port << " is not a port of " << verilog_top_module
+           << " in " << verilog_design << endl;
+      exit(1);
+    }
+  }
+  bool uses_clk = ports.count("clk") > 0;
+  bool uses_reset = ports.count("reset") > 0;
+  bool uses_valid = ports.count("valid") > 0;
+  if (uses_valid) {
+    cout << "image is using output valid" << endl;
+  }
+  if (sparse_output && !uses_valid) {
+    cout << "a sparse output needs the output valid to mark its records" << endl;
+    exit(1);
+  }
+
+  string verilator = env_or_default("VERILATOR", "verilator");
+  int num_threads = atoi(env_or_default("VERILATOR_THREADS", "1").c_str());
+  string sim_dir = dirname_of(verilog_design) + "/verilator";
+  string tb_file = sim_dir + "/tb_" + verilog_top_module + ".cpp";
+  string input_file = sim_dir + "/input.raw";
+  string output_file = sim_dir + "/output.raw";
+
+  run_or_die("mkdir -p " + sim_dir);
+  {
+    ofstream tb(tb_file);
+    tb << testbench_source(input_port, output_ports, taps, uses_clk, uses_reset, uses_valid);
+  }
+  cout << "generated verilator testbench " << tb_file << endl;
+
+  // Build the model. --threads partitions the design across threads, which is
+  // what makes full frame simulations of the larger apps tolerable.
+  ostringstream build;
+  build << verilator << " -Wno-fatal -O3 --x-assign fast --x-initial fast --noassert"
+        << " --cc " << verilog_design
+        << " --top-module " << verilog_top_module
+        << " --prefix " << verilator_prefix
+        << " -Mdir " << sim_dir
+        << " --exe " << absolute_path(tb_file);
+  if (num_threads > 1) {
+    build << " --threads " << num_threads;
+  }
+  run_or_die(build.str());
+  run_or_die("make -s -j -C " + sim_dir + " -f " + verilator_prefix + ".mk " + verilator_prefix);
+
+  // Stream the input in the same x, y, c order as the interpreter. With more
+  // than one frame, the frames follow each other with no reset in between.
+  int num_frames = stream_frame_count();
+  uint32_t frame_pixels = input.width() * input.height() * input.channels();
+  {
+    ofstream fin(input_file, ios::binary);
+    uint32_t num_pixels = frame_pixels * num_frames;
+    fin.write((const char *)&num_pixels, sizeof(num_pixels));
+    for (int frame = 0; frame < num_frames; frame++) {
+      Halide::Runtime::Buffer<T> frame_input = stream_frame(input, frame);
+      for (int y = 0; y < frame_input.height(); y++) {
+        for (int x = 0; x < frame_input.width(); x++) {
+          for (int c = 0; c < frame_input.channels(); c++) {
+            uint16_t value = (uint16_t)frame_input(x, y, c);
+            fin.write((const char *)&value, sizeof(value));
+          }
+        }
+      }
+    }
+  }
+
+  auto start_time = chrono::steady_clock::now();
+  run_or_die(sim_dir + "/" + verilator_prefix + " " + input_file + " " + output_file);
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+
+  ifstream fout(output_file, ios::binary);
+  uint32_t num_outputs = 0;
+  fout.read((char *)&num_outputs, sizeof(num_outputs));
+  vector<uint16_t> values(num_outputs);
+  fout.read((char *)values.data(), num_outputs * sizeof(uint16_t));
+
+  vector<Halide::Runtime::Buffer<T>> frame_outputs = {output};
+  for (int frame = 1; frame < num_frames; frame++) {
+    frame_outputs.push_back(Halide::Runtime::Buffer<T>::make_with_shape_of(output));
+  }
+
+  if (sparse_output) {
+    // records of the nonzero pixels, and the last pixel of each frame
+    size_t lanes = output_ports.size();
+    size_t frame = 0;
+    for (auto &frame_output : frame_outputs) {
+      frame_output.fill(0);
+    }
+    for (size_t i = 0; i + lanes <= values.size() && frame < frame_outputs.size(); i += lanes) {
+      vector<int> record(values.begin() + i, values.begin() + i + lanes);
+      if (scatter_sparse_record(frame_outputs[frame], record)) {
+        frame++;
+      }
+    }
+    cout << "received " << values.size() / lanes << " sparse output records for "
+         << (uint64_t)output.number_of_elements() * num_frames << " pixels" << endl;
+  } else if (uses_valid) {
+    // valid outputs arrive in raster order of the output image, one frame
+    // after the other
+    size_t i = 0;
+    for (auto &frame_output : frame_outputs) {
+      for (int c = 0; c < frame_output.channels(); c++) {
+        for (int y = 0; y < frame_output.height(); y++) {
+          for (int x = 0; x < frame_output.width(); x++) {
+            if (i < values.size()) {
+              frame_output(x, y, c) = (T)values[i++];
+            }
+          }
+        }
+      }
+    }
+    size_t expected_outputs = (size_t)(output.width() * output.height() * output.channels()) * num_frames;
+    if (values.size() != expected_outputs) {
+      cout << "warning: produced " << values.size() << " valid outputs for "
+           << expected_outputs << " pixels" << endl;
+    }
+  } else {
+    // without valid, the output of each cycle lines up with the input pixel
+    size_t i = 0;
+    for (auto &frame_output : frame_outputs) {
+      for (int y = 0; y < input.height(); y++) {
+        for (int x = 0; x < input.width(); x++) {
+          for (int c = 0; c < input.channels(); c++, i++) {
+            if (i < values.size() &&
+                x < output.width() && y < output.height() && c < output.channels()) {
+              frame_output(x, y, c) = (T)values[i];
+            }
+          }
+        }
+      }
+    }
+  }
+
+  if (num_frames > 1) {
+    check_stream_frames(frame_outputs);
+    report_frame_rate("verilator", num_frames, (uint64_t)frame_pixels * num_frames, seconds);
+    // the last frame of the input image went through after other frames
+    output.copy_from(frame_outputs[(num_frames - 1) & ~1]);
+  }
+
+  printf("finished running verilator simulation\n");
+}
+
+// declare which types will be used with template function
+template void run_verilator_on_design<uint16_t>(std::string verilog_design,
+                                                Halide::Runtime::Buffer<uint16_t> input,
+                                                Halide::Runtime::Buffer<uint16_t> output,
+                                                std::string input_name,
+                                                std::string output_name,
+                                                TapValues taps,
+                                                bool sparse_output);
+
+template void run_verilator_on_design<int16_t>(std::string verilog_design,
+                                               Halide::Runtime::Buffer<int16_t> input,
+                                               Halide::Runtime::Buffer<int16_t> output,
+                                               std::string input_name,
+                                               std::string output_name,
+                                               TapValues taps,
+                                               bool sparse_output);
+
+template void run_verilator_on_design<bool>(std::string verilog_design,
+                                            Halide::Runtime::Buffer<bool> input,
+                                            Halide::Runtime::Buffer<bool> output,
+                                            std::string input_name,
+                                            std::string output_name,
+                                            TapValues taps,
+                                            bool sparse_output);
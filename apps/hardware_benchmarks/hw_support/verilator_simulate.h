@@ -0,0 +1,18 @@
+#include "HalideBuffer.h"
+#include "coreir_interpret.h"
+
+// Simulates the verilog emitted for a CoreIR design (bin/top.v) with
+// Verilator. The testbench is generated from the same port names that are
+// passed to run_coreir_on_interpreter (e.g. "self.in_arg_0_0_0"), and is
+// built with whichever verilator is found in $VERILATOR (or on the path).
+// Setting $VERILATOR_THREADS > 1 builds a multithreaded model. The taps are
+// written into the model before reset and held for the whole frame. Sparse
+// outputs are read as in run_coreir_on_interpreter.
+template<typename T>
+void run_verilator_on_design(std::string verilog_design,
+                             Halide::Runtime::Buffer<T> input,
+                             Halide::Runtime::Buffer<T> output,
+                             std::string input_name,
+                             std::string output_name,
+                             TapValues taps = TapValues(),
+                             bool sparse_output = false);
@@ -4,16 +4,13 @@
 
 #include "hardware_process_helper.h"
 #include "coreir_interpret.h"
+#include "verilator_simulate.h"
 #include "halide_image_io.h"
 
 using namespace Halide::Tools;
 using namespace Halide::Runtime;
 using namespace std;
 
-
-#include "coreir_interpret.cpp"
-using namespace CoreIR;
-
 int main(int argc, char **argv) {
 
   OneInOneOut_ProcessController<uint16_t> processor("conv_2_1",
@@ -24,6 +21,10 @@ int main(int argc, char **argv) {
                                             {"coreir",
                                                 [&]() { run_coreir_on_interpreter<>("bin/design_top.json", processor.input, processor.output,
                                                                                     "self.in_arg_0_0_0", "self.out_0_0"); }
+                                            },
+                                            {"verilog",
+                                                [&]() { run_verilator_on_design<>("bin/top.v", processor.input, processor.output,
+                                                                                  "self.in_arg_0_0_0", "self.out_0_0"); }
                                             }
                                           });
 
@@ -0,0 +1,66 @@
+#include "Halide.h"
+
+namespace {
+
+using namespace Halide;
+
+class ConvolutionTapsKernel : public Halide::Generator<ConvolutionTapsKernel> {
+public:
+    Input<Buffer<uint16_t>>  input{"input", 2};
+    // the filter weights are taps, so they can change without a new design
+    Input<Buffer<uint16_t>>  weights{"weights", 2};
+    Output<Buffer<uint16_t>> output{"output", 2};
+
+    void generate() {
+        /* THE ALGORITHM */
+
+        Var x("x"), y("y");
+
+        Func conv("conv");
+        RDom r(0, 3,
+               0, 3);
+
+        conv(x, y) = 0;
+
+        Func hw_input("hw_input");
+        hw_input(x, y) = input(x, y);
+        conv(x, y)  += weights(r.x, r.y) * hw_input(x + r.x, y + r.y);
+
+        Func hw_output("hw_output");
+        hw_output(x, y) = cast<uint16_t>(conv(x, y));
+        output(x, y) = hw_output(x,y);
+
+        weights.dim(0).set_bounds(0, 3)
+               .dim(1).set_bounds(0, 3);
+
+        /* THE SCHEDULE */
+        if (get_target().has_feature(Target::CoreIR)) {
+          Var xi,yi, xo,yo;
+          
+          hw_input.compute_root();
+          hw_output.compute_root();
+          
+          hw_output.tile(x,y, xo,yo, xi,yi, 64-2, 64-2)
+            .hw_accelerate(xi, xo);
+
+          conv.update()
+            .unroll(r.x, 3)
+            .unroll(r.y, 3);
+
+          conv.linebuffer();
+
+          hw_input.stream_to_accelerator();
+          
+        } else {  // schedule to CPU
+          conv.compute_root();
+          conv.update()
+            .unroll(r.x, 3)
+            .unroll(r.y, 3);
+        }
+        
+    }
+};
+
+}  // namespace
+
+HALIDE_REGISTER_GENERATOR(ConvolutionTapsKernel, conv_taps)
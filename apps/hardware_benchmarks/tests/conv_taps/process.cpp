@@ -0,0 +1,49 @@
+#include <cstdio>
+
+#include "conv_taps.h"
+
+#include "hardware_process_helper.h"
+#include "coreir_interpret.h"
+#include "verilator_simulate.h"
+#include "halide_image_io.h"
+
+using namespace Halide::Tools;
+using namespace Halide::Runtime;
+
+int main(int argc, char **argv) {
+
+  // The weights are written to the tap ports of the design before the frame
+  // streams in, so any filter runs on the same hardware.
+  Buffer<uint16_t> weights(3, 3);
+  int filter[3][3] = {{11, 12, 13},
+                      {14,  0, 16},
+                      {17, 18, 19}};
+  for (int y = 0; y < weights.height(); y++) {
+    for (int x = 0; x < weights.width(); x++) {
+      weights(x, y) = filter[x][y];
+    }
+  }
+  TapValues taps = tap_ports("weights_stencil", weights);
+
+  OneInOneOut_ProcessController<uint16_t> processor("conv_taps",
+                                            {
+                                              {"cpu",
+                                                  [&]() { conv_taps(processor.input, weights, processor.output); }
+                                              },
+                                              {"coreir",
+                                                  [&]() { run_coreir_on_interpreter<>("bin/design_top.json", processor.input, processor.output,
+                                                                                      "self.in_arg_0_0_0", "self.out_0_0", taps); }
+                                              },
+                                              {"verilog",
+                                                  [&]() { run_verilator_on_design<>("bin/top.v", processor.input, processor.output,
+                                                                                    "self.in_arg_0_0_0", "self.out_0_0", taps); }
+                                              }
+
+                                            });
+
+  processor.input = Buffer<uint16_t>(64, 64);
+  processor.output = Buffer<uint16_t>(62, 62);
+  
+  processor.process_command(argc, argv);
+  
+}
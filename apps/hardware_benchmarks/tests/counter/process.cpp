@@ -4,6 +4,7 @@
 
 #include "hardware_process_helper.h"
 #include "coreir_interpret.h"
+#include "verilator_simulate.h"
 #include "halide_image_io.h"
 
 using namespace Halide::Tools;
@@ -19,6 +20,10 @@ int main(int argc, char **argv) {
                                             {"coreir",
                                                 [&]() { run_coreir_on_interpreter<>("bin/design_top.json", processor.input, processor.output,
                                                                                     "self.in_arg_4_0_0", "self.out_0_0"); }
+                                            },
+                                            {"verilog",
+                                                [&]() { run_verilator_on_design<>("bin/top.v", processor.input, processor.output,
+                                                                                  "self.in_arg_4_0_0", "self.out_0_0"); }
                                             }
                                           });
 
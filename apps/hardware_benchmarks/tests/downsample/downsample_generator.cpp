@@ -0,0 +1,52 @@
+#include "Halide.h"
+
+namespace {
+
+using namespace Halide;
+
+// A 2x2 box filter that halves the image in both dimensions, which is one
+// level of an image pyramid. The input is streamed in at one pixel per cycle
+// and the linebuffer only passes every other window on to the output.
+class DownsampleKernel : public Halide::Generator<DownsampleKernel> {
+public:
+    Input<Buffer<uint16_t>>  input{"input", 2};
+    Output<Buffer<uint16_t>> output{"output", 2};
+
+    void generate() {
+        /* THE ALGORITHM */
+
+        Var x("x"), y("y");
+
+        Func hw_input("hw_input");
+        hw_input(x, y) = input(x, y);
+
+        Func down("down");
+        down(x, y) = (hw_input(2*x,   2*y)   + hw_input(2*x+1, 2*y) +
+                      hw_input(2*x,   2*y+1) + hw_input(2*x+1, 2*y+1)) / 4;
+
+        Func hw_output("hw_output");
+        hw_output(x, y) = cast<uint16_t>(down(x, y));
+        output(x, y) = hw_output(x,y);
+
+        /* THE SCHEDULE */
+        if (get_target().has_feature(Target::CoreIR)) {
+          Var xi,yi, xo,yo;
+
+          hw_input.compute_root();
+          hw_output.compute_root();
+
+          hw_output.tile(x,y, xo,yo, xi,yi, 32, 32)
+            .hw_accelerate(xi, xo);
+
+          hw_input.stream_to_accelerator();
+
+        } else {  // schedule to CPU
+          hw_output.compute_root();
+        }
+
+    }
+};
+
+}  // namespace
+
+HALIDE_REGISTER_GENERATOR(DownsampleKernel, downsample)
@@ -0,0 +1,57 @@
+#include "Halide.h"
+
+namespace {
+
+using namespace Halide;
+
+// A 3x3 box sum that shrinks the image by three in both dimensions. The
+// stride is not a power of two, so the linebuffer counts the phase of each
+// window index to pick every third window.
+class Downsample3Kernel : public Halide::Generator<Downsample3Kernel> {
+public:
+    Input<Buffer<uint16_t>>  input{"input", 2};
+    Output<Buffer<uint16_t>> output{"output", 2};
+
+    void generate() {
+        /* THE ALGORITHM */
+
+        Var x("x"), y("y");
+
+        Func hw_input("hw_input");
+        hw_input(x, y) = input(x, y);
+
+        Func down("down");
+        Expr sum = cast<uint16_t>(0);
+        for (int j = 0; j < 3; j++) {
+          for (int i = 0; i < 3; i++) {
+            sum = sum + hw_input(3*x + i, 3*y + j);
+          }
+        }
+        down(x, y) = sum;
+
+        Func hw_output("hw_output");
+        hw_output(x, y) = cast<uint16_t>(down(x, y));
+        output(x, y) = hw_output(x,y);
+
+        /* THE SCHEDULE */
+        if (get_target().has_feature(Target::CoreIR)) {
+          Var xi,yi, xo,yo;
+
+          hw_input.compute_root();
+          hw_output.compute_root();
+
+          hw_output.tile(x,y, xo,yo, xi,yi, 21, 21)
+            .hw_accelerate(xi, xo);
+
+          hw_input.stream_to_accelerator();
+
+        } else {  // schedule to CPU
+          hw_output.compute_root();
+        }
+
+    }
+};
+
+}  // namespace
+
+HALIDE_REGISTER_GENERATOR(Downsample3Kernel, downsample_3)
@@ -0,0 +1,55 @@
+#include "Halide.h"
+
+namespace {
+
+using namespace Halide;
+
+// Counts the pixels of the image in 16 bins. The bins are cleared and then
+// updated once per pixel in an sram, so runs of pixels in the same bin
+// exercise the forwarding of back-to-back read-modify-write updates.
+class HistogramKernel : public Halide::Generator<HistogramKernel> {
+public:
+    Input<Buffer<uint16_t>>  input{"input", 2};
+    Output<Buffer<uint16_t>> output{"output", 2};
+
+    void generate() {
+        /* THE ALGORITHM */
+
+        Var x("x"), y("y");
+
+        Func hw_input("hw_input");
+        hw_input(x, y) = input(x, y);
+
+        Func hist("hist");
+        RDom r(0, 64, 0, 64);
+        hist(x) = cast<uint16_t>(0);
+        Expr bin = cast<int>(min(hw_input(r.x, r.y) / 16, 15));
+        hist(bin) += cast<uint16_t>(1);
+
+        Func hw_output("hw_output");
+        hw_output(x, y) = hist(x);
+        output(x, y) = hw_output(x,y);
+
+        /* THE SCHEDULE */
+        if (get_target().has_feature(Target::CoreIR)) {
+          Var xi,yi, xo,yo;
+
+          hw_input.compute_root();
+          hw_output.compute_root();
+
+          hw_output.tile(x,y, xo,yo, xi,yi, 16, 1)
+            .hw_accelerate(xi, xo);
+          hist.compute_at(hw_output, xo);
+
+          hw_input.stream_to_accelerator();
+
+        } else {  // schedule to CPU
+          hw_output.compute_root();
+        }
+
+    }
+};
+
+}  // namespace
+
+HALIDE_REGISTER_GENERATOR(HistogramKernel, histogram)
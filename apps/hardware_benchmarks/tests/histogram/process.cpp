@@ -0,0 +1,37 @@
+#include <cstdio>
+
+#include "histogram.h"
+
+#include "hardware_process_helper.h"
+#include "coreir_interpret.h"
+#include "verilator_simulate.h"
+#include "halide_image_io.h"
+
+using namespace Halide::Tools;
+using namespace Halide::Runtime;
+using namespace std;
+
+int main(int argc, char **argv) {
+
+  OneInOneOut_ProcessController<uint16_t> processor("histogram",
+                                          {
+                                            {"cpu",
+                                                [&]() { histogram(processor.input, processor.output); }
+                                            },
+                                            {"coreir",
+                                                [&]() { run_coreir_on_interpreter<>("bin/design_top.json", processor.input, processor.output,
+                                                                                    "self.in_arg_0_0_0", "self.out_0_0"); }
+                                            },
+                                            {"verilog",
+                                                [&]() { run_verilator_on_design<>("bin/top.v", processor.input, processor.output,
+                                                                                  "self.in_arg_0_0_0", "self.out_0_0"); }
+                                            }
+                                          });
+
+  // the whole 64x64 image streams in, and the 16 bins come out once it
+  // has all been counted
+  processor.input = Buffer<uint16_t>(64, 64);
+  processor.output = Buffer<uint16_t>(16, 1);
+
+  processor.process_command(argc, argv);
+}
@@ -0,0 +1,70 @@
+#include "Halide.h"
+
+namespace {
+
+using namespace Halide;
+
+// A 3x3 convolution over a frame narrow enough that its linebuffer is
+// cheaper in registers than in srams, so it is built as a shift register.
+class LinebufferRegs : public Halide::Generator<LinebufferRegs> {
+public:
+    Input<Buffer<uint16_t>>  input{"input", 2};
+    Output<Buffer<uint16_t>> output{"output", 2};
+
+    void generate() {
+        /* THE ALGORITHM */
+
+        Var x("x"), y("y");
+
+        Func kernel("kernel");
+        Func conv("conv");
+        RDom r(0, 3,
+               0, 3);
+
+        kernel(x,y) = 0;
+        kernel(0,0) = 11;      kernel(0,1) = 12;      kernel(0,2) = 13;
+        kernel(1,0) = 14;      kernel(1,1) = 0;       kernel(1,2) = 16;
+        kernel(2,0) = 17;      kernel(2,1) = 18;      kernel(2,2) = 19;
+
+        conv(x, y) = 0;
+
+        Func hw_input("hw_input");
+        hw_input(x, y) = input(x, y);
+        conv(x, y)  += kernel(r.x, r.y) * hw_input(x + r.x, y + r.y);
+
+        Func hw_output("hw_output");
+        hw_output(x, y) = cast<uint16_t>(conv(x, y));
+        output(x, y) = hw_output(x,y);
+
+        /* THE SCHEDULE */
+        if (get_target().has_feature(Target::CoreIR)) {
+          Var xi,yi, xo,yo;
+          
+          hw_input.compute_root();
+          hw_output.compute_root();
+          
+          hw_output.tile(x,y, xo,yo, xi,yi, 16-2, 16-2)
+            .hw_accelerate(xi, xo);
+
+          conv.update()
+            .unroll(r.x, 3)
+            .unroll(r.y, 3);
+
+          conv.linebuffer();
+
+          hw_input.stream_to_accelerator();
+          
+        } else {  // schedule to CPU
+          kernel.compute_root();
+          conv.compute_root();
+          conv.update()
+            .unroll(r.x, 3)
+            .unroll(r.y, 3);
+        }
+        
+    }
+};
+
+}  // namespace
+
+HALIDE_REGISTER_GENERATOR(LinebufferRegs, linebuffer_regs)
@@ -0,0 +1,37 @@
+#include <cstdio>
+
+#include "linebuffer_regs.h"
+
+#include "hardware_process_helper.h"
+#include "coreir_interpret.h"
+#include "verilator_simulate.h"
+#include "halide_image_io.h"
+
+using namespace Halide::Tools;
+using namespace Halide::Runtime;
+using namespace std;
+
+int main(int argc, char **argv) {
+
+  OneInOneOut_ProcessController<uint16_t> processor("linebuffer_regs",
+                                          {
+                                            {"cpu",
+                                                [&]() { linebuffer_regs(processor.input, processor.output); }
+                                            },
+                                            {"coreir",
+                                                [&]() { run_coreir_on_interpreter<>("bin/design_top.json", processor.input, processor.output,
+                                                                                    "self.in_arg_0_0_0", "self.out_0_0"); }
+                                            },
+                                            {"verilog",
+                                                [&]() { run_verilator_on_design<>("bin/top.v", processor.input, processor.output,
+                                                                                  "self.in_arg_0_0_0", "self.out_0_0"); }
+                                            }
+                                          });
+
+  // the 16 pixel rows only need 38 words of linebuffer, which are built
+  // from registers instead of srams
+  processor.input = Buffer<uint16_t>(16, 16);
+  processor.output = Buffer<uint16_t>(14, 14);
+
+  processor.process_command(argc, argv);
+}
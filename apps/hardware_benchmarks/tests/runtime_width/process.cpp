@@ -0,0 +1,40 @@
+#include <cstdio>
+
+#include "runtime_width.h"
+
+#include "hardware_process_helper.h"
+#include "coreir_interpret.h"
+#include "verilator_simulate.h"
+#include "halide_image_io.h"
+
+using namespace Halide::Tools;
+using namespace Halide::Runtime;
+using namespace std;
+
+int main(int argc, char **argv) {
+
+  // The design is built for 62 wide tiles, and runs on 30 wide ones here.
+  // The width is a tap, so the linebuffer rows follow it.
+  const int width = 30;
+  TapValues taps = {{"self.taps_width", width}};
+
+  OneInOneOut_ProcessController<uint16_t> processor("runtime_width",
+                                          {
+                                            {"cpu",
+                                                [&]() { runtime_width(processor.input, width, processor.output); }
+                                            },
+                                            {"coreir",
+                                                [&]() { run_coreir_on_interpreter<>("bin/design_top.json", processor.input, processor.output,
+                                                                                    "self.in_arg_0_0_0", "self.out_0_0", taps); }
+                                            },
+                                            {"verilog",
+                                                [&]() { run_verilator_on_design<>("bin/top.v", processor.input, processor.output,
+                                                                                  "self.in_arg_0_0_0", "self.out_0_0", taps); }
+                                            }
+                                          });
+
+  processor.input = Buffer<uint16_t>(width + 2, 64);
+  processor.output = Buffer<uint16_t>(width, 62);
+
+  processor.process_command(argc, argv);
+}
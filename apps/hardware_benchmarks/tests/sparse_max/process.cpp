@@ -0,0 +1,36 @@
+#include <cstdio>
+
+#include "sparse_max.h"
+
+#include "hardware_process_helper.h"
+#include "coreir_interpret.h"
+#include "verilator_simulate.h"
+#include "halide_image_io.h"
+
+using namespace Halide::Tools;
+using namespace Halide::Runtime;
+using namespace std;
+
+int main(int argc, char **argv) {
+
+  // the output port carries (x, y, value) records on self.out_0 to self.out_2
+  OneInOneOut_ProcessController<uint16_t> processor("sparse_max",
+                                          {
+                                            {"cpu",
+                                                [&]() { sparse_max(processor.input, processor.output); }
+                                            },
+                                            {"coreir",
+                                                [&]() { run_coreir_on_interpreter<>("bin/design_top.json", processor.input, processor.output,
+                                                                                    "self.in_arg_0_0_0", "self.out", TapValues(), true); }
+                                            },
+                                            {"verilog",
+                                                [&]() { run_verilator_on_design<>("bin/top.v", processor.input, processor.output,
+                                                                                  "self.in_arg_0_0_0", "self.out", TapValues(), true); }
+                                            }
+                                          });
+
+  processor.input = Buffer<uint16_t>(64, 64);
+  processor.output = Buffer<uint16_t>(62, 62);
+
+  processor.process_command(argc, argv);
+}
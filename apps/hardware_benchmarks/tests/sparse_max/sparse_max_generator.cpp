@@ -0,0 +1,55 @@
+#include "Halide.h"
+
+namespace {
+
+using namespace Halide;
+
+// A detector of local maxima: a pixel that is brighter than its four
+// neighbours keeps its value, and every other pixel is zero. Only the
+// maxima are sent back from the accelerator, as (x, y, value) records.
+class SparseMaxKernel : public Halide::Generator<SparseMaxKernel> {
+public:
+    Input<Buffer<uint16_t>>  input{"input", 2};
+    Output<Buffer<uint16_t>> output{"output", 2};
+
+    void generate() {
+        /* THE ALGORITHM */
+
+        Var x("x"), y("y");
+
+        Func hw_input("hw_input");
+        hw_input(x, y) = input(x, y);
+
+        Func maxima("maxima");
+        Expr center = hw_input(x + 1, y + 1);
+        Expr is_max = (center > hw_input(x,     y + 1) && center > hw_input(x + 2, y + 1) &&
+                       center > hw_input(x + 1, y)     && center > hw_input(x + 1, y + 2));
+        maxima(x, y) = select(is_max, center, cast<uint16_t>(0));
+
+        Func hw_output("hw_output");
+        hw_output(x, y) = maxima(x, y);
+        output(x, y) = hw_output(x,y);
+
+        /* THE SCHEDULE */
+        if (get_target().has_feature(Target::CoreIR)) {
+          Var xi,yi, xo,yo;
+
+          hw_input.compute_root();
+          hw_output.compute_root();
+
+          hw_output.tile(x,y, xo,yo, xi,yi, 64-2, 64-2)
+            .hw_accelerate(xi, xo);
+          hw_output.sparse_output();
+
+          hw_input.stream_to_accelerator();
+
+        } else {  // schedule to CPU
+          hw_output.compute_root();
+        }
+
+    }
+};
+
+}  // namespace
+
+HALIDE_REGISTER_GENERATOR(SparseMaxKernel, sparse_max)
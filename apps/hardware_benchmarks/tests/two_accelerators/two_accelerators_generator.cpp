@@ -0,0 +1,56 @@
+#include "Halide.h"
+
+namespace {
+
+using namespace Halide;
+
+// Two accelerated regions, where the output of the first is streamed into
+// the second. DesignTop wires the stream between the two instances, so only
+// the input of the first and the output of the second are ports.
+class TwoAccelerators : public Halide::Generator<TwoAccelerators> {
+public:
+    Input<Buffer<uint16_t>>  input{"input", 2};
+    Output<Buffer<uint16_t>> output{"output", 2};
+
+    void generate() {
+        /* THE ALGORITHM */
+
+        Var x("x"), y("y");
+
+        Func hw_input("hw_input");
+        hw_input(x, y) = input(x, y);
+
+        Func hw_mid("hw_mid");
+        hw_mid(x, y) = hw_input(x, y) * 2;
+
+        Func hw_output("hw_output");
+        hw_output(x, y) = hw_mid(x, y) + 3;
+        output(x, y) = hw_output(x,y);
+
+        /* THE SCHEDULE */
+        if (get_target().has_feature(Target::CoreIR)) {
+          Var xi,yi, xo,yo;
+
+          hw_input.compute_root();
+          hw_mid.compute_root();
+          hw_output.compute_root();
+
+          hw_mid.tile(x,y, xo,yo, xi,yi, 64, 64)
+            .hw_accelerate(xi, xo);
+          hw_input.stream_to_accelerator();
+
+          hw_output.tile(x,y, xo,yo, xi,yi, 64, 64)
+            .hw_accelerate(xi, xo);
+          hw_mid.stream_to_accelerator();
+
+        } else {  // schedule to CPU
+          hw_mid.compute_root();
+          hw_output.compute_root();
+        }
+
+    }
+};
+
+}  // namespace
+
+HALIDE_REGISTER_GENERATOR(TwoAccelerators, two_accelerators)
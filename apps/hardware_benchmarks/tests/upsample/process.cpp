@@ -0,0 +1,30 @@
+#include <cstdio>
+
+#include "upsample.h"
+#include "upsample_vhls.h"
+
+#include "hardware_process_helper.h"
+#include "halide_image_io.h"
+
+using namespace Halide::Tools;
+using namespace Halide::Runtime;
+using namespace std;
+
+int main(int argc, char **argv) {
+
+  OneInOneOut_ProcessController<uint16_t> processor("upsample",
+                                          {
+                                            {"cpu",
+                                                [&]() { upsample(processor.input, processor.output); }
+                                            },
+                                            {"vhls",
+                                                [&]() { upsample_vhls(processor.input, processor.output); }
+                                            }
+                                          });
+
+  // each pixel of the 32x32 input is repeated in a 2x2 block of the output
+  processor.input = Buffer<uint16_t>(32, 32);
+  processor.output = Buffer<uint16_t>(64, 64);
+
+  processor.process_command(argc, argv);
+}
@@ -0,0 +1,53 @@
+#include "Halide.h"
+
+namespace {
+
+using namespace Halide;
+
+// A 2x nearest neighbor upsample, which is the expand step of an image
+// pyramid. Every input pixel is held for two output pixels along x and two
+// rows along y, so the linebuffer repeats each window instead of dropping
+// them like the downsample test.
+class UpsampleKernel : public Halide::Generator<UpsampleKernel> {
+public:
+    Input<Buffer<uint16_t>>  input{"input", 2};
+    Output<Buffer<uint16_t>> output{"output", 2};
+
+    void generate() {
+        /* THE ALGORITHM */
+
+        Var x("x"), y("y");
+
+        Func hw_input("hw_input");
+        hw_input(x, y) = input(x, y);
+
+        Func up("up");
+        up(x, y) = hw_input(x/2, y/2);
+
+        Func hw_output("hw_output");
+        hw_output(x, y) = cast<uint16_t>(up(x, y));
+        output(x, y) = hw_output(x,y);
+
+        /* THE SCHEDULE */
+        if (get_target().has_feature(Target::HLS)) {
+          // upsampling is only supported by the HLS backend
+          Var xi,yi, xo,yo;
+
+          hw_input.compute_root();
+          hw_output.compute_root();
+
+          hw_output.tile(x,y, xo,yo, xi,yi, 64, 64)
+            .hw_accelerate(xi, xo);
+
+          hw_input.stream_to_accelerator();
+
+        } else {  // schedule to CPU
+          hw_output.compute_root();
+        }
+
+    }
+};
+
+}  // namespace
+
+HALIDE_REGISTER_GENERATOR(UpsampleKernel, upsample)
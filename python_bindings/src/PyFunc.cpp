@@ -227,8 +227,8 @@ void define_func(py::module &m) {
         }, py::arg("idx") = 0)
         .def("rvars", &Func::rvars, py::arg("idx") = 0)
 
-        .def("trace_loads", &Func::trace_loads)
-        .def("trace_stores", &Func::trace_stores)
+        .def("trace_loads", (Func &(Func::*)()) &Func::trace_loads)
+        .def("trace_stores", (Func &(Func::*)()) &Func::trace_stores)
         .def("trace_realizations", &Func::trace_realizations)
         .def("print_loop_nest", &Func::print_loop_nest)
         .def("add_trace_tag", &Func::add_trace_tag, py::arg("trace_tag"))
@@ -1,6 +1,8 @@
 #include "AssociativeOpsTable.h"
 #include "IRPrinter.h"
 
+#include <mutex>
+
 namespace Halide {
 namespace Internal {
 
@@ -111,7 +113,13 @@ struct TableKey {
     }
 };
 
+// Filled in lazily, and shared by every thread lowering a pipeline (the
+// sub-targets of a multitarget generator compile concurrently), so it
+// is guarded by pattern_tables_lock. Entries are never modified once
+// populated, and map nodes don't move, so the returned references stay
+// valid without the lock.
 static map<TableKey, vector<AssociativePattern>> pattern_tables;
+static std::mutex pattern_tables_lock;
 
 #define declare_vars(t, index)                  \
     Expr x##index = Variable::make(t, "x" + std::to_string(index)); \
@@ -276,6 +284,7 @@ const vector<AssociativePattern> &get_ops_table_helper(const vector<Type> &types
     TableKey gen_key(ValType::All, root, dim);
     TableKey key(convert_halide_types_to_val_types(types), root, dim);
 
+    std::lock_guard<std::mutex> lock_guard(pattern_tables_lock);
     const auto &table_it = pattern_tables.find(key);
     if (table_it == pattern_tables.end()) { // Populate the table if we haven't done so previously
         vector<AssociativePattern> &table = pattern_tables[key];
@@ -295,7 +295,11 @@ class ForkAsyncProducers : public IRMutator2 {
 
     Stmt visit(const Realize *op) override {
         auto it = env.find(op->name);
-        internal_assert(it != env.end());
+        if (it == env.end()) {
+            // The streams and stencils of a hardware accelerator are
+            // not Funcs, and are never forked off.
+            return IRMutator2::visit(op);
+        }
         Function f = it->second;
         if (f.schedule().async()) {
             Stmt body = op->body;
@@ -469,10 +473,18 @@ class TightenProducerConsumerNodes : public IRMutator2 {
     }
 
     Stmt visit(const ProducerConsumer *op) override {
-        Stmt body = mutate(op->body);        
+        Stmt body = mutate(op->body);
+        auto it = env.find(op->name);
+        if (it == env.end()) {
+            // e.g. the _hls_target node around an accelerator
+            if (body.same_as(op->body)) {
+                return op;
+            }
+            return ProducerConsumer::make(op->name, op->is_producer, body);
+        }
         Scope<int> scope;
         scope.push(op->name, 0);
-        Function f = env.find(op->name)->second;
+        Function f = it->second;
         if (f.outputs() == 1) {
             scope.push(op->name + ".buffer", 0);
         } else {
@@ -50,6 +50,7 @@ const string globals = R"INLINE_CODE(
 extern "C" {
 int64_t halide_current_time_ns(void *ctx);
 void halide_profiler_pipeline_end(void *, void *);
+void halide_profiler_instance_end(void *, void *);
 }
 
 #ifdef _WIN32
@@ -2608,7 +2609,8 @@ void CodeGen_C::visit(const Allocate *op) {
                    << op_name
                    << " = ("
                    << op_type
-                   << " *)halide_malloc(_ucon, sizeof("
+                   << " *)" << (target.has_feature(Target::PoolAllocator) ? "halide_pool_malloc" : "halide_malloc")
+                   << "(_ucon, sizeof("
                    << op_type
                    << ")*" << size_id << ");\n";
             heap_allocations.push(op->name);
@@ -2619,7 +2621,10 @@ void CodeGen_C::visit(const Allocate *op) {
         create_assertion(op_name, "halide_error_out_of_memory(_ucon)");
 
         do_indent();
-        string free_function = op->free_function.empty() ? "halide_free" : op->free_function;
+        string free_function = op->free_function;
+        if (free_function.empty()) {
+            free_function = target.has_feature(Target::PoolAllocator) ? "halide_pool_free" : "halide_free";
+        }
         stream << "HalideFreeHelper " << op_name << "_free(_ucon, "
                << op_name << ", " << free_function << ");\n";
     }
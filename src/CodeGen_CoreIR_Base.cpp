@@ -3,6 +3,7 @@
 
 #include "CodeGen_Internal.h"
 #include "CodeGen_CoreIR_Base.h"
+#include "StreamOpt.h"
 #include "Substitute.h"
 #include "IROperator.h"
 #include "Param.h"
@@ -87,7 +88,8 @@ string CodeGen_CoreIR_Base::print_stencil_pragma(const string &name) {
 
 void CodeGen_CoreIR_Base::visit(const Call *op) {
     if (op->name == "linebuffer") {
-        //IR: linebuffer(buffered.stencil_update.stream, buffered.stencil.stream, extent_0[, extent_1, ...])
+        //IR: linebuffer(buffered.stencil_update.stream, buffered.stencil.stream, extent_0[, extent_1, ...]
+        //               [, stride_0, ..., hold_0, ...])
         //C: linebuffer<extent_0[, extent_1, ...]>(buffered.stencil_update.stream, buffered.stencil.stream)
         internal_assert(op->args.size() >= 3);
         string a0 = print_expr(op->args[0]);
@@ -95,12 +97,31 @@ void CodeGen_CoreIR_Base::visit(const Call *op) {
 	const Variable *stencil_var = op->args[1].as<Variable>();
 	Stencil_Type stencil_type = stencils.get(stencil_var->name);
 
+        size_t num_dims = stencil_type.bounds.size();
         do_indent();
-        stream << "linebuffer<";
-        for(size_t i = 2; i < op->args.size(); i++) {
-            stream << print_expr(op->args[i]);
-            if (i != op->args.size() -1)
-                stream << ", ";
+        if (op->args.size() == 2 + 3 * num_dims) {
+            // IR: linebuffer(..., extent_0, ..., stride_0, ..., hold_0, ...)
+            // C: linebuffer_resample<extent_0, .., extent_3, stride_0, .., stride_3, hold_0, .., hold_3>(...)
+            stream << "linebuffer_resample<";
+            for (size_t group = 0; group < 3; group++) {
+                for (size_t i = 0; i < 4; i++) {
+                    if (i < num_dims) {
+                        stream << max_extent_value(op->args[2 + group * num_dims + i]);
+                    } else {
+                        stream << "1";
+                    }
+                    if (group != 2 || i != 3)
+                        stream << ", ";
+                }
+            }
+        } else {
+            // template arguments size the buffer for the largest frame
+            stream << "linebuffer<";
+            for(size_t i = 2; i < op->args.size(); i++) {
+                stream << max_extent_value(op->args[i]);
+                if (i != op->args.size() -1)
+                    stream << ", ";
+            }
         }
         stream << ">(" << a0 << ", " << a1 << ");\n";
         id = "0"; // skip evaluation
@@ -250,21 +271,21 @@ void CodeGen_CoreIR_Base::visit(const Call *op) {
         size_t num_of_demensions = *as_const_int(op->args[1]);
         vector<int> stencil_sizes(num_of_demensions);
         vector<int> stencil_steps(num_of_demensions);
-        vector<int> store_extents(num_of_demensions);
+        vector<Expr> store_extents(num_of_demensions);
 
         internal_assert(op->args.size() >= num_of_demensions*3 + 2);
         for (size_t i = 0; i < num_of_demensions; i++) {
             stencil_sizes[i] = *as_const_int(op->args[i*3 + 2]);
             stencil_steps[i] = *as_const_int(op->args[i*3 + 3]);
-            store_extents[i] = *as_const_int(op->args[i*3 + 4]);
+            store_extents[i] = op->args[i*3 + 4];
         }
 
         internal_assert(op->args.size() >= num_of_demensions*3 + 3);
         size_t num_of_consumers = *as_const_int(op->args[num_of_demensions*3 + 2]);
         vector<string> consumer_names(num_of_consumers);
         vector<int> consumer_fifo_depth(num_of_consumers);
-        vector<vector<int> > consumer_offsets(num_of_consumers);
-        vector<vector<int> > consumer_extents(num_of_consumers);
+        vector<vector<Expr> > consumer_offsets(num_of_consumers);
+        vector<vector<Expr> > consumer_extents(num_of_consumers);
 
         internal_assert(op->args.size() >= num_of_demensions*3 + 3 + num_of_consumers*(2 + 2*num_of_demensions));
         for (size_t i = 0; i < num_of_consumers; i++) {
@@ -274,11 +295,12 @@ void CodeGen_CoreIR_Base::visit(const Call *op) {
             const IntImm *int_imm = op->args[num_of_demensions*3 + 4 + (2 + 2*num_of_demensions)*i].as<IntImm>();
             internal_assert(int_imm);
             consumer_fifo_depth[i] = int_imm->value;
-            vector<int> offsets(num_of_demensions);
-            vector<int > extents(num_of_demensions);
+            // offsets and extents are runtime values when the frame size is
+            vector<Expr> offsets(num_of_demensions);
+            vector<Expr> extents(num_of_demensions);
             for (size_t j = 0; j < num_of_demensions; j++) {
-                offsets[j] = *as_const_int(op->args[num_of_demensions*3 + 5 + (2 + 2*num_of_demensions)*i + 2*j]);
-                extents[j] = *as_const_int(op->args[num_of_demensions*3 + 6 + (2 + 2*num_of_demensions)*i + 2*j]);
+                offsets[j] = op->args[num_of_demensions*3 + 5 + (2 + 2*num_of_demensions)*i + 2*j];
+                extents[j] = op->args[num_of_demensions*3 + 6 + (2 + 2*num_of_demensions)*i + 2*j];
             }
             consumer_offsets[i] = offsets;
             consumer_extents[i] = extents;
@@ -320,7 +342,7 @@ void CodeGen_CoreIR_Base::visit(const Call *op) {
             do_indent();
             // HLS C: for(int dim = 0; dim <= store_extent - stencil.size; dim += stencil.step)
             stream << "for (int " << dim_name <<" = 0; "
-                   << dim_name << " <= " << store_extents[i] - stencil_sizes[i] << "; "
+                   << dim_name << " <= " << print_expr(simplify(store_extents[i] - stencil_sizes[i])) << "; "
                    << dim_name << " += " << stencil_steps[i] << ")\n";
         }
         open_scope();
@@ -345,8 +367,8 @@ void CodeGen_CoreIR_Base::visit(const Call *op) {
             stream << "if (";
             for (size_t j = 0; j < num_of_demensions; j++) {
                 string dim_name = "_dim_" + to_string(j);
-                stream << dim_name << " >= " << consumer_offsets[i][j] << " && "
-                       << dim_name << " <= " << consumer_offsets[i][j] + consumer_extents[i][j] - stencil_sizes[j];
+                stream << dim_name << " >= " << print_expr(consumer_offsets[i][j]) << " && "
+                       << dim_name << " <= " << print_expr(simplify(consumer_offsets[i][j] + consumer_extents[i][j] - stencil_sizes[j]));
                 if (j != num_of_demensions - 1)
                     stream << " && ";
             }
@@ -364,6 +386,11 @@ void CodeGen_CoreIR_Base::visit(const Call *op) {
         close_scope("");
 
         id = "0"; // skip evaluation
+
+    } else if (is_runtime_extent(op)) {
+        // the value is read from its configuration register
+        id = print_expr(op->args[0]);
+
 // FIXME: This intrinsic was removed?        
 //    } else if (op->is_intrinsic(Call::address_of)) {
 //        const Load *l = op->args[0].as<Load>();
@@ -1,10 +1,14 @@
 #include <iostream>
 #include <fstream>
 #include <limits>
+#include <set>
 #include <algorithm>
+#include <functional>
 
 #include "CodeGen_Internal.h"
 #include "CodeGen_CoreIR_Target.h"
+#include "HWBuffer.h"
+#include "StreamOpt.h"
 #include "Substitute.h"
 #include "IRMutator.h"
 #include "IROperator.h"
@@ -98,111 +102,27 @@ bool variable_used(Stmt s, string varname) {
   return uv.used;
 }
 
-class AllocationUsage : public IRVisitor {
+class LoadsBuffer : public IRVisitor {
   using IRVisitor::visit;
   void visit(const Load *op) {
-    if (op->name == alloc_name) {
-      num_loads++;
-      load_index_exprs.emplace_back(op->index);
-      
-      if (!is_const(op->index)) {
-        uses_variable_load_index = true;
-      }
-    }
-  }
-
-  void visit(const Store *op) {
-    if (op->name == alloc_name) {
-      num_stores++;
-      store_index_exprs.emplace_back(op->index);
-      
-      if (!is_const(op->index)) {
-        uses_variable_store_index = true;
-      }
-      if (!is_const(op->value)) {
-        uses_variable_store_value = true;
-      }
-
+    if (op->name == buffer) {
+      found = true;
     }
+    IRVisitor::visit(op);
   }
 
-
- public:
-  bool uses_variable_load_index;
-  bool uses_variable_store_index;
-  bool uses_variable_store_value;
-  bool load_index_equals_store_index;
-  uint num_loads;
-  uint num_stores;
-  vector<Expr> store_index_exprs;
-  vector<Expr> load_index_exprs;
-  string alloc_name;
-  
-  AllocationUsage(string allocname) : uses_variable_load_index(false),
-                                      uses_variable_store_index(false),
-                                      uses_variable_store_value(false),
-                                      load_index_equals_store_index(false),
-                                      num_loads(0),
-                                      num_stores(0),
-                                      alloc_name(allocname) {}
-};
-
-enum AllocationType {
-  NO_ALLOCATION,
-  INOUT_ALLOCATION,
-  ROM_ALLOCATION,
-  REGS_ALLOCATION,
-  SRAM_ALLOCATION,
-  RMW_ALLOCATION,
-  UNKNOWN_ALLOCATION
+public:
+  bool found;
+  string buffer;
+  LoadsBuffer(string buffer) : found(false), buffer(buffer) {}
 };
 
-AllocationType identify_allocation(Stmt s, string allocname) {
-  AllocationUsage au(allocname);
-  s.accept(&au);
-
-  if (au.num_stores == 0 || au.num_loads == 0) {
-    return INOUT_ALLOCATION;
-    
-  } else if (!au.uses_variable_load_index &&
-             !au.uses_variable_store_index &&
-             !au.uses_variable_store_value) {
-    return NO_ALLOCATION;
-
-  } else if (au.uses_variable_load_index &&
-             !au.uses_variable_store_index &&
-             !au.uses_variable_store_value) {
-    return ROM_ALLOCATION;
-
-  } else if (au.uses_variable_load_index &&
-             au.uses_variable_store_index &&
-             au.load_index_equals_store_index) {
-    return RMW_ALLOCATION;
-
-  } else if (au.uses_variable_load_index &&
-             au.uses_variable_store_index &&
-             !au.load_index_equals_store_index) {
-    return SRAM_ALLOCATION;
-    
-  } else {
-    return UNKNOWN_ALLOCATION;
-  }
-      
+// identifies a load from the buffer in an expression (e.g. an update's value)
+bool loads_buffer(Expr e, string buffer) {
+  LoadsBuffer lb(buffer);
+  e.accept(&lb);
+  return lb.found;
 }
-  
-bool variable_index_load(Stmt s, string allocname) {
-  AllocationUsage au(allocname);
-  s.accept(&au);
-  return au.uses_variable_load_index;
-}
-
-bool can_use_rom(Stmt s, string allocname) {
-  AllocationUsage au(allocname);
-  s.accept(&au);
-  return (!au.uses_variable_store_index &&
-          !au.uses_variable_store_value);
-}
-
 
 }
 
@@ -215,7 +135,11 @@ CodeGen_CoreIR_Target::CodeGen_CoreIR_Target(const string &name, Target target)
   CodeGen_CoreIR_Target::CodeGen_CoreIR_C::CodeGen_CoreIR_C(std::ostream &s,
                                                             Target target,
                                                             OutputKind output_kind) : 
-    CodeGen_CoreIR_Base(s, target, output_kind), has_valid(target.has_feature(Target::CoreIRValid)) {
+    CodeGen_CoreIR_Base(s, target, output_kind), has_valid(target.has_feature(Target::CoreIRValid)),
+    is_continuous(target.has_feature(Target::CoreIRContinuous)) {
+  user_assert(!is_continuous || has_valid)
+    << "The coreir_continuous target feature needs coreir_valid to mark frame boundaries.\n";
+
   // set up coreir generation
   bitwidth = 16;
   context = CoreIR::newContext();
@@ -229,7 +153,7 @@ CodeGen_CoreIR_Target::CodeGen_CoreIR_Target(const string &name, Target target)
                                            "ult", "ugt", "ule", "uge",
                                            "slt", "sgt", "sle", "sge", 
                                            "shl", "ashr", "lshr",
-                                           "mux", "const", "wire"};
+                                           "mux", "const", "wire", "reg"};
 
   for (auto gen_name : corelib_gen_names) {
     gens[gen_name] = "coreir." + gen_name;
@@ -266,7 +190,7 @@ CodeGen_CoreIR_Target::CodeGen_CoreIR_Target(const string &name, Target target)
   // add all modules from corebit
   context->getNamespace("corebit");
   std::vector<string> corebitlib_mod_names = {"bitand", "bitor", "bitxor", "bitnot",
-                                              "bitmux", "bitconst"};
+                                              "bitmux", "bitconst", "bitreg"};
   for (auto mod_name : corebitlib_mod_names) {
     // these were renamed to using the corebit library
     gens[mod_name] = "corebit." + mod_name.substr(3);
@@ -307,9 +231,14 @@ CodeGen_CoreIR_Target::~CodeGen_CoreIR_Target() {
 }
 
 CodeGen_CoreIR_Target::CodeGen_CoreIR_C::~CodeGen_CoreIR_C() {
-  if (def != NULL && def->hasInstances()) {
+  bool has_instances = false;
+  for (const auto &kernel : kernel_modules) {
+    has_instances = has_instances || kernel.module->getDef()->hasInstances();
+  }
+
+  if (has_instances) {
     // check the completed coreir design
-    design->setDef(def);
+    compose_design_top();
     context->checkerrors();
     design->print();
     
@@ -384,15 +313,207 @@ CodeGen_CoreIR_Target::CodeGen_CoreIR_C::~CodeGen_CoreIR_C() {
     
     CoreIR::deleteContext(context);
   } else {
-    if (def == NULL) {
-      cout << "null def- \n";
-    } else if (!def->hasInstances()) {
+    if (kernel_modules.empty()) {
+      cout << "no kernels- \n";
+    } else {
       cout << "no instances- \n";
     }
     cout << "No target json outputted " << endl;
   }
 }
 
+void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::reset_kernel_state() {
+  hw_wire_set.clear();
+  hw_store_set.clear();
+  hw_def_set.clear();
+  rmw_buffers.clear();
+  hw_input_set.clear();
+  hw_output_set.clear();
+  hw_dispatch_set.clear();
+  lb_map.clear();
+  lb_kernel_map.clear();
+  lb_valid_map.clear();
+  fifo_delays.clear();
+  loop_valid = NULL;
+  predicate = NULL;
+  output_predicate = NULL;
+}
+
+namespace {
+// The func carried by a stream, e.g. f for f.stencil.stream or
+// f.stencil_update.stream.
+string stream_func_name(const string &stream_name) {
+  size_t stencil = stream_name.find(".stencil");
+  return stencil == string::npos ? stream_name : stream_name.substr(0, stencil);
+}
+}  // namespace
+
+// Instance every kernel module in DesignTop. A stream written by one
+// accelerator and read by another is wired between their instances (with the
+// producer valid driving the consumer input enable), and every other stream
+// becomes a port of DesignTop. Kernels that do not feed each other have no
+// connections between them, so they run side by side.
+void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::compose_design_top() {
+  // streams are matched by the func they carry, since the stream read by
+  // the consumer can be named differently from the one the producer wrote
+  std::map<string, const KernelModule*> producers;
+  for (const auto &kernel : kernel_modules) {
+    if (!kernel.output.empty()) {
+      string func = stream_func_name(kernel.output);
+      internal_assert(producers.count(func) == 0)
+        << "func " << func << " is written by two accelerators\n";
+      producers[func] = &kernel;
+    }
+  }
+
+  std::map<string, bool> consumed;
+  for (const auto &kernel : kernel_modules) {
+    for (const auto &input : kernel.inputs) {
+      string func = stream_func_name(input.second);
+      if (producers.count(func) == 0) {
+        continue;
+      }
+      const KernelModule* producer = producers[func];
+      user_assert(kernel.input_types.at(input.first)->getFlipped() == producer->output_type)
+        << "Accelerator " << kernel.name << " reads " << func << " as " << input.second
+        << ", which does not match the stream " << producer->output
+        << " that accelerator " << producer->name << " writes it to. "
+        << "Stream it to the second accelerator with the same stencil.\n";
+      consumed[producer->output] = true;
+    }
+  }
+
+  // ports only get the kernel name when several kernels have inputs from
+  // outside, so a chain of kernels keeps the ports of a single one
+  int kernels_with_inputs = 0;
+  for (const auto &kernel : kernel_modules) {
+    for (const auto &input : kernel.inputs) {
+      if (producers.count(stream_func_name(input.second)) == 0) {
+        kernels_with_inputs++;
+        break;
+      }
+    }
+  }
+  auto top_port = [&](const KernelModule &kernel, const string &port) {
+    return kernels_with_inputs <= 1 ? port : kernel.name + "_" + port;
+  };
+
+  std::vector<std::pair<string, CoreIR::Type*>> input_types, output_types, valid_types;
+  for (const auto &kernel : kernel_modules) {
+    for (const auto &input : kernel.inputs) {
+      if (producers.count(stream_func_name(input.second)) == 0) {
+        input_types.push_back({top_port(kernel, input.first), kernel.input_types.at(input.first)});
+      }
+    }
+    if (!kernel.output.empty() && consumed.count(kernel.output) == 0) {
+      output_types.push_back({kernel.name, kernel.output_type});
+      valid_types.push_back({kernel.name, context->Bit()});
+    }
+  }
+
+  // with more than one output left, the outputs are a record by kernel
+  bool single_output = output_types.size() == 1;
+  CoreIR::Type* output_type = context->Bit();
+  CoreIR::Type* valid_type = context->Bit();
+  if (single_output) {
+    output_type = output_types[0].second;
+  } else if (!output_types.empty()) {
+    output_type = context->Record(output_types);
+    valid_type = context->Record(valid_types);
+  }
+
+  // taps with the same name are the same parameter, so kernels share the port
+  std::vector<std::pair<string, CoreIR::Type*>> tap_types;
+  std::set<string> tap_names;
+  for (const auto &kernel : kernel_modules) {
+    for (const auto &tap : kernel.taps) {
+      if (tap_names.insert(tap.first).second) {
+        tap_types.push_back(tap);
+      }
+    }
+  }
+
+  std::vector<std::pair<string, CoreIR::Type*>> design_fields = {
+    {"in", context->Record(input_types)},
+    {"out", output_type}
+  };
+  if (has_valid) {
+    design_fields.push_back({"reset", context->BitIn()});
+    design_fields.push_back({"valid", valid_type});
+  }
+  if (!tap_types.empty()) {
+    design_fields.push_back({"taps", context->Record(tap_types)});
+  }
+  CoreIR::Type* design_type = context->Record(design_fields);
+
+  design = global_ns->newModuleDecl("DesignTop", design_type);
+  def = design->newModuleDef();
+  self = def->sel("self");
+
+  std::map<string, CoreIR::Wireable*> instances;
+  for (const auto &kernel : kernel_modules) {
+    instances[kernel.name] = def->addInstance(kernel.name, kernel.module);
+    stream << "// DesignTop instance " << kernel.name << "\n";
+  }
+
+  for (const auto &kernel : kernel_modules) {
+    CoreIR::Wireable* inst = instances[kernel.name];
+    CoreIR::Wireable* in_en = NULL;
+
+    for (const auto &input : kernel.inputs) {
+      string func = stream_func_name(input.second);
+      if (producers.count(func) > 0) {
+        const KernelModule* producer = producers[func];
+        stream << "// " << input.second << " streams from " << producer->name
+               << " to " << kernel.name << "\n";
+        CoreIR::Wireable* producer_inst = instances[producer->name];
+        def->connect(producer_inst->sel("out"), inst->sel("in")->sel(input.first));
+
+        if (has_valid) {
+          // only take data when every producer has some
+          if (in_en == NULL) {
+            in_en = producer_inst->sel("valid");
+          } else {
+            string and_name = kernel.name + "_in_en_" + input.first;
+            CoreIR::Wireable* both = def->addInstance(and_name, gens["bitand"]);
+            def->connect(in_en, both->sel("in0"));
+            def->connect(producer_inst->sel("valid"), both->sel("in1"));
+            in_en = both->sel("out");
+          }
+        }
+      } else {
+        def->connect(self->sel("in")->sel(top_port(kernel, input.first)),
+                     inst->sel("in")->sel(input.first));
+      }
+    }
+
+    for (const auto &tap : kernel.taps) {
+      def->connect(self->sel("taps")->sel(tap.first), inst->sel("taps")->sel(tap.first));
+    }
+
+    if (!kernel.output.empty() && consumed.count(kernel.output) == 0) {
+      CoreIR::Wireable* out = single_output ? self->sel("out") : self->sel("out")->sel(kernel.name);
+      def->connect(inst->sel("out"), out);
+      if (has_valid) {
+        CoreIR::Wireable* valid = single_output ? self->sel("valid") : self->sel("valid")->sel(kernel.name);
+        def->connect(inst->sel("valid"), valid);
+      }
+    }
+
+    if (has_valid) {
+      if (in_en == NULL) {
+        // inputs from outside of the accelerator arrive every cycle
+        string en_name = kernel.name + "_in_en";
+        in_en = def->addInstance(en_name, gens["bitconst"], {{"value",CoreIR::Const::make(context,true)}})->sel("out");
+      }
+      def->connect(in_en, inst->sel("in_en"));
+      def->connect(self->sel("reset"), inst->sel("reset"));
+    }
+  }
+
+  design->setDef(def);
+}
+
 namespace {
 const string hls_header_includes =
   "#include <assert.h>\n"
@@ -483,13 +604,17 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::add_kernel(Stmt stmt,
                                                          const string &name,
                                                          const vector<CoreIR_Argument> &args) {
 
+  // every dag starts from an empty module
+  reset_kernel_state();
+  KernelModule kernel_module;
+  kernel_module.name = print_name(name);
+
   // Emit the function prototype
   // keep track of number of inputs/outputs to determine if file needed
   uint num_inouts = 0;
 
-  // Keep track of the inputs, output, and taps for this module
+  // Keep track of the inputs and output for this module (taps are kept in kernel_module)
   std::vector<std::pair<string, CoreIR::Type*>> input_types;
-  std::map<string, CoreIR::Type*> tap_types;
   CoreIR::Type* output_type = context->Bit();
 
   stream << "void " << print_name(name) << "(\n";
@@ -526,6 +651,7 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::add_kernel(Stmt stmt,
         }
 
         hw_output_set.insert(arg_name);
+        kernel_module.output = args[i].name;
       } else if (!args[i].is_output && args[i].stencil_type.type == Stencil_Type::StencilContainerType::AxiStream) {
         // add another input
         uint in_bitwidth = inst_bitwidth(stype.elemType.bits());
@@ -534,15 +660,17 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::add_kernel(Stmt stmt,
           input_type = input_type->Arr(indices[i]);
         }
         input_types.push_back({arg_name, input_type});
+        kernel_module.inputs.push_back({arg_name, args[i].name});
+        kernel_module.input_types[arg_name] = input_type;
           
       } else {
         // add another array of taps (configuration changes infrequently)
         uint in_bitwidth = inst_bitwidth(stype.elemType.bits());
-        CoreIR::Type* tap_type = context->Bit()->Arr(in_bitwidth);
+        CoreIR::Type* tap_type = in_bitwidth > 1 ? context->BitIn()->Arr(in_bitwidth) : context->BitIn();
         for (uint i=0; i<indices.size(); ++i) {
           tap_type = tap_type->Arr(indices[i]);
         }
-        tap_types[args[i].name] = tap_type;
+        kernel_module.taps.push_back({print_name(args[i].name), tap_type});
       }
 
       num_inouts++;
@@ -551,8 +679,8 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::add_kernel(Stmt stmt,
       // add another tap (single value)
       stream << print_type(args[i].scalar_type) << " " << arg_name;
       uint in_bitwidth = inst_bitwidth(args[i].scalar_type.bits());
-      CoreIR::Type* tap_type = context->BitIn()->Arr(in_bitwidth);
-      tap_types[arg_name] = tap_type;
+      CoreIR::Type* tap_type = in_bitwidth > 1 ? context->BitIn()->Arr(in_bitwidth) : context->BitIn();
+      kernel_module.taps.push_back({print_name(args[i].name), tap_type});
     }
 
     if (i < args.size()-1) stream << ",\n";
@@ -565,26 +693,32 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::add_kernel(Stmt stmt,
 
   // Create CoreIR design interface with input and output types.
   //  Output a valid bit if that exists in the design.
+  //  Taps are ports that hold their value while the design streams, so the
+  //  host can program them like configuration registers.
   CoreIR::Type* design_type;
   cout << "creating a design with " << input_types.size()
-       << " inputs from " << args.size() << " args\n";
+       << " inputs and " << kernel_module.taps.size()
+       << " taps from " << args.size() << " args\n";
   
+  std::vector<std::pair<string, CoreIR::Type*>> design_fields = {
+    {"in", context->Record(input_types)},
+    {"out", output_type}
+  };
   if (has_valid) {
-    design_type = context->Record({
-      {"in", context->Record(input_types)},
-      {"reset", context->BitIn()},
-      {"out", output_type},
-      {"valid", context->Bit()}
-    });
-  } else {
-    design_type = context->Record({
-      {"in", context->Record(input_types)},
-      {"out", output_type}
-    });
+    // in_en marks the cycles where the input streams carry data
+    design_fields.push_back({"in_en", context->BitIn()});
+    design_fields.push_back({"reset", context->BitIn()});
+    design_fields.push_back({"valid", context->Bit()});
+  }
+  if (!kernel_module.taps.empty()) {
+    design_fields.push_back({"taps", context->Record(kernel_module.taps)});
   }
+  design_type = context->Record(design_fields);
 
-  design = global_ns->newModuleDecl("DesignTop", design_type);
+  design = global_ns->newModuleDecl(kernel_module.name, design_type);
   def = design->newModuleDef();
+  kernel_module.module = design;
+  kernel_module.output_type = output_type;
   self = def->sel("self");
 
   for (auto input_pair : input_types) {
@@ -649,14 +783,9 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::add_kernel(Stmt stmt,
           }
 		
         } else {
-          string taps_name = "taps" + print_name(args[i].name);
-          bool has_arg = (tap_types.count(args[i].name) > 0);
-          cout << "contains: " << args[i].name << "=" << has_arg << "\n";
-          auto tap_type = tap_types[args[i].name];
-          CoreIR::Wireable* taps_inst = def->addInstance(taps_name, gens["const_array"], {{"type",CoreIR::Const::make(context,tap_type)}});
-          taps_inst->getMetaData()["tap"] = "This array of constants is expected to be changed as tap values.";
-          
-          add_wire(print_name(args[i].name), taps_inst->sel("out"));
+          // stencil taps (such as filter weights) are read from a port
+          string tap_name = print_name(args[i].name);
+          add_wire(tap_name, self->sel("taps")->sel(tap_name));
 
         }
 
@@ -665,24 +794,9 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::add_kernel(Stmt stmt,
         stream << print_type(args[i].scalar_type) << " &"
                << print_name(args[i].name) << " = " << arg_name << ";\n";
                 
-        // configurable taps are generated as constant registers
-        string const_name = print_name(args[i].name);
-        string tap_name = "tap" + const_name;
-        int const_bitwidth = args[i].scalar_type.bits();
-        int const_value = 0;
-        CoreIR::Wireable* const_inst;
-
-        if (const_bitwidth == 1) {
-          CoreIR::Values mod_args = {{"value",CoreIR::Const::make(context,(bool)const_value)}};
-          const_inst = def->addInstance(tap_name, gens["bitconst"], mod_args);
-        } else {
-          int bw = inst_bitwidth(const_bitwidth);
-          CoreIR::Values gen_args = {{"width", CoreIR::Const::make(context,bw)}};
-          CoreIR::Values mod_args = {{"value",CoreIR::Const::make(context,BitVector(bw,const_value))}};
-          const_inst = def->addInstance(tap_name, gens["const"], gen_args, mod_args);
-        }
-        const_inst->getMetaData()["tap"] = "This constant is expected to be changed as a tap value.";
-        add_wire(const_name, const_inst->sel("out"));
+        // configurable taps are read from a port
+        string tap_name = print_name(args[i].name);
+        add_wire(tap_name, self->sel("taps")->sel(tap_name));
           
       }
 
@@ -704,11 +818,17 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::add_kernel(Stmt stmt,
 
     // print body
     print(stmt);
+    if (output_predicate) {
+      gate_output_valid();
+    }
 
     close_scope("kernel hls_target" + print_name(name));
   }
   stream << "\n";
 
+  design->setDef(def);
+  kernel_modules.push_back(kernel_module);
+
   for (size_t i = 0; i < args.size(); i++) {
     // Remove buffer arguments from allocation scope
     if (args[i].stencil_type.type == Stencil_Type::StencilContainerType::Stream) {
@@ -931,7 +1051,11 @@ CoreIR::Wireable* CodeGen_CoreIR_Target::CodeGen_CoreIR_C::get_wire(string name,
     CoreIR::Wireable* inst = def->addInstance(inst_name, inst_args->gen, inst_args->args, inst_args->genargs);
     add_wire(name, inst->sel(inst_args->selname));
     
-    if (inst_args->gen == gens["ram2"]) {
+    if (inst_args->gen == gens["ram2"] && rmw_buffers.count(name) > 0) {
+      int depth = inst_args->args.at("depth")->get<int>();
+      return add_rmw_forwarding(name, inst_name, inst, depth);
+
+    } else if (inst_args->gen == gens["ram2"]) {
       add_wire(name + "_waddr", inst->sel("waddr"));
       add_wire(name + "_wdata", inst->sel("wdata"));
       add_wire(name + "_raddr", inst->sel("raddr"));
@@ -960,6 +1084,133 @@ CoreIR::Wireable* CodeGen_CoreIR_Target::CodeGen_CoreIR_C::get_wire(string name,
   }
 }
 
+// A read-modify-write sram (e.g. a histogram) reads a bin, updates it, and
+// writes it back, once per cycle that the update loop is enabled. The sram
+// returns read data a cycle after the read address, so the update is written
+// back on the next cycle, to the delayed read address. When the next update
+// reads the same bin, its read is sampled on the edge that writes the previous
+// update, and it would see the stale count. Such back-to-back hits are caught
+// by comparing against the last write back, and forwarded from a register
+// instead of the sram. Other stores (e.g. clearing the bins) share the write
+// port at their own address, and fill the sram once after reset.
+CoreIR::Wireable* CodeGen_CoreIR_Target::CodeGen_CoreIR_C::add_rmw_forwarding(string name, string inst_name,
+                                                                               CoreIR::Wireable* ram, int depth) {
+  CoreIR::Values width_args = {{"width", CoreIR::Const::make(context,bitwidth)}};
+  CoreIR::Type* ptype = context->Bit()->Arr(bitwidth);
+
+  auto passthrough = [&](string suffix, CoreIR::Type* type) {
+    return def->addInstance(inst_name + suffix, gens["passthrough"], {{"type",CoreIR::Const::make(context,type)}});
+  };
+  auto bit_const = [&](string suffix, bool value) {
+    return def->addInstance(inst_name + suffix, gens["bitconst"], {{"value", CoreIR::Const::make(context,value)}})->sel("out");
+  };
+  auto bit_op = [&](string suffix, string op, CoreIR::Wireable* in0, CoreIR::Wireable* in1) {
+    CoreIR::Wireable* inst = def->addInstance(inst_name + suffix, gens[op]);
+    def->connect(in0, inst->sel("in0"));
+    def->connect(in1, inst->sel("in1"));
+    return inst->sel("out");
+  };
+  auto bit_reg = [&](string suffix, CoreIR::Wireable* in) {
+    CoreIR::Wireable* reg = def->addInstance(inst_name + suffix, gens["bitreg"]);
+    def->connect(in, reg->sel("in"));
+    return reg->sel("out");
+  };
+  // a register that only takes a new value on the cycles en is high
+  auto enabled_reg = [&](string suffix, CoreIR::Wireable* in, CoreIR::Wireable* en) {
+    CoreIR::Wireable* reg = def->addInstance(inst_name + suffix, gens["reg"], width_args);
+    CoreIR::Wireable* hold = def->addInstance(inst_name + suffix + "_hold", gens["mux"], width_args);
+    def->connect(reg->sel("out"), hold->sel("in0"));
+    def->connect(in, hold->sel("in1"));
+    def->connect(en, hold->sel("sel"));
+    def->connect(hold->sel("out"), reg->sel("in"));
+    return reg->sel("out");
+  };
+
+  // The update connects its read address, write data and the cycles it runs
+  // on; the other stores connect their address, data and enable. Neither
+  // writes until its store is connected.
+  CoreIR::Wireable* raddr_in = passthrough("_raddr_in", ptype);
+  CoreIR::Wireable* wdata_in = passthrough("_wdata_in", ptype);
+  CoreIR::Wireable* update_en = passthrough("_update_en", context->Bit());
+  CoreIR::Wireable* init_addr = passthrough("_init_addr", ptype);
+  CoreIR::Wireable* init_data = passthrough("_init_data", ptype);
+  CoreIR::Wireable* init_en = passthrough("_init_en", context->Bit());
+  CoreIR::Wireable* zero = def->addInstance(inst_name + "_zero", gens["const"], width_args,
+                                            {{"value",CoreIR::Const::make(context,BitVector(bitwidth,0))}});
+  def->connect(bit_const("_update_off", false), update_en->sel("in"));
+  def->connect(bit_const("_init_off", false), init_en->sel("in"));
+  def->connect(zero->sel("out"), init_addr->sel("in"));
+  def->connect(zero->sel("out"), init_data->sel("in"));
+
+  // the other stores write each word once, then stop until the next reset
+  CoreIR::Values count_args = {{"width",CoreIR::Const::make(context,bitwidth)},
+                               {"min",CoreIR::Const::make(context,0)},
+                               {"max",CoreIR::Const::make(context,depth - 1)},
+                               {"inc",CoreIR::Const::make(context,1)}};
+  CoreIR::Wireable* init_count = def->addInstance(inst_name + "_init_count", gens["counter"], count_args);
+  CoreIR::Wireable* init_done = def->addInstance(inst_name + "_init_done", gens["bitreg"]);
+  CoreIR::Wireable* init_pending = def->addInstance(inst_name + "_init_pending", gens["bitnot"]);
+  def->connect(init_done->sel("out"), init_pending->sel("in"));
+  CoreIR::Wireable* init_write = bit_op("_init_write", "bitand", init_en->sel("out"), init_pending->sel("out"));
+  CoreIR::Wireable* init_last = bit_op("_init_last", "bitand", init_write, init_count->sel("overflow"));
+  CoreIR::Wireable* done_next = bit_op("_init_done_next", "bitor", init_done->sel("out"), init_last);
+  def->connect(init_write, init_count->sel("en"));
+  if (has_valid) {
+    CoreIR::Wireable* running = def->addInstance(inst_name + "_running", gens["bitnot"]);
+    def->connect(self->sel("reset"), running->sel("in"));
+    def->connect(self->sel("reset"), init_count->sel("reset"));
+    done_next = bit_op("_init_done_kept", "bitand", done_next, running->sel("out"));
+  } else {
+    def->connect(bit_const("_init_count_reset", false), init_count->sel("reset"));
+  }
+  def->connect(done_next, init_done->sel("in"));
+
+  // the read in flight, which is written back on the next cycle
+  CoreIR::Wireable* raddr_d = enabled_reg("_raddr_d", raddr_in->sel("out"), update_en->sel("out"));
+  CoreIR::Wireable* write_back = bit_reg("_write_back", update_en->sel("out"));
+
+  // the last write back, and whether it was on the previous cycle
+  CoreIR::Wireable* waddr_d = enabled_reg("_waddr_d", raddr_d, write_back);
+  CoreIR::Wireable* wdata_d = enabled_reg("_wdata_d", wdata_in->sel("out"), write_back);
+  CoreIR::Wireable* wrote = bit_reg("_wrote", write_back);
+
+  CoreIR::Wireable* same = def->addInstance(inst_name + "_fwd_same", gens["eq"], width_args);
+  CoreIR::Wireable* fwd = def->addInstance(inst_name + "_fwd", gens["mux"], width_args);
+  def->connect(raddr_d, same->sel("in0"));
+  def->connect(waddr_d, same->sel("in1"));
+  CoreIR::Wireable* hit = bit_op("_fwd_hit", "bitand", same->sel("out"), wrote);
+  def->connect(ram->sel("rdata"), fwd->sel("in0"));
+  def->connect(wdata_d, fwd->sel("in1"));
+  def->connect(hit, fwd->sel("sel"));
+
+  // the write port takes the other stores while they fill the sram
+  CoreIR::Wireable* waddr = def->addInstance(inst_name + "_waddr", gens["mux"], width_args);
+  CoreIR::Wireable* wdata = def->addInstance(inst_name + "_wdata", gens["mux"], width_args);
+  def->connect(raddr_d, waddr->sel("in0"));
+  def->connect(init_addr->sel("out"), waddr->sel("in1"));
+  def->connect(init_write, waddr->sel("sel"));
+  def->connect(wdata_in->sel("out"), wdata->sel("in0"));
+  def->connect(init_data->sel("out"), wdata->sel("in1"));
+  def->connect(init_write, wdata->sel("sel"));
+
+  def->connect(raddr_in->sel("out"), ram->sel("raddr"));
+  def->connect(waddr->sel("out"), ram->sel("waddr"));
+  def->connect(wdata->sel("out"), ram->sel("wdata"));
+  def->connect(bit_op("_wen", "bitor", write_back, init_write), ram->sel("wen"));
+  def->connect(bit_const("_ren", true), ram->sel("ren"));
+
+  add_wire(name + "_raddr", raddr_in->sel("in"));
+  add_wire(name + "_wdata", wdata_in->sel("in"));
+  add_wire(name + "_update_en", update_en->sel("in"));
+  add_wire(name + "_init_addr", init_addr->sel("in"));
+  add_wire(name + "_init_data", init_data->sel("in"));
+  add_wire(name + "_init_en", init_en->sel("in"));
+  add_wire(name, fwd->sel("out"));
+  stream << "// forwarding back-to-back updates of " << name << endl;
+
+  return fwd->sel("out");
+}
+
 void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::add_wire(string out_name, CoreIR::Wireable* in_wire, vector<uint> out_indices) {
   //cout << "add wire to " << out_name << "\n";
   if (is_storage(out_name)) {
@@ -1165,11 +1416,200 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::record_dispatch(std::string produc
   }
 }
 
+// Only keep the output valid of the cycles where a sparse output sends a
+// record, by and-ing whatever drives the valid port with the predicate.
+void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::gate_output_valid() {
+  user_assert(has_valid)
+    << "A sparse output needs the coreir_valid target feature to mark its records.\n";
+  CoreIR::Wireable* valid_port = self->sel("valid");
+  std::set<CoreIR::Wireable*> drivers = valid_port->getConnectedWireables();
+  internal_assert(drivers.size() == 1) << "the output valid has " << drivers.size() << " drivers\n";
+  CoreIR::Wireable* dense_valid = *drivers.begin();
+
+  CoreIR::Wireable* sparse_valid = def->addInstance("sparse_valid", gens["bitand"]);
+  def->disconnect(dense_valid, valid_port);
+  def->connect(dense_valid, sparse_valid->sel("in0"));
+  def->connect(output_predicate, sparse_valid->sel("in1"));
+  def->connect(sparse_valid->sel("out"), valid_port);
+  stream << "// gated the output valid for the sparse output\n";
+}
+
 void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::record_linebuffer(std::string producer_name, CoreIR::Wireable* wire) {
   stream << "// added " << producer_name << " linebuffer to record map\n";
   lb_map[producer_name] = wire;
 }
 
+// The valid seen downstream of a linebuffer, which is decimated for
+// linebuffers feeding a downsampling kernel.
+CoreIR::Wireable* CodeGen_CoreIR_Target::CodeGen_CoreIR_C::linebuffer_valid(CoreIR::Wireable* lb_wire) {
+  if (lb_valid_map.count(lb_wire) > 0) {
+    return lb_valid_map[lb_wire];
+  }
+  return lb_wire->sel("valid");
+}
+
+// Count the windows coming out of a linebuffer in each dimension, and only
+// keep the valid of windows whose index is a multiple of the stride.
+CoreIR::Wireable* CodeGen_CoreIR_Target::CodeGen_CoreIR_C::decimate_linebuffer_valid(std::string lb_name,
+                                                                                     CoreIR::Wireable* valid,
+                                                                                     const vector<int> &windows,
+                                                                                     const vector<int> &strides) {
+  CoreIR::Wireable* count_en = valid;
+  for (size_t i = 0; i < windows.size(); i++) {
+    string dim = std::to_string(i);
+    string counter_name = lb_name + "_window_" + dim;
+    CoreIR::Values args = {{"width",CoreIR::Const::make(context,bitwidth)},
+                           {"min",CoreIR::Const::make(context,0)},
+                           {"max",CoreIR::Const::make(context,windows[i] - 1)},
+                           {"inc",CoreIR::Const::make(context,1)}};
+    CoreIR::Wireable* counter_inst = def->addInstance(counter_name, gens["counter"], args);
+    def->connect({"self", "reset"}, {counter_name, "reset"});
+    def->connect(count_en, counter_inst->sel("en"));
+
+    if (strides[i] > 1) {
+      CoreIR::Wireable* aligned;
+      if ((strides[i] & (strides[i] - 1)) == 0) {
+        // a power of two stride only needs the low bits of the window index
+        CoreIR::Wireable* mask = def->addInstance(counter_name + "_mask", gens["const"],
+                                                  {{"width", CoreIR::Const::make(context,bitwidth)}},
+                                                  {{"value",CoreIR::Const::make(context,BitVector(bitwidth,strides[i] - 1))}});
+        CoreIR::Wireable* zero = def->addInstance(counter_name + "_zero", gens["const"],
+                                                  {{"width", CoreIR::Const::make(context,bitwidth)}},
+                                                  {{"value",CoreIR::Const::make(context,BitVector(bitwidth,0))}});
+        CoreIR::Wireable* phase = def->addInstance(counter_name + "_phase", gens["and"],
+                                                   {{"width", CoreIR::Const::make(context,bitwidth)}});
+        def->connect(counter_inst->sel("out"), phase->sel("in0"));
+        def->connect(mask->sel("out"), phase->sel("in1"));
+        aligned = def->addInstance(counter_name + "_aligned", gens["eq"],
+                                   {{"width", CoreIR::Const::make(context,bitwidth)}});
+        def->connect(phase->sel("out"), aligned->sel("in0"));
+        def->connect(zero->sel("out"), aligned->sel("in1"));
+        aligned = aligned->sel("out");
+      } else {
+        // otherwise count the phase alongside the window index, and start
+        // it over with the index at the end of each row
+        aligned = stride_phase_aligned(counter_name, count_en, counter_inst->sel("overflow"), strides[i]);
+      }
+
+      CoreIR::Wireable* keep = def->addInstance(counter_name + "_valid", gens["bitand"]);
+      def->connect(valid, keep->sel("in0"));
+      def->connect(aligned, keep->sel("in1"));
+      valid = keep->sel("out");
+    }
+
+    // the next dimension moves when this one wraps around
+    if (i + 1 < windows.size()) {
+      CoreIR::Wireable* next_en = def->addInstance(counter_name + "_wrap", gens["bitand"]);
+      def->connect(count_en, next_en->sel("in0"));
+      def->connect(counter_inst->sel("overflow"), next_en->sel("in1"));
+      count_en = next_en->sel("out");
+    }
+  }
+  return valid;
+}
+
+
+// A phase counter from 0 to stride - 1 that moves with en and goes back to 0
+// after the last window of the row, returning whether the phase is 0.
+CoreIR::Wireable* CodeGen_CoreIR_Target::CodeGen_CoreIR_C::stride_phase_aligned(std::string counter_name,
+                                                                                CoreIR::Wireable* en,
+                                                                                CoreIR::Wireable* row_end,
+                                                                                int stride) {
+  CoreIR::Values width_args = {{"width", CoreIR::Const::make(context,bitwidth)}};
+  CoreIR::Wireable* phase = def->addInstance(counter_name + "_phase", config_counter_module());
+  CoreIR::Wireable* zero = def->addInstance(counter_name + "_zero", gens["const"], width_args,
+                                            {{"value",CoreIR::Const::make(context,BitVector(bitwidth,0))}});
+  CoreIR::Wireable* last = def->addInstance(counter_name + "_last", gens["const"], width_args,
+                                            {{"value",CoreIR::Const::make(context,BitVector(bitwidth,stride - 1))}});
+  def->connect(zero->sel("out"), phase->sel("min"));
+  def->connect(last->sel("out"), phase->sel("max"));
+  def->connect(en, phase->sel("en"));
+
+  // restart on reset, and when the window index wraps
+  CoreIR::Wireable* wraps = def->addInstance(counter_name + "_row_end", gens["bitand"]);
+  def->connect(en, wraps->sel("in0"));
+  def->connect(row_end, wraps->sel("in1"));
+  CoreIR::Wireable* restart = def->addInstance(counter_name + "_restart", gens["bitor"]);
+  def->connect(self->sel("reset"), restart->sel("in0"));
+  def->connect(wraps->sel("out"), restart->sel("in1"));
+  def->connect(restart->sel("out"), phase->sel("reset"));
+
+  CoreIR::Wireable* aligned = def->addInstance(counter_name + "_aligned", gens["eq"], width_args);
+  def->connect(phase->sel("out"), aligned->sel("in0"));
+  def->connect(zero->sel("out"), aligned->sel("in1"));
+  return aligned->sel("out");
+}
+
+// When frames stream back to back, the first rows of a frame are written
+// while the last rows of the previous frame are still in the linebuffer.
+// Track where each write lands in its frame, and only keep the valid of
+// windows that lie entirely inside one frame. The position counters wrap at
+// the end of every frame, so nothing needs to be reset between frames.
+CoreIR::Wireable* CodeGen_CoreIR_Target::CodeGen_CoreIR_C::frame_linebuffer_valid(std::string lb_name,
+                                                                                  CoreIR::Wireable* lb_wire,
+                                                                                  CoreIR::Wireable* wen,
+                                                                                  const vector<int> &input_dims,
+                                                                                  const vector<int> &output_dims,
+                                                                                  const vector<int> &image_dims) {
+  CoreIR::Wireable* count_en = wen;
+  CoreIR::Wireable* valid = lb_wire->sel("valid");
+  for (size_t i = 0; i < image_dims.size(); i++) {
+    string dim = std::to_string(i);
+    string counter_name = lb_name + "_frame_" + dim;
+    int positions = image_dims[i] / input_dims[i];
+    CoreIR::Values args = {{"width",CoreIR::Const::make(context,bitwidth)},
+                           {"min",CoreIR::Const::make(context,0)},
+                           {"max",CoreIR::Const::make(context,positions - 1)},
+                           {"inc",CoreIR::Const::make(context,1)}};
+    CoreIR::Wireable* counter_inst = def->addInstance(counter_name, gens["counter"], args);
+    def->connect({"self", "reset"}, {counter_name, "reset"});
+    def->connect(count_en, counter_inst->sel("en"));
+
+    // a window needs this many earlier writes in this dimension
+    int needed = (output_dims[i] - input_dims[i]) / input_dims[i];
+    if (needed > 0) {
+      CoreIR::Wireable* first = def->addInstance(counter_name + "_first", gens["const"],
+                                                 {{"width", CoreIR::Const::make(context,bitwidth)}},
+                                                 {{"value",CoreIR::Const::make(context,BitVector(bitwidth,needed))}});
+      CoreIR::Wireable* inside = def->addInstance(counter_name + "_inside", gens["uge"],
+                                                  {{"width", CoreIR::Const::make(context,bitwidth)}});
+      def->connect(counter_inst->sel("out"), inside->sel("in0"));
+      def->connect(first->sel("out"), inside->sel("in1"));
+
+      CoreIR::Wireable* keep = def->addInstance(counter_name + "_valid", gens["bitand"]);
+      def->connect(valid, keep->sel("in0"));
+      def->connect(inside->sel("out"), keep->sel("in1"));
+      valid = keep->sel("out");
+    }
+
+    if (i + 1 < image_dims.size()) {
+      CoreIR::Wireable* next_en = def->addInstance(counter_name + "_wrap", gens["bitand"]);
+      def->connect(count_en, next_en->sel("in0"));
+      def->connect(counter_inst->sel("overflow"), next_en->sel("in1"));
+      count_en = next_en->sel("out");
+    }
+  }
+  return valid;
+}
+
+// A fifo of the given depth that never stalls is a chain of that many
+// registers, on the data (a reg_array of the wire's type) or on a valid bit.
+CoreIR::Wireable* CodeGen_CoreIR_Target::CodeGen_CoreIR_C::add_delay(std::string name, CoreIR::Wireable* in_wire,
+                                                                      int stages, bool is_bit) {
+  CoreIR::Wireable* wire = in_wire;
+  for (int i = 0; i < stages; i++) {
+    string reg_name = name + "_fifo" + std::to_string(i);
+    CoreIR::Wireable* reg;
+    if (is_bit) {
+      reg = def->addInstance(reg_name, gens["bitreg"]);
+    } else {
+      reg = def->addInstance(reg_name, gens["reg_array"], {{"type",CoreIR::Const::make(context,in_wire->getType())}});
+    }
+    def->connect(wire, reg->sel("in"));
+    wire = reg->sel("out");
+  }
+  return wire;
+}
 
 bool CodeGen_CoreIR_Target::CodeGen_CoreIR_C::connect_linebuffer(std::string consumer_name, CoreIR::Wireable* consumer_wen_wire) {
   // strip off suffix to consumer name
@@ -1179,11 +1619,16 @@ bool CodeGen_CoreIR_Target::CodeGen_CoreIR_C::connect_linebuffer(std::string con
   //cout << "stripped name: " << consumer << std::endl;
   std::string producer, producer_name;
 
-  // trace back consumers looking for one that is a linebuffer
+  // trace back consumers looking for one that is a linebuffer, adding up
+  // the fifos the data went through on the way
   std::string consumer_recurse = consumer;
+  int fifo_delay = 0;
   while (hw_dispatch_set.count(consumer_recurse) > 0) {
     consumer = consumer_recurse;
     auto producer_list = hw_dispatch_set[consumer];
+    if (fifo_delays.count(consumer) > 0) {
+      fifo_delay += fifo_delays[consumer];
+    }
 
     // FIXME: what about merges?
     //internal_assert(producer_list.size() == 1);
@@ -1197,7 +1642,12 @@ bool CodeGen_CoreIR_Target::CodeGen_CoreIR_C::connect_linebuffer(std::string con
       stream << "// connected lb valid: connecting " << producer_name << " valid to " 
              << consumer_name << " wen\n";
       CoreIR::Wireable* linebuffer_wire = lb_map[producer_name];
-      def->connect(linebuffer_wire->sel("valid"), consumer_wen_wire);
+      CoreIR::Wireable* valid = linebuffer_valid(linebuffer_wire);
+      if (fifo_delay > 0) {
+        stream << "// delaying valid by " << fifo_delay << " fifo stages\n";
+        valid = add_delay(unique_name("fifo_valid"), valid, fifo_delay, true);
+      }
+      def->connect(valid, consumer_wen_wire);
       return true;
     }
 
@@ -1207,14 +1657,18 @@ bool CodeGen_CoreIR_Target::CodeGen_CoreIR_C::connect_linebuffer(std::string con
 
   if (is_input(consumer_name)) {
     // connect to self upstream valid
-    stream << "// TODO: connect to upstream valid here\n";
+    if (has_valid) {
+      stream << "// connecting input enable to " << consumer_name << " wen\n";
+      def->connect(self->sel("in_en"), consumer_wen_wire);
+      return true;
+    }
     return false;
   } else if (lb_map.count(producer_name) > 0) {
     // connect to upstream linebuffer valid
     stream << "// connecting " << producer_name << " valid to " 
            << consumer_name << " wen\n";
     CoreIR::Wireable* linebuffer_wire = lb_map[producer_name];
-    def->connect(linebuffer_wire->sel("valid"), consumer_wen_wire);
+    def->connect(linebuffer_valid(linebuffer_wire), consumer_wen_wire);
 
     return true;
   } else {
@@ -1608,6 +2062,9 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::visit(const ProducerConsumer *op)
 
       stream << "// emitting produce\n";
       print_stmt(op->body);
+
+      // the kernel is the func name without the stencil/stream suffix
+      tag_kernel_instances(op->name.substr(0, op->name.find(".")));
       
     } else { // this is a consumer
       stream << "// consume " << op->name << '\n';
@@ -1615,6 +2072,21 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::visit(const ProducerConsumer *op)
     }
 }
 
+// Label each instance created while emitting a kernel with the kernel name,
+// so simulation results can be attributed back to the HWKernel. Nested
+// produce nodes are emitted first and keep their own label.
+void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::tag_kernel_instances(string kernel_name) {
+  if (def == NULL) {
+    return;
+  }
+  for (auto inst_pair : def->getInstances()) {
+    CoreIR::Instance* inst = inst_pair.second;
+    if (inst->getMetaData().count("kernel") == 0) {
+      inst->getMetaData()["kernel"] = kernel_name;
+    }
+  }
+}
+
 void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::visit(const Provide *op) {
   if (ends_with(op->name, ".stencil") ||
       ends_with(op->name, ".stencil_update")) {
@@ -1739,24 +2211,44 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::visit(const For *op) {
     stream << "// added " << varname << " with a linebuffer\n";
   }
 
+  // stores in an innermost loop happen on the cycles its counter is enabled
+  CoreIR::Wireable* outer_loop_valid = loop_valid;
+  if (!contain_for_loop(op->body)) {
+    loop_valid = lb_kernel_map.count(op->name) ? linebuffer_valid(lb_kernel_map[op->name]) : NULL;
+  }
+
   // generate coreir: add counter module if variable used
   if (variable_used(op->body, op->name) || is_defined(print_name(op->name))) {
     string wirename = print_name(op->name);
     stream << "// creating counter for " << wirename << "\n";
     
     //internal_assert(is_const(op->min));
-    internal_assert(is_const(op->extent));
-    int min_value = is_const(op->min) ? id_const_value(op->min) : 0;
-    int max_value = min_value + id_const_value(op->extent) - 1;
-    int inc_value = 1;
     string counter_name = "count_" + wirename;
+    CoreIR::Wireable* counter_inst;
 
-    CoreIR::Values args = {{"width",CoreIR::Const::make(context,bitwidth)},
-                           {"min",CoreIR::Const::make(context,min_value)},
-                           {"max",CoreIR::Const::make(context,max_value)},
-                           {"inc",CoreIR::Const::make(context,inc_value)}};
+    if (is_const(op->extent)) {
+      int min_value = is_const(op->min) ? id_const_value(op->min) : 0;
+      int max_value = min_value + id_const_value(op->extent) - 1;
+      int inc_value = 1;
 
-    CoreIR::Wireable* counter_inst = def->addInstance(counter_name, gens["counter"], args);
+      CoreIR::Values args = {{"width",CoreIR::Const::make(context,bitwidth)},
+                             {"min",CoreIR::Const::make(context,min_value)},
+                             {"max",CoreIR::Const::make(context,max_value)},
+                             {"inc",CoreIR::Const::make(context,inc_value)}};
+
+      counter_inst = def->addInstance(counter_name, gens["counter"], args);
+    } else {
+      // the extent is set at runtime, so the counter bounds are wired
+      // from its configuration register
+      stream << "// loop extent " << op->extent << " is set at runtime\n";
+      Expr max_expr = simplify(op->min + op->extent - 1);
+      CoreIR::Wireable* min_wire = get_wire(print_expr(op->min), op->min);
+      CoreIR::Wireable* max_wire = get_wire(print_expr(max_expr), max_expr);
+
+      counter_inst = def->addInstance(counter_name, config_counter_module());
+      def->connect(min_wire, counter_inst->sel("min"));
+      def->connect(max_wire, counter_inst->sel("max"));
+    }
     add_wire(wirename, counter_inst->sel("out"));
     
     // connect reset wire
@@ -1785,7 +2277,7 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::visit(const For *op) {
       
     } else if (lb_kernel_map.count(op->name)) {
       stream << "// connected to lb valid" << "\n";
-      def->connect(lb_kernel_map[op->name]->sel("valid"), counter_inst->sel("en"));
+      def->connect(linebuffer_valid(lb_kernel_map[op->name]), counter_inst->sel("en"));
     } else {
       // connect wen wire
       string const_name = counter_name + "_wen";
@@ -1800,7 +2292,262 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::visit(const For *op) {
 
   op->body.accept(this);
   close_scope("for " + print_name(op->name));
+  loop_valid = outer_loop_valid;
+}
+
+// A counter from min to max (inclusive) where both bounds are inputs, for
+// loops with an extent that is set at runtime. The other ports match the
+// commonlib counter, so it can be used in its place.
+CoreIR::Module* CodeGen_CoreIR_Target::CodeGen_CoreIR_C::config_counter_module() {
+  if (config_counter != NULL) {
+    return config_counter;
+  }
+
+  CoreIR::Type* counter_type = context->Record({
+      {"en", context->BitIn()},
+      {"reset", context->BitIn()},
+      {"min", context->BitIn()->Arr(bitwidth)},
+      {"max", context->BitIn()->Arr(bitwidth)},
+      {"out", context->Bit()->Arr(bitwidth)},
+      {"overflow", context->Bit()}
+    });
+  config_counter = global_ns->newModuleDecl("config_counter", counter_type);
+  CoreIR::ModuleDef* counter_def = config_counter->newModuleDef();
+  CoreIR::Wireable* counter_self = counter_def->sel("self");
+
+  CoreIR::Values width_args = {{"width", CoreIR::Const::make(context,bitwidth)}};
+  CoreIR::Wireable* count = counter_def->addInstance("count", gens["reg"], width_args);
+  CoreIR::Wireable* one = counter_def->addInstance("one", gens["const"], width_args,
+                                                   {{"value",CoreIR::Const::make(context,BitVector(bitwidth,1))}});
+  CoreIR::Wireable* inc = counter_def->addInstance("inc", gens["add"], width_args);
+  CoreIR::Wireable* last = counter_def->addInstance("last", gens["eq"], width_args);
+  CoreIR::Wireable* wrap = counter_def->addInstance("wrap", gens["mux"], width_args);
+  CoreIR::Wireable* step = counter_def->addInstance("step", gens["mux"], width_args);
+  CoreIR::Wireable* next = counter_def->addInstance("next", gens["mux"], width_args);
+  CoreIR::Wireable* wraps = counter_def->addInstance("wraps", gens["bitand"]);
+
+  // count up, and go back to min after max
+  counter_def->connect(count->sel("out"), inc->sel("in0"));
+  counter_def->connect(one->sel("out"), inc->sel("in1"));
+  counter_def->connect(count->sel("out"), last->sel("in0"));
+  counter_def->connect(counter_self->sel("max"), last->sel("in1"));
+  counter_def->connect(inc->sel("out"), wrap->sel("in0"));
+  counter_def->connect(counter_self->sel("min"), wrap->sel("in1"));
+  counter_def->connect(last->sel("out"), wrap->sel("sel"));
+
+  // only move when enabled, and start over from min on reset
+  counter_def->connect(count->sel("out"), step->sel("in0"));
+  counter_def->connect(wrap->sel("out"), step->sel("in1"));
+  counter_def->connect(counter_self->sel("en"), step->sel("sel"));
+  counter_def->connect(step->sel("out"), next->sel("in0"));
+  counter_def->connect(counter_self->sel("min"), next->sel("in1"));
+  counter_def->connect(counter_self->sel("reset"), next->sel("sel"));
+  counter_def->connect(next->sel("out"), count->sel("in"));
+
+  counter_def->connect(count->sel("out"), counter_self->sel("out"));
+  counter_def->connect(counter_self->sel("en"), wraps->sel("in0"));
+  counter_def->connect(last->sel("out"), wraps->sel("in1"));
+  counter_def->connect(wraps->sel("out"), counter_self->sel("overflow"));
+
+  config_counter->setDef(counter_def);
+  return config_counter;
+}
+
+// A linebuffer for a stream of one word per cycle, built from delay lines.
+// The word at window position w was written sum_d (size_d - 1 - w_d) * row_d
+// writes ago, where row_d is the product of the image extents below d, so
+// each dimension above 0 delays the stream by row_d (size_d - 1) times and
+// dimension 0 shifts it through registers. The delay lines are registers, or
+// srams addressed in a circle, as the buffer was mapped. Image extents that
+// are set at runtime come in on the extents port, and the delay lines and
+// position counters follow them up to the extents the module was built for.
+// The other ports match the commonlib linebuffer, so it can be used in its
+// place.
+CoreIR::Module* CodeGen_CoreIR_Target::CodeGen_CoreIR_C::linebuffer_module(string lb_name,
+                                                                           CoreIR::Type* input_type,
+                                                                           CoreIR::Type* output_type,
+                                                                           const vector<int> &output_dims,
+                                                                           const vector<int> &image_dims,
+                                                                           const vector<bool> &runtime_extents,
+                                                                           bool use_sram) {
+  size_t num_dims = image_dims.size();
+  bool has_runtime_extent = false;
+  for (bool runtime : runtime_extents) {
+    has_runtime_extent = has_runtime_extent || runtime;
+  }
+
+  std::vector<std::pair<string, CoreIR::Type*>> lb_fields = {
+    {"in", input_type},
+    {"wen", context->BitIn()},
+    {"reset", context->BitIn()},
+    {"out", output_type},
+    {"valid", context->Bit()}
+  };
+  if (has_runtime_extent) {
+    lb_fields.push_back({"extents", context->BitIn()->Arr(bitwidth)->Arr(num_dims)});
+  }
+  string module_name = "hw_buffer" + lb_name;
+  while (global_ns->hasModule(module_name)) {
+    module_name = unique_name("hw_buffer" + lb_name);
+  }
+  CoreIR::Module* lb_module = global_ns->newModuleDecl(module_name, context->Record(lb_fields));
+  CoreIR::ModuleDef* lb_def = lb_module->newModuleDef();
+  CoreIR::Wireable* lb_self = lb_def->sel("self");
+  CoreIR::Values width_args = {{"width", CoreIR::Const::make(context,bitwidth)}};
+
+  int num_insts = 0;
+  auto inst_name = [&](string kind) { return kind + std::to_string(num_insts++); };
+  auto constant = [&](int value) {
+    return lb_def->addInstance(inst_name("const"), gens["const"], width_args,
+                               {{"value",CoreIR::Const::make(context,BitVector(bitwidth,value))}})->sel("out");
+  };
+  auto binary = [&](string op, CoreIR::Wireable* a, CoreIR::Wireable* b) {
+    CoreIR::Wireable* inst = lb_def->addInstance(inst_name(op), gens[op], width_args);
+    lb_def->connect(a, inst->sel("in0"));
+    lb_def->connect(b, inst->sel("in1"));
+    return inst->sel("out");
+  };
+  auto mux = [&](CoreIR::Wireable* sel, CoreIR::Wireable* if_false, CoreIR::Wireable* if_true) {
+    CoreIR::Wireable* inst = lb_def->addInstance(inst_name("mux"), gens["mux"], width_args);
+    lb_def->connect(if_false, inst->sel("in0"));
+    lb_def->connect(if_true, inst->sel("in1"));
+    lb_def->connect(sel, inst->sel("sel"));
+    return inst->sel("out");
+  };
+  // a register that only takes its input on writes
+  auto enabled_reg = [&](CoreIR::Wireable* in) {
+    CoreIR::Wireable* reg = lb_def->addInstance(inst_name("reg"), gens["reg"], width_args);
+    lb_def->connect(mux(lb_self->sel("wen"), reg->sel("out"), in), reg->sel("in"));
+    return reg->sel("out");
+  };
+
+  // the extent of each dimension, and the words in a row of each dimension
+  vector<CoreIR::Wireable*> extents(num_dims, NULL), rows(num_dims, NULL);
+  vector<int> max_rows(num_dims, 1);
+  for (size_t d = 0; d < num_dims; d++) {
+    if (runtime_extents[d]) {
+      extents[d] = lb_self->sel("extents")->sel(d);
+    }
+    if (d > 0) {
+      max_rows[d] = max_rows[d - 1] * image_dims[d - 1];
+      if (has_runtime_extent) {
+        CoreIR::Wireable* below = extents[d - 1] ? extents[d - 1] : constant(image_dims[d - 1]);
+        rows[d] = d == 1 ? below : binary("mul", rows[d - 1], below);
+      }
+    }
+  }
+
+  // delays the stream by a row of dimension d
+  auto delay_row = [&](CoreIR::Wireable* in, size_t d) {
+    int max_length = max_rows[d];
+    CoreIR::Wireable* length = rows[d];
+    if (use_sram) {
+      // read the word written a row ago at the address about to be written
+      CoreIR::Wireable* ram = lb_def->addInstance(inst_name("row_sram"), gens["ram2"],
+                                                  {{"width",CoreIR::Const::make(context,bitwidth)},
+                                                   {"depth",CoreIR::Const::make(context,max_length)}});
+      CoreIR::Wireable* addr = lb_def->addInstance(inst_name("row_addr"), config_counter_module());
+      CoreIR::Wireable* last = length ? binary("sub", length, constant(1)) : constant(max_length - 1);
+      lb_def->connect(constant(0), addr->sel("min"));
+      lb_def->connect(last, addr->sel("max"));
+      lb_def->connect(lb_self->sel("wen"), addr->sel("en"));
+      lb_def->connect(lb_self->sel("reset"), addr->sel("reset"));
+
+      // the read is registered, so it is issued for the next address
+      CoreIR::Wireable* wrapped = mux(binary("eq", addr->sel("out"), last),
+                                      binary("add", addr->sel("out"), constant(1)), constant(0));
+      CoreIR::Wireable* next = mux(lb_self->sel("reset"),
+                                   mux(lb_self->sel("wen"), addr->sel("out"), wrapped), constant(0));
+      CoreIR::Wireable* ren = lb_def->addInstance(inst_name("ren"), gens["bitconst"],
+                                                  {{"value",CoreIR::Const::make(context,true)}});
+      lb_def->connect(next, ram->sel("raddr"));
+      lb_def->connect(ren->sel("out"), ram->sel("ren"));
+      lb_def->connect(addr->sel("out"), ram->sel("waddr"));
+      lb_def->connect(in, ram->sel("wdata"));
+      lb_def->connect(lb_self->sel("wen"), ram->sel("wen"));
+      return ram->sel("rdata");
+    }
+
+    vector<CoreIR::Wireable*> stages = {in};
+    for (int i = 0; i < max_length; i++) {
+      stages.push_back(enabled_reg(stages.back()));
+    }
+    if (length == NULL) {
+      return stages.back();
+    }
+    // tap the chain at the configured row length
+    CoreIR::Wireable* out = stages[1];
+    for (int i = 2; i <= max_length; i++) {
+      out = mux(binary("eq", length, constant(i)), out, stages[i]);
+    }
+    return out;
+  };
+
+  // delay the stream by each row above dimension 0, and shift each of the
+  // delayed streams through the window in dimension 0
+  CoreIR::Wireable* word = lb_self->sel("in");
+  for (size_t d = 0; d < num_dims; d++) {
+    word = word->sel(0);
+  }
+  vector<int> position(num_dims);
+  std::function<void(int, CoreIR::Wireable*)> build_window = [&](int d, CoreIR::Wireable* stream) {
+    for (int k = 0; k < output_dims[d]; k++) {
+      position[d] = output_dims[d] - 1 - k;
+      if (d == 0) {
+        CoreIR::Wireable* out = lb_self->sel("out");
+        for (int i = num_dims - 1; i >= 0; i--) {
+          out = out->sel(position[i]);
+        }
+        lb_def->connect(stream, out);
+      } else {
+        build_window(d - 1, stream);
+      }
+      if (k + 1 < output_dims[d]) {
+        stream = d == 0 ? enabled_reg(stream) : delay_row(stream, d);
+      }
+    }
+  };
+  build_window(num_dims - 1, word);
+
+  // a window is valid once the write is at least size - 1 into each dimension
+  CoreIR::Wireable* count_en = lb_self->sel("wen");
+  CoreIR::Wireable* valid = lb_self->sel("wen");
+  for (size_t d = 0; d < num_dims; d++) {
+    string counter_name = "position_" + std::to_string(d);
+    CoreIR::Wireable* counter_inst;
+    if (runtime_extents[d]) {
+      counter_inst = lb_def->addInstance(counter_name, config_counter_module());
+      lb_def->connect(constant(0), counter_inst->sel("min"));
+      lb_def->connect(binary("sub", extents[d], constant(1)), counter_inst->sel("max"));
+    } else {
+      CoreIR::Values args = {{"width",CoreIR::Const::make(context,bitwidth)},
+                             {"min",CoreIR::Const::make(context,0)},
+                             {"max",CoreIR::Const::make(context,image_dims[d] - 1)},
+                             {"inc",CoreIR::Const::make(context,1)}};
+      counter_inst = lb_def->addInstance(counter_name, gens["counter"], args);
+    }
+    lb_def->connect(lb_self->sel("reset"), counter_inst->sel("reset"));
+    lb_def->connect(count_en, counter_inst->sel("en"));
 
+    if (output_dims[d] > 1) {
+      CoreIR::Wireable* inside = binary("uge", counter_inst->sel("out"), constant(output_dims[d] - 1));
+      CoreIR::Wireable* keep = lb_def->addInstance(counter_name + "_valid", gens["bitand"]);
+      lb_def->connect(valid, keep->sel("in0"));
+      lb_def->connect(inside, keep->sel("in1"));
+      valid = keep->sel("out");
+    }
+
+    if (d + 1 < num_dims) {
+      CoreIR::Wireable* next_en = lb_def->addInstance(counter_name + "_wrap", gens["bitand"]);
+      lb_def->connect(count_en, next_en->sel("in0"));
+      lb_def->connect(counter_inst->sel("overflow"), next_en->sel("in1"));
+      count_en = next_en->sel("out");
+    }
+  }
+  lb_def->connect(valid, lb_self->sel("valid"));
+
+  lb_module->setDef(lb_def);
+  return lb_module;
 }
 
 class RenameAllocation : public IRMutator2 {
@@ -1882,13 +2629,14 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::visit(const Allocate *op) {
          << print_name(alloc_name)
          << "[" << constant_size << "]; [alloc]\n";
 
-  auto alloc_type = identify_allocation(new_body, alloc_name);
-  
-  // define a rom that can be created and used later
-  // FIXME: better way to decide to use rom
+  // describe the allocation by how it is accessed, and let the buffer
+  // mapping decide what it is built from
+  HWBuffer buffer = allocation_hw_buffer(new_body, alloc_name, op->type, constant_size);
+  map_hw_buffer(buffer);
+  stream << "// hardware buffer " << buffer.name << " mapped to " << buffer.mapping << "\n";
+
   // FIXME: use an array of constants to load the rom
-  if (alloc_type == AllocationType::ROM_ALLOCATION &&
-      constant_size > 100) {
+  if (buffer.mapping == HWBufferMapping::ROM) {
     CoreIR_Inst_Args rom_args;
     rom_args.ref_name = alloc_name;
     rom_args.name = "rom_" + alloc_name;
@@ -1906,27 +2654,8 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::visit(const Allocate *op) {
     hw_def_set[alloc_name] = std::make_shared<CoreIR_Inst_Args>(rom_args);
     stream << "// created a rom called " << rom_args.name << "\n";
                     
-  } else if (alloc_type == AllocationType::RMW_ALLOCATION) {
-    CoreIR_Inst_Args rmw_args;
-    rmw_args.ref_name = alloc_name;
-    rmw_args.name = "rmw_" + alloc_name;
-    rmw_args.gen = gens["rmw"];
-    rmw_args.args = {{"width",CoreIR::Const::make(context,bitwidth)},
-                     {"depth",CoreIR::Const::make(context,constant_size)}};
-
-    // set initial values for rom
-    nlohmann::json jdata;
-    jdata["init"][0] = 0;
-    CoreIR::Values modparams = {{"init", CoreIR::Const::make(context, jdata)}};
-    rmw_args.genargs = modparams;
-    rmw_args.selname = "rdata";
-
-    hw_def_set[alloc_name] = std::make_shared<CoreIR_Inst_Args>(rmw_args);
-
-    stream << "// created a rmw histogram called " << alloc_name << "\n";
-    cout << "// created a rmw histogram called " << alloc_name << "\n";
-
-  } else if (alloc_type == AllocationType::SRAM_ALLOCATION) {
+  } else if (buffer.mapping == HWBufferMapping::SRAM) {
+    // read-modify-write buffers (e.g. histograms) share the same sram
     CoreIR_Inst_Args sram_args;
     sram_args.ref_name = alloc_name;
     sram_args.name = "sram_" + alloc_name;
@@ -1942,11 +2671,15 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::visit(const Allocate *op) {
     sram_args.selname = "rdata";
 
     hw_def_set[alloc_name] = std::make_shared<CoreIR_Inst_Args>(sram_args);
+    if (buffer.read_modify_write) {
+      rmw_buffers.insert(alloc_name);
+    }
 
     stream << "// created an sram allocation called " << alloc_name << "\n";
     cout << "// created an sram allocation called " << alloc_name << "\n";
 
   }
+  // wires and register files are built from the stores and loads themselves
   
   //  CoreIR::Type* type_input = context->Bit()->Arr(bitwidth)->Arr(constant_size);
   //  CoreIR::Wireable* wire_array = def->addInstance("array", gens["passthrough"], {{"type", CoreIR::Const::make(context,type_input)}});
@@ -2056,7 +2789,8 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::visit(const Call *op) {
 //
     
   } else if (op->name == "linebuffer") {
-    //IR: linebuffer(buffered.stencil_update.stream, buffered.stencil.stream, extent_0[, extent_1, ...])
+    //IR: linebuffer(buffered.stencil_update.stream, buffered.stencil.stream, extent_0[, extent_1, ...]
+    //               [, stride_0, ..., hold_0, ...])
     //C: linebuffer<extent_0[, extent_1, ...]>(buffered.stencil_update.stream, buffered.stencil.stream)
     internal_assert(op->args.size() >= 3);
     string a0 = print_expr(op->args[0]);
@@ -2066,13 +2800,24 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::visit(const Call *op) {
     const Variable *in_stencil_var = op->args[0].as<Variable>();
     Stencil_Type in_stencil_type = stencils.get(in_stencil_var->name);
 
+    uint num_dims = stencil_type.bounds.size();
+    internal_assert(op->args.size() == 2 + num_dims || op->args.size() == 2 + 3 * num_dims);
+    vector<int> strides(num_dims, 1), holds(num_dims, 1);
+    bool is_resampling = op->args.size() == 2 + 3 * num_dims;
+    if (is_resampling) {
+      for (uint i = 0; i < num_dims; i++) {
+        strides[i] = id_const_value(op->args[2 + num_dims + i]);
+        holds[i] = id_const_value(op->args[2 + 2 * num_dims + i]);
+      }
+    }
+
     stream << in_stencil_var->name << "\n";
 
     do_indent();
     stream << "linebuffer<";
-    for(size_t i = 2; i < op->args.size(); i++) {
-      stream << print_expr(op->args[i]);
-      if (i != op->args.size() -1)
+    for(size_t i = 2; i < 2 + num_dims; i++) {
+      stream << max_extent_value(op->args[i]);
+      if (i != 1 + num_dims)
         stream << ", ";
     }
     stream << ">(" << a0 << ", " << a1 << ");\n";
@@ -2083,9 +2828,17 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::visit(const Call *op) {
     string lb_out_name = print_name(a1);
 
     // add linebuffer to coreir
-    uint num_dims = op->args.size() - 2;
     string lb_name = "lb" + lb_in_name;
 
+    for (uint i = 0; i < num_dims; i++) {
+      // repeating windows would need the input stream to stall
+      user_assert(holds[i] == 1)
+        << "Linebuffer " << lb_name << " upsamples dimension " << i
+        << ", which the CoreIR backend does not support (only the Vivado HLS backend does).\n";
+      user_assert(strides[i] == 1 || has_valid)
+        << "Linebuffer " << lb_name << " downsamples, so it needs the coreir_valid target feature.\n";
+    }
+
     bool connected_wen = false;
     // FIXME: use proper bitwidth
     CoreIR::Type* input_type = context->BitIn()->Arr(bitwidth);
@@ -2114,24 +2867,121 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::visit(const Call *op) {
     stream << " image=";
     uint image_dims [num_dims];
     for (uint i=0; i<num_dims; ++i) {
-      image_dims[i] = id_const_value(id_const_value(op->args[i+2]));
+      // runtime extents are built for the largest frame
+      image_dims[i] = max_extent_value(op->args[i+2]);
       image_type = image_type->Arr(image_dims[i]);
       stream << image_dims[i] << " ";
     }
     stream << "\n";
 
-    CoreIR::Values lb_args = {{"input_type", CoreIR::Const::make(context,input_type)},
-                              {"output_type", CoreIR::Const::make(context,output_type)},
-                              {"image_type", CoreIR::Const::make(context,image_type)},
-                              {"has_valid",CoreIR::Const::make(context,has_valid)}};
-
-    CoreIR::Wireable* coreir_lb = def->addInstance(lb_name, gens["linebuffer"], lb_args);
+    // build the linebuffer from what its buffer maps to. single word
+    // streams are built here from register or sram delay lines, which also
+    // follow extents set at runtime; wide streams use the commonlib
+    // linebuffer, which keeps its rows in memories.
+    HWBuffer lb_buffer = linebuffer_hw_buffer(lb_name, Int(bitwidth),
+                                              vector<int>(input_dims, input_dims + num_dims),
+                                              vector<int>(output_dims, output_dims + num_dims),
+                                              vector<int>(image_dims, image_dims + num_dims),
+                                              strides, holds);
+    map_hw_buffer(lb_buffer);
+    stream << "// linebuffer mapped to " << lb_buffer.mapping << " with capacity " << lb_buffer.capacity << "\n";
+
+    bool single_word = true;
+    vector<bool> runtime_extents(num_dims);
+    bool has_runtime_extent = false;
+    for (uint i = 0; i < num_dims; i++) {
+      single_word = single_word && input_dims[i] == 1;
+      runtime_extents[i] = is_runtime_extent(op->args[i+2]);
+      has_runtime_extent = has_runtime_extent || runtime_extents[i];
+    }
+    if (has_runtime_extent) {
+      user_assert(!is_continuous)
+        << "Linebuffer " << lb_name << " has a runtime extent, which the coreir_continuous "
+        << "frame counters do not support yet.\n";
+      user_assert(single_word)
+        << "Linebuffer " << lb_name << " has a runtime extent, so its input has to be one "
+        << "pixel per cycle.\n";
+      user_assert(!is_resampling)
+        << "Linebuffer " << lb_name << " has a runtime extent, so it cannot resample.\n";
+    }
+
+    CoreIR::Wireable* coreir_lb;
+    if (single_word && (has_runtime_extent ||
+                        lb_buffer.mapping == HWBufferMapping::ShiftRegister ||
+                        lb_buffer.mapping == HWBufferMapping::Wires)) {
+      bool use_sram = lb_buffer.mapping == HWBufferMapping::SRAM;
+      CoreIR::Module* lb_module = linebuffer_module(lb_name, input_type, output_type,
+                                                    vector<int>(output_dims, output_dims + num_dims),
+                                                    vector<int>(image_dims, image_dims + num_dims),
+                                                    runtime_extents, use_sram);
+      coreir_lb = def->addInstance(lb_name, lb_module);
+      stream << "// linebuffer built from " << (use_sram ? "sram" : "register")
+             << " delay lines as " << lb_module->getName() << "\n";
+    } else {
+      CoreIR::Values lb_args = {{"input_type", CoreIR::Const::make(context,input_type)},
+                                {"output_type", CoreIR::Const::make(context,output_type)},
+                                {"image_type", CoreIR::Const::make(context,image_type)},
+                                {"has_valid",CoreIR::Const::make(context,has_valid)}};
+      coreir_lb = def->addInstance(lb_name, gens["linebuffer"], lb_args);
+    }
+    std::ostringstream lb_mapping;
+    lb_mapping << lb_buffer.mapping;
+    coreir_lb->getMetaData()["hw_buffer"]["mapping"] = lb_mapping.str();
+    coreir_lb->getMetaData()["hw_buffer"]["capacity"] = lb_buffer.capacity;
+    coreir_lb->getMetaData()["hw_buffer"]["banks"] = lb_buffer.num_banks;
+    coreir_lb->getMetaData()["hw_buffer"]["fetch_width"] = lb_buffer.fetch_width;
+    for (uint i = 0; i < num_dims; i++) {
+      if (runtime_extents[i]) {
+        // the extent of this dimension comes from its configuration register
+        Expr extent = op->args[i+2].as<Call>()->args[0];
+        def->connect(get_wire(print_expr(extent), extent), coreir_lb->sel("extents")->sel(i));
+        stream << "// linebuffer dimension " << i << " has runtime extent " << extent << "\n";
+      } else if (has_runtime_extent) {
+        CoreIR::Wireable* extent = def->addInstance(lb_name + "_extent_" + std::to_string(i), gens["const"],
+                                                    {{"width", CoreIR::Const::make(context,bitwidth)}},
+                                                    {{"value",CoreIR::Const::make(context,BitVector(bitwidth,image_dims[i]))}});
+        def->connect(extent->sel("out"), coreir_lb->sel("extents")->sel(i));
+      }
+    }
+    CoreIR::Wireable* lb_wen = coreir_lb->sel("wen");
     if (has_valid) {
       if (coreir_lb == NULL) {
         internal_assert(false) << "NULL LINEBUFFER before recording\n";
       }
+      CoreIR::Wireable* valid = coreir_lb->sel("valid");
+      if (is_continuous) {
+        // the write enable also drives the frame position counters
+        CoreIR::Wireable* wen_true = def->addInstance(lb_name + "_wen_true", gens["bitconst"],
+                                                      {{"value",CoreIR::Const::make(context,true)}});
+        CoreIR::Wireable* wen_buf = def->addInstance(lb_name + "_wen_buf", gens["bitand"]);
+        def->connect(wen_true->sel("out"), wen_buf->sel("in1"));
+        def->connect(wen_buf->sel("out"), coreir_lb->sel("wen"));
+        lb_wen = wen_buf->sel("in0");
+        valid = frame_linebuffer_valid(lb_name, coreir_lb, wen_buf->sel("out"),
+                                       vector<int>(input_dims, input_dims + num_dims),
+                                       vector<int>(output_dims, output_dims + num_dims),
+                                       vector<int>(image_dims, image_dims + num_dims));
+        stream << "// linebuffer valid limited to windows inside one frame\n";
+      }
+      if (is_resampling) {
+        // the linebuffer emits a window per input, and only every
+        // stride-th window goes on to the consumers
+        vector<int> windows(num_dims);
+        for (uint i = 0; i < num_dims; i++) {
+          windows[i] = (image_dims[i] - output_dims[i]) / input_dims[i] + 1;
+        }
+        valid = decimate_linebuffer_valid(lb_name, valid, windows, strides);
+        stream << "// linebuffer valid decimated by strides";
+        for (int stride : strides) {
+          stream << " " << stride;
+        }
+        stream << "\n";
+      }
+      if (valid != coreir_lb->sel("valid")) {
+        lb_valid_map[coreir_lb] = valid;
+      }
       record_linebuffer(lb_out_name, coreir_lb);
-      connected_wen = connect_linebuffer(lb_in_name, coreir_lb->sel("wen"));
+      connected_wen = connect_linebuffer(lb_in_name, lb_wen);
 
       def->connect({"self", "reset"}, {lb_name, "reset"});
     } else {
@@ -2146,8 +2996,8 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::visit(const Call *op) {
     def->connect(lb_in_wire, coreir_lb->sel("in"));
     add_wire(lb_out_name, coreir_lb->sel("out"));
     if (!connected_wen) {
-      CoreIR::Wireable* lb_wen = def->addInstance(lb_name+"_wen", gens["bitconst"], {{"value",CoreIR::Const::make(context,true)}});
-      def->connect(lb_wen->sel("out"), coreir_lb->sel("wen"));
+      CoreIR::Wireable* lb_wen_const = def->addInstance(lb_name+"_wen", gens["bitconst"], {{"value",CoreIR::Const::make(context,true)}});
+      def->connect(lb_wen_const->sel("out"), lb_wen);
     }
     //hw_wire_set[lb_out_name] = coreir_lb->sel("out");
 				
@@ -2227,7 +3077,13 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::visit(const Call *op) {
     }
 
     // generate coreir: wire with indices maybe
-    if (predicate) {
+    if (predicate && is_output(printed_stream_name)) {
+      // a sparse output is always wired to the port, and only marked valid
+      // in the cycles that send a record
+      string cond_id = print_expr(predicate->condition);
+      output_predicate = get_wire(cond_id, predicate->condition);
+      stream << "// output is only valid when " << cond_id << "\n";
+    } else if (predicate) {
       // FIXME: implement predicate
       stream << "// writing stream with a predicate\n";
     }
@@ -2442,10 +3298,18 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::visit(const Call *op) {
         
   } else if (op->name == "dispatch_stream") {
     //cout << "doing a dispatch\n";
-    // emits the calling arguments in comment
+    // emits the calling arguments in comment (runtime extents are only
+    // printed, so that no hardware is built for them here)
     vector<string> args(op->args.size());
-    for(size_t i = 0; i < op->args.size(); i++)
-      args[i] = print_expr(op->args[i]);
+    for(size_t i = 0; i < op->args.size(); i++) {
+      if (is_runtime_extent(op->args[i])) {
+        ostringstream arg;
+        arg << op->args[i];
+        args[i] = arg.str();
+      } else {
+        args[i] = print_expr(op->args[i]);
+      }
+    }
 
     do_indent();
     stream << "// dispatch_stream(";
@@ -2474,21 +3338,21 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::visit(const Call *op) {
     size_t num_of_demensions = *as_const_int(op->args[1]);
     vector<int> stencil_sizes(num_of_demensions);
     vector<int> stencil_steps(num_of_demensions);
-    vector<int> store_extents(num_of_demensions);
+    vector<Expr> store_extents(num_of_demensions);
 
     internal_assert(op->args.size() >= num_of_demensions*3 + 2);
     for (size_t i = 0; i < num_of_demensions; i++) {
       stencil_sizes[i] = *as_const_int(op->args[i*3 + 2]);
       stencil_steps[i] = *as_const_int(op->args[i*3 + 3]);
-      store_extents[i] = *as_const_int(op->args[i*3 + 4]);
+      store_extents[i] = op->args[i*3 + 4];
     }
 
     internal_assert(op->args.size() >= num_of_demensions*3 + 3);
     size_t num_of_consumers = *as_const_int(op->args[num_of_demensions*3 + 2]);
     vector<string> consumer_names(num_of_consumers);
     vector<int> consumer_fifo_depth(num_of_consumers);
-    vector<vector<int> > consumer_offsets(num_of_consumers);
-    vector<vector<int> > consumer_extents(num_of_consumers);
+    vector<vector<Expr> > consumer_offsets(num_of_consumers);
+    vector<vector<Expr> > consumer_extents(num_of_consumers);
 
     internal_assert(op->args.size() >= num_of_demensions*3 + 3 + num_of_consumers*(2 + 2*num_of_demensions));
     for (size_t i = 0; i < num_of_consumers; i++) {
@@ -2498,11 +3362,11 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::visit(const Call *op) {
       const IntImm *int_imm = op->args[num_of_demensions*3 + 4 + (2 + 2*num_of_demensions)*i].as<IntImm>();
       internal_assert(int_imm);
       consumer_fifo_depth[i] = int_imm->value;
-      vector<int> offsets(num_of_demensions);
-      vector<int > extents(num_of_demensions);
+      vector<Expr> offsets(num_of_demensions);
+      vector<Expr> extents(num_of_demensions);
       for (size_t j = 0; j < num_of_demensions; j++) {
-        offsets[j] = *as_const_int(op->args[num_of_demensions*3 + 5 + (2 + 2*num_of_demensions)*i + 2*j]);
-        extents[j] = *as_const_int(op->args[num_of_demensions*3 + 6 + (2 + 2*num_of_demensions)*i + 2*j]);
+        offsets[j] = op->args[num_of_demensions*3 + 5 + (2 + 2*num_of_demensions)*i + 2*j];
+        extents[j] = op->args[num_of_demensions*3 + 6 + (2 + 2*num_of_demensions)*i + 2*j];
       }
       consumer_offsets[i] = offsets;
       consumer_extents[i] = extents;
@@ -2560,7 +3424,7 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::visit(const Call *op) {
       do_indent();
       // HLS C: for(int dim = 0; dim <= store_extent - stencil.size; dim += stencil.step)
       stream << "for (int " << dim_name <<" = 0; "
-             << dim_name << " <= " << store_extents[i] - stencil_sizes[i] << "; "
+             << dim_name << " <= " << simplify(store_extents[i] - stencil_sizes[i]) << "; "
              << dim_name << " += " << stencil_steps[i] << ")\n";
 
     }
@@ -2589,7 +3453,7 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::visit(const Call *op) {
       for (size_t j = 0; j < num_of_demensions; j++) {
         string dim_name = "_dim_" + std::to_string(j);
         stream << dim_name << " >= " << consumer_offsets[i][j] << " && "
-               << dim_name << " <= " << consumer_offsets[i][j] + consumer_extents[i][j] - stencil_sizes[j];
+               << dim_name << " <= " << simplify(consumer_offsets[i][j] + consumer_extents[i][j] - stencil_sizes[j]);
         if (j != num_of_demensions - 1)
           stream << " && ";
       }
@@ -2602,10 +3466,20 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::visit(const Call *op) {
              << print_name(stencil_name) << ");\n";
       close_scope("");
 
-      // generate coreir
+      // generate coreir. a fifo in front of a linebuffered consumer becomes
+      // registers on its windows, and connect_linebuffer delays their valid
+      // to match. other fifo depths are only the HLS workaround above.
       string stream_in_name = print_name(stream_name);
       string stream_out_name = print_name(consumer_stream_name);
-      rename_wire(stream_out_name, stream_in_name, op->args[0]);
+      if (consumer_fifo_depth[i] > 0 && lb_map.count(stream_in_name) > 0 && !is_output(stream_out_name)) {
+        stream << "// " << stream_out_name << " goes through a fifo of depth " << consumer_fifo_depth[i] << "\n";
+        CoreIR::Wireable* delayed = add_delay(stream_out_name, get_wire(stream_in_name, op->args[0]),
+                                              consumer_fifo_depth[i], false);
+        add_wire(stream_out_name, delayed);
+        fifo_delays[print_name(consumer_names[i])] = consumer_fifo_depth[i];
+      } else {
+        rename_wire(stream_out_name, stream_in_name, op->args[0]);
+      }
       //def->connect({stream_in_name,"valid"}, {print_name(consumer_names[i]), "wen"});
 						
     }
@@ -2757,12 +3631,36 @@ void CodeGen_CoreIR_Target::CodeGen_CoreIR_C::visit(const Store *op) {
   if (is_const(op->index)) {
     string out_var = name + "_" + id_index;
     rename_wire(out_var, id_value, op->value);
+  } else if (is_defined(name) && hw_def_set[name]->gen==gens["ram2"] && rmw_buffers.count(name) > 0) {
+    get_wire(name, op->name); // creates the sram
+    auto reconnect = [&](string port, CoreIR::Wireable* wire) {
+      def->disconnect(get_wire(port, Expr()));
+      def->connect(get_wire(port, Expr()), wire);
+    };
+    CoreIR::Wireable* enable = loop_valid;
+    if (enable == NULL) {
+      enable = def->addInstance(unique_name(name + "_store_en"), gens["bitconst"],
+                                {{"value",CoreIR::Const::make(context,true)}})->sel("out");
+    }
+
+    if (loads_buffer(op->value, op->name)) {
+      // an update, written back to the address it was read from
+      stream << "// " << name << " updated by ram\n";
+      reconnect(name + "_wdata", get_wire(id_value, op->value));
+      reconnect(name + "_update_en", enable);
+    } else {
+      stream << "// " << name << " initialized by ram\n";
+      reconnect(name + "_init_addr", get_wire(id_index, op->index));
+      reconnect(name + "_init_data", get_wire(id_value, op->value));
+      reconnect(name + "_init_en", enable);
+    }
+
   } else if (is_defined(name) && hw_def_set[name]->gen==gens["ram2"]) {
     stream << "// " << name << " connected by ram\n";
     get_wire(name, op->name); // creates the sram
     def->disconnect(get_wire(name + "_wdata", Expr()));
-    def->disconnect(get_wire(name + "_waddr", Expr()));
     def->connect(get_wire(name + "_wdata", Expr()), get_wire(id_value, op->value));
+    def->disconnect(get_wire(name + "_waddr", Expr()));
     def->connect(get_wire(name + "_waddr", Expr()), get_wire(id_index, op->index));
   }
 
@@ -99,6 +99,7 @@ namespace Halide {
         // for coreir generation
         bool create_json = false;
         bool has_valid = false;
+        bool is_continuous = false;  // frames stream back to back without a reset
         uint8_t bitwidth;
         CoreIR::Context* context = NULL;
         CoreIR::Namespace* global_ns = NULL;
@@ -107,11 +108,44 @@ namespace Halide {
         CoreIR::Module* design = NULL;
         CoreIR::Wireable* self = NULL;
         const IfThenElse* predicate  = NULL;
+        // condition under which a sparse output sends a record
+        CoreIR::Wireable* output_predicate = NULL;
+        void gate_output_valid();
+
+        // each accelerator dag is built as its own module, and all of them
+        // are instanced in DesignTop once every kernel has been added
+        struct KernelModule {
+          std::string name;
+          CoreIR::Module* module;
+          // input port and the halide stream it reads
+          std::vector<std::pair<std::string, std::string>> inputs;
+          std::map<std::string, CoreIR::Type*> input_types;
+          std::string output;          // halide stream driven by the output port
+          CoreIR::Type* output_type;
+          // configuration port for each tap, written before streaming starts
+          std::vector<std::pair<std::string, CoreIR::Type*>> taps;
+        };
+        std::vector<KernelModule> kernel_modules;
+        void reset_kernel_state();
+        void compose_design_top();
+
+        // counter with bounds set at runtime, shared by every loop that needs one
+        CoreIR::Module* config_counter = NULL;
+        CoreIR::Module* config_counter_module();
+        CoreIR::Module* linebuffer_module(std::string lb_name,
+                                          CoreIR::Type* input_type,
+                                          CoreIR::Type* output_type,
+                                          const std::vector<int> &output_dims,
+                                          const std::vector<int> &image_dims,
+                                          const std::vector<bool> &runtime_extents,
+                                          bool use_sram);
 
         // keep track of coreir dag
         std::map<std::string,CoreIR::Wireable*> hw_wire_set;
         std::map<std::string,std::shared_ptr<Storage_Def>> hw_store_set;
         std::map<std::string,std::shared_ptr<CoreIR_Inst_Args>> hw_def_set;
+        // srams read and written at the same address by each update (e.g. histograms)
+        std::unordered_set<std::string> rmw_buffers;
         std::map<std::string,CoreIR::Wireable*> hw_input_set;
         std::unordered_set<std::string> hw_output_set;
 
@@ -119,9 +153,25 @@ namespace Halide {
         std::map<std::string, std::vector<std::string> > hw_dispatch_set;
         std::map<std::string, CoreIR::Wireable*> lb_map;          // lb name to lb wire
         std::map<std::string, CoreIR::Wireable*> lb_kernel_map;   // element in kernel to lb wire
+        std::map<CoreIR::Wireable*, CoreIR::Wireable*> lb_valid_map; // lb wire to its decimated valid
+        std::map<std::string, int> fifo_delays;                   // consumer to the fifo depth in front of it
+        CoreIR::Wireable* loop_valid = NULL;                      // enable of the innermost loop, NULL if always
         void record_dispatch(std::string producer_name, std::string consumer_name);
         void record_linebuffer(std::string producer_name, CoreIR::Wireable* wire);
+        CoreIR::Wireable* linebuffer_valid(CoreIR::Wireable* lb_wire);
+        CoreIR::Wireable* decimate_linebuffer_valid(std::string lb_name, CoreIR::Wireable* valid,
+                                                    const std::vector<int> &windows,
+                                                    const std::vector<int> &strides);
+        CoreIR::Wireable* stride_phase_aligned(std::string counter_name, CoreIR::Wireable* en,
+                                               CoreIR::Wireable* row_end, int stride);
+        CoreIR::Wireable* frame_linebuffer_valid(std::string lb_name, CoreIR::Wireable* lb_wire,
+                                                 CoreIR::Wireable* wen,
+                                                 const std::vector<int> &input_dims,
+                                                 const std::vector<int> &output_dims,
+                                                 const std::vector<int> &image_dims);
+        CoreIR::Wireable* add_delay(std::string name, CoreIR::Wireable* in_wire, int stages, bool is_bit);
         bool connect_linebuffer(std::string consumer_name, CoreIR::Wireable* consumer_wen_wire);
+        void tag_kernel_instances(std::string kernel_name);
 
         // coreir methods to wire things together
         bool is_const(const Expr e);
@@ -133,6 +183,8 @@ namespace Halide {
 
         int id_const_value(const Expr e);
         CoreIR::Wireable* get_wire(std::string name, Expr e, std::vector<uint> indices={});
+        CoreIR::Wireable* add_rmw_forwarding(std::string name, std::string inst_name, CoreIR::Wireable* ram,
+                                             int depth);
         void rename_wire(std::string new_name, std::string in_name, Expr in_expr, std::vector<uint> indices={});
         void add_wire(std::string name, CoreIR::Wireable* wire, std::vector<uint> indices={});
 
@@ -159,7 +159,11 @@ bool function_takes_user_context(const std::string &name) {
         "halide_error",
         "halide_free",
         "halide_malloc",
+        "halide_pool_free",
+        "halide_pool_malloc",
         "halide_print",
+        "halide_profiler_instance_end",
+        "halide_profiler_instance_start",
         "halide_profiler_memory_allocate",
         "halide_profiler_memory_free",
         "halide_profiler_pipeline_start",
@@ -183,8 +183,10 @@ CodeGen_Posix::Allocation CodeGen_Posix::create_allocation(const std::string &na
             allocation.ptr = codegen(new_expr);
         } else {
             // call malloc
-            llvm::Function *malloc_fn = module->getFunction("halide_malloc");
-            internal_assert(malloc_fn) << "Could not find halide_malloc in module\n";
+            const string malloc_function =
+                target.has_feature(Target::PoolAllocator) ? "halide_pool_malloc" : "halide_malloc";
+            llvm::Function *malloc_fn = module->getFunction(malloc_function);
+            internal_assert(malloc_fn) << "Could not find " << malloc_function << " in module\n";
             #if LLVM_VERSION < 50
             malloc_fn->setDoesNotAlias(0);
             #else
@@ -195,7 +197,7 @@ CodeGen_Posix::Allocation CodeGen_Posix::create_allocation(const std::string &na
             ++arg_iter;  // skip the user context *
             llvm_size = builder->CreateIntCast(llvm_size, arg_iter->getType(), false);
 
-            debug(4) << "Creating call to halide_malloc for allocation " << name
+            debug(4) << "Creating call to " << malloc_function << " for allocation " << name
                      << " of size " << type.bytes();
             for (Expr e : extents) {
                 debug(4) << " x " << e;
@@ -228,7 +230,7 @@ CodeGen_Posix::Allocation CodeGen_Posix::create_allocation(const std::string &na
 
         // Register a destructor for this allocation.
         if (free_function.empty()) {
-            free_function = "halide_free";
+            free_function = target.has_feature(Target::PoolAllocator) ? "halide_pool_free" : "halide_free";
         }
         llvm::Function *free_fn = module->getFunction(free_function);
         internal_assert(free_fn) << "Could not find " << free_function << " in module.\n";
@@ -3,6 +3,7 @@
 
 #include "CodeGen_VHLS_Base.h"
 #include "CodeGen_Internal.h"
+#include "StreamOpt.h"
 #include "Substitute.h"
 #include "IROperator.h"
 #include "Param.h"
@@ -20,6 +21,20 @@ using std::vector;
 using std::ostringstream;
 using std::to_string;
 
+namespace {
+
+// The HLS linebuffer and dispatcher are sized by template arguments, so the
+// frame size cannot change after synthesis.
+void check_constant_extents(const Call *op) {
+    for (const Expr &arg : op->args) {
+        user_assert(!is_runtime_extent(arg))
+            << op->name << " has the runtime extent " << arg << ", which the Vivado HLS "
+            << "backend does not support. Use constant tile sizes, or the CoreIR backend.\n";
+    }
+}
+
+}  // namespace
+
 string CodeGen_VHLS_Base::print_stencil_type(Stencil_Type stencil_type) {
     ostringstream oss;
     // C: Stencil<uint16_t, 1, 1, 1> stencil_var;
@@ -85,17 +100,39 @@ string CodeGen_VHLS_Base::print_stencil_pragma(const string &name) {
 
 void CodeGen_VHLS_Base::visit(const Call *op) {
   if (op->name == "linebuffer") {
-        //IR: linebuffer(buffered.stencil_update.stream, buffered.stencil.stream, extent_0[, extent_1, ...])
+        //IR: linebuffer(buffered.stencil_update.stream, buffered.stencil.stream, extent_0[, extent_1, ...]
+        //               [, stride_0, ..., hold_0, ...])
         //C: linebuffer<extent_0[, extent_1, ...]>(buffered.stencil_update.stream, buffered.stencil.stream)
         internal_assert(op->args.size() >= 3);
+        check_constant_extents(op);
         string a0 = print_expr(op->args[0]);
         string a1 = print_expr(op->args[1]);
+        const Variable *out_stream_var = op->args[1].as<Variable>();
+        internal_assert(out_stream_var && stencils.contains(out_stream_var->name));
+        size_t num_dims = stencils.get(out_stream_var->name).bounds.size();
         do_indent();
-        stream << "linebuffer<";
-        for(size_t i = 2; i < op->args.size(); i++) {
-            stream << print_expr(op->args[i]);
-            if (i != op->args.size() -1)
-                stream << ", ";
+        if (op->args.size() == 2 + 3 * num_dims) {
+            // IR: linebuffer(..., extent_0, ..., stride_0, ..., hold_0, ...)
+            // C: linebuffer_resample<extent_0, .., extent_3, stride_0, .., stride_3, hold_0, .., hold_3>(...)
+            stream << "linebuffer_resample<";
+            for (size_t group = 0; group < 3; group++) {
+                for (size_t i = 0; i < 4; i++) {
+                    if (i < num_dims) {
+                        stream << print_expr(op->args[2 + group * num_dims + i]);
+                    } else {
+                        stream << "1";
+                    }
+                    if (group != 2 || i != 3)
+                        stream << ", ";
+                }
+            }
+        } else {
+            stream << "linebuffer<";
+            for(size_t i = 2; i < op->args.size(); i++) {
+                stream << print_expr(op->args[i]);
+                if (i != op->args.size() -1)
+                    stream << ", ";
+            }
         }
         stream << ">(" << a0 << ", " << a1 << ");\n";
         id = "0"; // skip evaluation
@@ -200,6 +237,7 @@ void CodeGen_VHLS_Base::visit(const Call *op) {
 
         print_assignment(op->type, rhs.str());
     } else if (op->name == "dispatch_stream") {
+        check_constant_extents(op);
         // emits the calling arguments in comment
         vector<string> args(op->args.size());
         for(size_t i = 0; i < op->args.size(); i++)
@@ -222,7 +260,8 @@ void CodeGen_VHLS_Base::visit(const Call *op) {
         //                   consumer_0_name, fifo_0_depth,
         //                   consumer_0_offset_dim_0, consumer_0_extent_dim_0,
         //                   [consumer_0_offset_dim_1, consumer_0_extent_dim_1, ...]
-        //                   [consumer_1_name, ...])
+        //                   [consumer_1_name, ...]
+        //                   [hold_dim_0, hold_dim_1, ...])
 
         // recover the structed data from op->args
         internal_assert(op->args.size() >= 2);
@@ -266,6 +305,15 @@ void CodeGen_VHLS_Base::visit(const Call *op) {
             consumer_extents[i] = extents;
         }
 
+        // an upsampling linebuffer repeats each window 'hold' times
+        vector<int> holds(num_of_demensions, 1);
+        size_t holds_begin = num_of_demensions*3 + 3 + num_of_consumers*(2 + 2*num_of_demensions);
+        if (op->args.size() == holds_begin + num_of_demensions) {
+            for (size_t i = 0; i < num_of_demensions; i++) {
+                holds[i] = *as_const_int(op->args[holds_begin + i]);
+            }
+        }
+
         // emits declarations of streams for each consumer
         internal_assert(stencils.contains(stream_name));
         Stencil_Type stream_type = stencils.get(stream_name);
@@ -303,6 +351,13 @@ void CodeGen_VHLS_Base::visit(const Call *op) {
             stream << "for (int " << dim_name <<" = 0; "
                    << dim_name << " <= " << store_extents[i] - stencil_sizes[i] << "; "
                    << dim_name << " += " << stencil_steps[i] << ")\n";
+            if (holds[i] > 1) {
+                string hold_name = "_hold_" + to_string(i);
+                do_indent();
+                stream << "for (int " << hold_name << " = 0; "
+                       << hold_name << " < " << holds[i] << "; "
+                       << hold_name << "++)\n";
+            }
         }
         open_scope();
         // pragma
@@ -127,6 +127,8 @@ void CodeGen_VHLS_Testbench::visit(const Call *op) {
             rhs << "subimage_to_stream(";
         } else if (direction->value == "stream_to_buffer") {
             rhs << "stream_to_subimage(";
+        } else if (direction->value == "records_to_buffer") {
+            rhs << "records_to_subimage(";
         } else {
             internal_error;
         }
@@ -194,7 +196,8 @@ void CodeGen_VHLS_Testbench::visit(const Block *op) {
     }
     if (call->name == "stream_subimage") {
         const StringImm *direction = call->args[0].as<StringImm>();
-        if (direction->value == "stream_to_buffer") {
+        if (direction->value == "stream_to_buffer" ||
+            direction->value == "records_to_buffer") {
             internal_assert(op->rest.defined());
             op->rest.accept(this);
             op->first.accept(this);
@@ -0,0 +1,758 @@
+#include "EmulateHWStreams.h"
+#include "Debug.h"
+#include "IRMutator.h"
+#include "IROperator.h"
+#include "IRVisitor.h"
+#include "Scope.h"
+#include "Simplify.h"
+#include "StreamOpt.h"
+
+#include <functional>
+
+namespace Halide {
+namespace Internal {
+
+using std::function;
+using std::string;
+using std::vector;
+
+namespace {
+
+// Hardware fifo depths count cycles of latency. On the CPU a deeper fifo lets
+// the tasks on either side run further ahead between synchronizations.
+const int min_fifo_depth = 64;
+
+// Waiting on a semaphore runs a parallel task, which costs far more than
+// moving a stencil, so each side of a fifo takes up to this many slots
+// from its semaphore at once, and the reader frees slots this many at a
+// time. The fifo gets this many extra slots to make up for the ones the
+// reader holds on to.
+const int fifo_block = 16;
+
+// The entries of <name>.pos.
+enum FifoPos {
+    WritePos,
+    ReadPos,
+    WriteCredits,  // free slots the writer has taken and not yet filled
+    ReadCredits,   // filled slots the reader has taken and not yet read
+    ReadDone,      // slots read but not yet freed
+    NumFifoPos
+};
+
+// The emulation sizes everything from the runtime value of an extent, so the
+// declared maximum is not needed.
+Expr runtime_value(Expr e) {
+    if (is_runtime_extent(e)) {
+        return e.as<Call>()->args[0];
+    }
+    return e;
+}
+
+int const_value(Expr e) {
+    const int64_t *value = as_const_int(e);
+    internal_assert(value) << "expected a constant, got " << e << "\n";
+    return (int)*value;
+}
+
+string stream_name_of(Expr e) {
+    const Variable *var = e.as<Variable>();
+    internal_assert(var) << "expected a stream or a stencil, got " << e << "\n";
+    return var->name;
+}
+
+// Row major index of idx in a box of the given extents, dim 0 innermost.
+Expr flatten(const vector<Expr> &idx, const vector<Expr> &extents) {
+    internal_assert(idx.size() == extents.size());
+    Expr flat = 0;
+    for (size_t i = idx.size(); i > 0; i--) {
+        flat = flat * extents[i - 1] + idx[i - 1];
+    }
+    return simplify(flat);
+}
+
+Expr product(const vector<Expr> &extents) {
+    Expr p = 1;
+    for (const Expr &e : extents) {
+        p = p * e;
+    }
+    return simplify(p);
+}
+
+Expr semaphore_var(const string &name) {
+    return Variable::make(type_of<halide_semaphore_t *>(), name);
+}
+
+// Declare a semaphore on the stack, in the same form InitializeSemaphores
+// gives the semaphores of async producers.
+Stmt make_semaphore(const string &name, Expr count, Stmt body) {
+    Expr init = Call::make(Int(32), "halide_semaphore_init", {semaphore_var(name), count}, Call::Extern);
+    Expr space = Call::make(type_of<halide_semaphore_t *>(), Call::alloca,
+                            {(int)sizeof(halide_semaphore_t)}, Call::Intrinsic);
+    return LetStmt::make(name, space, Block::make(Evaluate::make(init), body));
+}
+
+// A nest of loops over the box [0, extents), dim 0 innermost, around the
+// body made from the loop variables.
+Stmt loop_nest(const string &prefix, const vector<Expr> &extents,
+               function<Stmt(const vector<Expr> &)> make_body) {
+    vector<string> names;
+    vector<Expr> idx;
+    for (size_t i = 0; i < extents.size(); i++) {
+        names.push_back(unique_name(prefix + "." + std::to_string(i)));
+        idx.push_back(Variable::make(Int(32), names.back()));
+    }
+    Stmt s = make_body(idx);
+    for (size_t i = 0; i < extents.size(); i++) {
+        s = For::make(names[i], 0, extents[i], ForType::Serial, DeviceAPI::None, s);
+    }
+    return s;
+}
+
+// A bounded single producer, single consumer queue of stencils. The
+// elements live in <name>.slots, <name>.pos holds the positions and
+// counts in FifoPos, and the semaphores count the free and the filled
+// slots.
+struct Fifo {
+    string name;
+    Type type;
+    vector<Expr> shape;  // extent of each dimension of one element
+    Expr depth;
+
+    Expr words() const {
+        return product(shape);
+    }
+
+    Expr slots() const {
+        return simplify(depth + fifo_block);
+    }
+
+    Expr load_pos(FifoPos i) const {
+        return Load::make(Int(32), name + ".pos", (int)i, Buffer<>(), Parameter(), const_true());
+    }
+
+    Stmt store_pos(FifoPos i, Expr value) const {
+        return Store::make(name + ".pos", value, (int)i, Parameter(), const_true());
+    }
+
+    // When the credits counted in pos are used up, take a block from the
+    // semaphore if it has one, else whatever it has, and only wait if it
+    // has nothing.
+    Stmt take_credits(const string &semaphore, FifoPos credits) const {
+        auto try_acquire = [&](int n) {
+            return Call::make(Bool(), "halide_semaphore_try_acquire",
+                              {semaphore_var(semaphore), n}, Call::Extern);
+        };
+        Stmt wait = Acquire::make(semaphore_var(semaphore), 1, store_pos(credits, 1));
+        Stmt take = IfThenElse::make(try_acquire(1), store_pos(credits, 1), wait);
+        take = IfThenElse::make(try_acquire(fifo_block), store_pos(credits, fifo_block), take);
+        Stmt use = store_pos(credits, load_pos(credits) - 1);
+        return Block::make(IfThenElse::make(load_pos(credits) == 0, take), use);
+    }
+
+    // Push one element, blocking while the fifo is full. Filled slots are
+    // released one at a time, so the reader never waits on an element that
+    // has already been written.
+    Stmt push(function<Expr(const vector<Expr> &)> value) const {
+        string slot = unique_name(name + ".slot");
+        Expr slot_var = Variable::make(Int(32), slot);
+        Stmt copy = loop_nest(name + ".w", shape, [&](const vector<Expr> &idx) {
+            return Store::make(name + ".slots", value(idx), slot_var * words() + flatten(idx, shape),
+                               Parameter(), const_true());
+        });
+        Stmt advance = store_pos(WritePos, (slot_var + 1) % slots());
+        Stmt release = Evaluate::make(Call::make(Int(32), "halide_semaphore_release",
+                                                 {semaphore_var(name + ".data"), 1}, Call::Extern));
+        Stmt body = LetStmt::make(slot, load_pos(WritePos), Block::make({copy, advance, release}));
+        return Block::make(take_credits(name + ".space", WriteCredits), body);
+    }
+
+    // Pop one element, blocking while the fifo is empty.
+    Stmt pop(function<Stmt(const vector<Expr> &, Expr)> use) const {
+        string slot = unique_name(name + ".slot");
+        Expr slot_var = Variable::make(Int(32), slot);
+        Stmt copy = loop_nest(name + ".r", shape, [&](const vector<Expr> &idx) {
+            Expr value = Load::make(type, name + ".slots", slot_var * words() + flatten(idx, shape),
+                                    Buffer<>(), Parameter(), const_true());
+            return use(idx, value);
+        });
+        Stmt advance = store_pos(ReadPos, (slot_var + 1) % slots());
+        Stmt release = Evaluate::make(Call::make(Int(32), "halide_semaphore_release",
+                                                 {semaphore_var(name + ".space"), fifo_block}, Call::Extern));
+        Stmt done = Block::make(store_pos(ReadDone, 0), release);
+        Stmt free = Block::make(store_pos(ReadDone, load_pos(ReadDone) + 1),
+                                IfThenElse::make(load_pos(ReadDone) == fifo_block, done));
+        Stmt body = LetStmt::make(slot, load_pos(ReadPos), Block::make({copy, advance, free}));
+        return Block::make(take_credits(name + ".data", ReadCredits), body);
+    }
+
+    Stmt allocate(Stmt body) const {
+        vector<Stmt> init;
+        for (int i = 0; i < NumFifoPos; i++) {
+            init.push_back(store_pos((FifoPos)i, 0));
+        }
+        body = Block::make(Block::make(init), body);
+        body = Allocate::make(name + ".pos", Int(32), MemoryType::Auto, {NumFifoPos}, const_true(), body);
+        body = Allocate::make(name + ".slots", type, MemoryType::Auto, {slots(), words()}, const_true(), body);
+        body = make_semaphore(name + ".data", 0, body);
+        body = make_semaphore(name + ".space", slots(), body);
+        return body;
+    }
+};
+
+// The arguments of a dispatch_stream call (see create_dispatch_call in
+// StreamOpt.cpp).
+struct DispatchArgs {
+    string stream;
+    vector<Expr> size, step, extent, hold;
+    struct Consumer {
+        string name;
+        int depth;
+        vector<Expr> offset, extent;
+    };
+    vector<Consumer> consumers;
+
+    DispatchArgs(const Call *op) {
+        stream = stream_name_of(op->args[0]);
+        int dims = const_value(op->args[1]);
+        size_t arg = 2;
+        for (int i = 0; i < dims; i++) {
+            size.push_back(op->args[arg++]);
+            step.push_back(op->args[arg++]);
+            extent.push_back(runtime_value(op->args[arg++]));
+        }
+        int num_consumers = const_value(op->args[arg++]);
+        for (int c = 0; c < num_consumers; c++) {
+            Consumer consumer;
+            const StringImm *name = op->args[arg++].as<StringImm>();
+            internal_assert(name);
+            consumer.name = name->value;
+            consumer.depth = const_value(op->args[arg++]);
+            for (int i = 0; i < dims; i++) {
+                consumer.offset.push_back(runtime_value(op->args[arg++]));
+                consumer.extent.push_back(runtime_value(op->args[arg++]));
+            }
+            consumers.push_back(consumer);
+        }
+        for (int i = 0; i < dims; i++) {
+            hold.push_back(arg < op->args.size() ? op->args[arg++] : Expr(1));
+        }
+        internal_assert(arg == op->args.size()) << "malformed dispatch_stream of " << stream << "\n";
+    }
+
+    Expr windows(size_t i) const {
+        return simplify((extent[i] - size[i]) / step[i] + 1);
+    }
+
+    // The number of windows read from the stream, repeats included.
+    Expr num_windows() const {
+        Expr n = 1;
+        for (size_t i = 0; i < size.size(); i++) {
+            n = n * windows(i) * hold[i];
+        }
+        return simplify(n);
+    }
+
+    static string fifo_name(const string &stream, const string &consumer) {
+        return stream + ".to." + consumer;
+    }
+};
+
+class FindDispatch : public IRVisitor {
+    using IRVisitor::visit;
+
+    void visit(const Call *op) override {
+        IRVisitor::visit(op);
+        if (op->name == "dispatch_stream" && stream_name_of(op->args[0]) == stream) {
+            result = op;
+        }
+    }
+
+    const string &stream;
+
+public:
+    const Call *result = nullptr;
+    FindDispatch(const string &s) : stream(s) {}
+};
+
+bool is_stream_process(const ProducerConsumer *op) {
+    // the scan loops of a kernel are produced into its output stream
+    return op->is_producer && ends_with(op->name, ".stream");
+}
+
+bool is_stream_process(const Call *op) {
+    return (op->name == "linebuffer" ||
+            op->name == "dispatch_stream" ||
+            op->name == "stream_subimage");
+}
+
+class HasStreamProcess : public IRVisitor {
+    using IRVisitor::visit;
+
+    void visit(const ProducerConsumer *op) override {
+        if (is_stream_process(op)) {
+            result = true;
+        } else {
+            IRVisitor::visit(op);
+        }
+    }
+
+    void visit(const Call *op) override {
+        result = result || is_stream_process(op);
+        IRVisitor::visit(op);
+    }
+
+public:
+    bool result = false;
+};
+
+bool has_stream_process(Stmt s) {
+    HasStreamProcess has;
+    s.accept(&has);
+    return has.result;
+}
+
+// The kernels, linebuffers and dispatchers of an accelerator all run at once
+// in hardware. Turn the blocks that sequence them into forks, so each becomes
+// a task that blocks on its fifos instead of on the statement before it.
+class ForkStreamProcesses : public IRMutator2 {
+    using IRMutator2::visit;
+
+    Stmt visit(const ProducerConsumer *op) override {
+        if (is_stream_process(op)) {
+            return op;
+        }
+        return IRMutator2::visit(op);
+    }
+
+    Stmt visit(const Block *op) override {
+        Stmt first = mutate(op->first);
+        Stmt rest = mutate(op->rest);
+        if (has_stream_process(first) && has_stream_process(rest)) {
+            return Fork::make(first, rest);
+        }
+        return Block::make(first, rest);
+    }
+};
+
+class EmulateStreams : public IRMutator2 {
+    using IRMutator2::visit;
+
+    Scope<Fifo> fifos;
+    Scope<vector<Expr>> stencils;
+
+    Fifo stream_fifo(const string &name, Type t, const Region &bounds, Expr depth) {
+        Fifo f;
+        f.name = name;
+        f.type = t;
+        for (const Range &r : bounds) {
+            internal_assert(is_zero(r.min));
+            f.shape.push_back(r.extent);
+        }
+        f.depth = simplify(max(depth, min_fifo_depth));
+        return f;
+    }
+
+    Stmt visit(const Realize *op) override {
+        if (ends_with(op->name, ".stream")) {
+            internal_assert(op->types.size() == 1);
+            vector<Fifo> created;
+            created.push_back(stream_fifo(op->name, op->types[0], op->bounds, 1));
+
+            // the dispatcher of the stream feeds a fifo per consumer
+            FindDispatch dispatch(op->name);
+            op->body.accept(&dispatch);
+            if (dispatch.result) {
+                DispatchArgs args(dispatch.result);
+                for (const auto &c : args.consumers) {
+                    Expr depth = c.depth;
+                    if (args.consumers.size() > 1) {
+                        // Unlike the hardware linebuffers, the emulation stalls
+                        // when a fifo is full, so the consumers of a fork in
+                        // the dataflow must be able to fall a frame apart.
+                        depth = max(depth, args.num_windows());
+                    }
+                    created.push_back(stream_fifo(DispatchArgs::fifo_name(op->name, c.name),
+                                                  op->types[0], op->bounds, depth));
+                }
+            }
+
+            for (const Fifo &f : created) {
+                fifos.push(f.name, f);
+            }
+            Stmt body = mutate(op->body);
+            for (auto it = created.rbegin(); it != created.rend(); it++) {
+                fifos.pop(it->name);
+                body = it->allocate(body);
+            }
+            return body;
+
+        } else if (ends_with(op->name, ".stencil") || ends_with(op->name, ".stencil_update")) {
+            internal_assert(op->types.size() == 1);
+            vector<Expr> extents;
+            for (const Range &r : op->bounds) {
+                internal_assert(is_zero(r.min));
+                extents.push_back(r.extent);
+            }
+            stencils.push(op->name, extents);
+            Stmt body = mutate(op->body);
+            stencils.pop(op->name);
+            return Allocate::make(op->name, op->types[0], op->memory_type, extents, const_true(), body);
+
+        } else {
+            return IRMutator2::visit(op);
+        }
+    }
+
+    Stmt visit(const Provide *op) override {
+        if (!stencils.contains(op->name)) {
+            return IRMutator2::visit(op);
+        }
+        internal_assert(op->values.size() == 1);
+        vector<Expr> args;
+        for (const Expr &e : op->args) {
+            args.push_back(mutate(e));
+        }
+        return Store::make(op->name, mutate(op->values[0]), flatten(args, stencils.get(op->name)),
+                           Parameter(), const_true());
+    }
+
+    Expr visit(const Call *op) override {
+        if (!stencils.contains(op->name)) {
+            return IRMutator2::visit(op);
+        }
+        vector<Expr> args;
+        for (const Expr &e : op->args) {
+            args.push_back(mutate(e));
+        }
+        return Load::make(op->type, op->name, flatten(args, stencils.get(op->name)),
+                          Buffer<>(), Parameter(), const_true());
+    }
+
+    Stmt visit(const Evaluate *op) override {
+        const Call *call = op->value.as<Call>();
+        if (!call) {
+            return IRMutator2::visit(op);
+        } else if (call->name == "write_stream") {
+            return write_stream(call);
+        } else if (call->name == "read_stream") {
+            return read_stream(call);
+        } else if (call->name == "linebuffer") {
+            return linebuffer(call);
+        } else if (call->name == "dispatch_stream") {
+            return dispatch_stream(call);
+        } else if (call->name == "stream_subimage") {
+            return stream_subimage(call);
+        } else if (call->name == "buffer_to_stencil") {
+            return buffer_to_stencil(call);
+        } else {
+            return IRMutator2::visit(op);
+        }
+    }
+
+    Fifo get_fifo(const string &name) {
+        internal_assert(fifos.contains(name)) << "no fifo for stream " << name << "\n";
+        return fifos.get(name);
+    }
+
+    vector<Expr> get_stencil(const string &name) {
+        internal_assert(stencils.contains(name)) << "no realization of stencil " << name << "\n";
+        return stencils.get(name);
+    }
+
+    // write_stream(stream, stencil[, loop_var, loop_max, ...])
+    Stmt write_stream(const Call *op) {
+        Fifo f = get_fifo(stream_name_of(op->args[0]));
+        string stencil = stream_name_of(op->args[1]);
+        vector<Expr> extents = get_stencil(stencil);
+        internal_assert(extents.size() == f.shape.size());
+        return f.push([&](const vector<Expr> &idx) {
+            return Load::make(f.type, stencil, flatten(idx, extents), Buffer<>(), Parameter(), const_true());
+        });
+    }
+
+    // read_stream(stream, stencil[, consumer])
+    Stmt read_stream(const Call *op) {
+        string name = stream_name_of(op->args[0]);
+        if (op->args.size() == 3) {
+            const StringImm *consumer = op->args[2].as<StringImm>();
+            internal_assert(consumer);
+            string consumer_fifo = DispatchArgs::fifo_name(name, consumer->value);
+            if (fifos.contains(consumer_fifo)) {
+                name = consumer_fifo;
+            }
+        }
+        Fifo f = get_fifo(name);
+        string stencil = stream_name_of(op->args[1]);
+        vector<Expr> extents = get_stencil(stencil);
+        internal_assert(extents.size() == f.shape.size());
+        return f.pop([&](const vector<Expr> &idx, Expr value) {
+            return Store::make(stencil, value, flatten(idx, extents), Parameter(), const_true());
+        });
+    }
+
+    // linebuffer(update_stream, stream, extent_0, ..., [stride_0, ..., hold_0, ...])
+    //
+    // The updates arrive in raster order. The linebuffer keeps a circular
+    // buffer of rows along the outermost dimension that is streamed in
+    // more than one update, and after each row of updates it emits every
+    // window whose last row has arrived.
+    Stmt linebuffer(const Call *op) {
+        Fifo in = get_fifo(stream_name_of(op->args[0]));
+        Fifo out = get_fifo(stream_name_of(op->args[1]));
+        size_t dims = in.shape.size();
+        internal_assert(out.shape.size() == dims);
+        internal_assert(op->args.size() == 2 + dims || op->args.size() == 2 + 3 * dims);
+
+        vector<Expr> extent, stride(dims, 1), hold(dims, 1), step, size, window_step, windows;
+        for (size_t i = 0; i < dims; i++) {
+            extent.push_back(runtime_value(op->args[2 + i]));
+            if (op->args.size() == 2 + 3 * dims) {
+                stride[i] = op->args[2 + dims + i];
+                hold[i] = op->args[2 + 2 * dims + i];
+            }
+            step.push_back(in.shape[i]);
+            size.push_back(out.shape[i]);
+            window_step.push_back(simplify(step[i] * stride[i]));
+            windows.push_back(simplify((extent[i] - size[i]) / window_step[i] + 1));
+        }
+
+        int k = (int)dims - 1;
+        while (k > 0 && can_prove(extent[k] == step[k])) {
+            k--;
+        }
+        for (size_t i = k + 1; i < dims; i++) {
+            user_assert(can_prove(windows[i] * hold[i] == 1))
+                << "Cannot emulate the linebuffer of " << out.name
+                << ", which repeats a whole frame along dimension " << i << ".\n";
+        }
+
+        // the rows of dimension k that are live at once
+        Expr rows = simplify(size[k] + step[k]);
+        string storage = out.name + ".linebuffer";
+        vector<Expr> storage_extents = extent;
+        storage_extents[k] = rows;
+        auto storage_index = [&](vector<Expr> coord) {
+            coord[k] = coord[k] % rows;
+            return flatten(coord, storage_extents);
+        };
+
+        string row = unique_name(out.name + ".row");
+        Expr row_var = Variable::make(Int(32), row);
+
+        // read a row of updates
+        vector<Expr> updates;
+        for (size_t i = 0; i < dims; i++) {
+            updates.push_back((int)i == k ? Expr(1) : simplify(extent[i] / step[i]));
+        }
+        Stmt fill = loop_nest(out.name + ".update", updates, [&](const vector<Expr> &u) {
+            return in.pop([&](const vector<Expr> &idx, Expr value) {
+                vector<Expr> coord;
+                for (size_t i = 0; i < dims; i++) {
+                    Expr base = (int)i == k ? row_var : u[i];
+                    coord.push_back(base * step[i] + idx[i]);
+                }
+                return Store::make(storage, value, storage_index(coord), Parameter(), const_true());
+            });
+        });
+
+        // emit the windows that end in that row, repeating each as it is held
+        vector<string> window_names, hold_names;
+        vector<Expr> w;
+        for (size_t i = 0; i < dims; i++) {
+            window_names.push_back(unique_name(out.name + ".window." + std::to_string(i)));
+            hold_names.push_back(unique_name(out.name + ".hold." + std::to_string(i)));
+            w.push_back(Variable::make(Int(32), window_names.back()));
+        }
+        Stmt emit = out.push([&](const vector<Expr> &idx) {
+            vector<Expr> coord;
+            for (size_t i = 0; i < dims; i++) {
+                coord.push_back(w[i] * window_step[i] + idx[i]);
+            }
+            return Load::make(out.type, storage, storage_index(coord), Buffer<>(), Parameter(), const_true());
+        });
+        for (size_t i = 0; i < dims; i++) {
+            if (!is_one(hold[i])) {
+                emit = For::make(hold_names[i], 0, hold[i], ForType::Serial, DeviceAPI::None, emit);
+            }
+            emit = For::make(window_names[i], 0, windows[i], ForType::Serial, DeviceAPI::None, emit);
+            if ((int)i == k) {
+                Expr last_row = (w[k] * window_step[k] + size[k] + step[k] - 1) / step[k] - 1;
+                const For *loop = emit.as<For>();
+                Stmt body = IfThenElse::make(last_row == row_var, loop->body);
+                emit = For::make(loop->name, loop->min, loop->extent, loop->for_type, loop->device_api, body);
+            }
+        }
+
+        Stmt s = For::make(row, 0, simplify(extent[k] / step[k]), ForType::Serial, DeviceAPI::None,
+                           Block::make(fill, emit));
+        return Allocate::make(storage, out.type, MemoryType::Auto, storage_extents, const_true(), s);
+    }
+
+    // Read each window of the stream and copy it to the fifos of the
+    // consumers whose region it falls in.
+    Stmt dispatch_stream(const Call *op) {
+        DispatchArgs args(op);
+        Fifo in = get_fifo(args.stream);
+        size_t dims = args.size.size();
+        string window = in.name + ".dispatched";
+
+        vector<string> window_names, hold_names;
+        vector<Expr> w;
+        for (size_t i = 0; i < dims; i++) {
+            window_names.push_back(unique_name(in.name + ".window." + std::to_string(i)));
+            hold_names.push_back(unique_name(in.name + ".hold." + std::to_string(i)));
+            w.push_back(Variable::make(Int(32), window_names.back()));
+        }
+
+        vector<Stmt> body;
+        body.push_back(in.pop([&](const vector<Expr> &idx, Expr value) {
+            return Store::make(window, value, flatten(idx, in.shape), Parameter(), const_true());
+        }));
+        for (const auto &c : args.consumers) {
+            Fifo out = get_fifo(DispatchArgs::fifo_name(args.stream, c.name));
+            Expr in_region = const_true();
+            for (size_t i = 0; i < dims; i++) {
+                Expr pos = w[i] * args.step[i];
+                in_region = in_region && pos >= c.offset[i] && pos <= c.offset[i] + c.extent[i] - args.size[i];
+            }
+            Stmt push = out.push([&](const vector<Expr> &idx) {
+                return Load::make(in.type, window, flatten(idx, in.shape), Buffer<>(), Parameter(), const_true());
+            });
+            body.push_back(IfThenElse::make(simplify(in_region), push));
+        }
+
+        Stmt s = Block::make(body);
+        for (size_t i = 0; i < dims; i++) {
+            if (!is_one(args.hold[i])) {
+                s = For::make(hold_names[i], 0, args.hold[i], ForType::Serial, DeviceAPI::None, s);
+            }
+            s = For::make(window_names[i], 0, args.windows(i), ForType::Serial, DeviceAPI::None, s);
+        }
+        return Allocate::make(window, in.type, MemoryType::Auto, in.shape, const_true(), s);
+    }
+
+    // stream_subimage(direction, buffer_var, stream_var, address_of_subimage_origin,
+    //                 dim_0_stride, dim_0_extent, ...)
+    //
+    // The origin is the host address of a call to the function at the corner
+    // of the subimage, so the elements are read or written through that call.
+    Stmt stream_subimage(const Call *op) {
+        const StringImm *direction = op->args[0].as<StringImm>();
+        Fifo f = get_fifo(stream_name_of(op->args[2]));
+        const Call *host = op->args[3].as<Call>();
+        internal_assert(direction && host && host->name == Call::buffer_get_host);
+        const Call *origin = host->args[0].as<Call>();
+        internal_assert(origin && origin->call_type == Call::Halide);
+        if (direction->value == "records_to_buffer") {
+            return records_to_buffer(op, f, origin);
+        }
+
+        size_t dims = (op->args.size() - 4) / 2;
+        internal_assert(dims == f.shape.size() && dims == origin->args.size());
+        vector<Expr> elements;
+        for (size_t i = 0; i < dims; i++) {
+            Expr extent = runtime_value(op->args[5 + 2 * i]);
+            elements.push_back(simplify(extent / f.shape[i]));
+        }
+
+        auto coords = [&](const vector<Expr> &p, const vector<Expr> &idx) {
+            vector<Expr> coord;
+            for (size_t i = 0; i < dims; i++) {
+                coord.push_back(simplify(origin->args[i] + p[i] * f.shape[i] + idx[i]));
+            }
+            return coord;
+        };
+
+        return loop_nest(f.name + ".element", elements, [&](const vector<Expr> &p) {
+            if (direction->value == "buffer_to_stream") {
+                return f.push([&](const vector<Expr> &idx) {
+                    return Call::make(origin->type, origin->name, coords(p, idx), origin->call_type,
+                                      origin->func, origin->value_index, origin->image, origin->param);
+                });
+            } else {
+                internal_assert(direction->value == "stream_to_buffer");
+                return f.pop([&](const vector<Expr> &idx, Expr value) {
+                    return Provide::make(origin->name, {value}, coords(p, idx));
+                });
+            }
+        });
+    }
+
+    // The stream of a sparse output carries (coordinates..., value) records
+    // of the nonzero pixels, and always the last pixel. Zero the subimage,
+    // then scatter the records into it until the last pixel arrives.
+    Stmt records_to_buffer(const Call *op, const Fifo &f, const Call *origin) {
+        size_t dims = (op->args.size() - 4) / 2;
+        internal_assert(f.shape.size() == 1 && dims == origin->args.size());
+        vector<Expr> extents;
+        for (size_t i = 0; i < dims; i++) {
+            extents.push_back(runtime_value(op->args[5 + 2 * i]));
+        }
+
+        Stmt zero = loop_nest(f.name + ".zero", extents, [&](const vector<Expr> &idx) {
+            vector<Expr> coord;
+            for (size_t i = 0; i < dims; i++) {
+                coord.push_back(simplify(origin->args[i] + idx[i]));
+            }
+            return Provide::make(origin->name, {make_zero(f.type)}, coord);
+        });
+
+        string record = f.name + ".record";
+        string done = f.name + ".done";
+        auto field = [&](int i) {
+            return Load::make(f.type, record, i, Buffer<>(), Parameter(), const_true());
+        };
+        Stmt pop = f.pop([&](const vector<Expr> &idx, Expr value) {
+            return Store::make(record, value, idx[0], Parameter(), const_true());
+        });
+        vector<Expr> coord;
+        Expr last = const_true();
+        for (size_t i = 0; i < dims; i++) {
+            Expr c = cast<int>(field(i));
+            coord.push_back(simplify(origin->args[i] + c));
+            last = last && (c == extents[i] - 1);
+        }
+        Stmt scatter = Provide::make(origin->name, {field(dims)}, coord);
+        Stmt mark = Store::make(done, select(last, 1, 0), 0, Parameter(), const_true());
+        Expr waiting = Load::make(Int(32), done, 0, Buffer<>(), Parameter(), const_true()) == 0;
+        Stmt receive = IfThenElse::make(waiting, Block::make({pop, scatter, mark}));
+
+        // there is at most one record per pixel
+        Stmt loop = For::make(unique_name(f.name + ".records"), 0, product(extents),
+                              ForType::Serial, DeviceAPI::None, receive);
+        Stmt s = Block::make({zero, Store::make(done, 0, 0, Parameter(), const_true()), loop});
+        s = Allocate::make(done, Int(32), MemoryType::Auto, {1}, const_true(), s);
+        return Allocate::make(record, f.type, MemoryType::Auto, f.shape, const_true(), s);
+    }
+
+    // buffer_to_stencil(buffer_var, stencil_var)
+    Stmt buffer_to_stencil(const Call *op) {
+        const Variable *buffer = op->args[0].as<Variable>();
+        internal_assert(buffer);
+        string stencil = stream_name_of(op->args[1]);
+        vector<Expr> extents = get_stencil(stencil);
+        Parameter param = buffer->param;
+        user_assert(param.defined())
+            << "Cannot emulate the tap " << stencil << ", which is not an input buffer.\n";
+        return loop_nest(stencil + ".tap", extents, [&](const vector<Expr> &idx) {
+            vector<Expr> coord;
+            for (size_t i = 0; i < idx.size(); i++) {
+                Expr min = Variable::make(Int(32), param.name() + ".min." + std::to_string(i), param);
+                coord.push_back(min + idx[i]);
+            }
+            return Store::make(stencil, Call::make(param, coord), flatten(idx, extents),
+                               Parameter(), const_true());
+        });
+    }
+};
+
+}  // namespace
+
+Stmt emulate_hw_streams(Stmt s) {
+    s = ForkStreamProcesses().mutate(s);
+    s = EmulateStreams().mutate(s);
+    return s;
+}
+
+}  // namespace Internal
+}  // namespace Halide
@@ -0,0 +1,26 @@
+#ifndef HALIDE_EMULATE_HW_STREAMS_H
+#define HALIDE_EMULATE_HW_STREAMS_H
+
+/** \file
+ *
+ * Defines the pass that runs the streams of a hardware accelerator on the CPU
+ */
+
+#include "IR.h"
+
+namespace Halide {
+namespace Internal {
+
+/** Lower the read_stream, write_stream, linebuffer, dispatch_stream and
+ * stream_subimage intrinsics inserted by stream_opt to code that runs on the
+ * CPU. Every stream becomes a bounded fifo guarded by semaphores, linebuffers
+ * keep a circular window of rows, and the kernels, linebuffers and
+ * dispatchers of an accelerator run as concurrent tasks. The result is a
+ * functional model of the streamed dataflow that any CPU backend can compile.
+ */
+Stmt emulate_hw_streams(Stmt s);
+
+}
+}
+
+#endif
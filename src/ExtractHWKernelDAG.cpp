@@ -194,12 +194,19 @@ bool operator==(const StencilDimSpecs &left, const StencilDimSpecs &right) {
     return left.loop_var == right.loop_var &&
         is_one(simplify(left.min_pos == right.min_pos)) &&
         left.size == right.size &&
-        left.step == right.step;
+        left.step == right.step &&
+        left.rate == right.rate &&
+        left.hold == right.hold;
 }
 
 ostream &operator<<(ostream &out, const StencilDimSpecs &dim) {
     out << "[" << dim.min_pos << ", "
-        << dim.size << ", looping "<< dim.loop_var << " step " << dim.step << "]"
+        << dim.size << ", looping "<< dim.loop_var << " step " << dim.step;
+    if (dim.rate != 1)
+        out << " rate " << dim.rate;
+    if (dim.hold != 1)
+        out << " hold " << dim.hold;
+    out << "]"
         << " over " << "[" << dim.store_bound.min << ", " << dim.store_bound.max << "]\n";
     return out;
 }
@@ -234,6 +241,27 @@ ostream &operator<<(ostream &out, const set<T> &s) {
     return out;
 }
 
+int HWKernel::window_stride(size_t dim) const {
+    int stride = 1;
+    for (auto it = consumer_stencils.begin(); it != consumer_stencils.end(); ++it) {
+        int consumer_stride = dims[dim].rate / it->second[dim].rate;
+        user_assert(it == consumer_stencils.begin() || consumer_stride == stride)
+            << "The consumers of " << name << " are downsampling it by different factors.\n";
+        stride = consumer_stride;
+    }
+    return stride;
+}
+
+int HWKernel::window_hold(size_t dim) const {
+    int hold = 1;
+    for (auto it = consumer_stencils.begin(); it != consumer_stencils.end(); ++it) {
+        user_assert(it == consumer_stencils.begin() || it->second[dim].hold == hold)
+            << "The consumers of " << name << " are upsampling it by different factors.\n";
+        hold = it->second[dim].hold;
+    }
+    return hold;
+}
+
 ostream &operator<<(ostream &out, const HWKernel &k) {
     out << "HWKernel " << k.name << " takes inputs " << k.input_streams << "\n";
     if(k.is_inlined) {
@@ -259,6 +287,9 @@ ostream &operator<<(ostream &out, const HWTap &t) {
     return out;
 }
 
+// largest upsampling factor recognized by extract_stencil_specs
+const int max_stencil_hold = 16;
+
 vector<StencilDimSpecs>
 extract_stencil_specs(Box box, const set<string> &scan_loops,
                       const Scope<Expr> &stencil_bounds,
@@ -289,6 +320,19 @@ extract_stencil_specs(Box box, const set<string> &scan_loops,
               dim_specs.loop_var = scan_loop;
               Expr step = simplify(finite_difference(min, dim_specs.loop_var));
               const IntImm *step_int = step.as<IntImm>();
+              if (!step_int) {
+                  // An upsampling consumer (e.g. f(x/2)) moves the window
+                  // once every few iterations; find how many.
+                  Expr loop_var = Variable::make(Int(32), scan_loop);
+                  for (int hold = 2; hold <= max_stencil_hold && !step_int; hold++) {
+                      Expr held_min = substitute(scan_loop, loop_var * hold, min);
+                      step = simplify(finite_difference(held_min, scan_loop));
+                      step_int = step.as<IntImm>();
+                      if (step_int) {
+                          dim_specs.hold = hold;
+                      }
+                  }
+              }
               internal_assert(step_int) << scan_loop << " stencil window step is not a const." << "\n" << step << "\n";
               dim_specs.step = step_int->value;
               break;
@@ -316,6 +360,7 @@ merge_consumer_stencils(map<string, vector<StencilDimSpecs> > &consumer_stencils
         dim_specs.step = first_stencil[i].step;
         dim_specs.min_pos = first_stencil[i].min_pos;
         dim_specs.loop_var = first_stencil[i].loop_var;
+        dim_specs.hold = first_stencil[i].hold;
         for (const auto& p : consumer_stencils) {
             internal_assert(p.second.size() == num_of_dims);
             const StencilDimSpecs &consumer_dim = p.second[i];
@@ -325,6 +370,8 @@ merge_consumer_stencils(map<string, vector<StencilDimSpecs> > &consumer_stencils
             internal_assert(consumer_dim.loop_var == dim_specs.loop_var);
             internal_assert(dim_specs.loop_var == "undef"
                             || consumer_dim.step == dim_specs.step); // step is valid only if loop_var is not "undef"
+            user_assert(consumer_dim.hold == dim_specs.hold)
+                << "The consumers of a hardware kernel upsample it by different factors.\n";
 
             // compute the max size of the stencil window
             dim_specs.size = dim_specs.size > consumer_dim.size ? dim_specs.size :
@@ -382,6 +429,58 @@ merge_consumer_stencils(map<string, vector<StencilDimSpecs> > &consumer_stencils
     return res;
 }
 
+// Figure out the rate of a buffered kernel, and turn the holds of its consumer
+// stencils (which are counted in iterations of the loop vars) into the number
+// of consumer iterations that reuse each window. All consumers of the kernel
+// must already be in the dag.
+void calculate_rates(HWKernel &kernel, const HWKernelDAG &dag, const HWKernel &output) {
+    // the output kernel advances by one update per iteration
+    map<string, int> output_steps;
+    for (const StencilDimSpecs &dim : output.dims) {
+        if (dim.loop_var != "undef") {
+            output_steps[dim.loop_var] = dim.step;
+        }
+    }
+
+    for (auto &p : kernel.consumer_stencils) {
+        internal_assert(dag.kernels.count(p.first));
+        const HWKernel &consumer = dag.kernels.find(p.first)->second;
+        for (StencilDimSpecs &dim : p.second) {
+            for (const StencilDimSpecs &consumer_dim : consumer.dims) {
+                if (dim.loop_var != "undef" && consumer_dim.loop_var == dim.loop_var) {
+                    user_assert(dim.hold % consumer_dim.hold == 0)
+                        << "Cannot upsample " << kernel.name << " for " << consumer.name
+                        << " along " << dim.loop_var << ".\n";
+                    dim.hold /= consumer_dim.hold;
+                    dim.rate = consumer_dim.rate;
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < kernel.dims.size(); i++) {
+        StencilDimSpecs &dim = kernel.dims[i];
+        if (dim.loop_var == "undef" || dim.hold != 1 || !output_steps.count(dim.loop_var)) {
+            continue;
+        }
+        // A kernel that moves faster than the output is split into updates
+        // of the output step, e.g. the input of a 2x downsample produces
+        // two updates per output pixel instead of one update of two pixels.
+        int output_step = output_steps[dim.loop_var];
+        if (dim.step > output_step && dim.step % output_step == 0) {
+            dim.rate = dim.step / output_step;
+        }
+        for (const auto &p : kernel.consumer_stencils) {
+            const StencilDimSpecs &consumer_dim = p.second[i];
+            user_assert(dim.rate % consumer_dim.rate == 0 &&
+                        consumer_dim.step % consumer_dim.rate == 0)
+                << "Cannot resample " << kernel.name << " (rate " << dim.rate
+                << ") for " << p.first << " (rate " << consumer_dim.rate
+                << ") along " << dim.loop_var << ".\n";
+        }
+    }
+}
+
 // Build calculate the input streams for each HWKernel in dag
 void calculate_input_streams(HWKernelDAG &dag) {
     for (auto &p : dag.kernels) {
@@ -431,6 +530,22 @@ class BuildDAGForFunction : public IRVisitor {
             scan_loops.insert(op->name);
             loop_mins[op->name] = op->min;
             loop_maxes[op->name] = simplify(op->min + op->extent - 1);
+
+            if (!is_const(op->extent)) {
+                // the extent is set at runtime, and the hardware is built
+                // for the largest one
+                string var = op->name.substr(op->name.rfind('.') + 1);
+                const auto &max_extents = func.schedule().max_extents();
+                user_assert(max_extents.count(var))
+                    << "Accelerator loop " << op->name << " has the symbolic extent " << op->extent
+                    << ". Declare its largest value with " << func.name() << ".hw_max_extent("
+                    << var << ", ...).\n";
+                const Variable *extent_var = op->extent.as<Variable>();
+                user_assert(extent_var)
+                    << "The extent " << op->extent << " of accelerator loop " << op->name
+                    << " has to be a single variable (e.g. a Param) to be set at runtime.\n";
+                dag.max_extents[extent_var->name] = max_extents.at(var);
+            }
         }
         if (store_level.match(op->name)) {
             is_scan_loops = true;
@@ -618,6 +733,8 @@ class BuildDAGForFunction : public IRVisitor {
                     cur_kernel.dims = merge_consumer_stencils(cur_kernel.consumer_stencils);
 
                     if (!cur_kernel.is_inlined) {
+                        calculate_rates(cur_kernel, dag, dag.kernels[func.name()]);
+
                         // check consistency between min_pos and store_bounds.min
                         // TODO bring this check to a more expressive level
                         for (size_t i = 0; i < cur_kernel.dims.size(); i++) {
@@ -51,6 +51,19 @@ struct StencilDimSpecs {
     Expr min_pos; // stencil origin position w.r.t. the original image buffer
     std::string loop_var;  // outer loop var that shifts this dimensions
     Interval store_bound;
+
+    // Multi-rate pipelines (image pyramids). A kernel upstream of a
+    // downsample produces its step in 'rate' updates per iteration of
+    // loop_var, so that it runs at one update per cycle like the input.
+    // For a consumer stencil, 'rate' is the rate of the consumer.
+    int rate = 1;
+    // Zero-order hold of upsampling. For a kernel, the number of iterations
+    // of loop_var that share one update; for a consumer stencil, the number
+    // of consecutive consumer iterations that reuse each window.
+    int hold = 1;
+
+    /** Size of the update stencil produced in one cycle. */
+    int update_step() const { return step / rate; }
 };
 
 struct HWKernel {
@@ -66,6 +79,12 @@ struct HWKernel {
     HWKernel() : is_inlined(false), is_output(false) {}
     HWKernel(Function f, const std::string &s)
         : func(f), name(s), is_inlined(false), is_output(false) {}
+
+    /** Update stencils between two windows sent to the consumers in dimension
+     * dim, i.e. the decimation done by the linebuffer of this kernel. */
+    int window_stride(size_t dim) const;
+    /** Number of times the linebuffer repeats each window in dimension dim. */
+    int window_hold(size_t dim) const;
 };
 
 struct HWTap {
@@ -83,6 +102,7 @@ struct HWKernelDAG {
     std::set<std::string> input_kernels;
     std::set<std::string> loop_vars;   // FIXME we use loop_vars name to figure out the location to start Stream transformation. Need better way.
     LoopLevel compute_level, store_level;
+    std::map<std::string, int> max_extents;  // symbolic scan loop extent -> its declared maximum
 };
 
 std::ostream &operator<<(std::ostream &out, const HWKernel &k);
@@ -2603,6 +2603,19 @@ Func &Func::fifo_depth(Func consumer, int depth) {
     return *this;
 }
 
+Func &Func::hw_max_extent(Var var, int max_extent) {
+    invalidate_cache();
+    user_assert(max_extent > 0) << "Maximum extent must be greater than zero.\n";
+    func.schedule().max_extents()[var.name()] = max_extent;
+    return *this;
+}
+
+Func &Func::sparse_output() {
+    invalidate_cache();
+    func.schedule().is_sparse_output() = true;
+    return *this;
+}
+
 Func &Func::compute_inline() {
     return compute_at(LoopLevel::inlined());
 }
@@ -2613,12 +2626,24 @@ Func &Func::trace_loads() {
     return *this;
 }
 
+Func &Func::trace_loads(const TraceFilter &filter) {
+    invalidate_cache();
+    func.trace_loads(filter);
+    return *this;
+}
+
 Func &Func::trace_stores() {
     invalidate_cache();
     func.trace_stores();
     return *this;
 }
 
+Func &Func::trace_stores(const TraceFilter &filter) {
+    invalidate_cache();
+    func.trace_stores(filter);
+    return *this;
+}
+
 Func &Func::trace_realizations() {
     invalidate_cache();
     func.trace_realizations();
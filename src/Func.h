@@ -2282,6 +2282,22 @@ public:
      */
     Func &fifo_depth(Func consumer, int depth);
 
+    /** Declare the largest extent of the loop over var in an accelerated
+     * function. The loop may then have a symbolic extent (e.g. a tile
+     * size given by a Param); the hardware is sized for max_extent, and
+     * the actual extent is set through a configuration register.
+     */
+    Func &hw_max_extent(Var var, int max_extent);
+
+    /** Only send the nonzero pixels of this accelerator output back to
+     * the host, as records of their coordinates and value. The host
+     * fills in the rest of the output with zeros, so the result is the
+     * same as the dense output. This suits detectors (e.g. corners) that
+     * are zero almost everywhere. The output must be produced one pixel
+     * at a time.
+     */
+    Func &sparse_output();
+
     /** Aggressively inline all uses of this function. This is the
      * default schedule, so you're unlikely to need to call this. For
      * a Func with an update definition, that means it gets computed
@@ -2324,11 +2340,26 @@ public:
      * effect. */
     Func &trace_loads();
 
+    /** Trace the loads from this Func that pass the given filter. See
+     * TraceFilter. */
+    Func &trace_loads(const TraceFilter &filter);
+
     /** Trace all stores to the buffer backing this Func by emitting
      * calls to halide_trace. If the Func is inlined, this call
      * has no effect. */
     Func &trace_stores();
 
+    /** Trace the stores to this Func that pass the given filter. For
+     * example, to trace one in every 16 stores to a 64x64 tile:
+     \code
+     TraceFilter filter;
+     filter.sample_every = 16;
+     filter.region = {{0, 64}, {0, 64}};
+     f.trace_stores(filter);
+     \endcode
+     */
+    Func &trace_stores(const TraceFilter &filter);
+
     /** Trace all realizations of this Func by emitting calls to
      * halide_trace. */
     Func &trace_realizations();
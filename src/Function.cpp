@@ -88,6 +88,7 @@ struct FunctionContents {
     Expr extern_proxy_expr;
 
     bool trace_loads = false, trace_stores = false, trace_realizations = false;
+    TraceFilter trace_load_filter, trace_store_filter;
     std::vector<string> trace_tags;
 
     bool frozen = false;
@@ -130,6 +131,17 @@ struct FunctionContents {
                 }
             }
         }
+
+        for (const TraceFilter *filter : {&trace_load_filter, &trace_store_filter}) {
+            for (const auto &r : filter->region) {
+                if (r.first.defined()) {
+                    r.first.accept(visitor);
+                }
+                if (r.second.defined()) {
+                    r.second.accept(visitor);
+                }
+            }
+        }
     }
 
     // Pass an IRMutator2 through to all Exprs referenced in the FunctionContents
@@ -151,6 +163,17 @@ struct FunctionContents {
             }
             extern_proxy_expr = mutator->mutate(extern_proxy_expr);
         }
+
+        for (TraceFilter *filter : {&trace_load_filter, &trace_store_filter}) {
+            for (auto &r : filter->region) {
+                if (r.first.defined()) {
+                    r.first = mutator->mutate(r.first);
+                }
+                if (r.second.defined()) {
+                    r.second = mutator->mutate(r.second);
+                }
+            }
+        }
     }
 };
 
@@ -341,6 +364,8 @@ void Function::deep_copy(FunctionPtr copy, DeepCopyMap &copied_map) const {
     copy->trace_loads = contents->trace_loads;
     copy->trace_stores = contents->trace_stores;
     copy->trace_realizations = contents->trace_realizations;
+    copy->trace_load_filter = contents->trace_load_filter;
+    copy->trace_store_filter = contents->trace_store_filter;
     copy->trace_tags = contents->trace_tags;
     copy->frozen = contents->frozen;
     copy->output_buffers = contents->output_buffers;
@@ -896,11 +921,43 @@ std::string &Function::debug_file() {
     return contents->debug_file;
 }
 
-void Function::trace_loads() {
+namespace {
+void check_trace_filter(const TraceFilter &filter, int dimensions, const string &name) {
+    user_assert(filter.sample_every >= 1)
+        << "Func " << name << " can't trace one in every "
+        << filter.sample_every << " sites.\n";
+    user_assert((int)filter.region.size() <= dimensions)
+        << "Trace filter region for Func " << name << " has "
+        << filter.region.size() << " dimensions, but the Func only has "
+        << dimensions << ".\n";
+    for (const auto &r : filter.region) {
+        user_assert(!r.first.defined() || r.first.type().is_int())
+            << "Trace filter region for Func " << name << " has non-integer min "
+            << r.first << ".\n";
+        user_assert(!r.second.defined() || r.second.type().is_int())
+            << "Trace filter region for Func " << name << " has non-integer extent "
+            << r.second << ".\n";
+    }
+}
+}  // namespace
+
+void Function::trace_loads(const TraceFilter &filter) {
+    check_trace_filter(filter, dimensions(), name());
     contents->trace_loads = true;
+    contents->trace_load_filter = filter;
+    if (filter.aggregate) {
+        // The aggregates are kept per consumption of the Func.
+        contents->trace_realizations = true;
+    }
 }
-void Function::trace_stores() {
+void Function::trace_stores(const TraceFilter &filter) {
+    check_trace_filter(filter, dimensions(), name());
     contents->trace_stores = true;
+    contents->trace_store_filter = filter;
+    if (filter.aggregate) {
+        // The aggregates are kept per production of the Func.
+        contents->trace_realizations = true;
+    }
 }
 void Function::trace_realizations() {
     contents->trace_realizations = true;
@@ -918,6 +975,12 @@ bool Function::is_tracing_stores() const {
 bool Function::is_tracing_realizations() const {
     return contents->trace_realizations;
 }
+const TraceFilter &Function::get_trace_load_filter() const {
+    return contents->trace_load_filter;
+}
+const TraceFilter &Function::get_trace_store_filter() const {
+    return contents->trace_store_filter;
+}
 const std::vector<std::string> &Function::get_trace_tags() const {
     return contents->trace_tags;
 }
@@ -57,6 +57,32 @@ enum class NameMangling {
     CPlusPlus, ///< C++ name mangling
 };
 
+/** Limits on which loads or stores of a Func get traced, to keep the
+ * traces of large pipelines to a manageable size. Loads and stores
+ * that are filtered out don't call halide_trace at all. A vector load
+ * or store is traced in full if any of its lanes passes the filter. */
+struct TraceFilter {
+    /** Only trace one in this many sites. The sites are picked by
+     * hashing their coordinates, so the same ones get traced on every
+     * run, and on every thread. */
+    int sample_every = 1;
+
+    /** If not empty, only trace sites inside this box, given as the
+     * min and extent of the leading dimensions of the Func. */
+    std::vector<std::pair<Expr, Expr>> region;
+
+    /** Instead of tracing each value, have the default trace handler
+     * keep the count, min and max of the values of each production
+     * (or consumption) of the Func, and emit them as a trace tag
+     * event when it ends. Implies trace_realizations. */
+    bool aggregate = false;
+
+    /** Check if this filter lets everything through. */
+    bool is_trivial() const {
+        return sample_every == 1 && region.empty() && !aggregate;
+    }
+};
+
 namespace Internal {
 
 struct Call;
@@ -275,13 +301,15 @@ public:
     /** Tracing calls and accessors, passed down from the Func
      * equivalents. */
     // @{
-    void trace_loads();
-    void trace_stores();
+    void trace_loads(const TraceFilter &filter = TraceFilter());
+    void trace_stores(const TraceFilter &filter = TraceFilter());
     void trace_realizations();
     void add_trace_tag(const std::string &trace_tag);
     bool is_tracing_loads() const;
     bool is_tracing_stores() const;
     bool is_tracing_realizations() const;
+    const TraceFilter &get_trace_load_filter() const;
+    const TraceFilter &get_trace_store_filter() const;
     const std::vector<std::string> &get_trace_tags() const;
     // @}
 
@@ -0,0 +1,343 @@
+#include "HWBuffer.h"
+#include "Debug.h"
+#include "ExprUsesVar.h"
+#include "IREquality.h"
+#include "IROperator.h"
+#include "IRVisitor.h"
+#include "Simplify.h"
+#include "Substitute.h"
+
+namespace Halide {
+namespace Internal {
+
+using std::string;
+using std::vector;
+
+namespace {
+
+int product(const vector<int> &v) {
+    int p = 1;
+    for (int e : v) {
+        p *= e;
+    }
+    return p;
+}
+
+// Raster order walk over an image, advancing by step in each dimension and
+// covering a block of words per access.
+AccessPattern raster_pattern(const vector<int> &step, const vector<int> &block,
+                             const vector<int> &image) {
+    AccessPattern p;
+    int words_below = 1;
+    for (size_t i = 0; i < image.size(); i++) {
+        p.extent.push_back(std::max(1, image[i] / std::max(1, step[i])));
+        p.stride.push_back(step[i] * words_below);
+        words_below *= image[i];
+    }
+    p.block = block;
+    return p;
+}
+
+// Collects the address patterns of every Load and Store of one allocation,
+// in terms of the loops inside the allocation with constant bounds.
+class BufferAccesses : public IRVisitor {
+    using IRVisitor::visit;
+
+    struct Loop {
+        string name;
+        Expr min;
+        int extent;
+    };
+    vector<Loop> loops;
+
+    void visit(const For *op) override {
+        op->min.accept(this);
+        op->extent.accept(this);
+        const int64_t *extent = as_const_int(op->extent);
+        loops.push_back({op->name, op->min, extent ? (int)*extent : -1});
+        op->body.accept(this);
+        loops.pop_back();
+    }
+
+    void visit(const Load *op) override {
+        IRVisitor::visit(op);
+        if (op->name == name) {
+            load_indices.push_back(op->index);
+            loads.push_back(pattern_for(op->index));
+        }
+    }
+
+    void visit(const Store *op) override {
+        IRVisitor::visit(op);
+        if (op->name == name) {
+            store_indices.push_back(op->index);
+            stores.push_back(pattern_for(op->index));
+            if (!is_const(op->value)) {
+                constant_values = false;
+            }
+        }
+    }
+
+    AccessPattern pattern_for(Expr index) {
+        AccessPattern p;
+        p.block = {1};
+        Expr base = index;
+        for (size_t i = loops.size(); i > 0; i--) {
+            const Loop &loop = loops[i - 1];
+            if (!expr_uses_var(index, loop.name)) {
+                continue;
+            }
+            Expr next = substitute(loop.name, Variable::make(Int(32), loop.name) + 1, index);
+            const int64_t *stride = as_const_int(simplify(next - index));
+            if (!stride || loop.extent < 0) {
+                p.is_affine = false;
+                continue;
+            }
+            p.extent.push_back(loop.extent);
+            p.stride.push_back((int)*stride);
+            base = substitute(loop.name, loop.min, base);
+        }
+        const int64_t *b = as_const_int(simplify(base));
+        if (b) {
+            p.base = (int)*b;
+        } else {
+            p.is_affine = false;
+        }
+        return p;
+    }
+
+public:
+    const string &name;
+    vector<Expr> load_indices, store_indices;
+    vector<AccessPattern> loads, stores;
+    bool constant_values = true;
+
+    BufferAccesses(const string &n) : name(n) {}
+};
+
+}  // namespace
+
+int AccessPattern::num_accesses() const {
+    return product(extent);
+}
+
+int AccessPattern::width() const {
+    return product(block);
+}
+
+int HWBuffer::size() const {
+    return product(logical_size);
+}
+
+HWBuffer linebuffer_hw_buffer(const string &name, Type t,
+                              const vector<int> &step,
+                              const vector<int> &size,
+                              const vector<int> &image,
+                              const vector<int> &stride,
+                              const vector<int> &hold) {
+    internal_assert(step.size() == size.size() && size.size() == image.size());
+    internal_assert(stride.empty() || stride.size() == step.size());
+    internal_assert(hold.empty() || hold.size() == step.size());
+
+    vector<int> window_step = step;
+    for (size_t i = 0; i < stride.size(); i++) {
+        window_step[i] *= stride[i];
+    }
+    AccessPattern out = raster_pattern(window_step, size, image);
+    for (size_t i = 0; i < hold.size(); i++) {
+        out.extent[i] *= hold[i];
+    }
+
+    HWBuffer b;
+    b.name = name;
+    b.elem_type = t;
+    b.logical_size = image;
+    b.is_stream = true;
+    b.write_ports.push_back({"in", raster_pattern(step, step, image)});
+    b.read_ports.push_back({"out", out});
+
+    // A window that overlaps the previous one in dimension d has to keep
+    // (size - step) slices of the image below d, and of the window above d.
+    b.capacity = 0;
+    for (size_t d = 0; d < image.size(); d++) {
+        int slice = std::max(0, size[d] - step[d]);
+        for (size_t i = 0; i < d; i++) {
+            slice *= image[i];
+        }
+        for (size_t i = d + 1; i < image.size(); i++) {
+            slice *= size[i];
+        }
+        b.capacity += slice;
+    }
+    return b;
+}
+
+HWBuffer kernel_hw_buffer(const HWKernel &kernel) {
+    vector<int> step, size, image, stride, hold;
+    for (size_t i = 0; i < kernel.dims.size(); i++) {
+        const StencilDimSpecs &dim = kernel.dims[i];
+        step.push_back(dim.update_step());
+        size.push_back(dim.size);
+        Expr store_extent = simplify(dim.store_bound.max - dim.store_bound.min + 1);
+        const int64_t *extent = as_const_int(store_extent);
+        image.push_back(extent ? (int)*extent : dim.size);
+        stride.push_back(kernel.window_stride(i));
+        hold.push_back(kernel.window_hold(i));
+    }
+    return linebuffer_hw_buffer(kernel.name, kernel.func.output_types()[0], step, size, image,
+                                stride, hold);
+}
+
+HWBuffer allocation_hw_buffer(Stmt body, const string &name, Type t, int size) {
+    BufferAccesses accesses(name);
+    body.accept(&accesses);
+
+    HWBuffer b;
+    b.name = name;
+    b.elem_type = t;
+    b.logical_size = {size};
+    b.capacity = size;
+    for (size_t i = 0; i < accesses.stores.size(); i++) {
+        b.write_ports.push_back({"write_" + std::to_string(i), accesses.stores[i]});
+    }
+    for (size_t i = 0; i < accesses.loads.size(); i++) {
+        b.read_ports.push_back({"read_" + std::to_string(i), accesses.loads[i]});
+    }
+
+    bool constant_store_index = true;
+    for (const Expr &index : accesses.store_indices) {
+        constant_store_index = constant_store_index && is_const(index);
+    }
+    b.constant_data = constant_store_index && accesses.constant_values;
+
+    for (const Expr &load_index : accesses.load_indices) {
+        for (const Expr &store_index : accesses.store_indices) {
+            if (!is_const(load_index) && equal(load_index, store_index)) {
+                b.read_modify_write = true;
+            }
+        }
+    }
+    return b;
+}
+
+void map_hw_buffer(HWBuffer &b, const HWBufferCostModel &model) {
+    b.num_banks = 1;
+    b.fetch_width = 1;
+
+    if (b.read_ports.empty() || b.write_ports.empty()) {
+        // passed in or out of the accelerator; nothing is built here
+        b.mapping = HWBufferMapping::Unmapped;
+
+    } else if (b.is_stream) {
+        const AccessPattern &in = b.write_ports[0].pattern;
+        const AccessPattern &out = b.read_ports[0].pattern;
+
+        if (out.block == in.block && out.stride == in.stride && out.extent == in.extent) {
+            // windows do not overlap and every update is one window, so the
+            // stream passes straight through
+            b.mapping = HWBufferMapping::Wires;
+        } else {
+            // In SRAM, the buffered rows live in banks (one per row that is
+            // read in the same cycle) and only the window is kept in registers.
+            int rows = 1;
+            for (size_t d = 1; d < out.block.size(); d++) {
+                rows *= std::max(1, out.block[d] - in.block[d]);
+            }
+            int window = out.width();
+            int sram_words = std::max(0, b.capacity - window);
+            int banks = std::max(rows, (sram_words + model.sram_bank_depth - 1) / model.sram_bank_depth);
+
+            int shift_register_cost = b.capacity * model.register_word_cost;
+            int sram_cost = banks * model.sram_bank_cost +
+                sram_words * model.sram_word_cost +
+                window * model.register_word_cost;
+
+            if (out.block.size() > 1 && sram_cost < shift_register_cost) {
+                b.mapping = HWBufferMapping::SRAM;
+                b.num_banks = banks;
+                // aggregate the words written in one cycle into a wide fetch
+                b.fetch_width = in.block.empty() ? 1 : in.block[0];
+            } else {
+                b.mapping = HWBufferMapping::ShiftRegister;
+            }
+        }
+
+    } else {
+        bool constant_reads = true, constant_writes = true;
+        for (const HWBufferPort &p : b.read_ports) {
+            constant_reads = constant_reads && p.pattern.is_constant();
+        }
+        for (const HWBufferPort &p : b.write_ports) {
+            constant_writes = constant_writes && p.pattern.is_constant();
+        }
+
+        if (constant_reads && constant_writes) {
+            b.mapping = HWBufferMapping::Wires;
+        } else if (!constant_writes) {
+            // only memories support data dependent or walking write addresses
+            b.mapping = HWBufferMapping::SRAM;
+            b.num_banks = (b.capacity + model.sram_bank_depth - 1) / model.sram_bank_depth;
+        } else if (b.constant_data && b.capacity > model.max_rom_registers) {
+            b.mapping = HWBufferMapping::ROM;
+        } else if (!constant_reads) {
+            b.mapping = HWBufferMapping::RegisterFile;
+        } else {
+            b.mapping = HWBufferMapping::Unmapped;
+        }
+    }
+
+    debug(3) << "mapped hardware buffer " << b << "\n";
+}
+
+std::ostream &operator<<(std::ostream &out, const HWBufferMapping &mapping) {
+    switch (mapping) {
+    case HWBufferMapping::Unmapped:
+        return out << "unmapped";
+    case HWBufferMapping::Wires:
+        return out << "wires";
+    case HWBufferMapping::RegisterFile:
+        return out << "register_file";
+    case HWBufferMapping::ShiftRegister:
+        return out << "shift_register";
+    case HWBufferMapping::SRAM:
+        return out << "sram";
+    case HWBufferMapping::ROM:
+        return out << "rom";
+    }
+    return out;
+}
+
+std::ostream &operator<<(std::ostream &out, const AccessPattern &p) {
+    if (!p.is_affine) {
+        return out << "<data dependent>";
+    }
+    out << p.base;
+    for (size_t i = 0; i < p.extent.size(); i++) {
+        out << " + " << p.stride[i] << "*[0," << p.extent[i] << ")";
+    }
+    if (p.width() != 1) {
+        out << " x" << p.width();
+    }
+    return out;
+}
+
+std::ostream &operator<<(std::ostream &out, const HWBuffer &b) {
+    out << b.name << " (" << b.elem_type << ", size " << b.size()
+        << ", capacity " << b.capacity << ") -> " << b.mapping;
+    if (b.mapping == HWBufferMapping::SRAM) {
+        out << " banks=" << b.num_banks << " fetch_width=" << b.fetch_width;
+    }
+    if (b.read_modify_write) {
+        out << " rmw";
+    }
+    for (const HWBufferPort &p : b.write_ports) {
+        out << "\n  write " << p.name << ": " << p.pattern;
+    }
+    for (const HWBufferPort &p : b.read_ports) {
+        out << "\n  read " << p.name << ": " << p.pattern;
+    }
+    return out;
+}
+
+}  // namespace Internal
+}  // namespace Halide
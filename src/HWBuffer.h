@@ -0,0 +1,130 @@
+#ifndef HALIDE_HW_BUFFER_H
+#define HALIDE_HW_BUFFER_H
+
+/** \file
+ *
+ * Defines the unified hardware buffer. Every piece of on-chip storage in an
+ * accelerator (linebuffers, SRAMs, ROMs, register files) is described by the
+ * address patterns of its write and read ports and the capacity it needs, and
+ * a cost-based mapping step decides what it is built from.
+ */
+
+#include "ExtractHWKernelDAG.h"
+#include "IR.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace Halide {
+namespace Internal {
+
+/** An affine address generator. A port with this pattern visits the addresses
+ *   base + sum_i stride[i] * idx[i],  0 <= idx[i] < extent[i]
+ * where idx[0] is the innermost loop. Each access covers a block of words
+ * (e.g. a stencil window) whose extent in each logical dimension is given by
+ * block. Data dependent addresses are marked as not affine.
+ */
+struct AccessPattern {
+    int base = 0;
+    std::vector<int> extent;
+    std::vector<int> stride;
+    std::vector<int> block;
+    bool is_affine = true;
+
+    /** Number of accesses made by one pass of the address generator. */
+    int num_accesses() const;
+    /** Number of words covered by each access. */
+    int width() const;
+    /** Every access goes to the same, known address. */
+    bool is_constant() const { return is_affine && extent.empty(); }
+};
+
+struct HWBufferPort {
+    std::string name;
+    AccessPattern pattern;
+};
+
+/** What a buffer is built from once it has been mapped. */
+enum class HWBufferMapping {
+    Unmapped,       ///< not mapped yet, or nothing needs to be built
+    Wires,          ///< every access has a constant address; storage is just wires
+    RegisterFile,   ///< registers with muxes on the read ports
+    ShiftRegister,  ///< a chain of registers shifted by the write stream
+    SRAM,           ///< one or more SRAM banks with address generators
+    ROM             ///< a read-only memory holding constant data
+};
+
+struct HWBuffer {
+    std::string name;
+    Type elem_type;
+    /** Logical extent of each dimension of the stored data. */
+    std::vector<int> logical_size;
+    std::vector<HWBufferPort> write_ports;
+    std::vector<HWBufferPort> read_ports;
+    /** Filled and drained by streams in raster order, like a linebuffer. */
+    bool is_stream = false;
+    /** Only constants are ever written, so the contents are known up front. */
+    bool constant_data = false;
+    /** A read and a write port walk the same address stream. */
+    bool read_modify_write = false;
+
+    /** Words that must be held at once. Streams only keep the data that is
+     * still to be reused; everything else holds its full size. */
+    int capacity = 0;
+
+    /** Set by map_hw_buffer. */
+    // @{
+    HWBufferMapping mapping = HWBufferMapping::Unmapped;
+    int num_banks = 1;    ///< memory tiles used when mapped to SRAM
+    int fetch_width = 1;  ///< words fetched per SRAM access
+    // @}
+
+    /** Number of words of the full logical buffer. */
+    int size() const;
+};
+
+/** Relative area of the building blocks, used to pick a mapping. */
+struct HWBufferCostModel {
+    /** Area of one word held in a register, including its read mux. */
+    int register_word_cost = 8;
+    /** Area of one word held in SRAM. */
+    int sram_word_cost = 1;
+    /** Fixed area of an SRAM bank (address generation, sense amps). */
+    int sram_bank_cost = 256;
+    /** Words in one SRAM bank. */
+    int sram_bank_depth = 2048;
+    /** Constant tables up to this many words stay in registers. */
+    int max_rom_registers = 100;
+};
+
+/** Describe the linebuffer between the stencil_update stream of a kernel
+ * (advancing by step each cycle) and its full stencil stream (windows of
+ * size) over an image of the given extents. A resampling linebuffer only
+ * emits a window every stride updates, and repeats each window hold times;
+ * both default to 1 in every dimension. */
+HWBuffer linebuffer_hw_buffer(const std::string &name, Type t,
+                              const std::vector<int> &step,
+                              const std::vector<int> &size,
+                              const std::vector<int> &image,
+                              const std::vector<int> &stride = {},
+                              const std::vector<int> &hold = {});
+
+/** Describe the buffer needed to stream a kernel to its consumers. */
+HWBuffer kernel_hw_buffer(const HWKernel &kernel);
+
+/** Describe an Allocate node from the Loads and Stores to it in body. */
+HWBuffer allocation_hw_buffer(Stmt body, const std::string &name, Type t, int size);
+
+/** Pick the cheapest implementation of the buffer that supports its ports,
+ * and fill in its banking. */
+void map_hw_buffer(HWBuffer &buffer, const HWBufferCostModel &model = HWBufferCostModel());
+
+std::ostream &operator<<(std::ostream &out, const HWBufferMapping &mapping);
+std::ostream &operator<<(std::ostream &out, const AccessPattern &pattern);
+std::ostream &operator<<(std::ostream &out, const HWBuffer &buffer);
+
+}  // namespace Internal
+}  // namespace Halide
+
+#endif
@@ -127,6 +127,10 @@ public:
     /** Trace all loads from this ImageParam by emitting calls to halide_trace. */
     void trace_loads();
 
+    /** Trace the loads from this ImageParam that pass the given
+     * filter. See TraceFilter. */
+    void trace_loads(const TraceFilter &filter);
+
     /** Add a trace tag to this ImageParam's Func. */
     ImageParam &add_trace_tag(const std::string &trace_tag);
 };
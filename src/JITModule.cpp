@@ -454,6 +454,24 @@ void JITModule::memoization_cache_set_size(int64_t size) const {
     }
 }
 
+bool JITModule::memoization_cache_stats(halide_memoization_cache_stats_t *stats) const {
+    std::map<std::string, Symbol>::const_iterator f =
+        exports().find("halide_memoization_cache_stats");
+    if (f != exports().end()) {
+        return (reinterpret_bits<int (*)(halide_memoization_cache_stats_t *)>(f->second.address))(stats) == 0;
+    }
+    return false;
+}
+
+bool JITModule::pool_allocator_stats(halide_pool_allocator_stats_t *stats) const {
+    std::map<std::string, Symbol>::const_iterator f =
+        exports().find("halide_pool_allocator_stats");
+    if (f != exports().end()) {
+        return (reinterpret_bits<int (*)(halide_pool_allocator_stats_t *)>(f->second.address))(stats) == 0;
+    }
+    return false;
+}
+
 bool JITModule::compiled() const {
   return jit_module->execution_engine != nullptr;
 }
@@ -930,5 +948,25 @@ void JITSharedRuntime::memoization_cache_set_size(int64_t size) {
     }
 }
 
+halide_memoization_cache_stats_t JITSharedRuntime::memoization_cache_stats() {
+    std::lock_guard<std::mutex> lock(shared_runtimes_mutex);
+
+    halide_memoization_cache_stats_t stats = {};
+    if (shared_runtimes(MainShared).compiled()) {
+        shared_runtimes(MainShared).memoization_cache_stats(&stats);
+    }
+    return stats;
+}
+
+halide_pool_allocator_stats_t JITSharedRuntime::pool_allocator_stats() {
+    std::lock_guard<std::mutex> lock(shared_runtimes_mutex);
+
+    halide_pool_allocator_stats_t stats = {};
+    if (shared_runtimes(MainShared).compiled()) {
+        shared_runtimes(MainShared).pool_allocator_stats(&stats);
+    }
+    return stats;
+}
+
 }  // namespace Internal
 }  // namespace Halide
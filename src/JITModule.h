@@ -116,6 +116,14 @@ struct JITModule {
     /** Encapsulate device (GPU) and buffer interactions. */
     void memoization_cache_set_size(int64_t size) const;
 
+    /** Fill in the hit, miss and eviction counts of the memoization
+     * cache. Returns false if this module has no cache. */
+    bool memoization_cache_stats(halide_memoization_cache_stats_t *stats) const;
+
+    /** Fill in the hit and miss counts of the pool allocator. Returns
+     * false if this module has no pool allocator. */
+    bool pool_allocator_stats(halide_pool_allocator_stats_t *stats) const;
+
     /** Return true if compile_module has been called on this module. */
     bool compiled() const;
 };
@@ -153,6 +161,18 @@ public:
      */
     static void memoization_cache_set_size(int64_t size);
 
+    /** Read the counters of the memoization cache used by JIT
+     * pipelines. If you are compiling statically, call
+     * halide_memoization_cache_stats() instead.
+     */
+    static halide_memoization_cache_stats_t memoization_cache_stats();
+
+    /** Read the counters of the pool allocator used by JIT
+     * pipelines. If you are compiling statically, call
+     * halide_pool_allocator_stats() instead.
+     */
+    static halide_pool_allocator_stats_t pool_allocator_stats();
+
     static void release_all();
 };
 
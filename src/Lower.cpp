@@ -19,6 +19,7 @@
 #include "DebugToFile.h"
 #include "Deinterleave.h"
 #include "EarlyFree.h"
+#include "EmulateHWStreams.h"
 #include "ExtractHWKernelDAG.h"
 #include "FindCalls.h"
 #include "Func.h"
@@ -171,7 +172,7 @@ Module lower(const vector<Function> &output_funcs, const string &pipeline_name,
     debug(2) << "Lowering after removing extern loops:\n" << s << '\n';
 
     debug(1) << "Performing sliding window optimization...\n";
-    //s = sliding_window(s, env);
+    s = sliding_window(s, env);
     debug(2) << "Lowering after sliding window:\n" << s << '\n';
 
     debug(1) << "Performing allocation bounds inference...\n";
@@ -202,6 +203,13 @@ Module lower(const vector<Function> &output_funcs, const string &pipeline_name,
         //s = replace_image_param(s, dag);
       }
 
+      if (t.has_feature(Target::JIT)) {
+        // The JIT has no hardware backend, so run the streams on the CPU.
+        debug(1) << "Emulating hardware streams...\n";
+        s = emulate_hw_streams(s);
+        debug(2) << "Lowering after emulating hardware streams:\n" << s << '\n';
+      }
+
       debug(2) << "Lowering after HLS optimization:\n" << s << '\n';
       //std::cout << "Lowering after HLS optimization:\n" << s << '\n';
     }
@@ -211,9 +219,7 @@ Module lower(const vector<Function> &output_funcs, const string &pipeline_name,
     debug(2) << "Lowering after first simplification:\n" << s << "\n\n";
 
     debug(1) << "Performing storage folding optimization...\n";
-    //if (!t.has_feature(Target::CoreIR) && !t.has_feature(Target::HLS)) { // FIXME: don't omit this pass globally with CoreIR
-      s = storage_folding(s, env);
-      //}
+    s = storage_folding(s, env);
     debug(2) << "Lowering after storage folding:\n" << s << '\n';
 
     debug(1) << "Injecting debug_to_file calls...\n";
@@ -229,11 +235,11 @@ Module lower(const vector<Function> &output_funcs, const string &pipeline_name,
     debug(2) << "Lowering after dynamically skipping stages:\n" << s << "\n\n";
     //std::cout << "Lowering after dynamically skipping stages:\n" << s << "\n\n";
 
-    if (!t.has_feature(Target::CoreIR) && !t.has_feature(Target::HLS)) { // FIXME: don't omit this pass globally with CoreIR
-      debug(1) << "Forking asynchronous producers...\n";
-      s = fork_async_producers(s, env);
-      debug(2) << "Lowering after forking asynchronous producers:\n" << s << '\n';
-    }
+    // With an accelerator, this is what lets host stages scheduled
+    // async run concurrently with the accelerated region.
+    debug(1) << "Forking asynchronous producers...\n";
+    s = fork_async_producers(s, env);
+    debug(2) << "Lowering after forking asynchronous producers:\n" << s << '\n';
 
     debug(1) << "Destructuring tuple-valued realizations...\n";
     s = split_tuples(s, env);
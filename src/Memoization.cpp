@@ -2,12 +2,15 @@
 #include "Error.h"
 #include "IRMutator.h"
 #include "IROperator.h"
+#include "IRPrinter.h"
 #include "Param.h"
 #include "Scope.h"
 #include "Util.h"
 #include "Var.h"
 
 #include <map>
+#include <set>
+#include <sstream>
 
 namespace Halide {
 namespace Internal {
@@ -20,6 +23,7 @@ public:
     ~FindParameterDependencies() override { }
 
     void visit_function(const Function &function) {
+        describe(function);
         function.accept(this);
 
         if (function.has_extern_definition()) {
@@ -38,6 +42,11 @@ public:
         }
     }
 
+    // Text of the definitions of every Function visited, which
+    // identifies the computation independently of the process that
+    // compiled it.
+    std::ostringstream definitions;
+
     using IRGraphVisitor::visit;
 
     void visit(const Call *call) override {
@@ -79,6 +88,50 @@ public:
         IRGraphVisitor::visit(var);
     }
 
+    void describe(const Function &function) {
+        if (!described.insert(function.name()).second) {
+            return;
+        }
+        definitions << function.name() << "(";
+        for (const Type &t : function.output_types()) {
+            definitions << t << ",";
+        }
+        definitions << ")";
+        if (function.has_extern_definition()) {
+            definitions << " extern " << function.extern_function_name() << "(";
+            for (const ExternFuncArgument &arg : function.extern_arguments()) {
+                if (arg.is_func()) {
+                    definitions << Function(arg.func).name();
+                } else if (arg.is_expr()) {
+                    definitions << arg.expr;
+                } else if (arg.is_buffer()) {
+                    definitions << arg.buffer.name();
+                } else if (arg.is_image_param()) {
+                    definitions << arg.image_param.name();
+                }
+                definitions << ",";
+            }
+            definitions << ")";
+        }
+        std::vector<Definition> defs;
+        if (function.has_pure_definition()) {
+            defs.push_back(function.definition());
+        }
+        defs.insert(defs.end(), function.updates().begin(), function.updates().end());
+        for (const Definition &def : defs) {
+            definitions << " [";
+            for (const Expr &e : def.args()) {
+                definitions << e << ",";
+            }
+            definitions << "] = (";
+            for (const Expr &e : def.values()) {
+                definitions << e << ",";
+            }
+            definitions << ")";
+        }
+        definitions << ";";
+    }
+
     void record(const Parameter &parameter) {
         struct DependencyInfo info;
 
@@ -139,6 +192,9 @@ public:
     };
 
     std::map<DependencyKey, DependencyInfo> dependency_info;
+
+private:
+    std::set<std::string> described;
 };
 
 typedef std::pair<FindParameterDependencies::DependencyKey, FindParameterDependencies::DependencyInfo> DependencyKeyInfoPair;
@@ -202,6 +258,19 @@ public:
         }
     }
 
+    // A 64-bit FNV-1a hash of the definitions of the function and
+    // everything it calls, in hex.
+    std::string definitions_hash() {
+        std::string text = dependencies.definitions.str();
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (char c : text) {
+            h = (h ^ (uint8_t)c) * 0x100000001b3ULL;
+        }
+        std::ostringstream hex;
+        hex << std::hex << h;
+        return hex.str();
+    }
+
     // Return the number of bytes needed to store the cache key
     // for the target function. Make sure it takes 4 bytes in cache key.
     Expr key_size() { return cast<int32_t>(key_size_expr); };
@@ -216,15 +285,21 @@ public:
         // Store a pointer to a string identifying the filter and
         // function. Assume this will be unique due to CSE. This can
         // break with loading and unloading of code, though the name
-        // mechanism can also break in those conditions.
+        // mechanism can also break in those conditions. The disk tier
+        // of the cache can't use the pointer, so it keys on the
+        // contents of the string instead, which end with a hash of the
+        // definitions the result depends on.
         writes.push_back(Store::make(key_name,
                                      StringImm::make(std::to_string(top_level_name.size()) + ":" + top_level_name +
-                                                     std::to_string(function_name.size()) + ":" + function_name),
+                                                     std::to_string(function_name.size()) + ":" + function_name +
+                                                     ":" + definitions_hash()),
                                      (index / Handle().bytes()), Parameter(), const_true()));
         size_t alignment = Handle().bytes();
         index += Handle().bytes();
 
-        // Halide compilation is not threadsafe anyway...
+        // Halide compilation is not threadsafe anyway... This and the
+        // pointer before it only mean something within one process, so
+        // the disk tier skips them. See halide_memoization_disk_cache_lookup.
         writes.push_back(Store::make(key_name,
                                      memoize_instance,
                                      (index / Int(32).bytes()),
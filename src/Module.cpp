@@ -520,7 +520,8 @@ void compile_multitarget(const std::string &fn_name,
                          const Outputs &output_files,
                          const std::vector<Target> &targets,
                          ModuleProducer module_producer,
-                         const std::map<std::string, std::string> &suffixes) {
+                         const std::map<std::string, std::string> &suffixes,
+                         bool thread_safe_producer) {
     user_assert(!fn_name.empty()) << "Function name must be specified.\n";
     user_assert(!targets.empty()) << "Must specify at least one target.\n";
 
@@ -562,6 +563,18 @@ void compile_multitarget(const std::string &fn_name,
     constexpr int kFeaturesWordCount = (Target::FeatureEnd + 63) / (sizeof(uint64_t) * 8);
     uint64_t runtime_features[kFeaturesWordCount] = {(uint64_t)-1LL};
 
+    // The sub-targets may be lowered and compiled concurrently below, each
+    // into its own LLVMContext. Everything that depends on their order
+    // (the object files in the library, and the order the wrapper tries
+    // them in) is set up here first, so the output doesn't depend on
+    // which finishes first.
+    struct SubTarget {
+        std::string fn_name;
+        Target target;
+        Outputs outputs;
+    };
+    std::vector<SubTarget> sub_targets;
+
     TemporaryObjectFileDir temp_dir;
     std::vector<Expr> wrapper_args;
     std::vector<LoweredArgument> base_target_args;
@@ -607,16 +620,10 @@ void compile_multitarget(const std::string &fn_name,
             sub_fn_target = sub_fn_target.without_feature(Target::Matlab);
         }
 
-        Module sub_module = module_producer(sub_fn_name, sub_fn_target);
-        // Re-assign every time -- should be the same across all targets anyway,
-        // but base_target is always the last one we encounter.
-        base_target_args = sub_module.get_function_by_name(sub_fn_name).args;
-
         Outputs sub_out = add_suffixes(output_files, suffix);
         internal_assert(sub_out.object_name.empty());
         sub_out.object_name = temp_dir.add_temp_object_file(output_files.static_library_name, suffix, target);
-        debug(1) << "compile_multitarget: compile_sub_target " << sub_out.object_name << "\n";
-        sub_module.compile(sub_out);
+        sub_targets.push_back({sub_fn_name, sub_fn_target, sub_out});
 
         uint64_t cur_target_features[kFeaturesWordCount] = {0};
         for (int i = 0; i < Target::FeatureEnd; ++i) {
@@ -646,6 +653,18 @@ void compile_multitarget(const std::string &fn_name,
         wrapper_args.push_back(sub_fn_name);
     }
 
+    // A deferred sub-target runs when it's waited for below, on this thread.
+    std::launch policy = thread_safe_producer ? std::launch::async : std::launch::deferred;
+    std::vector<std::future<std::vector<LoweredArgument>>> sub_compiles;
+    for (const SubTarget &sub : sub_targets) {
+        sub_compiles.push_back(std::async(policy, [&module_producer, sub]() {
+            Module sub_module = module_producer(sub.fn_name, sub.target);
+            debug(1) << "compile_multitarget: compile_sub_target " << sub.outputs.object_name << "\n";
+            sub_module.compile(sub.outputs);
+            return sub_module.get_function_by_name(sub.fn_name).args;
+        }));
+    }
+
     // If we haven't specified "no runtime", build a runtime with the base target
     // and add that to the result.
     if (!base_target.has_feature(Target::NoRuntime)) {
@@ -668,6 +687,13 @@ void compile_multitarget(const std::string &fn_name,
         compile_standalone_runtime(runtime_out, runtime_target);
     }
 
+    // Wait for the sub-targets in order, so that if more than one fails,
+    // the error reported is the first one's. The arguments should be the
+    // same across all targets anyway, but take them from the base target.
+    for (auto &sub_compile : sub_compiles) {
+        base_target_args = sub_compile.get();
+    }
+
     if (needs_wrapper) {
         Expr indirect_result = Call::make(Int(32), Call::call_cached_indirect_function, wrapper_args, Call::Intrinsic);
         std::string private_result_name = unique_name(fn_name + "_result");
@@ -166,11 +166,18 @@ Outputs compile_standalone_runtime(const Outputs &output_files, Target t);
 
 typedef std::function<Module(const std::string &, const Target &)> ModuleProducer;
 
+/** Compile a module for each target into one static library, with a
+ * wrapper that picks the best one the host can run. If
+ * thread_safe_producer is true, module_producer may be called for
+ * several targets at once (e.g. because it builds a fresh Generator
+ * each time), and the targets are compiled concurrently. Otherwise
+ * they are compiled one at a time. */
 void compile_multitarget(const std::string &fn_name,
                          const Outputs &output_files,
                          const std::vector<Target> &targets,
                          ModuleProducer module_producer,
-                         const std::map<std::string, std::string> &suffixes = {});
+                         const std::map<std::string, std::string> &suffixes = {},
+                         bool thread_safe_producer = false);
 
 }  // namespace Halide
 
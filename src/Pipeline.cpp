@@ -289,6 +289,8 @@ void Pipeline::compile_to_multitarget_static_library(const std::string &filename
         return compile_to_module(args, name, target);
     };
     Outputs outputs = static_library_outputs(filename_prefix, targets.back());
+    // Every target lowers this same pipeline, which caches the module it
+    // lowered last, so the targets have to be compiled one at a time.
     compile_multitarget(generate_function_name(), outputs, targets, module_producer);
 }
 
@@ -47,6 +47,11 @@ private:
 
     bool profiling_memory = true;
 
+    // Inside code offloaded to a remote device, which reports through
+    // the remote copy of the global profiler state rather than through
+    // this invocation's instance state.
+    bool in_remote_loop = false;
+
     // Strip down the tuple name, e.g. f.0 into f
     string normalize_name(const string &name) {
         vector<string> v = split_string(name, ".");
@@ -201,11 +206,18 @@ private:
         }
 
         Expr profiler_token = Variable::make(Int(32), "profiler_token");
-        Expr profiler_state = Variable::make(Handle(), "profiler_state");
 
         // This call gets inlined and becomes a single store instruction.
-        Expr set_task = Call::make(Int(32), "halide_profiler_set_current_func",
-                                   {profiler_state, profiler_token, idx}, Call::Extern);
+        Expr set_task;
+        if (in_remote_loop) {
+            Expr profiler_state = Variable::make(Handle(), "profiler_state");
+            set_task = Call::make(Int(32), "halide_profiler_set_current_func",
+                                  {profiler_state, profiler_token, idx}, Call::Extern);
+        } else {
+            Expr profiler_instance = Variable::make(Handle(), "profiler_instance");
+            set_task = Call::make(Int(32), "halide_profiler_instance_set_current_func",
+                                  {profiler_instance, profiler_token, idx}, Call::Extern);
+        }
 
         body = Block::make(Evaluate::make(set_task), body);
 
@@ -213,15 +225,25 @@ private:
     }
 
     Stmt incr_active_threads() {
-        Expr state = Variable::make(Handle(), "profiler_state");
-        return Evaluate::make(Call::make(Int(32), "halide_profiler_incr_active_threads",
-                                  {state}, Call::Extern));
+        if (in_remote_loop) {
+            Expr state = Variable::make(Handle(), "profiler_state");
+            return Evaluate::make(Call::make(Int(32), "halide_profiler_incr_active_threads",
+                                             {state}, Call::Extern));
+        }
+        Expr instance = Variable::make(Handle(), "profiler_instance");
+        return Evaluate::make(Call::make(Int(32), "halide_profiler_instance_incr_active_threads",
+                                         {instance}, Call::Extern));
     }
 
     Stmt decr_active_threads() {
-        Expr state = Variable::make(Handle(), "profiler_state");
-        return Evaluate::make(Call::make(Int(32), "halide_profiler_decr_active_threads",
-                                         {state}, Call::Extern));
+        if (in_remote_loop) {
+            Expr state = Variable::make(Handle(), "profiler_state");
+            return Evaluate::make(Call::make(Int(32), "halide_profiler_decr_active_threads",
+                                             {state}, Call::Extern));
+        }
+        Expr instance = Variable::make(Handle(), "profiler_instance");
+        return Evaluate::make(Call::make(Int(32), "halide_profiler_instance_decr_active_threads",
+                                         {instance}, Call::Extern));
     }
 
     Stmt visit_parallel_task(Stmt s) {
@@ -254,6 +276,11 @@ private:
         bool update_active_threads = (op->device_api == DeviceAPI::Hexagon ||
                                       op->is_parallel());
 
+        bool old_in_remote_loop = in_remote_loop;
+        if (op->device_api == DeviceAPI::Hexagon) {
+            in_remote_loop = true;
+        }
+
         if (update_active_threads) {
             body = Block::make({incr_active_threads(), body, decr_active_threads()});
         }
@@ -282,6 +309,8 @@ private:
             body = op->body;
         }
 
+        in_remote_loop = old_in_remote_loop;
+
         Stmt stmt = For::make(op->name, op->min, op->extent, op->for_type, op->device_api, body);
 
         if (update_active_threads) {
@@ -299,17 +328,21 @@ Stmt inject_profiling(Stmt s, string pipeline_name) {
 
     Expr func_names_buf = Variable::make(Handle(), "profiling_func_names");
 
-    Expr start_profiler = Call::make(Int(32), "halide_profiler_pipeline_start",
-                                     {pipeline_name, num_funcs, func_names_buf}, Call::Extern);
+    // Each invocation of the pipeline reports the Func it's computing
+    // through its own halide_profiler_instance_state on the stack, so
+    // that invocations running at the same time on different threads
+    // don't overwrite each other's state.
+    Expr profiler_instance = Variable::make(Handle(), "profiler_instance");
 
-    Expr get_state = Call::make(Handle(), "halide_profiler_get_state", {}, Call::Extern);
+    Expr start_profiler = Call::make(Int(32), "halide_profiler_instance_start",
+                                     {pipeline_name, num_funcs, func_names_buf, profiler_instance}, Call::Extern);
 
     Expr get_pipeline_state = Call::make(Handle(), "halide_profiler_get_pipeline_state", {pipeline_name}, Call::Extern);
 
     Expr profiler_token = Variable::make(Int(32), "profiler_token");
 
     Expr stop_profiler = Call::make(Int(32), Call::register_destructor,
-                                    {Expr("halide_profiler_pipeline_end"), get_state}, Call::Intrinsic);
+                                    {Expr("halide_profiler_instance_end"), profiler_instance}, Call::Intrinsic);
 
     bool no_stack_alloc = profiling.func_stack_peak.empty();
     if (!no_stack_alloc) {
@@ -321,23 +354,32 @@ Stmt inject_profiling(Stmt s, string pipeline_name) {
         s = Block::make(update_stack, s);
     }
 
-    Expr profiler_state = Variable::make(Handle(), "profiler_state");
     Stmt incr_active_threads =
-        Evaluate::make(Call::make(Int(32), "halide_profiler_incr_active_threads",
-                                  {profiler_state}, Call::Extern));
+        Evaluate::make(Call::make(Int(32), "halide_profiler_instance_incr_active_threads",
+                                  {profiler_instance}, Call::Extern));
     Stmt decr_active_threads =
-        Evaluate::make(Call::make(Int(32), "halide_profiler_decr_active_threads",
-                                  {profiler_state}, Call::Extern));
+        Evaluate::make(Call::make(Int(32), "halide_profiler_instance_decr_active_threads",
+                                  {profiler_instance}, Call::Extern));
     s = Block::make({incr_active_threads, s, decr_active_threads});
 
     s = LetStmt::make("profiler_pipeline_state", get_pipeline_state, s);
-    s = LetStmt::make("profiler_state", get_state, s);
+    // Stop sampling this invocation however the pipeline exits, but
+    // only once it has been added to the profiler's list.
+    s = Block::make(Evaluate::make(stop_profiler), s);
     // If there was a problem starting the profiler, it will call an
     // appropriate halide error function and then return the
     // (negative) error code as the token.
     s = Block::make(AssertStmt::make(profiler_token >= 0, profiler_token), s);
     s = LetStmt::make("profiler_token", start_profiler, s);
 
+    // Room for three ints and two pointers, on targets of any bitness.
+    const int instance_words = 4;
+    static_assert(sizeof(halide_profiler_instance_state) <= instance_words * sizeof(uint64_t),
+                  "halide_profiler_instance_state doesn't fit in the space reserved for it");
+    s = Block::make(s, Free::make("profiler_instance"));
+    s = Allocate::make("profiler_instance", UInt(64),
+                       MemoryType::Stack, {instance_words}, const_true(), s);
+
     if (!no_stack_alloc) {
         for (int i = num_funcs-1; i >= 0; --i) {
             s = Block::make(Store::make("profiling_func_stack_peak_buf",
@@ -356,7 +398,6 @@ Stmt inject_profiling(Stmt s, string pipeline_name) {
     s = Block::make(s, Free::make("profiling_func_names"));
     s = Allocate::make("profiling_func_names", Handle(),
                        MemoryType::Auto, {num_funcs}, const_true(), s);
-    s = Block::make(Evaluate::make(stop_profiler), s);
 
     return s;
 }
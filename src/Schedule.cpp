@@ -221,10 +221,12 @@ struct FuncScheduleContents {
     bool is_accelerator_input;
     bool is_accelerator_output;
     bool is_linebuffered;
+    bool is_sparse_output;
     std::set<std::string> accelerate_inputs;
     std::string accelerate_exit;
     LoopLevel accelerate_compute_level, accelerate_store_level;
     std::map<std::string, int> fifo_depths;   // key is the name of the consumer
+    std::map<std::string, int> max_extents;   // key is the name of the loop var
     std::map<std::string, Function> tap_funcs;
     std::map<std::string, Parameter> tap_params;
 
@@ -232,7 +234,7 @@ struct FuncScheduleContents {
       store_level(LoopLevel::inlined()), compute_level(LoopLevel::inlined()),
         memory_type(MemoryType::Auto), memoized(false), async(false), is_hw_kernel(false),
         is_accelerated(false), is_accelerator_input(false), is_accelerator_output(false),
-        is_linebuffered(false) {};
+        is_linebuffered(false), is_sparse_output(false) {};
 
     // Pass an IRMutator2 through to all Exprs referenced in the FuncScheduleContents
     void mutate(IRMutator2 *mutator) {
@@ -355,10 +357,12 @@ FuncSchedule FuncSchedule::deep_copy(
     copy.contents->accelerate_compute_level = contents->accelerate_compute_level;
     copy.contents->accelerate_store_level = contents->accelerate_store_level;
     copy.contents->fifo_depths = contents->fifo_depths;
+    copy.contents->max_extents = contents->max_extents;
     //copy.contents->is_kernel_buffer = contents->is_kernel_buffer;
     //copy.contents->is_kernel_buffer_slice = contents->is_kernel_buffer_slice;
     copy.contents->is_accelerator_input = contents->is_accelerator_input;
     copy.contents->is_accelerator_output = contents->is_accelerator_output;
+    copy.contents->is_sparse_output = contents->is_sparse_output;
     copy.contents->tap_funcs = contents->tap_funcs;
     copy.contents->tap_params = contents->tap_params;
 
@@ -497,6 +501,14 @@ bool &FuncSchedule::is_accelerator_output() {
     return contents->is_accelerator_output;
 }
 
+bool FuncSchedule::is_sparse_output() const {
+    return contents->is_sparse_output;
+}
+
+bool &FuncSchedule::is_sparse_output() {
+    return contents->is_sparse_output;
+}
+
 const std::set<std::string> &FuncSchedule::accelerate_inputs() const{
   return contents->accelerate_inputs;
 }
@@ -529,6 +541,14 @@ std::map<std::string, int> &FuncSchedule::fifo_depths() {
     return contents->fifo_depths;
 }
 
+const std::map<std::string, int> &FuncSchedule::max_extents() const {
+    return contents->max_extents;
+}
+
+std::map<std::string, int> &FuncSchedule::max_extents() {
+    return contents->max_extents;
+}
+
 const std::string &FuncSchedule::accelerate_exit() const{
     return contents->accelerate_exit;
 }
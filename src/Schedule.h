@@ -475,6 +475,13 @@ public:
     bool is_accelerator_output() const;
     bool &is_accelerator_output();
 
+    /** Does the accelerator only send the nonzero pixels of this
+     * output back to the host? */
+    // @{
+    bool is_sparse_output() const;
+    bool &is_sparse_output();
+    // @}
+
     /** The input functions of the hardware accelerator pipeline. */
     // @{
     const std::set<std::string> &accelerate_inputs() const;
@@ -496,6 +503,13 @@ public:
     std::map<std::string, int> &fifo_depths();
     // @}
 
+    /** The largest extents that the accelerator loops over symbolic
+     * extents may take, by loop var. */
+    // @{
+    const std::map<std::string, int> &max_extents() const;
+    std::map<std::string, int> &max_extents();
+    // @}
+
     /** The output functions of the hardware accelerator pipeline. */
     // @{
     const std::string &accelerate_exit() const;
@@ -383,6 +383,13 @@ class SlidingWindow : public IRMutator2 {
             return IRMutator2::visit(op);
         }
 
+        // Functions inside a hardware accelerator are linebuffered by
+        // stream_opt instead.
+        if (sched.is_hw_kernel() || sched.is_accelerated()) {
+            debug(3) << "Not sliding " << op->name << " because it is part of an accelerator\n";
+            return IRMutator2::visit(op);
+        }
+
         Stmt new_body = op->body;
 
         debug(3) << "Doing sliding window analysis on realization of " << op->name << "\n";
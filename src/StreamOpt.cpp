@@ -1,4 +1,5 @@
 #include "StreamOpt.h"
+#include "HWBuffer.h"
 #include "IRMutator.h"
 #include "IROperator.h"
 #include "Scope.h"
@@ -49,6 +50,19 @@ Expr expand_expr(Expr e, const Scope<Expr> &scope) {
     return result;
 }
 
+// A kernel with rate > 1 in a dimension produces the step of each scan
+// iteration in several updates, counted by a phase loop.
+string phase_var_name(const HWKernel &kernel, size_t dim) {
+    return kernel.name + "." + kernel.func.args()[dim] + ".__phase";
+}
+
+// Position of the current update within the step of the scan iteration.
+Expr phase_offset(const HWKernel &kernel, size_t dim) {
+    if (kernel.dims[dim].rate == 1) {
+        return 0;
+    }
+    return Variable::make(Int(32), phase_var_name(kernel, dim)) * kernel.dims[dim].update_step();
+}
 
 }
 
@@ -97,11 +111,11 @@ class ReplaceReferencesWithStencil : public IRMutator2 {
               return IRMutator2::visit(op);
             }
             Expr new_min = 0;
-            Expr new_extent = kernel.dims[dim_idx].step;
+            Expr new_extent = kernel.dims[dim_idx].update_step();
 
             // create a let statement for the old_loop_var
             Expr old_min = op->min;
-            Expr old_var_value = new_var + old_min;
+            Expr old_var_value = new_var + old_min + phase_offset(kernel, dim_idx);
 
             // traversal down into the body
             scope.push(old_var_name, simplify(expand_expr(old_var_value, scope)));
@@ -124,7 +138,8 @@ class ReplaceReferencesWithStencil : public IRMutator2 {
             // Replace the arguments. e.g.
             //   func.s0.x -> func.stencil.x
             for (size_t i = 0; i < kernel.func.args().size(); i++) {
-              new_args[i] = simplify(expand_expr(mutate(op->args[i]) - kernel.dims[i].min_pos, scope));
+              Expr offset = kernel.dims[i].min_pos + phase_offset(kernel, i);
+              new_args[i] = simplify(expand_expr(mutate(op->args[i]) - offset, scope));
             }
 
             vector<Expr> new_values(op->values.size());
@@ -163,13 +178,23 @@ class ReplaceReferencesWithStencil : public IRMutator2 {
                 Expr offset;
                 if (stencil_kernel.name == kernel.name) {
                     // The call is in an update definition of the kernel itself
-                    offset = stencil_kernel.dims[i].min_pos;
+                    offset = stencil_kernel.dims[i].min_pos + phase_offset(kernel, i);
                 } else {
                     // This is call to input stencil
                     // we use the min_pos stored in in_kernel.consumer_stencils
                     const auto it = stencil_kernel.consumer_stencils.find(kernel.name);
                     internal_assert(it != kernel.consumer_stencils.end());
-                    offset = it->second[i].min_pos;
+                    const StencilDimSpecs &input_dim = it->second[i];
+                    offset = input_dim.min_pos;
+                    // the window moves along with the phase of this kernel
+                    for (size_t j = 0; j < kernel.dims.size(); j++) {
+                        if (input_dim.loop_var != "undef" &&
+                            kernel.dims[j].loop_var == input_dim.loop_var &&
+                            kernel.dims[j].rate > 1) {
+                            offset += Variable::make(Int(32), phase_var_name(kernel, j)) *
+                                (input_dim.step / input_dim.rate);
+                        }
+                    }
                 }
 
                 Expr new_arg = old_arg - offset;
@@ -257,7 +282,70 @@ public:
 };
 
 
-Stmt create_dispatch_call(const HWKernel& kernel, int min_fifo_depth = 0) {
+bool has_window_stride(const HWKernel &kernel) {
+    for (size_t i = 0; i < kernel.dims.size(); i++) {
+        if (kernel.window_stride(i) != 1) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool has_window_hold(const HWKernel &kernel) {
+    for (size_t i = 0; i < kernel.dims.size(); i++) {
+        if (kernel.window_hold(i) != 1) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Wrap an extent that depends on symbolic loop extents as
+//   hw_max_extent(extent, max)
+// where max is its value for the declared maximum of each loop.
+Expr runtime_extent(Expr extent, const HWKernelDAG &dag) {
+    if (is_const(extent)) {
+        return extent;
+    }
+    map<string, Expr> maxes;
+    for (const auto &p : dag.max_extents) {
+        maxes[p.first] = p.second;
+    }
+    Expr max_extent = simplify(substitute(maxes, extent));
+    user_assert(is_const(max_extent))
+        << "Cannot bound the extent " << extent << " of a buffer in accelerator " << dag.name
+        << ". Declare the largest extent of each symbolic loop with hw_max_extent.\n";
+    return Call::make(Int(32), "hw_max_extent", {extent, max_extent}, Call::PureIntrinsic);
+}
+
+// A sparse output streams records of (coordinates..., value) instead of
+// every pixel of the output kernel.
+bool is_sparse_output(const HWKernel &kernel) {
+    return kernel.is_output && kernel.func.schedule().is_sparse_output();
+}
+
+// The number of updates of the kernel along dimension i.
+Expr scan_loop_extent(const HWKernel &kernel, size_t i) {
+    Expr store_extent = simplify(kernel.dims[i].store_bound.max -
+                                 kernel.dims[i].store_bound.min + 1);
+    debug(3) << "kernel " << kernel.name << " store_extent = " << store_extent << '\n';
+
+    // check the condition for the new loop for sliding the update stencil
+    const IntImm *store_extent_int = store_extent.as<IntImm>();
+    if (!store_extent_int) {
+        // a runtime extent has to be a multiple of the step, like the constant ones
+        return simplify(store_extent / kernel.dims[i].step);
+    }
+    if (store_extent_int->value % kernel.dims[i].step != 0) {
+        // we cannot handle this scenario yet
+        internal_error
+            << "Line buffer extent (" << store_extent_int->value
+            << ") is not divisible by the stencil step " << kernel.dims[i].step << '\n';
+    }
+    return (int)(store_extent_int->value / kernel.dims[i].step);
+}
+
+Stmt create_dispatch_call(const HWKernel& kernel, const HWKernelDAG &dag, int min_fifo_depth = 0) {
     // dispatch the stream into seperate streams for each of its consumers
     // syntax:
     //   dispatch_stream(stream_name, num_of_dimensions,
@@ -267,16 +355,18 @@ Stmt create_dispatch_call(const HWKernel& kernel, int min_fifo_depth = 0) {
     //                   consumer_0_name, fifo_0_depth,
     //                   consumer_0_offset_dim_0, consumer_0_extent_dim_0,
     //                   [consumer_0_offset_dim_1, consumer_0_extent_dim_1, ...]
-    //                   [consumer_1_name, ...])
+    //                   [consumer_1_name, ...]
+    //                   [hold_dim_0, hold_dim_1, ...])
+    // The stencil step is the distance between two windows in the stream,
+    // and the trailing holds are only there if the linebuffer repeats windows.
     Expr stream_var = Variable::make(Handle(), kernel.name + ".stencil.stream");
     vector<Expr> dispatch_args({stream_var, (int)kernel.dims.size()});
     for (size_t i = 0; i < kernel.dims.size(); i++) {
         dispatch_args.push_back(kernel.dims[i].size);
-        dispatch_args.push_back(kernel.dims[i].step);
+        dispatch_args.push_back(kernel.dims[i].update_step() * kernel.window_stride(i));
         Expr store_extent = simplify(kernel.dims[i].store_bound.max -
                                      kernel.dims[i].store_bound.min + 1);
-        internal_assert(is_const(store_extent));
-        dispatch_args.push_back((int)*as_const_int(store_extent));
+        dispatch_args.push_back(runtime_extent(store_extent, dag));
     }
     dispatch_args.push_back((int)kernel.consumer_stencils.size());
     for (const auto& p : kernel.consumer_stencils) {
@@ -289,10 +379,13 @@ Stmt create_dispatch_call(const HWKernel& kernel, int min_fifo_depth = 0) {
                                          kernel.dims[i].store_bound.min);
             Expr store_extent = simplify(p.second[i].store_bound.max -
                                          p.second[i].store_bound.min + 1);
-            internal_assert(is_const(store_offset));
-            internal_assert(is_const(store_extent));
-            dispatch_args.push_back((int)*as_const_int(store_offset));
-            dispatch_args.push_back((int)*as_const_int(store_extent));
+            dispatch_args.push_back(runtime_extent(store_offset, dag));
+            dispatch_args.push_back(runtime_extent(store_extent, dag));
+        }
+    }
+    if (has_window_hold(kernel)) {
+        for (size_t i = 0; i < kernel.dims.size(); i++) {
+            dispatch_args.push_back(kernel.window_hold(i));
         }
     }
     return Evaluate::make(Call::make(Handle(), "dispatch_stream", dispatch_args, Call::Intrinsic));
@@ -329,16 +422,11 @@ Stmt add_input_stencil(Stmt s, const HWKernel &kernel, const HWKernel &input) {
 }
 
 bool need_linebuffer(const HWKernel &kernel) {
-    // check if we need a line buffer
-    bool ret = false;
-    for (size_t i = 0; i < kernel.dims.size(); i++) {
-      //std::cout << "kernel " << kernel.name << " has size=" << kernel.dims[i].size << " step=" << kernel.dims[i].step << std::endl;
-      if (kernel.dims.at(i).size != kernel.dims.at(i).step) {
-            ret = true;
-            break;
-        }
-    }
-    return ret;
+    // a line buffer is needed unless the kernel's buffer maps to plain wires,
+    // i.e. consecutive stencil windows do not overlap and are not resampled
+    HWBuffer buffer = kernel_hw_buffer(kernel);
+    map_hw_buffer(buffer);
+    return buffer.mapping != HWBufferMapping::Wires;
 }
 
 // IR for line buffers
@@ -346,7 +434,7 @@ bool need_linebuffer(const HWKernel &kernel) {
 // to generate the stencil.stream
 // The former is smaller, which only consist of the new pixels
 // sided in each shift of the stencil window.
-Stmt add_linebuffer(Stmt s, const HWKernel &kernel) {
+Stmt add_linebuffer(Stmt s, const HWKernel &kernel, const HWKernelDAG &dag) {
     Stmt ret;
     if (need_linebuffer(kernel)) {
         // Before mutation:
@@ -368,10 +456,20 @@ Stmt add_linebuffer(Stmt s, const HWKernel &kernel) {
         for (size_t i = 0; i < kernel.dims.size(); i++) {
             Expr store_extent = simplify(kernel.dims[i].store_bound.max -
                                          kernel.dims[i].store_bound.min + 1);
-            linebuffer_args.push_back(store_extent);
+            linebuffer_args.push_back(runtime_extent(store_extent, dag));
+        }
+        // a resampling linebuffer also takes the stride and hold of each dimension:
+        //   linebuffer(update_stream, stream, extent_0, ..., stride_0, ..., hold_0, ...)
+        if (has_window_stride(kernel) || has_window_hold(kernel)) {
+            for (size_t i = 0; i < kernel.dims.size(); i++) {
+                linebuffer_args.push_back(kernel.window_stride(i));
+            }
+            for (size_t i = 0; i < kernel.dims.size(); i++) {
+                linebuffer_args.push_back(kernel.window_hold(i));
+            }
         }
         Stmt linebuffer_call = Evaluate::make(Call::make(Handle(), "linebuffer", linebuffer_args, Call::Intrinsic));
-        Stmt dispatch_call = create_dispatch_call(kernel);
+        Stmt dispatch_call = create_dispatch_call(kernel, dag);
         Stmt buffer_calls = Block::make(linebuffer_call, dispatch_call);
 
         // create a realization of the stencil of the window-size
@@ -397,7 +495,7 @@ Stmt add_linebuffer(Stmt s, const HWKernel &kernel) {
         int force_buffer_depth = 0;
         if (kernel.input_streams.empty() && kernel.consumer_stencils.size() == 1)
             force_buffer_depth = 1;
-        Stmt dispatch_call = create_dispatch_call(kernel, force_buffer_depth);
+        Stmt dispatch_call = create_dispatch_call(kernel, dag, force_buffer_depth);
         ret = Block::make(dispatch_call, s);
     }
     return ret;
@@ -438,6 +536,52 @@ Stmt add_linebuffer(Stmt s, const HWKernel &kernel) {
     return s;
   }
 
+// Replace the write of every pixel of a sparse output kernel with
+//   realize kernel.record.stencil
+//     kernel.record.stencil(i) = scan loop var i, ...
+//     kernel.record.stencil(n) = kernel.stencil(0, ...)
+//     if (value != 0 || last pixel)
+//       write_stream(kernel.record.stream, kernel.record.stencil, loop_var_1, loop_max_1, ...)
+// The last pixel is always sent, so its TLAST marks the end of the frame.
+Stmt compact_output_write(const HWKernel &kernel, const vector<Expr> &dense_write_args) {
+    Type t = kernel.func.output_types()[0];
+    for (size_t i = 0; i < kernel.dims.size(); i++) {
+        user_assert(kernel.dims[i].loop_var != "undef" && kernel.dims[i].step == 1)
+            << "The sparse output " << kernel.name << " has to be produced one pixel at a time.\n";
+        const int64_t *extent = as_const_int(scan_loop_extent(kernel, i));
+        user_assert(!extent || t.can_represent(*extent - 1))
+            << "The coordinates of the sparse output " << kernel.name
+            << " do not fit in its type " << t << ".\n";
+    }
+
+    string stencil_name = kernel.name + ".stencil";
+    string record_name = kernel.name + ".record.stencil";
+    string stream_name = kernel.name + ".record.stream";
+    vector<Expr> pixel(kernel.dims.size(), 0);
+    Expr value = Call::make(t, stencil_name, pixel, Call::Intrinsic);
+
+    vector<Stmt> fields;
+    Expr last = const_true();
+    size_t n = 0;
+    for (size_t i = 2; i < dense_write_args.size(); i += 2, n++) {
+        Expr loop_var = dense_write_args[i];
+        Expr loop_max = dense_write_args[i + 1];
+        fields.push_back(Provide::make(record_name, {cast(t, loop_var)}, {(int)n}));
+        last = last && (loop_var == loop_max);
+    }
+    fields.push_back(Provide::make(record_name, {value}, {(int)n}));
+
+    vector<Expr> write_args = dense_write_args;
+    write_args[0] = Variable::make(Handle(), stream_name);
+    write_args[1] = Variable::make(Handle(), record_name);
+    Stmt write_call = Evaluate::make(Call::make(Handle(), "write_stream", write_args, Call::Intrinsic));
+
+    // the fields are wired up every cycle; only the write depends on the value
+    Stmt send = IfThenElse::make(value != make_zero(t) || last, write_call);
+    Stmt body = Block::make(Block::make(fields), send);
+    return Realize::make(record_name, {t}, MemoryType::Auto, {Range(0, (int)n + 1)}, const_true(), body);
+}
+
 Stmt transform_kernel(Stmt s, const HWKernelDAG &dag, Scope<Expr> &scope) {
     Stmt ret;
 
@@ -542,10 +686,10 @@ Stmt transform_kernel(Stmt s, const HWKernelDAG &dag, Scope<Expr> &scope) {
         //Stmt stencil_pc = ProducerConsumer::make(stencil_name, produce, update, write_call);
         Stmt stencil_pc = Block::make(stencil_produce, stencil_consume);
 
-        // create a realization of the stencil of the step-size
+        // create a realization of the stencil of the update-size
         Region step_bounds;
         for (StencilDimSpecs dim: kernel.dims) {
-            step_bounds.push_back(Range(0, dim.step));
+            step_bounds.push_back(Range(0, dim.update_step()));
         }
         Stmt stencil_realize = Realize::make(stencil_name, kernel.func.output_types(), MemoryType::Auto, step_bounds, const_true(), stencil_pc);
 
@@ -566,26 +710,18 @@ Stmt transform_kernel(Stmt s, const HWKernelDAG &dag, Scope<Expr> &scope) {
 
             string loop_var_name = kernel.name + "." + kernel.func.args()[i]
                 + ".__scan_dim_" + std::to_string(scan_dim++);
+            Expr loop_extent = scan_loop_extent(kernel, i);
 
-            Expr store_extent = simplify(kernel.dims[i].store_bound.max -
-                                         kernel.dims[i].store_bound.min + 1);
-            //std::cout << store_extent << " ";
-            debug(3) << "kernel " << kernel.name << " store_extent = " << store_extent << '\n';
-
-            // check the condition for the new loop for sliding the update stencil
-            const IntImm *store_extent_int = store_extent.as<IntImm>();
-            internal_assert(store_extent_int);
-            if (store_extent_int->value % kernel.dims[i].step != 0) {
-                // we cannot handle this scenario yet
-                internal_error
-                    << "Line buffer extent (" << store_extent_int->value
-                    << ") is not divisible by the stencil step " << kernel.dims[i].step << '\n';
+            // the updates of one step are produced in consecutive cycles
+            if (kernel.dims[i].rate > 1) {
+                scan_loops = For::make(phase_var_name(kernel, i), 0, kernel.dims[i].rate,
+                                       ForType::Serial, DeviceAPI::Host, scan_loops);
             }
-            int loop_extent = store_extent_int->value / kernel.dims[i].step;
 
             // add letstmt to connect old loop var to new loop var_name
             // FIXME this is not correct in general
-            scan_loops = LetStmt::make(kernel.dims[i].loop_var, Variable::make(Int(32), loop_var_name), scan_loops);
+            Expr loop_var_value = Variable::make(Int(32), loop_var_name) * kernel.dims[i].hold;
+            scan_loops = LetStmt::make(kernel.dims[i].loop_var, simplify(loop_var_value), scan_loops);
             scan_loops = For::make(loop_var_name, 0, loop_extent, ForType::Serial, DeviceAPI::Host, scan_loops);
         }
         //std::cout << "\n";
@@ -599,7 +735,7 @@ Stmt transform_kernel(Stmt s, const HWKernelDAG &dag, Scope<Expr> &scope) {
         //std::cout << consume_node->name << " after recursion\n";
         
         // Add line buffer and dispatcher
-        Stmt stream_realize = add_linebuffer(stream_consume, kernel);
+        Stmt stream_realize = add_linebuffer(stream_consume, kernel, dag);
 
         // create the PC node for update stream
         //Stmt stream_pc = ProducerConsumer::make(stream_name, scan_loops, Stmt(), stream_realize);
@@ -748,20 +884,19 @@ Stmt transform_kernel(Stmt s, const HWKernelDAG &dag, Scope<Expr> &scope) {
             if (kernel.dims[i].loop_var != "undef") {
                 string loop_var_name = kernel.name + "." + kernel.func.args()[i]
                     + ".__scan_dim_" + std::to_string(scan_dim++);
-                Expr store_extent = simplify(kernel.dims[i].store_bound.max -
-                                             kernel.dims[i].store_bound.min + 1);
-                const IntImm *store_extent_int = store_extent.as<IntImm>();
-                internal_assert(store_extent_int);
-                int loop_extent = store_extent_int->value / kernel.dims[i].step;
-
                 Expr loop_var = Variable::make(Int(32), loop_var_name);
-                Expr loop_max = make_const(Int(32), loop_extent - 1);
+                Expr loop_max = simplify(scan_loop_extent(kernel, i) - 1);
                 write_args.push_back(loop_var);
                 write_args.push_back(loop_max);
             }
         }
         Stmt write_call = Evaluate::make(Call::make(Handle(), "write_stream", write_args, Call::Intrinsic));
 
+        if (is_sparse_output(kernel)) {
+            write_call = compact_output_write(kernel, write_args);
+            stream_name = kernel.name + ".record.stream";
+        }
+
         //Stmt stencil_pc = ProducerConsumer::make(stencil_name, produce, Stmt(), write_call);
         Stmt stencil_produce = ProducerConsumer::make_produce(stencil_name, produce);
         Stmt stencil_consume = ProducerConsumer::make_consume(stencil_name, write_call);
@@ -790,21 +925,7 @@ Stmt transform_kernel(Stmt s, const HWKernelDAG &dag, Scope<Expr> &scope) {
 
             string loop_var_name = kernel.name + "." + kernel.func.args()[i]
                 + ".__scan_dim_" + std::to_string(scan_dim++);
-
-            Expr store_extent = simplify(kernel.dims[i].store_bound.max -
-                                         kernel.dims[i].store_bound.min + 1);
-            debug(3) << "kernel " << kernel.name << " store_extent = " << store_extent << '\n';
-
-            // check the condition for the new loop for sliding the update stencil
-            const IntImm *store_extent_int = store_extent.as<IntImm>();
-            internal_assert(store_extent_int);
-            if (store_extent_int->value % kernel.dims[i].step != 0) {
-                // we cannot handle this scenario yet
-                internal_error
-                    << "Line buffer extent (" << store_extent_int->value
-                    << ") is not divisible by the stencil step " << kernel.dims[i].step << '\n';
-            }
-            int loop_extent = store_extent_int->value / kernel.dims[i].step;
+            Expr loop_extent = scan_loop_extent(kernel, i);
 
             // add letstmt to connect old loop var to new loop var_name
             // FIXME this is not correct in general
@@ -906,7 +1027,7 @@ class StreamOpt : public IRMutator2 {
             // insert line buffers for input streams
             for (const string &kernel_name : dag.input_kernels) {
                 const HWKernel &input_kernel = dag.kernels.find(kernel_name)->second;
-                new_body = add_linebuffer(new_body, input_kernel);
+                new_body = add_linebuffer(new_body, input_kernel, dag);
             }
 
             // Rewrap the let statements
@@ -952,6 +1073,11 @@ class StreamOpt : public IRMutator2 {
                     kernel.name + ".stencil_update.stream" : kernel.name + ".stencil.stream";
 
                 string direction = kernel.is_output ? "stream_to_buffer" : "buffer_to_stream";
+                if (is_sparse_output(kernel)) {
+                    // the host scatters the records into a zeroed subimage
+                    stream_name = kernel.name + ".record.stream";
+                    direction = "records_to_buffer";
+                }
                 Expr stream_var = Variable::make(Handle(), stream_name);
 
                 // derive the coordinate of the sub-image block
@@ -976,7 +1102,10 @@ class StreamOpt : public IRMutator2 {
 
                 Region bounds;
                 for (StencilDimSpecs dim: kernel.dims) {
-                    bounds.push_back(Range(0, dim.step));
+                    bounds.push_back(Range(0, dim.update_step()));
+                }
+                if (is_sparse_output(kernel)) {
+                    bounds = {Range(0, (int)kernel.dims.size() + 1)};
                 }
                 new_body = Realize::make(stream_name, kernel.func.output_types(), MemoryType::Auto, bounds, const_true(), Block::make(stream_subimg, new_body));
             }
@@ -990,7 +1119,10 @@ class StreamOpt : public IRMutator2 {
                 const HWTap &tap = p.second;
                 const string stencil_name = tap.name + ".tap.stencil";
 
-                Expr buffer_var = Variable::make(type_of<struct buffer_t *>(), tap.name + ".buffer");
+                // input buffers keep their parameter, so the CPU emulation can read them
+                Expr buffer_var = tap.is_func ?
+                    Variable::make(type_of<struct buffer_t *>(), tap.name + ".buffer") :
+                    Variable::make(type_of<struct buffer_t *>(), tap.name + ".buffer", tap.param);
                 Expr stencil_var = Variable::make(Handle(), stencil_name);
                 vector<Expr> args({buffer_var, stencil_var});
                 Stmt convert_call = Evaluate::make(Call::make(Handle(), "buffer_to_stencil", args, Call::Intrinsic));
@@ -1059,6 +1191,20 @@ public:
         : dag(d) {}
 };
 
+bool is_runtime_extent(Expr e) {
+    const Call *call = e.as<Call>();
+    return call && call->name == "hw_max_extent";
+}
+
+int max_extent_value(Expr e) {
+    if (is_runtime_extent(e)) {
+        e = e.as<Call>()->args[1];
+    }
+    const int64_t *value = as_const_int(e);
+    internal_assert(value) << "extent " << e << " has no constant maximum\n";
+    return (int)*value;
+}
+
 Stmt stream_opt(Stmt s, const HWKernelDAG &dag) {
     debug(3) << s << "\n";
     s = StreamOpt(dag).mutate(s);
@@ -16,6 +16,16 @@ namespace Internal {
  */
 Stmt stream_opt(Stmt s, const HWKernelDAG &dag);
 
+/** Extents of accelerator buffers that are only known at runtime are
+ * passed to the hardware backends as hw_max_extent(extent, max), where
+ * max is the largest value the extent can take (see Func::hw_max_extent).
+ */
+// @{
+bool is_runtime_extent(Expr e);
+/** The largest value of an extent. A constant extent is its own maximum. */
+int max_extent_value(Expr e);
+// @}
+
 }
 }
 
@@ -309,6 +309,8 @@ const std::map<std::string, Target::Feature> feature_name_map = {
     {"coreir", Target::CoreIR},
     {"coreir_valid", Target::CoreIRValid},
     {"hls", Target::HLS},
+    {"coreir_continuous", Target::CoreIRContinuous},
+    {"pool_allocator", Target::PoolAllocator},
     // NOTE: When adding features to this map, be sure to update
     // PyEnums.cpp and halide.cmake as well.
 };
@@ -104,6 +104,8 @@ struct Target {
         CoreIR = halide_target_feature_coreir,
         CoreIRValid = halide_target_feature_coreir_valid,
         HLS = halide_target_feature_hls,
+        CoreIRContinuous = halide_target_feature_coreir_continuous,
+        PoolAllocator = halide_target_feature_pool_allocator,
         FeatureEnd = halide_target_feature_end
     };
     Target() : os(OSUnknown), arch(ArchUnknown), bits(0) {}
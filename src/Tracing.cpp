@@ -46,6 +46,40 @@ struct TraceEventBuilder {
     }
 };
 
+// Loads and stores to be aggregated rather than traced carry this tag,
+// which the runtime checks for.
+const char *const aggregate_trace_tag = "aggregate";
+
+// The condition under which a load or store at the given coordinates
+// passes the filter, or an undefined Expr if they all do.
+Expr trace_filter_condition(const TraceFilter &filter, const vector<Expr> &coords) {
+    Expr cond;
+    for (size_t i = 0; i < filter.region.size() && i < coords.size(); i++) {
+        Expr min = filter.region[i].first, extent = filter.region[i].second;
+        Expr c = coords[i];
+        if (min.defined()) {
+            Expr in_range = c >= cast(c.type(), min);
+            cond = cond.defined() ? (cond && in_range) : in_range;
+        }
+        if (min.defined() && extent.defined()) {
+            Expr in_range = c < cast(c.type(), min + extent);
+            cond = cond.defined() ? (cond && in_range) : in_range;
+        }
+    }
+    if (filter.sample_every > 1 && !coords.empty()) {
+        // Hash the coordinates so that the sites picked don't line up
+        // with the schedule, and don't depend on the order they're
+        // visited in.
+        Expr h = make_zero(UInt(32));
+        for (const Expr &c : coords) {
+            h = (h + cast<uint32_t>(c)) * make_const(UInt(32), 0x9e3779b1u);
+        }
+        Expr sampled = ((h >> 16) % make_const(UInt(32), filter.sample_every)) == make_zero(UInt(32));
+        cond = cond.defined() ? (cond && sampled) : sampled;
+    }
+    return cond;
+}
+
 class InjectTracing : public IRMutator2 {
 public:
     const map<string, Function> &env;
@@ -94,6 +128,18 @@ private:
         }
     }
 
+    // Only make the trace call if the coordinates pass the filter.
+    Expr guard_trace(Expr trace, const TraceFilter &filter, const vector<Expr> &coords) {
+        Expr cond = trace_filter_condition(filter, coords);
+        if (cond.defined()) {
+            // Note: VectorizeLoops special-cases this too, so that a
+            // vector is traced if any lane passes.
+            trace = Call::make(Int(32), Call::if_then_else,
+                               {cond, trace, 0}, Call::PureIntrinsic);
+        }
+        return trace;
+    }
+
     using IRMutator2::visit;
 
     Expr visit(const Call *op) override {
@@ -102,6 +148,7 @@ private:
         internal_assert(op);
         bool trace_it = false;
         Expr trace_parent;
+        TraceFilter filter;
         if (op->call_type == Call::Halide) {
             auto it = env.find(op->name);
             internal_assert(it != env.end()) << op->name << " not in environment\n";
@@ -112,6 +159,7 @@ private:
             trace_parent = Variable::make(Int(32), op->name + ".trace_id");
             if (trace_it) {
                 add_trace_tags(op->name, f.get_trace_tags());
+                filter = f.get_trace_load_filter();
             }
         } else if (op->call_type == Call::Image) {
             trace_it = trace_all_loads;
@@ -129,6 +177,7 @@ private:
                     f.schedule().compute_level().is_inlined()) {
                     trace_it = true;
                     add_trace_tags(op->name, f.get_trace_tags());
+                    filter = f.get_trace_load_filter();
                 }
             }
 
@@ -149,7 +198,10 @@ private:
             builder.event = halide_trace_load;
             builder.parent_id = trace_parent;
             builder.value_index = op->value_index;
-            Expr trace = builder.build();
+            if (filter.aggregate) {
+                builder.trace_tag_expr = Expr(aggregate_trace_tag);
+            }
+            Expr trace = guard_trace(builder.build(), filter, op->args);
 
             expr = Let::make(value_var_name, op,
                              Call::make(op->type, Call::return_second,
@@ -174,11 +226,29 @@ private:
             const vector<Expr> &values = op->values;
             vector<Expr> traces(op->values.size());
 
+            // Lift the args out into lets so that the order of
+            // evaluation is right for scatters. Otherwise the store
+            // is traced before any loads in the index.
+            vector<Expr> args = op->args;
+            vector<pair<string, Expr>> lets;
+            for (size_t i = 0; i < args.size(); i++) {
+                if (!args[i].as<Variable>() && !is_const(args[i])) {
+                    string name = unique_name('t');
+                    lets.push_back({name, args[i]});
+                    args[i] = Variable::make(args[i].type(), name);
+                }
+            }
+
+            const TraceFilter &filter = f.is_tracing_stores() ? f.get_trace_store_filter() : TraceFilter();
+
             TraceEventBuilder builder;
             builder.func = f.name();
             builder.coordinates = op->args;
             builder.event = halide_trace_store;
             builder.parent_id = Variable::make(Int(32), op->name + ".trace_id");
+            if (filter.aggregate) {
+                builder.trace_tag_expr = Expr(aggregate_trace_tag);
+            }
             for (size_t i = 0; i < values.size(); i++) {
                 Type t = values[i].type();
                 add_func_touched(f.name(), (int) i, t);
@@ -188,26 +258,13 @@ private:
                 builder.type = t;
                 builder.value_index = (int)i;
                 builder.value = {value_var};
-                Expr trace = builder.build();
+                Expr trace = guard_trace(builder.build(), filter, args);
 
                 traces[i] = Let::make(value_var_name, values[i],
                                       Call::make(t, Call::return_second,
                                                  {trace, value_var}, Call::PureIntrinsic));
             }
 
-            // Lift the args out into lets so that the order of
-            // evaluation is right for scatters. Otherwise the store
-            // is traced before any loads in the index.
-            vector<Expr> args = op->args;
-            vector<pair<string, Expr>> lets;
-            for (size_t i = 0; i < args.size(); i++) {
-                if (!args[i].as<Variable>() && !is_const(args[i])) {
-                    string name = unique_name('t');
-                    lets.push_back({name, args[i]});
-                    args[i] = Variable::make(args[i].type(), name);
-                }
-            }
-
             stmt = Provide::make(op->name, traces, args);
             for (const auto &p : lets) {
                 stmt = LetStmt::make(p.first, p.second, stmt);
@@ -541,6 +541,22 @@ class VectorSubs : public IRMutator2 {
                 }
             }
             return Call::make(op->type, Call::trace, new_args, op->call_type);
+        } else if (op->is_intrinsic(Call::if_then_else) &&
+                   op->args[1].as<Call>() &&
+                   op->args[1].as<Call>()->name == Call::trace) {
+            // A trace call guarded by a TraceFilter. The trace call
+            // above covers the entire vector, so make it if any of the
+            // lanes pass the filter.
+            Expr cond = new_args[0];
+            if (cond.type().is_vector()) {
+                Expr any_lane = extract_lane(cond, 0);
+                for (int k = 1; k < cond.type().lanes(); k++) {
+                    any_lane = any_lane || extract_lane(cond, k);
+                }
+                cond = any_lane;
+            }
+            return Call::make(op->type, Call::if_then_else,
+                              {cond, new_args[1], new_args[2]}, op->call_type);
         } else {
             // Widen the args to have the same lanes as the max lanes found
             for (size_t i = 0; i < new_args.size(); i++) {
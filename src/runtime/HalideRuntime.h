@@ -281,6 +281,33 @@ extern int halide_default_semaphore_release(struct halide_semaphore_t *, int n);
 extern bool halide_default_semaphore_try_acquire(struct halide_semaphore_t *, int n);
 // @}
 
+/** Versions of do_par_for and do_parallel_tasks that share the
+ * default thread pool, but schedule parallel loops by work
+ * stealing. Each worker on a loop claims chunks of iterations from a
+ * range of its own, and steals half of another worker's range once
+ * its own is empty, so the work queue lock is only taken when a
+ * worker joins or leaves a loop rather than for every
+ * iteration. Tasks that acquire semaphores or run serially are
+ * scheduled as before. Install them together with the remaining
+ * default functions:
+ \code
+ halide_set_custom_parallel_runtime(
+     halide_work_stealing_do_par_for, halide_default_do_task,
+     halide_default_do_loop_task, halide_work_stealing_do_parallel_tasks,
+     halide_default_semaphore_init, halide_default_semaphore_try_acquire,
+     halide_default_semaphore_release);
+ \endcode
+ */
+// @{
+extern int halide_work_stealing_do_par_for(void *user_context,
+                                           halide_task_t task,
+                                           int min, int size, uint8_t *closure);
+extern int halide_work_stealing_do_parallel_tasks(void *user_context,
+                                                  int num_tasks,
+                                                  struct halide_parallel_task_t *tasks,
+                                                  void *task_parent);
+// @}
+
 struct halide_thread;
 
 /** Spawn a thread. Returns a handle to the thread for the purposes of
@@ -309,6 +336,30 @@ extern void halide_join_thread(struct halide_thread *);
  */
 extern int halide_set_num_threads(int n);
 
+/** Where the default thread pool places its workers. */
+typedef enum halide_thread_affinity_t {
+    /** Let the OS schedule the workers. */
+    halide_thread_affinity_none = 0,
+    /** Pin each worker to a core. Consecutive workers go to
+     * different NUMA nodes. */
+    halide_thread_affinity_cores = 1,
+    /** Pin each worker to all the cores of a NUMA node. */
+    halide_thread_affinity_nodes = 2
+} halide_thread_affinity_t;
+
+/** Set where the thread pool places its workers, and return the old
+ * setting. Placement is currently only implemented on Linux. It
+ * defaults to the value of the environment variable
+ * HL_THREAD_AFFINITY ("none", "cores" or "nodes"), and takes effect
+ * the next time the thread pool starts up, so call it before running
+ * any pipelines or after halide_shutdown_thread_pool. When workers are
+ * pinned, the topology chosen is printed with halide_print, and the
+ * work-stealing scheduler (see halide_work_stealing_do_par_for) hands
+ * the same block of iterations of each parallel loop to the workers
+ * of the same node, so that buffers first touched by a loop stay local
+ * to the node that uses them. */
+extern halide_thread_affinity_t halide_set_thread_affinity(halide_thread_affinity_t affinity);
+
 /** Halide calls these functions to allocate and free memory. To
  * replace in AOT code, use the halide_set_custom_malloc and
  * halide_set_custom_free, or (on platforms that support weak
@@ -337,6 +388,42 @@ extern halide_malloc_t halide_set_custom_malloc(halide_malloc_t user_malloc);
 extern halide_free_t halide_set_custom_free(halide_free_t user_free);
 //@}
 
+/** A pooling allocator for pipelines that run many times on small
+ * inputs, and so allocate and free the same sizes of temporaries over
+ * and over. Requests are rounded up to one of a set of size classes
+ * (two per doubling, up to 16MB), and freed blocks are kept for reuse:
+ * first in a small cache private to the freeing thread, then in a pool
+ * shared by all threads that holds at most the reclaim limit. Blocks
+ * come from halide_default_malloc/free. Install it with
+ * halide_set_custom_malloc(halide_pool_malloc) and
+ * halide_set_custom_free(halide_pool_free), or compile pipelines with
+ * the pool_allocator target feature to have just their heap
+ * allocations use it. The profiler's report includes its hit rate. */
+//@{
+extern void *halide_pool_malloc(void *user_context, size_t x);
+extern void halide_pool_free(void *user_context, void *ptr);
+
+/** Set the most bytes of free blocks the shared pool keeps. Zero
+ * restores the default of 64MB. */
+extern void halide_pool_allocator_set_limit(int64_t max_idle_bytes);
+
+/** Give all the free blocks held by the pool back to the system. */
+extern void halide_pool_allocator_release_unused(void *user_context);
+
+struct halide_pool_allocator_stats_t {
+    /** Allocations served from free blocks, and ones that had to
+     * allocate a new block. */
+    uint64_t hits, misses;
+    /** Allocations too large for any size class. */
+    uint64_t oversized;
+    /** The bytes of free blocks held, and the reclaim limit. */
+    int64_t idle_bytes, max_idle_bytes;
+};
+
+/** Fill in the counters of the pool allocator. Returns zero. */
+extern int halide_pool_allocator_stats(struct halide_pool_allocator_stats_t *stats);
+//@}
+
 /** Halide calls these functions to interact with the underlying
  * system runtime functions. To replace in AOT code on platforms that
  * support weak linking, define these functions yourself, or use
@@ -489,7 +576,9 @@ struct halide_trace_event_t {
     int32_t *coordinates;
 
     /** For halide_trace_tag, this points to a read-only null-terminated string
-     * of arbitrary text. For all other events, this will be null.
+     * of arbitrary text. For loads and stores of Funcs traced with
+     * TraceFilter::aggregate set, it is "aggregate". For all other events,
+     * this will be null.
      */
     const char *trace_tag;
 
@@ -524,7 +613,14 @@ struct halide_trace_event_t {
  * HL_TRACE_FILE is defined, dumps the trace to that file in a
  * sequence of trace packets. The header for a trace packet is defined
  * below. If the trace is going to be large, you may want to make the
- * file a named pipe, and then read from that pipe into gzip.
+ * file a named pipe, and then read from that pipe into gzip. Each
+ * thread buffers its own packets, so packets from different threads
+ * may be out of order in the file; their ids are assigned in the
+ * order they were traced, and restore it. If
+ * HL_TRACE_FILE ends in ".json", the realizations, productions and
+ * consumptions are instead written in the Chrome trace event format,
+ * which chrome://tracing and Perfetto can display, and loads and
+ * stores are not written.
  *
  * halide_trace returns a unique ID which will be passed to future
  * events that "belong" to the earlier event as the parent id. The
@@ -553,6 +649,12 @@ struct halide_trace_event_t {
  * Note that all trace_tag events (if any) will occur just after the begin_pipeline
  * event, but before any begin_realization events. All trace_tags for a given Func
  * will be emitted in the order added.
+ *
+ * The exception is the aggregates halide_default_trace keeps for Funcs
+ * traced with TraceFilter::aggregate set. It emits a trace_tag event
+ * of the form "aggregate store count N min A max B" (or "load") for
+ * each value of the Func just before the end of the production (or
+ * consumption) it was computed over.
  */
 // @}
 extern int32_t halide_trace(void *user_context, const struct halide_trace_event_t *event);
@@ -840,8 +942,10 @@ extern void halide_set_gpu_device(int n);
  * HL_GPU_DEVICE. */
 extern int halide_get_gpu_device(void *user_context);
 
-/** Set the soft maximum amount of memory, in bytes, that the LRU
- *  cache will use to memoize Func results.  This is not a strict
+/** Set the soft maximum amount of memory, in bytes, that the
+ *  cache will use to memoize Func results. When the cache is full,
+ *  the entries evicted first are those that took the least time to
+ *  compute per byte and have not been used recently (GreedyDual-Size).  This is not a strict
  *  maximum in that concurrency and simultaneous use of memoized
  *  reults larger than the cache size can both cause it to
  *  temporariliy be larger than the size specified here.
@@ -910,6 +1014,42 @@ extern void halide_memoization_cache_release(void *user_context, void *host);
  */
 extern void halide_memoization_cache_cleanup();
 
+/** Counters describing the behavior of the memoization cache since
+ * it was last cleaned up. */
+struct halide_memoization_cache_stats_t {
+    uint64_t hits, misses, evictions;
+    /** The number of results currently stored. */
+    uint64_t entries;
+    /** The bytes currently stored, and the soft maximum. */
+    int64_t current_size, max_size;
+    /** Misses satisfied from disk, and results written to disk. See
+     * halide_memoization_cache_set_disk_path. */
+    uint64_t disk_hits, disk_writes;
+};
+
+/** Fill in the counters of the memoization cache. Returns zero. */
+extern int halide_memoization_cache_stats(struct halide_memoization_cache_stats_t *stats);
+
+/** Keep memoized results on disk as well as in memory, so that later
+ * processes can reuse them. Each result stored is also written to a
+ * file in the directory at path, which is created if needed, and
+ * lookups that miss in memory map the file instead of recomputing.
+ * Results are shared by pipelines whose memoized Funcs have the same
+ * names and definitions, whichever process compiled them.
+ * Files are written to a temporary name and renamed into place, so a
+ * crash never leaves a partial result behind. They are only flushed
+ * to disk before the rename if the environment variable
+ * HL_MEMOIZATION_CACHE_SYNC is 1. The least recently used
+ * files are deleted to keep the directory under max_size bytes, or
+ * 1GB if max_size is zero. Passing NULL turns the disk tier off. If
+ * this is never called, the directory is read from the environment
+ * variable HL_MEMOIZATION_CACHE_DIR. Must not be called while
+ * memoized pipelines are running. Returns nonzero if the directory
+ * can't be used or the platform has no disk tier (only posix
+ * platforms do).
+ */
+extern int halide_memoization_cache_set_disk_path(void *user_context, const char *path, int64_t max_size);
+
 /** Create a unique file with a name of the form prefixXXXXXsuffix in an arbitrary
  * (but writable) directory; this is typically $TMP or /tmp, but the specific
  * location is not guaranteed. (Note that the exact form of the file name
@@ -1290,7 +1430,9 @@ typedef enum halide_target_feature_t {
     halide_target_feature_coreir = 58, ///< Enable output to CoreIR.
     halide_target_feature_coreir_valid = 59, ///< Enable output signal valid for CoreIR.
     halide_target_feature_hls = 60, ///< Enable output to HLS.
-    halide_target_feature_end = 61 ///< A sentinel. Every target is considered to have this feature, and setting this feature does nothing.
+    halide_target_feature_coreir_continuous = 61, ///< Stream frames back to back through CoreIR designs.
+    halide_target_feature_pool_allocator = 62, ///< Allocate heap temporaries with halide_pool_malloc/free instead of halide_malloc/free.
+    halide_target_feature_end = 63 ///< A sentinel. Every target is considered to have this feature, and setting this feature does nothing.
 } halide_target_feature_t;
 
 /** This function is called internally by Halide in some situations to determine
@@ -1637,7 +1779,12 @@ struct halide_filter_metadata_t {
 
 /** The functions below here are relevant for pipelines compiled with
  * the -profile target flag, which runs a sampling profiler thread
- * alongside the pipeline. */
+ * alongside the pipeline. On x86 Linux, setting the environment
+ * variable HL_PROFILER_PERF_COUNTERS=1 also reads the hardware
+ * performance counters of each thread every time it moves to a
+ * different Func, and reports instructions per cycle, last-level
+ * cache misses, and branch misses per Func. This makes a syscall per
+ * transition, so expect very finely interleaved Funcs to slow down. */
 
 /** Per-Func state tracked by the sampling profiler. */
 struct halide_profiler_func_stats {
@@ -1664,6 +1811,10 @@ struct halide_profiler_func_stats {
 
     /** The total number of memory allocation of this Func. */
     int num_allocs;
+
+    /** Hardware event counts while computing this Func, if the
+     * performance counters are being read. */
+    uint64_t cycles, instructions, llc_misses, branch_misses;
 };
 
 /** Per-pipeline state tracked by the sampling profiler. These exist
@@ -1711,6 +1862,31 @@ struct halide_profiler_pipeline_stats {
     int num_allocs;
 };
 
+/** The state of one running invocation of a pipeline. Each call
+ * into a pipeline compiled with the profile feature keeps one on its
+ * stack for as long as it runs, so that pipelines running at the same
+ * time on different threads are sampled independently. */
+struct halide_profiler_instance_state {
+    /** The id of the Func this invocation is currently computing. Set
+     * by the pipeline, read periodically by the profiler thread. */
+    int current_func;
+
+    /** The number of threads currently doing work for this
+     * invocation. */
+    int active_threads;
+
+    /** Nonzero if hardware performance counters are read at each
+     * change of current_func. */
+    int count_events;
+
+    /** The stats of the pipeline being run. */
+    struct halide_profiler_pipeline_stats *pipeline;
+
+    /** The next running instance. It's a void * because types in the
+     * Halide runtime may not currently be recursive. */
+    void *next;
+};
+
 /** The global state of the profiler. */
 
 struct halide_profiler_state {
@@ -1726,11 +1902,14 @@ struct halide_profiler_state {
     /** An internal id used for bookkeeping. */
     int first_free_id;
 
-    /** The id of the current running Func. Set by the pipeline, read
-     * periodically by the profiler thread. */
+    /** The id of the current running Func. Host pipelines report
+     * through their instance state instead, so this is only set by
+     * code offloaded elsewhere (e.g. a DSP), and to
+     * halide_profiler_please_stop to halt the profiler thread. */
     int current_func;
 
-    /** The number of threads currently doing work. */
+    /** The number of threads currently doing work in offloaded
+     * code. */
     int active_threads;
 
     /** A linked list of stats gathered for each pipeline. */
@@ -1743,6 +1922,9 @@ struct halide_profiler_state {
 
     /** Sampling thread reference to be joined at shutdown. */
     struct halide_thread *sampling_thread;
+
+    /** A linked list of the pipeline invocations currently running. */
+    struct halide_profiler_instance_state *instances;
 };
 
 /** Profiler func ids with special meanings. */
@@ -1764,11 +1946,9 @@ extern struct halide_profiler_state *halide_profiler_get_state();
 extern struct halide_profiler_pipeline_stats *halide_profiler_get_pipeline_state(const char *pipeline_name);
 
 /** Reset profiler state cheaply. May leave threads running or some
- * memory allocated but all accumluated statistics are reset.
- * WARNING: Do NOT call this method while any halide pipeline is
- * running; halide_profiler_memory_allocate/free and
- * halide_profiler_stack_peak_update update the profiler pipeline's
- * state without grabbing the global profiler state's lock. */
+ * memory allocated but all accumluated statistics are reset. The
+ * stats of pipelines still running on other threads are kept, and
+ * count again from zero. */
 extern void halide_profiler_reset();
 
 /** Reset all profiler state.
@@ -1782,6 +1962,12 @@ void halide_profiler_shutdown();
  * reset. Also happens at process exit. */
 extern void halide_profiler_report(void *user_context);
 
+/** Write the timing statistics for everything run since the last
+ * reset to a file as JSON, for consumption by other tools. If
+ * HL_PROFILER_JSON is defined, this also happens to that file
+ * whenever a report is printed. Returns zero on success. */
+extern int halide_profiler_report_json(void *user_context, const char *filename);
+
 /// \name "Float16" functions
 /// These functions operate of bits (``uint16_t``) representing a half
 /// precision floating point number (IEEE-754 2008 binary16).
@@ -67,8 +67,6 @@ WEAK bool buffer_has_shape(const halide_buffer_t *buf, const halide_dimension_t
 
 struct CacheEntry {
     CacheEntry *next;
-    CacheEntry *more_recent;
-    CacheEntry *less_recent;
     uint8_t *metadata_storage;
     size_t key_size;
     uint8_t *key;
@@ -80,11 +78,22 @@ struct CacheEntry {
     halide_dimension_t *computed_bounds;
     // The actual stored data.
     halide_buffer_t *buf;
+    // The bytes of host memory held by the entry, and how long it took
+    // to compute them.
+    uint64_t size;
+    int64_t compute_time;
+    // The GreedyDual-Size priority. The entry with the lowest priority
+    // is evicted first.
+    double priority;
+    // The position of the entry in its shard's eviction heap. -1 while
+    // the entry is in use, as only unused entries can be evicted.
+    int32_t heap_index;
 
     bool init(const uint8_t *cache_key, size_t cache_key_size,
               uint32_t key_hash,
               const halide_buffer_t *computed_bounds_buf,
-              int32_t tuples, halide_buffer_t **tuple_buffers);
+              int32_t tuples, halide_buffer_t **tuple_buffers,
+              int64_t time_to_compute);
     void destroy();
     halide_buffer_t &buffer(int32_t i);
 
@@ -93,6 +102,9 @@ struct CacheEntry {
 struct CacheBlockHeader {
     CacheEntry *entry;
     uint32_t hash;
+    // When the lookup that missed was made, so that the store can tell
+    // how long the entry took to compute.
+    int64_t lookup_time;
 };
 
 // Each host block has extra space to store a header just before the
@@ -112,15 +124,18 @@ WEAK CacheBlockHeader *get_pointer_to_header(uint8_t * host) {
 
 WEAK bool CacheEntry::init(const uint8_t *cache_key, size_t cache_key_size,
                            uint32_t key_hash, const halide_buffer_t *computed_bounds_buf,
-                           int32_t tuples, halide_buffer_t **tuple_buffers) {
+                           int32_t tuples, halide_buffer_t **tuple_buffers,
+                           int64_t time_to_compute) {
     next = NULL;
-    more_recent = NULL;
-    less_recent = NULL;
     key_size = cache_key_size;
     hash = key_hash;
     in_use_count = 0;
     tuple_count = tuples;
     dimensions = computed_bounds_buf->dimensions;
+    size = 0;
+    compute_time = time_to_compute;
+    priority = 0;
+    heap_index = -1;
 
     // Allocate all the necessary space (or die)
     size_t storage_bytes = 0;
@@ -165,6 +180,7 @@ WEAK bool CacheEntry::init(const uint8_t *cache_key, size_t cache_key_size,
         for (int j = 0; j < dimensions; j++) {
             buf[i].dim[j] = tuple_buffers[i]->dim[j];
         }
+        size += buf[i].size_in_bytes();
     }
     return true;
 }
@@ -177,71 +193,252 @@ WEAK void CacheEntry::destroy() {
     halide_free(NULL, metadata_storage);
 }
 
-WEAK uint32_t djb_hash(const uint8_t *key, size_t key_size)  {
-    uint32_t h = 5381;
-    for (size_t i = 0; i < key_size; i++) {
-        h = (h << 5) + h + key[i];
-    }
-    return h;
+// Hash the key eight bytes at a time.
+WEAK uint32_t hash_key(const uint8_t *key, size_t key_size) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ key_size;
+    size_t i = 0;
+    for (; i + 8 <= key_size; i += 8) {
+        uint64_t word;
+        memcpy(&word, key + i, sizeof(word));
+        h = (h ^ word) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    uint64_t tail = 0;
+    for (; i < key_size; i++) {
+        tail = (tail << 8) | key[i];
+    }
+    h = (h ^ tail) * 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (uint32_t)h;
 }
 
-WEAK halide_mutex memoization_lock = { { 0 } };
+// The cache is split into shards, each with its own lock and hash
+// table, so that threads looking up different keys rarely contend.
+struct CacheShard {
+    halide_mutex lock;
 
-const size_t kHashTableSize = 256;
+    // A hash table that doubles in size as entries are added. Empty
+    // until the first store.
+    CacheEntry **buckets;
+    uint32_t num_buckets;
+    uint32_t num_entries;
 
-WEAK CacheEntry *cache_entries[kHashTableSize];
+    // The entries not in use, as a binary min-heap on priority.
+    CacheEntry **heap;
+    uint32_t heap_size;
+    uint32_t heap_capacity;
+
+    uint64_t hits, misses, evictions;
+};
 
-WEAK CacheEntry *most_recently_used = NULL;
-WEAK CacheEntry *least_recently_used = NULL;
+const int kCacheShardBits = 4;
+const int kCacheShards = 1 << kCacheShardBits;
+const uint32_t kInitialBuckets = 16;
+
+WEAK CacheShard cache_shards[kCacheShards];
+
+// Shards are picked with the top bits of the hash and buckets with the
+// bottom bits.
+WEAK CacheShard &shard_for(uint32_t hash) {
+    return cache_shards[hash >> (32 - kCacheShardBits)];
+}
+
+// Serializes eviction, which looks at every shard.
+WEAK halide_mutex eviction_lock = { { 0 } };
 
 const uint64_t kDefaultCacheSize = 1 << 20;
 WEAK int64_t max_cache_size = kDefaultCacheSize;
+// Only changed atomically, as stores to different shards update it concurrently.
 WEAK int64_t current_cache_size = 0;
 
+// The GreedyDual-Size inflation value: the priority of the last entry
+// evicted. Entries get a priority of this plus their compute time per
+// byte each time they stop being used, so entries that are cheap to
+// recompute for their size age out first, and entries that are not
+// used again eventually do too.
+WEAK double cache_inflation = 0;
+
+// Misses satisfied by the disk tier, and results written to it.
+WEAK uint64_t cache_disk_hits = 0;
+WEAK uint64_t cache_disk_writes = 0;
+
+WEAK void update_priority(CacheEntry *entry) {
+    double inflation;
+    __atomic_load(&cache_inflation, &inflation, __ATOMIC_RELAXED);
+    uint64_t size = entry->size > 0 ? entry->size : 1;
+    int64_t cost = entry->compute_time > 0 ? entry->compute_time : 1;
+    entry->priority = inflation + (double)cost / (double)size;
+}
+
+WEAK void heap_set(CacheShard &shard, uint32_t i, CacheEntry *entry) {
+    shard.heap[i] = entry;
+    entry->heap_index = i;
+}
+
+WEAK void heap_sift_up(CacheShard &shard, uint32_t i) {
+    CacheEntry *entry = shard.heap[i];
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (shard.heap[parent]->priority <= entry->priority) {
+            break;
+        }
+        heap_set(shard, i, shard.heap[parent]);
+        i = parent;
+    }
+    heap_set(shard, i, entry);
+}
+
+WEAK void heap_sift_down(CacheShard &shard, uint32_t i) {
+    CacheEntry *entry = shard.heap[i];
+    while (true) {
+        uint32_t child = 2 * i + 1;
+        if (child >= shard.heap_size) {
+            break;
+        }
+        if (child + 1 < shard.heap_size &&
+            shard.heap[child + 1]->priority < shard.heap[child]->priority) {
+            child++;
+        }
+        if (entry->priority <= shard.heap[child]->priority) {
+            break;
+        }
+        heap_set(shard, i, shard.heap[child]);
+        i = child;
+    }
+    heap_set(shard, i, entry);
+}
+
+// Make an entry that is no longer in use a candidate for eviction. If
+// the heap can't grow, the entry just stays in the cache until cleanup.
+WEAK void heap_push(CacheShard &shard, CacheEntry *entry) {
+    if (shard.heap_size == shard.heap_capacity) {
+        uint32_t capacity = shard.heap_capacity ? shard.heap_capacity * 2 : kInitialBuckets;
+        CacheEntry **heap = (CacheEntry **)halide_malloc(NULL, capacity * sizeof(CacheEntry *));
+        if (!heap) {
+            return;
+        }
+        if (shard.heap) {
+            memcpy(heap, shard.heap, shard.heap_size * sizeof(CacheEntry *));
+            halide_free(NULL, shard.heap);
+        }
+        shard.heap = heap;
+        shard.heap_capacity = capacity;
+    }
+    update_priority(entry);
+    heap_set(shard, shard.heap_size++, entry);
+    heap_sift_up(shard, entry->heap_index);
+}
+
+WEAK void heap_remove(CacheShard &shard, CacheEntry *entry) {
+    uint32_t i = entry->heap_index;
+    entry->heap_index = -1;
+    CacheEntry *last = shard.heap[--shard.heap_size];
+    if (i < shard.heap_size) {
+        heap_set(shard, i, last);
+        heap_sift_down(shard, i);
+        heap_sift_up(shard, last->heap_index);
+    }
+}
+
+WEAK bool insert_entry(CacheShard &shard, CacheEntry *entry) {
+    if (shard.num_entries >= shard.num_buckets) {
+        // Double the table. If that fails, chains just get longer.
+        uint32_t num_buckets = shard.num_buckets ? shard.num_buckets * 2 : kInitialBuckets;
+        CacheEntry **buckets = (CacheEntry **)halide_malloc(NULL, num_buckets * sizeof(CacheEntry *));
+        if (buckets) {
+            memset(buckets, 0, num_buckets * sizeof(CacheEntry *));
+            for (uint32_t i = 0; i < shard.num_buckets; i++) {
+                CacheEntry *e = shard.buckets[i];
+                while (e != NULL) {
+                    CacheEntry *next = e->next;
+                    uint32_t index = e->hash & (num_buckets - 1);
+                    e->next = buckets[index];
+                    buckets[index] = e;
+                    e = next;
+                }
+            }
+            if (shard.buckets) {
+                halide_free(NULL, shard.buckets);
+            }
+            shard.buckets = buckets;
+            shard.num_buckets = num_buckets;
+        } else if (shard.num_buckets == 0) {
+            return false;
+        }
+    }
+    uint32_t index = entry->hash & (shard.num_buckets - 1);
+    entry->next = shard.buckets[index];
+    shard.buckets[index] = entry;
+    shard.num_entries++;
+    return true;
+}
+
+WEAK void remove_entry(CacheShard &shard, CacheEntry *entry) {
+    CacheEntry **prev = &shard.buckets[entry->hash & (shard.num_buckets - 1)];
+    while (*prev != entry) {
+        halide_assert(NULL, *prev != NULL);
+        prev = &(*prev)->next;
+    }
+    *prev = entry->next;
+    shard.num_entries--;
+}
+
+WEAK CacheEntry *find_entry(CacheShard &shard, uint32_t h, const uint8_t *cache_key, int32_t size,
+                            const halide_buffer_t *computed_bounds, int32_t tuple_count) {
+    if (shard.num_buckets == 0) {
+        return NULL;
+    }
+    CacheEntry *entry = shard.buckets[h & (shard.num_buckets - 1)];
+    while (entry != NULL) {
+        if (entry->hash == h && entry->key_size == (size_t)size &&
+            keys_equal(entry->key, cache_key, size) &&
+            buffer_has_shape(computed_bounds, entry->computed_bounds) &&
+            entry->tuple_count == (uint32_t)tuple_count) {
+            return entry;
+        }
+        entry = entry->next;
+    }
+    return NULL;
+}
+
 #if CACHE_DEBUGGING
 WEAK void validate_cache() {
     print(NULL) << "validating cache, "
                 << "current size " << current_cache_size
                 << " of maximum " << max_cache_size << "\n";
-    int entries_in_hash_table = 0;
-    for (size_t i = 0; i < kHashTableSize; i++) {
-        CacheEntry *entry = cache_entries[i];
-        while (entry != NULL) {
-            entries_in_hash_table++;
-            if (entry->more_recent == NULL && entry != most_recently_used) {
-                halide_print(NULL, "cache invalid case 1\n");
-                __builtin_trap();
-            }
-            if (entry->less_recent == NULL && entry != least_recently_used) {
-                halide_print(NULL, "cache invalid case 2\n");
-                __builtin_trap();
+    int64_t size_in_shards = 0;
+    for (int s = 0; s < kCacheShards; s++) {
+        CacheShard &shard = cache_shards[s];
+        ScopedMutexLock lock(&shard.lock);
+        uint32_t entries = 0, unused = 0;
+        for (uint32_t i = 0; i < shard.num_buckets; i++) {
+            for (CacheEntry *entry = shard.buckets[i]; entry != NULL; entry = entry->next) {
+                entries++;
+                size_in_shards += entry->size;
+                if (&shard_for(entry->hash) != &shard) {
+                    halide_print(NULL, "cache invalid case 1\n");
+                    __builtin_trap();
+                }
+                if ((entry->in_use_count == 0) != (entry->heap_index >= 0) &&
+                    shard.heap_size < shard.heap_capacity) {
+                    halide_print(NULL, "cache invalid case 2\n");
+                    __builtin_trap();
+                }
+                if (entry->heap_index >= 0) {
+                    unused++;
+                    if (shard.heap[entry->heap_index] != entry) {
+                        halide_print(NULL, "cache invalid case 3\n");
+                        __builtin_trap();
+                    }
+                }
             }
-            entry = entry->next;
+        }
+        if (entries != shard.num_entries || unused != shard.heap_size) {
+            halide_print(NULL, "cache invalid case 4\n");
+            __builtin_trap();
         }
     }
-    int entries_from_mru = 0;
-    CacheEntry *mru_chain = most_recently_used;
-    while (mru_chain != NULL) {
-        entries_from_mru++;
-        mru_chain = mru_chain->less_recent;
-    }
-    int entries_from_lru = 0;
-    CacheEntry *lru_chain = least_recently_used;
-    while (lru_chain != NULL) {
-        entries_from_lru++;
-        lru_chain = lru_chain->more_recent;
-    }
-    print(NULL) << "hash entries " << entries_in_hash_table
-                << ", mru entries " << entries_from_mru
-                << ", lru entries " << entries_from_lru << "\n";
-    if (entries_in_hash_table != entries_from_mru) {
-        halide_print(NULL, "cache invalid case 3\n");
-        __builtin_trap();
-    }
-    if (entries_in_hash_table != entries_from_lru) {
-        halide_print(NULL, "cache invalid case 4\n");
-        __builtin_trap();
-    }
+    print(NULL) << "size of entries in shards " << size_in_shards << "\n";
     if (current_cache_size < 0) {
         halide_print(NULL, "cache size is negative\n");
         __builtin_trap();
@@ -249,62 +446,130 @@ WEAK void validate_cache() {
 }
 #endif
 
+// Evict the unused entry with the lowest priority in the whole
+// cache. Only one shard is locked at a time. Returns false if nothing
+// can be evicted. Must be called with the eviction lock held.
+WEAK bool evict_one_entry() {
+    int victim = -1;
+    double lowest = 0;
+    for (int s = 0; s < kCacheShards; s++) {
+        CacheShard &shard = cache_shards[s];
+        ScopedMutexLock lock(&shard.lock);
+        if (shard.heap_size > 0 &&
+            (victim < 0 || shard.heap[0]->priority < lowest)) {
+            victim = s;
+            lowest = shard.heap[0]->priority;
+        }
+    }
+    if (victim < 0) {
+        return false;
+    }
+
+    CacheEntry *entry = NULL;
+    {
+        CacheShard &shard = cache_shards[victim];
+        ScopedMutexLock lock(&shard.lock);
+        // The entry may have been picked up again since we looked, in
+        // which case we evict whatever is cheapest now.
+        if (shard.heap_size == 0) {
+            return true;
+        }
+        entry = shard.heap[0];
+        heap_remove(shard, entry);
+        remove_entry(shard, entry);
+        shard.evictions++;
+        double inflation;
+        __atomic_load(&cache_inflation, &inflation, __ATOMIC_RELAXED);
+        if (entry->priority > inflation) {
+            __atomic_store(&cache_inflation, &entry->priority, __ATOMIC_RELAXED);
+        }
+    }
+    __atomic_fetch_sub(&current_cache_size, (int64_t)entry->size, __ATOMIC_RELAXED);
+
+    // Deallocate the entry.
+    entry->destroy();
+    halide_free(NULL, entry);
+    return true;
+}
+
 WEAK void prune_cache() {
+    ScopedMutexLock lock(&eviction_lock);
 #if CACHE_DEBUGGING
     validate_cache();
 #endif
-    CacheEntry *prune_candidate = least_recently_used;
-    while (current_cache_size > max_cache_size &&
-           prune_candidate != NULL) {
-        CacheEntry *more_recent = prune_candidate->more_recent;
-
-        if (prune_candidate->in_use_count == 0) {
-            uint32_t h = prune_candidate->hash;
-            uint32_t index = h % kHashTableSize;
-
-            // Remove from hash table
-            CacheEntry *prev_hash_entry = cache_entries[index];
-            if (prev_hash_entry == prune_candidate) {
-                cache_entries[index] = prune_candidate->next;
-            } else {
-                while (prev_hash_entry != NULL && prev_hash_entry->next != prune_candidate) {
-                    prev_hash_entry = prev_hash_entry->next;
-                }
-                halide_assert(NULL, prev_hash_entry != NULL);
-                prev_hash_entry->next = prune_candidate->next;
-            }
+    while (__atomic_load_n(&current_cache_size, __ATOMIC_RELAXED) > max_cache_size &&
+           evict_one_entry()) {
+    }
+#if CACHE_DEBUGGING
+    validate_cache();
+#endif
+}
+
+// Add a result held in buffers allocated by
+// halide_memoization_cache_lookup to the cache. The caller keeps using
+// the buffers until it releases them.
+WEAK void store_entry(void *user_context, const uint8_t *cache_key, int32_t size,
+                     halide_buffer_t *computed_bounds,
+                     int32_t tuple_count, halide_buffer_t **tuple_buffers,
+                     uint32_t h, int64_t compute_time) {
+    CacheShard &shard = shard_for(h);
+
+    // Set up the entry before taking the lock.
+    CacheEntry *new_entry = (CacheEntry *)halide_malloc(NULL, sizeof(CacheEntry));
+    bool inited = false;
+    if (new_entry) {
+        inited = new_entry->init(cache_key, size, h, computed_bounds, tuple_count, tuple_buffers, compute_time);
+        if (!inited) {
+            halide_free(user_context, new_entry);
+            new_entry = NULL;
+        }
+    }
+
+    {
+        ScopedMutexLock lock(&shard.lock);
 
-            // Remove from less recent chain.
-            if (least_recently_used == prune_candidate) {
-                least_recently_used = more_recent;
+        CacheEntry *entry = find_entry(shard, h, cache_key, size, computed_bounds, tuple_count);
+        bool all_bounds_equal = false;
+        if (entry != NULL) {
+            all_bounds_equal = true;
+            bool no_host_pointers_equal = true;
+            for (int32_t i = 0; all_bounds_equal && i < tuple_count; i++) {
+                halide_buffer_t *buf = tuple_buffers[i];
+                all_bounds_equal = buffer_has_shape(tuple_buffers[i], entry->buf[i].dim);
+                if (entry->buf[i].host == buf->host) {
+                    no_host_pointers_equal = false;
+                }
             }
-            if (more_recent != NULL) {
-                more_recent->less_recent = prune_candidate->less_recent;
+            if (all_bounds_equal) {
+                halide_assert(user_context, no_host_pointers_equal);
             }
+        }
 
-            // Remove from more recent chain.
-            if (most_recently_used == prune_candidate) {
-                most_recently_used = prune_candidate->less_recent;
+        if (all_bounds_equal || new_entry == NULL || !insert_entry(shard, new_entry)) {
+            // Another thread stored the same entry first, or we ran out
+            // of memory. This entry is still in use by the caller. Mark
+            // it as having no cache entry so
+            // halide_memoization_cache_release can free the buffer.
+            for (int32_t i = 0; i < tuple_count; i++) {
+                get_pointer_to_header(tuple_buffers[i]->host)->entry = NULL;
             }
-            if (prune_candidate->less_recent != NULL) {
-                prune_candidate->less_recent = more_recent;
+            if (new_entry) {
+                // The buffers belong to the caller, so only free the metadata.
+                halide_free(user_context, new_entry->metadata_storage);
+                halide_free(user_context, new_entry);
             }
+            return;
+        }
 
-            // Decrease cache used amount.
-            for (uint32_t i = 0; i < prune_candidate->tuple_count; i++) {
-                current_cache_size -= prune_candidate->buf[i].size_in_bytes();
-            }
+        new_entry->in_use_count = tuple_count;
 
-            // Deallocate the entry.
-            prune_candidate->destroy();
-            halide_free(NULL, prune_candidate);
+        for (int32_t i = 0; i < tuple_count; i++) {
+            get_pointer_to_header(tuple_buffers[i]->host)->entry = new_entry;
         }
-
-        prune_candidate = more_recent;
     }
-#if CACHE_DEBUGGING
-    validate_cache();
-#endif
+
+    __atomic_fetch_add(&current_cache_size, (int64_t)new_entry->size, __ATOMIC_RELAXED);
+    prune_cache();
 }
 
 }}} // namespace Halide::Runtime::Internal
@@ -316,39 +581,36 @@ WEAK void halide_memoization_cache_set_size(int64_t size) {
         size = kDefaultCacheSize;
     }
 
-    ScopedMutexLock lock(&memoization_lock);
-
-    max_cache_size = size;
+    {
+        ScopedMutexLock lock(&eviction_lock);
+        max_cache_size = size;
+    }
     prune_cache();
 }
 
 WEAK int halide_memoization_cache_lookup(void *user_context, const uint8_t *cache_key, int32_t size,
                                          halide_buffer_t *computed_bounds, int32_t tuple_count, halide_buffer_t **tuple_buffers) {
-    uint32_t h = djb_hash(cache_key, size);
-    uint32_t index = h % kHashTableSize;
+    uint32_t h = hash_key(cache_key, size);
+    CacheShard &shard = shard_for(h);
 
-    ScopedMutexLock lock(&memoization_lock);
+    {
+        ScopedMutexLock lock(&shard.lock);
 
 #if CACHE_DEBUGGING
-    debug_print_key(user_context, "halide_memoization_cache_lookup", cache_key, size);
+        debug_print_key(user_context, "halide_memoization_cache_lookup", cache_key, size);
 
-    debug_print_buffer(user_context, "computed_bounds", *computed_bounds);
+        debug_print_buffer(user_context, "computed_bounds", *computed_bounds);
 
-    {
-        for (int32_t i = 0; i < tuple_count; i++) {
-            halide_buffer_t *buf = tuple_buffers[i];
-            debug_print_buffer(user_context, "Allocation bounds", *buf);
+        {
+            for (int32_t i = 0; i < tuple_count; i++) {
+                halide_buffer_t *buf = tuple_buffers[i];
+                debug_print_buffer(user_context, "Allocation bounds", *buf);
+            }
         }
-    }
 #endif
 
-    CacheEntry *entry = cache_entries[index];
-    while (entry != NULL) {
-        if (entry->hash == h && entry->key_size == (size_t)size &&
-            keys_equal(entry->key, cache_key, size) &&
-            buffer_has_shape(computed_bounds, entry->computed_bounds) &&
-            entry->tuple_count == (uint32_t)tuple_count) {
-
+        CacheEntry *entry = find_entry(shard, h, cache_key, size, computed_bounds, tuple_count);
+        if (entry != NULL) {
             // Check all the tuple buffers have the same bounds (they should).
             bool all_bounds_equal = true;
             for (int32_t i = 0; all_bounds_equal && i < tuple_count; i++) {
@@ -356,23 +618,9 @@ WEAK int halide_memoization_cache_lookup(void *user_context, const uint8_t *cach
             }
 
             if (all_bounds_equal) {
-                if (entry != most_recently_used) {
-                    halide_assert(user_context, entry->more_recent != NULL);
-                    if (entry->less_recent != NULL) {
-                        entry->less_recent->more_recent = entry->more_recent;
-                    } else {
-                        halide_assert(user_context, least_recently_used == entry);
-                        least_recently_used = entry->more_recent;
-                    }
-                    halide_assert(user_context, entry->more_recent != NULL);
-                    entry->more_recent->less_recent = entry->less_recent;
-
-                    entry->more_recent = NULL;
-                    entry->less_recent = most_recently_used;
-                    if (most_recently_used != NULL) {
-                        most_recently_used->more_recent = entry;
-                    }
-                    most_recently_used = entry;
+                // The entry can't be evicted while it is in use.
+                if (entry->heap_index >= 0) {
+                    heap_remove(shard, entry);
                 }
 
                 for (int32_t i = 0; i < tuple_count; i++) {
@@ -381,11 +629,13 @@ WEAK int halide_memoization_cache_lookup(void *user_context, const uint8_t *cach
                 }
 
                 entry->in_use_count += tuple_count;
+                shard.hits++;
 
                 return 0;
             }
         }
-        entry = entry->next;
+
+        shard.misses++;
     }
 
     for (int32_t i = 0; i < tuple_count; i++) {
@@ -403,11 +653,19 @@ WEAK int halide_memoization_cache_lookup(void *user_context, const uint8_t *cach
         CacheBlockHeader *header = get_pointer_to_header(buf->host);
         header->hash = h;
         header->entry = NULL;
+        header->lookup_time = halide_current_time_ns(user_context);
     }
 
-#if CACHE_DEBUGGING
-    validate_cache();
-#endif
+    int64_t compute_time = 0;
+    if (halide_memoization_disk_cache_lookup(user_context, cache_key, size, computed_bounds,
+                                             tuple_count, tuple_buffers, &compute_time) == 0) {
+        // The buffers now hold the result, so cache it in memory as if
+        // it had just been computed, and let the caller use it.
+        __atomic_fetch_add(&cache_disk_hits, 1, __ATOMIC_RELAXED);
+        store_entry(user_context, cache_key, size, computed_bounds,
+                    tuple_count, tuple_buffers, h, compute_time);
+        return 0;
+    }
 
     return 1;
 }
@@ -417,12 +675,6 @@ WEAK int halide_memoization_cache_store(void *user_context, const uint8_t *cache
                                         int32_t tuple_count, halide_buffer_t **tuple_buffers) {
     debug(user_context) << "halide_memoization_cache_store\n";
 
-    uint32_t h = get_pointer_to_header(tuple_buffers[0]->host)->hash;
-
-    uint32_t index = h % kHashTableSize;
-
-    ScopedMutexLock lock(&memoization_lock);
-
 #if CACHE_DEBUGGING
     debug_print_key(user_context, "halide_memoization_cache_store", cache_key, size);
 
@@ -436,88 +688,18 @@ WEAK int halide_memoization_cache_store(void *user_context, const uint8_t *cache
     }
 #endif
 
-    CacheEntry *entry = cache_entries[index];
-    while (entry != NULL) {
-        if (entry->hash == h && entry->key_size == (size_t)size &&
-            keys_equal(entry->key, cache_key, size) &&
-            buffer_has_shape(computed_bounds, entry->computed_bounds) &&
-            entry->tuple_count == (uint32_t)tuple_count) {
-
-            bool all_bounds_equal = true;
-            bool no_host_pointers_equal = true;
-            {
-                for (int32_t i = 0; all_bounds_equal && i < tuple_count; i++) {
-                    halide_buffer_t *buf = tuple_buffers[i];
-                    all_bounds_equal = buffer_has_shape(tuple_buffers[i], entry->buf[i].dim);
-                    if (entry->buf[i].host == buf->host) {
-                        no_host_pointers_equal = false;
-                    }
-                }
-            }
-            if (all_bounds_equal) {
-                halide_assert(user_context, no_host_pointers_equal);
-                // This entry is still in use by the caller. Mark it as having no cache entry
-                // so halide_memoization_cache_release can free the buffer.
-                for (int32_t i = 0; i < tuple_count; i++) {
-                    get_pointer_to_header(tuple_buffers[i]->host)->entry = NULL;
-
-                }
-                return 0;
-            }
-        }
-        entry = entry->next;
-    }
+    CacheBlockHeader *first_header = get_pointer_to_header(tuple_buffers[0]->host);
+    uint32_t h = first_header->hash;
+    int64_t compute_time = halide_current_time_ns(user_context) - first_header->lookup_time;
 
-    uint64_t added_size = 0;
-    {
-        for (int32_t i = 0; i < tuple_count; i++) {
-            halide_buffer_t *buf = tuple_buffers[i];
-            added_size += buf->size_in_bytes();
-        }
-    }
-    current_cache_size += added_size;
-    prune_cache();
+    store_entry(user_context, cache_key, size, computed_bounds,
+                tuple_count, tuple_buffers, h, compute_time);
 
-    CacheEntry *new_entry = (CacheEntry *)halide_malloc(NULL, sizeof(CacheEntry));
-    bool inited = false;
-    if (new_entry) {
-        inited = new_entry->init(cache_key, size, h, computed_bounds, tuple_count, tuple_buffers);
+    if (halide_memoization_disk_cache_store(user_context, cache_key, size, computed_bounds,
+                                            tuple_count, tuple_buffers, compute_time)) {
+        __atomic_fetch_add(&cache_disk_writes, 1, __ATOMIC_RELAXED);
     }
-    if (!inited) {
-        current_cache_size -= added_size;
-
-        // This entry is still in use by the caller. Mark it as having no cache entry
-        // so halide_memoization_cache_release can free the buffer.
-        for (int32_t i = 0; i < tuple_count; i++) {
-            get_pointer_to_header(tuple_buffers[i]->host)->entry = NULL;
-        }
 
-        if (new_entry) {
-            halide_free(user_context, new_entry);
-        }
-        return 0;
-    }
-
-    new_entry->next = cache_entries[index];
-    new_entry->less_recent = most_recently_used;
-    if (most_recently_used != NULL) {
-        most_recently_used->more_recent = new_entry;
-    }
-    most_recently_used = new_entry;
-    if (least_recently_used == NULL) {
-        least_recently_used = new_entry;
-    }
-    cache_entries[index] = new_entry;
-
-    new_entry->in_use_count = tuple_count;
-
-    for (int32_t i = 0; i < tuple_count; i++) {
-        get_pointer_to_header(tuple_buffers[i]->host)->entry = new_entry;
-    }
-
-#if CACHE_DEBUGGING
-    validate_cache();
-#endif
     debug(user_context) << "Exiting halide_memoization_cache_store\n";
 
     return 0;
@@ -531,33 +713,62 @@ WEAK void halide_memoization_cache_release(void *user_context, void *host) {
     if (entry == NULL) {
         halide_free(user_context, header);
     } else {
-        ScopedMutexLock lock(&memoization_lock);
+        CacheShard &shard = shard_for(entry->hash);
+        ScopedMutexLock lock(&shard.lock);
 
         halide_assert(user_context, entry->in_use_count > 0);
         entry->in_use_count--;
-#if CACHE_DEBUGGING
-        validate_cache();
-#endif
+        if (entry->in_use_count == 0) {
+            heap_push(shard, entry);
+        }
     }
 
     debug(user_context) << "Exited halide_memoization_cache_release.\n";
 }
 
+WEAK int halide_memoization_cache_stats(halide_memoization_cache_stats_t *stats) {
+    memset(stats, 0, sizeof(halide_memoization_cache_stats_t));
+    for (int s = 0; s < kCacheShards; s++) {
+        CacheShard &shard = cache_shards[s];
+        ScopedMutexLock lock(&shard.lock);
+        stats->hits += shard.hits;
+        stats->misses += shard.misses;
+        stats->evictions += shard.evictions;
+        stats->entries += shard.num_entries;
+    }
+    stats->current_size = __atomic_load_n(&current_cache_size, __ATOMIC_RELAXED);
+    stats->max_size = max_cache_size;
+    stats->disk_hits = __atomic_load_n(&cache_disk_hits, __ATOMIC_RELAXED);
+    stats->disk_writes = __atomic_load_n(&cache_disk_writes, __ATOMIC_RELAXED);
+    return 0;
+}
+
 WEAK void halide_memoization_cache_cleanup() {
     debug(NULL) << "halide_memoization_cache_cleanup\n";
-    for (size_t i = 0; i < kHashTableSize; i++) {
-        CacheEntry *entry = cache_entries[i];
-        cache_entries[i] = NULL;
-        while (entry != NULL) {
-            CacheEntry *next = entry->next;
-            entry->destroy();
-            halide_free(NULL, entry);
-            entry = next;
+    for (int s = 0; s < kCacheShards; s++) {
+        CacheShard &shard = cache_shards[s];
+        for (uint32_t i = 0; i < shard.num_buckets; i++) {
+            CacheEntry *entry = shard.buckets[i];
+            while (entry != NULL) {
+                CacheEntry *next = entry->next;
+                entry->destroy();
+                halide_free(NULL, entry);
+                entry = next;
+            }
+        }
+        if (shard.buckets) {
+            halide_free(NULL, shard.buckets);
+        }
+        if (shard.heap) {
+            halide_free(NULL, shard.heap);
         }
+        memset(&shard, 0, sizeof(CacheShard));
     }
     current_cache_size = 0;
-    most_recently_used = NULL;
-    least_recently_used = NULL;
+    cache_inflation = 0;
+    cache_disk_hits = 0;
+    cache_disk_writes = 0;
+    halide_memoization_disk_cache_cleanup();
 }
 
 namespace {
@@ -0,0 +1,38 @@
+#include "HalideRuntime.h"
+#include "printer.h"
+#include "runtime_internal.h"
+
+namespace Halide { namespace Runtime { namespace Internal {
+
+// The memoization cache has no persistent tier on this platform.
+
+WEAK int halide_memoization_disk_cache_lookup(void *user_context, const uint8_t *cache_key, int32_t size,
+                                              const halide_buffer_t *computed_bounds,
+                                              int32_t tuple_count, halide_buffer_t **tuple_buffers,
+                                              int64_t *compute_time) {
+    return 1;
+}
+
+WEAK bool halide_memoization_disk_cache_store(void *user_context, const uint8_t *cache_key, int32_t size,
+                                              const halide_buffer_t *computed_bounds,
+                                              int32_t tuple_count, halide_buffer_t **tuple_buffers,
+                                              int64_t compute_time) {
+    return false;
+}
+
+WEAK void halide_memoization_disk_cache_cleanup() {
+}
+
+}}} // namespace Halide::Runtime::Internal
+
+extern "C" {
+
+WEAK int halide_memoization_cache_set_disk_path(void *user_context, const char *path, int64_t max_size) {
+    if (path == NULL) {
+        return 0;
+    }
+    error(user_context) << "The memoization cache can't be kept on disk on this platform\n";
+    return halide_error_code_generic_error;
+}
+
+}
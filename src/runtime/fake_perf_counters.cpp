@@ -0,0 +1,17 @@
+#include "HalideRuntime.h"
+#include "runtime_internal.h"
+
+namespace Halide { namespace Runtime { namespace Internal {
+
+// The profiler can't read hardware performance counters on this
+// platform.
+
+WEAK bool halide_perf_counters_enabled() {
+    return false;
+}
+
+WEAK perf_counter_thread_state *halide_perf_counters_read(uint64_t *values) {
+    return NULL;
+}
+
+}}} // namespace Halide::Runtime::Internal
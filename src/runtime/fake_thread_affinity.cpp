@@ -0,0 +1,19 @@
+#include "runtime_internal.h"
+
+namespace Halide { namespace Runtime { namespace Internal {
+
+// Workers are not pinned on this platform, and the host is treated as
+// a single NUMA node.
+
+WEAK int halide_init_thread_placement(int affinity) {
+    return 1;
+}
+
+WEAK void halide_place_worker_thread(int worker) {
+}
+
+WEAK int halide_current_numa_node() {
+    return 0;
+}
+
+}}}
@@ -0,0 +1,225 @@
+#include "HalideRuntime.h"
+#include "runtime_internal.h"
+#include "scoped_spin_lock.h"
+
+// The syscall numbers vary across platforms. This module is only used
+// on x86.
+#ifdef BITS_64
+#define SYS_GETTID 186
+#define SYS_PERF_EVENT_OPEN 298
+#endif
+
+#ifdef BITS_32
+#define SYS_GETTID 224
+#define SYS_PERF_EVENT_OPEN 336
+#endif
+
+#define MAX_COUNTED_THREADS 256
+
+extern "C" {
+
+extern int syscall(int num, ...);
+extern ssize_t read(int fd, void *buf, size_t bytes);
+extern int close(int fd);
+
+typedef unsigned int pthread_key_t;
+
+extern int pthread_key_create(pthread_key_t *key, void (*destructor)(void*));
+extern int pthread_setspecific(pthread_key_t key, const void *value);
+extern void *pthread_getspecific(pthread_key_t key);
+
+}  // extern "C"
+
+namespace Halide { namespace Runtime { namespace Internal {
+
+// The start of struct perf_event_attr from linux/perf_event.h, as of
+// the first kernel that had it. Later kernels accept it as is.
+struct perf_event_attr_v0 {
+    uint32_t type;
+    uint32_t size;
+    uint64_t config;
+    uint64_t sample_period;
+    uint64_t sample_type;
+    uint64_t read_format;
+    uint64_t flags;
+    uint32_t wakeup_events;
+    uint32_t bp_type;
+    uint64_t config1;
+};
+
+const uint32_t kPerfTypeHardware = 0;
+const uint64_t kPerfFormatGroup = 1 << 3;
+const uint64_t kPerfExcludeKernel = 1 << 5;
+const uint64_t kPerfExcludeHv = 1 << 6;
+
+// The hardware events, in the order of the perf_counter_* enum. The
+// generic cache-miss event counts last-level cache misses on most
+// cpus.
+const uint64_t perf_event_configs[perf_counter_count] = {
+    0,  // PERF_COUNT_HW_CPU_CYCLES
+    1,  // PERF_COUNT_HW_INSTRUCTIONS
+    3,  // PERF_COUNT_HW_CACHE_MISSES
+    5,  // PERF_COUNT_HW_BRANCH_MISSES
+};
+
+// The counters of one thread. They are opened as a group led by the
+// cycle counter, so that all of them are read with one syscall. The
+// slot is freed and the counters closed when the thread exits, so
+// that a later thread reusing its tid never reads them.
+struct perf_counted_thread {
+    int32_t tid;
+    int leader;
+    int fds[perf_counter_count];
+    // Where each counter is in a read of the group, or -1 if the cpu
+    // doesn't have it.
+    int8_t position[perf_counter_count];
+    int num_open;
+    perf_counter_thread_state state;
+};
+
+WEAK perf_counted_thread perf_counted_threads[MAX_COUNTED_THREADS];
+
+// Each thread's slot, whose destructor runs when the thread exits.
+WEAK pthread_key_t perf_thread_key;
+WEAK volatile int perf_thread_key_lock = 0;
+// 0 until the key is created, -1 if it couldn't be.
+WEAK int perf_thread_key_state = 0;
+
+// -1 until the environment has been checked.
+WEAK int perf_counters_requested = -1;
+
+WEAK int perf_event_open(perf_event_attr_v0 *attr, int group_fd) {
+    // Count the calling thread, on any cpu.
+    return syscall(SYS_PERF_EVENT_OPEN, attr, 0, -1, group_fd, 0);
+}
+
+WEAK void open_thread_counters(perf_counted_thread *t) {
+    t->leader = -1;
+    t->num_open = 0;
+    for (int i = 0; i < perf_counter_count; i++) {
+        t->fds[i] = -1;
+        t->position[i] = -1;
+    }
+    for (int i = 0; i < perf_counter_count; i++) {
+        perf_event_attr_v0 attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = kPerfTypeHardware;
+        attr.size = sizeof(attr);
+        attr.config = perf_event_configs[i];
+        attr.read_format = kPerfFormatGroup;
+        // Count user space only, which doesn't need privileges.
+        attr.flags = kPerfExcludeKernel | kPerfExcludeHv;
+        int fd = perf_event_open(&attr, t->leader);
+        if (fd < 0) {
+            if (i == 0) {
+                // Without cycles there's nothing to lead the group.
+                // This is usually down to the system not allowing
+                // counters at all, so stop trying for new pipelines.
+                perf_counters_requested = 0;
+                return;
+            }
+            continue;
+        }
+        if (i == 0) {
+            t->leader = fd;
+        }
+        t->fds[i] = fd;
+        t->position[i] = t->num_open++;
+    }
+}
+
+WEAK void close_thread_counters(perf_counted_thread *t) {
+    for (int i = 0; i < perf_counter_count; i++) {
+        if (t->fds[i] >= 0) {
+            close(t->fds[i]);
+            t->fds[i] = -1;
+        }
+    }
+    t->leader = -1;
+}
+
+// Runs on the exit of a thread that has a slot.
+WEAK void release_counted_thread(void *arg) {
+    perf_counted_thread *t = (perf_counted_thread *)arg;
+    close_thread_counters(t);
+    __atomic_store_n(&t->tid, 0, __ATOMIC_RELEASE);
+}
+
+WEAK bool make_perf_thread_key() {
+    if (__atomic_load_n(&perf_thread_key_state, __ATOMIC_ACQUIRE) == 0) {
+        ScopedSpinLock lock(&perf_thread_key_lock);
+        if (perf_thread_key_state == 0) {
+            int state = pthread_key_create(&perf_thread_key, release_counted_thread) == 0 ? 1 : -1;
+            __atomic_store_n(&perf_thread_key_state, state, __ATOMIC_RELEASE);
+        }
+    }
+    return perf_thread_key_state == 1;
+}
+
+WEAK perf_counted_thread *find_counted_thread() {
+    if (!make_perf_thread_key()) {
+        return NULL;
+    }
+    perf_counted_thread *t = (perf_counted_thread *)pthread_getspecific(perf_thread_key);
+    if (t) {
+        return t;
+    }
+
+    int32_t tid = syscall(SYS_GETTID);
+    uint32_t h = (uint32_t)tid * 0x9e3779b1u;
+    for (int probe = 0; probe < MAX_COUNTED_THREADS; probe++) {
+        t = perf_counted_threads + ((h + probe) % MAX_COUNTED_THREADS);
+        int32_t owner = __atomic_load_n(&t->tid, __ATOMIC_ACQUIRE);
+        if (owner == tid) {
+            // A thread with our tid exited without its destructor
+            // running, which leaves counters of a thread that is gone.
+            close_thread_counters(t);
+        } else {
+            int32_t expected = 0;
+            if (owner != 0 ||
+                !__atomic_compare_exchange_n(&t->tid, &expected, tid, false,
+                                             __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                continue;
+            }
+        }
+        // Only this thread ever touches the rest of its slot.
+        open_thread_counters(t);
+        t->state.instance = NULL;
+        t->state.func = -1;
+        if (pthread_setspecific(perf_thread_key, t) != 0) {
+            release_counted_thread(t);
+            return NULL;
+        }
+        return t;
+    }
+    // Too many threads.
+    return NULL;
+}
+
+WEAK bool halide_perf_counters_enabled() {
+    if (perf_counters_requested < 0) {
+        const char *var = getenv("HL_PROFILER_PERF_COUNTERS");
+        perf_counters_requested = (var && atoi(var) != 0) ? 1 : 0;
+    }
+    return perf_counters_requested == 1;
+}
+
+WEAK perf_counter_thread_state *halide_perf_counters_read(uint64_t *values) {
+    perf_counted_thread *t = find_counted_thread();
+    if (!t || t->leader < 0) {
+        return NULL;
+    }
+    // The group is read as the number of counters followed by their
+    // values.
+    uint64_t buf[1 + perf_counter_count];
+    ssize_t expected = (1 + t->num_open) * sizeof(uint64_t);
+    if (read(t->leader, buf, expected) != expected) {
+        return NULL;
+    }
+    for (int i = 0; i < perf_counter_count; i++) {
+        values[i] = t->position[i] < 0 ? 0 : buf[1 + t->position[i]];
+    }
+    return &t->state;
+}
+
+}}} // namespace Halide::Runtime::Internal
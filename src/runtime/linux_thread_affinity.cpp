@@ -0,0 +1,189 @@
+#include "HalideRuntime.h"
+#include "runtime_internal.h"
+#include "printer.h"
+
+#define MAX_PLACED_CPUS 1024
+#define MAX_NUMA_NODES 64
+
+extern "C" {
+
+// This code cannot depend on system headers. A cpu_set_t of 1024
+// bits matches glibc's default.
+struct cpu_set_t {
+    uint64_t bits[MAX_PLACED_CPUS / 64];
+};
+
+extern int sched_getaffinity(int pid, size_t size, cpu_set_t *mask);
+extern int sched_setaffinity(int pid, size_t size, const cpu_set_t *mask);
+extern int sched_getcpu();
+extern char *fgets(char *, int, void *);
+
+}  // extern "C"
+
+namespace Halide { namespace Runtime { namespace Internal {
+
+struct thread_placement_t {
+    int affinity;
+    int num_cpus, num_nodes;
+    // The cpus workers are pinned to, in the order workers are
+    // spawned. Consecutive workers go to different NUMA nodes, so that
+    // a small pool still uses the memory bandwidth of every node.
+    int16_t cpus[MAX_PLACED_CPUS];
+    // The node of each cpu, numbered from zero over the nodes that
+    // have cpus this process may run on. -1 for the other cpus.
+    int8_t node_of_cpu[MAX_PLACED_CPUS];
+};
+
+WEAK thread_placement_t thread_placement;
+
+WEAK bool cpu_is_set(const cpu_set_t *set, int cpu) {
+    return (set->bits[cpu / 64] >> (cpu % 64)) & 1;
+}
+
+WEAK void set_cpu(cpu_set_t *set, int cpu) {
+    set->bits[cpu / 64] |= (uint64_t)1 << (cpu % 64);
+}
+
+// Read the cpus of a NUMA node from sysfs, which lists them as
+// ranges, e.g. "0-15,32-47".
+WEAK bool read_node_cpus(int node, cpu_set_t *cpus) {
+    char path[64];
+    char *end = path + sizeof(path);
+    char *dst = halide_string_to_string(path, end, "/sys/devices/system/node/node");
+    dst = halide_int64_to_string(dst, end, node, 1);
+    halide_string_to_string(dst, end, "/cpulist");
+
+    void *f = fopen(path, "r");
+    if (!f) {
+        return false;
+    }
+    char line[4096];
+    bool ok = fgets(line, sizeof(line), f) != NULL;
+    fclose(f);
+    if (!ok) {
+        return false;
+    }
+
+    memset(cpus, 0, sizeof(cpu_set_t));
+    const char *s = line;
+    while (*s >= '0' && *s <= '9') {
+        int first = atoi(s), last = first;
+        while (*s >= '0' && *s <= '9') s++;
+        if (*s == '-') {
+            s++;
+            last = atoi(s);
+            while (*s >= '0' && *s <= '9') s++;
+        }
+        for (int cpu = first; cpu <= last && cpu < MAX_PLACED_CPUS; cpu++) {
+            set_cpu(cpus, cpu);
+        }
+        if (*s == ',') s++;
+    }
+    return true;
+}
+
+WEAK int halide_init_thread_placement(int affinity) {
+    thread_placement_t &t = thread_placement;
+    memset(&t, 0, sizeof(t));
+    memset(t.node_of_cpu, -1, sizeof(t.node_of_cpu));
+    t.affinity = affinity;
+    t.num_nodes = 1;
+    if (affinity == halide_thread_affinity_none) {
+        return 1;
+    }
+
+    cpu_set_t allowed;
+    memset(&allowed, 0, sizeof(allowed));
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        t.affinity = halide_thread_affinity_none;
+        return 1;
+    }
+
+    // Group the cpus we may run on by node. Machines without NUMA
+    // information in sysfs are a single node.
+    int16_t by_node[MAX_PLACED_CPUS];
+    int node_begin[MAX_NUMA_NODES + 1], node_id[MAX_NUMA_NODES];
+    int num_nodes = 0, num_cpus = 0;
+    for (int id = 0; id < MAX_NUMA_NODES; id++) {
+        cpu_set_t node_cpus;
+        if (!read_node_cpus(id, &node_cpus)) {
+            continue;
+        }
+        node_begin[num_nodes] = num_cpus;
+        for (int cpu = 0; cpu < MAX_PLACED_CPUS; cpu++) {
+            if (cpu_is_set(&node_cpus, cpu) && cpu_is_set(&allowed, cpu) &&
+                t.node_of_cpu[cpu] < 0) {
+                t.node_of_cpu[cpu] = num_nodes;
+                by_node[num_cpus++] = cpu;
+            }
+        }
+        if (num_cpus > node_begin[num_nodes]) {
+            node_id[num_nodes++] = id;
+        }
+    }
+    if (num_nodes == 0) {
+        node_begin[0] = 0;
+        node_id[0] = 0;
+        num_nodes = 1;
+        for (int cpu = 0; cpu < MAX_PLACED_CPUS; cpu++) {
+            if (cpu_is_set(&allowed, cpu)) {
+                t.node_of_cpu[cpu] = 0;
+                by_node[num_cpus++] = cpu;
+            }
+        }
+    }
+    node_begin[num_nodes] = num_cpus;
+
+    // Interleave the nodes.
+    for (int i = 0; t.num_cpus < num_cpus; i++) {
+        for (int n = 0; n < num_nodes; n++) {
+            if (node_begin[n] + i < node_begin[n + 1]) {
+                t.cpus[t.num_cpus++] = by_node[node_begin[n] + i];
+            }
+        }
+    }
+    t.num_nodes = num_nodes;
+
+    print(NULL) << "Halide thread pool: pinning workers to "
+                << (affinity == halide_thread_affinity_cores ? "cores" : "nodes")
+                << " over " << num_cpus << " cpus on " << num_nodes << " NUMA nodes\n";
+    for (int n = 0; n < num_nodes; n++) {
+        print(NULL) << "    node " << node_id[n] << ": "
+                    << node_begin[n + 1] - node_begin[n] << " cpus\n";
+    }
+    return num_nodes;
+}
+
+WEAK void halide_place_worker_thread(int worker) {
+    thread_placement_t &t = thread_placement;
+    if (t.affinity == halide_thread_affinity_none || t.num_cpus == 0) {
+        return;
+    }
+    int cpu = t.cpus[worker % t.num_cpus];
+    cpu_set_t mask;
+    memset(&mask, 0, sizeof(mask));
+    if (t.affinity == halide_thread_affinity_cores) {
+        set_cpu(&mask, cpu);
+    } else {
+        for (int c = 0; c < MAX_PLACED_CPUS; c++) {
+            if (t.node_of_cpu[c] == t.node_of_cpu[cpu]) {
+                set_cpu(&mask, c);
+            }
+        }
+    }
+    sched_setaffinity(0, sizeof(mask), &mask);
+}
+
+WEAK int halide_current_numa_node() {
+    thread_placement_t &t = thread_placement;
+    if (t.num_nodes <= 1) {
+        return 0;
+    }
+    int cpu = sched_getcpu();
+    if (cpu < 0 || cpu >= MAX_PLACED_CPUS || t.node_of_cpu[cpu] < 0) {
+        return 0;
+    }
+    return t.node_of_cpu[cpu];
+}
+
+}}}
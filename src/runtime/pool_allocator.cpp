@@ -0,0 +1,241 @@
+#include "HalideRuntime.h"
+#include "printer.h"
+#include "runtime_internal.h"
+#include "scoped_mutex_lock.h"
+
+namespace Halide { namespace Runtime { namespace Internal {
+
+// Blocks come in size classes, two per doubling, from 64 bytes up to
+// 16MB: 64, 96, 128, 192, 256, ... Larger requests go straight to
+// halide_default_malloc.
+const int kPoolNumClasses = 37;
+const size_t kPoolMinBlock = 64;
+
+// Each thread keeps this many bytes of free blocks for itself. Beyond
+// that, freed blocks go to a depot shared by all threads, which holds
+// at most the reclaim limit. Beyond that, they go back to the system.
+const size_t kPoolThreadCacheBytes = 256 * 1024;
+const uint16_t kPoolThreadCacheBlocks = 16;
+const int64_t kPoolDefaultMaxIdleBytes = 64 * 1024 * 1024;
+
+const int kPoolThreadCacheBits = 6;
+const int kPoolThreadCaches = 1 << kPoolThreadCacheBits;
+
+const uint32_t kPoolMagic = 0x4c4f4f50;  // "POOL"
+
+// Every block starts with a header, padded to the malloc alignment,
+// just before the pointer returned.
+struct PoolBlockHeader {
+    uint32_t magic;
+    // -1 for blocks larger than the largest class.
+    int32_t size_class;
+};
+
+// While a block is free, its contents link it into a free list.
+struct PoolBlock {
+    PoolBlock *next;
+};
+
+struct PoolFreeLists {
+    halide_mutex lock;
+    PoolBlock *blocks[kPoolNumClasses];
+    uint16_t count[kPoolNumClasses];
+    int64_t idle_bytes;
+    // Allocations served from these lists.
+    uint64_t hits;
+};
+
+WEAK PoolFreeLists pool_thread_caches[kPoolThreadCaches];
+
+// The depot also counts the allocations that had to go to the system.
+WEAK PoolFreeLists pool_depot;
+WEAK uint64_t pool_misses = 0;
+WEAK uint64_t pool_oversized = 0;
+WEAK int64_t pool_max_idle_bytes = kPoolDefaultMaxIdleBytes;
+
+WEAK __attribute__((always_inline)) size_t pool_header_bytes() {
+    size_t s = sizeof(PoolBlockHeader);
+    size_t mask = halide_malloc_alignment() - 1;
+    return (s + mask) & ~mask;
+}
+
+WEAK PoolBlockHeader *pool_header(void *ptr) {
+    return (PoolBlockHeader *)((uint8_t *)ptr - pool_header_bytes());
+}
+
+WEAK size_t pool_class_size(int c) {
+    return (size_t)((c & 1) ? 96 : 64) << (c >> 1);
+}
+
+// The smallest class that fits size bytes, or -1 if none does.
+WEAK int pool_size_class(size_t size) {
+    if (size <= kPoolMinBlock) {
+        return 0;
+    }
+    // 2^(b-1) < size <= 2^b
+    int b = 64 - __builtin_clzll((uint64_t)(size - 1));
+    int c = (size <= ((size_t)3 << (b - 2))) ? 2 * b - 13 : 2 * b - 12;
+    return c < kPoolNumClasses ? c : -1;
+}
+
+// The runtime has no thread-local storage that works in both JIT and
+// AOT code, so threads are told apart by their stacks, which no two
+// running threads share. Threads that hash to the same cache just
+// share it.
+WEAK PoolFreeLists &pool_cache_for_this_thread() {
+    int marker;
+    uint64_t stack = (uint64_t)(uintptr_t)&marker >> 16;
+    return pool_thread_caches[(stack * 0x9e3779b97f4a7c15ULL) >> (64 - kPoolThreadCacheBits)];
+}
+
+WEAK PoolBlock *pop_block(PoolFreeLists &lists, int c) {
+    PoolBlock *block = lists.blocks[c];
+    if (block) {
+        lists.blocks[c] = block->next;
+        lists.count[c]--;
+        lists.idle_bytes -= pool_class_size(c);
+        lists.hits++;
+    }
+    return block;
+}
+
+WEAK void push_block(PoolFreeLists &lists, int c, PoolBlock *block) {
+    block->next = lists.blocks[c];
+    lists.blocks[c] = block;
+    lists.count[c]++;
+    lists.idle_bytes += pool_class_size(c);
+}
+
+WEAK void *pool_allocate_block(void *user_context, int c, size_t size) {
+    uint8_t *raw = (uint8_t *)halide_default_malloc(user_context, pool_header_bytes() + size);
+    if (raw == NULL) {
+        return NULL;
+    }
+    void *ptr = raw + pool_header_bytes();
+    PoolBlockHeader *header = pool_header(ptr);
+    header->magic = kPoolMagic;
+    header->size_class = c;
+    return ptr;
+}
+
+WEAK void pool_free_block(void *user_context, void *ptr) {
+    halide_default_free(user_context, pool_header(ptr));
+}
+
+// Return free blocks to the system until the lists hold at most
+// max_idle_bytes. Must be called with the lists locked.
+WEAK void trim_free_lists(void *user_context, PoolFreeLists &lists, int64_t max_idle_bytes) {
+    // Give back the largest blocks first.
+    for (int c = kPoolNumClasses - 1; c >= 0 && lists.idle_bytes > max_idle_bytes; c--) {
+        while (lists.blocks[c] && lists.idle_bytes > max_idle_bytes) {
+            PoolBlock *block = lists.blocks[c];
+            lists.blocks[c] = block->next;
+            lists.count[c]--;
+            lists.idle_bytes -= pool_class_size(c);
+            pool_free_block(user_context, block);
+        }
+    }
+}
+
+}}} // namespace Halide::Runtime::Internal
+
+extern "C" {
+
+WEAK void *halide_pool_malloc(void *user_context, size_t x) {
+    int c = pool_size_class(x);
+    if (c < 0) {
+        {
+            ScopedMutexLock lock(&pool_depot.lock);
+            pool_oversized++;
+        }
+        return pool_allocate_block(user_context, -1, x);
+    }
+
+    PoolFreeLists &cache = pool_cache_for_this_thread();
+    {
+        ScopedMutexLock lock(&cache.lock);
+        PoolBlock *block = pop_block(cache, c);
+        if (block) {
+            return block;
+        }
+    }
+    {
+        ScopedMutexLock lock(&pool_depot.lock);
+        PoolBlock *block = pop_block(pool_depot, c);
+        if (block) {
+            return block;
+        }
+        pool_misses++;
+    }
+    return pool_allocate_block(user_context, c, pool_class_size(c));
+}
+
+WEAK void halide_pool_free(void *user_context, void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    PoolBlockHeader *header = pool_header(ptr);
+    halide_assert(user_context, header->magic == kPoolMagic);
+    int c = header->size_class;
+    if (c < 0) {
+        pool_free_block(user_context, ptr);
+        return;
+    }
+
+    size_t size = pool_class_size(c);
+    PoolBlock *block = (PoolBlock *)ptr;
+    PoolFreeLists &cache = pool_cache_for_this_thread();
+    {
+        ScopedMutexLock lock(&cache.lock);
+        if (cache.count[c] < kPoolThreadCacheBlocks &&
+            cache.idle_bytes + size <= kPoolThreadCacheBytes) {
+            push_block(cache, c, block);
+            return;
+        }
+    }
+    {
+        ScopedMutexLock lock(&pool_depot.lock);
+        if (pool_depot.idle_bytes + (int64_t)size <= pool_max_idle_bytes) {
+            push_block(pool_depot, c, block);
+            return;
+        }
+    }
+    pool_free_block(user_context, ptr);
+}
+
+WEAK void halide_pool_allocator_set_limit(int64_t max_idle_bytes) {
+    if (max_idle_bytes == 0) {
+        max_idle_bytes = kPoolDefaultMaxIdleBytes;
+    }
+    ScopedMutexLock lock(&pool_depot.lock);
+    pool_max_idle_bytes = max_idle_bytes;
+    trim_free_lists(NULL, pool_depot, max_idle_bytes);
+}
+
+WEAK void halide_pool_allocator_release_unused(void *user_context) {
+    for (int i = 0; i < kPoolThreadCaches; i++) {
+        ScopedMutexLock lock(&pool_thread_caches[i].lock);
+        trim_free_lists(user_context, pool_thread_caches[i], 0);
+    }
+    ScopedMutexLock lock(&pool_depot.lock);
+    trim_free_lists(user_context, pool_depot, 0);
+}
+
+// Doesn't take the locks, so that the profiler can report the counters
+// during shutdown. The numbers may be slightly stale.
+WEAK int halide_pool_allocator_stats(halide_pool_allocator_stats_t *stats) {
+    memset(stats, 0, sizeof(halide_pool_allocator_stats_t));
+    for (int i = 0; i < kPoolThreadCaches; i++) {
+        PoolFreeLists &cache = pool_thread_caches[i];
+        stats->hits += cache.hits;
+        stats->idle_bytes += cache.idle_bytes;
+    }
+    stats->hits += pool_depot.hits;
+    stats->idle_bytes += pool_depot.idle_bytes;
+    stats->misses = pool_misses;
+    stats->oversized = pool_oversized;
+    stats->max_idle_bytes = pool_max_idle_bytes;
+    return 0;
+}
+
+}
@@ -0,0 +1,715 @@
+#include "HalideRuntime.h"
+#include "printer.h"
+#include "runtime_internal.h"
+#include "scoped_mutex_lock.h"
+
+// These have the same values on every posix platform this module is
+// used on.
+#define PROT_READ 1
+#define PROT_WRITE 2
+#define MAP_SHARED 1
+#define MAP_FAILED ((void *)-1)
+#define SEEK_END 2
+
+extern "C" {
+
+extern void *mmap(void *addr, size_t length, int prot, int flags, int fd, long offset);
+extern int munmap(void *addr, size_t length);
+extern int fseek(void *stream, long offset, int whence);
+extern long ftell(void *stream);
+extern int fflush(void *stream);
+extern int fsync(int fd);
+extern int rename(const char *oldpath, const char *newpath);
+extern int link(const char *oldpath, const char *newpath);
+extern int mkdir(const char *path, unsigned int mode);
+extern int getpid();
+extern long time(long *t);
+
+}
+
+namespace Halide { namespace Runtime { namespace Internal {
+
+const uint32_t kDiskCacheMagic = 0x434d4c48;  // "HLMC"
+const uint32_t kDiskCacheVersion = 2;
+const uint32_t kDiskCacheIndexSlots = 4096;
+const int64_t kDefaultDiskCacheSize = (int64_t)1 << 30;
+const size_t kDiskCachePathSize = 1024;
+const size_t kDiskCachePayloadAlignment = 64;
+
+// Every file in the store is listed in an index, which all processes
+// using the store share by mapping the file "index" in its
+// directory. Slots are claimed and updated with atomics, so no process
+// ever holds a lock on the store. Races between processes can at
+// worst leave a file that is not counted towards the size limit until
+// it is overwritten, or a slot whose file is gone, which ages out.
+struct DiskCacheSlot {
+    // The name of the file, or 0 if the slot is free.
+    uint64_t name;
+    uint64_t bytes;
+    // Seconds since the epoch, so it can be compared across processes.
+    int64_t last_used;
+};
+
+struct DiskCacheIndex {
+    uint32_t magic, version;
+    uint32_t num_slots, reserved;
+    DiskCacheSlot slots[kDiskCacheIndexSlots];
+};
+
+// Each file holds one result, and is named by a hash of its key and
+// bounds. The header is followed by the key as built by DiskCacheKey,
+// the computed bounds, and a DiskCacheTuple plus the shape of each
+// tuple buffer. The contents of the buffers come last, each at a
+// 64-byte aligned offset.
+struct DiskCacheFileHeader {
+    uint32_t magic, version;
+    uint32_t key_size, tuple_count;
+    int32_t dimensions, reserved;
+    int64_t compute_time;
+    uint64_t payload_offset, payload_bytes;
+    uint64_t checksum;
+};
+
+struct DiskCacheTuple {
+    uint8_t code, bits;
+    uint16_t lanes;
+    uint32_t reserved;
+    uint64_t bytes;
+};
+
+WEAK halide_mutex disk_cache_lock = { { 0 } };
+WEAK bool disk_cache_initialized = false;
+WEAK char disk_cache_dir[kDiskCachePathSize];
+WEAK int64_t disk_cache_max_size = kDefaultDiskCacheSize;
+WEAK DiskCacheIndex *disk_cache_index = NULL;
+// Lookups and stores running on the index, which can't be unmapped
+// until they finish.
+WEAK int disk_cache_users = 0;
+WEAK bool disk_cache_sync = false;
+WEAK uint32_t disk_cache_temp_counter = 0;
+
+WEAK size_t disk_cache_align(size_t x, size_t alignment) {
+    return (x + alignment - 1) & ~(alignment - 1);
+}
+
+WEAK uint64_t disk_cache_hash(uint64_t h, const uint8_t *data, size_t bytes) {
+    size_t i = 0;
+    for (; i + 8 <= bytes; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        h = (h ^ word) * 0x100000001b3ULL;
+        h ^= h >> 29;
+    }
+    for (; i < bytes; i++) {
+        h = (h ^ data[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// The key the compiler builds starts with a pointer to a string naming
+// the pipeline and Func, then a counter telling apart pipelines JIT
+// compiled to the same address (see KeyInfo in Memoization.cpp). Neither
+// is the same in another process, so files are keyed on the string
+// itself, which ends with a hash of the definitions of the Func, and
+// then the rest of the key.
+const size_t kMemoizationKeyHeaderBytes = 12;
+
+struct DiskCacheKey {
+    void *user_context;
+    uint8_t *key;
+    int32_t size;
+
+    DiskCacheKey(void *user_context, const uint8_t *cache_key, int32_t cache_key_size)
+        : user_context(user_context), key(NULL), size(0) {
+        if (cache_key_size < (int32_t)kMemoizationKeyHeaderBytes) {
+            return;
+        }
+        const char *name;
+        memcpy(&name, cache_key, sizeof(name));
+        size_t name_bytes = strlen(name) + 1;
+        size_t rest = cache_key_size - kMemoizationKeyHeaderBytes;
+        key = (uint8_t *)halide_malloc(user_context, name_bytes + rest);
+        if (key) {
+            memcpy(key, name, name_bytes);
+            memcpy(key + name_bytes, cache_key + kMemoizationKeyHeaderBytes, rest);
+            size = (int32_t)(name_bytes + rest);
+        }
+    }
+
+    ~DiskCacheKey() {
+        if (key) {
+            halide_free(user_context, key);
+        }
+    }
+};
+
+WEAK uint64_t disk_cache_name(const uint8_t *cache_key, int32_t size,
+                              const halide_buffer_t *computed_bounds, int32_t tuple_count) {
+    uint64_t h = disk_cache_hash(0xcbf29ce484222325ULL, cache_key, size);
+    h = disk_cache_hash(h, (const uint8_t *)computed_bounds->dim,
+                        computed_bounds->dimensions * sizeof(halide_dimension_t));
+    h = disk_cache_hash(h, (const uint8_t *)&tuple_count, sizeof(tuple_count));
+    // 0 marks a free slot in the index.
+    return h ? h : 1;
+}
+
+// Write <dir>/<name><suffix> to path. Returns false if it doesn't fit.
+WEAK bool disk_cache_path(char *path, uint64_t name, const char *suffix) {
+    char *end = path + kDiskCachePathSize - 1;
+    char *dst = halide_string_to_string(path, end, disk_cache_dir);
+    dst = halide_string_to_string(dst, end, "/");
+    dst = halide_uint64_to_string(dst, end, name, 1);
+    dst = halide_string_to_string(dst, end, suffix);
+    return dst < end;
+}
+
+// The bytes of a file before the contents of the buffers.
+WEAK size_t disk_cache_metadata_bytes(int32_t key_size, int32_t dimensions, int32_t tuple_count) {
+    size_t bytes = sizeof(DiskCacheFileHeader) + disk_cache_align(key_size, 8);
+    bytes += sizeof(halide_dimension_t) * dimensions;
+    bytes += (sizeof(DiskCacheTuple) + sizeof(halide_dimension_t) * dimensions) * tuple_count;
+    return disk_cache_align(bytes, kDiskCachePayloadAlignment);
+}
+
+WEAK DiskCacheIndex *map_disk_cache_index(void *user_context) {
+    char path[kDiskCachePathSize];
+    char *end = path + sizeof(path) - 1;
+    char *dst = halide_string_to_string(path, end, disk_cache_dir);
+    dst = halide_string_to_string(dst, end, "/index");
+    if (dst >= end) {
+        return NULL;
+    }
+
+    void *f = fopen(path, "r+b");
+    if (!f) {
+        // Write a fresh index to a temporary file and link it into
+        // place. Linking fails if another process got there first, in
+        // which case we use theirs.
+        char temp_path[kDiskCachePathSize];
+        end = temp_path + sizeof(temp_path) - 1;
+        dst = halide_string_to_string(temp_path, end, path);
+        dst = halide_string_to_string(dst, end, ".");
+        dst = halide_int64_to_string(dst, end, getpid(), 1);
+        dst = halide_string_to_string(dst, end, ".tmp");
+        if (dst >= end) {
+            return NULL;
+        }
+        DiskCacheIndex *fresh = (DiskCacheIndex *)halide_malloc(user_context, sizeof(DiskCacheIndex));
+        if (!fresh) {
+            return NULL;
+        }
+        memset(fresh, 0, sizeof(DiskCacheIndex));
+        fresh->magic = kDiskCacheMagic;
+        fresh->version = kDiskCacheVersion;
+        fresh->num_slots = kDiskCacheIndexSlots;
+        void *temp = fopen(temp_path, "wb");
+        bool written = false;
+        if (temp) {
+            written = fwrite(fresh, sizeof(DiskCacheIndex), 1, temp) == 1;
+            written = fclose(temp) == 0 && written;
+        }
+        halide_free(user_context, fresh);
+        if (written) {
+            link(temp_path, path);
+        }
+        remove(temp_path);
+        f = fopen(path, "r+b");
+        if (!f) {
+            return NULL;
+        }
+    }
+
+    void *mapping = MAP_FAILED;
+    if (fseek(f, 0, SEEK_END) == 0 && ftell(f) == (long)sizeof(DiskCacheIndex)) {
+        mapping = mmap(NULL, sizeof(DiskCacheIndex), PROT_READ | PROT_WRITE, MAP_SHARED, fileno(f), 0);
+    }
+    fclose(f);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+    DiskCacheIndex *index = (DiskCacheIndex *)mapping;
+    if (index->magic != kDiskCacheMagic ||
+        index->version != kDiskCacheVersion ||
+        index->num_slots != kDiskCacheIndexSlots) {
+        munmap(mapping, sizeof(DiskCacheIndex));
+        return NULL;
+    }
+    return index;
+}
+
+// Must be called with the disk cache lock held. Lookups and stores that
+// start from now on see no index, so once those already running have
+// finished nothing can be using the mapping.
+WEAK void close_disk_cache() {
+    DiskCacheIndex *index = __atomic_exchange_n(&disk_cache_index, (DiskCacheIndex *)NULL, __ATOMIC_SEQ_CST);
+    if (index) {
+        while (__atomic_load_n(&disk_cache_users, __ATOMIC_SEQ_CST) != 0) {
+            halide_thread_yield();
+        }
+        munmap(index, sizeof(DiskCacheIndex));
+    }
+}
+
+// Must be called with the disk cache lock held.
+WEAK bool open_disk_cache(void *user_context, const char *dir, int64_t max_size) {
+    close_disk_cache();
+    if (strlen(dir) + 32 >= kDiskCachePathSize) {
+        return false;
+    }
+    strncpy(disk_cache_dir, dir, kDiskCachePathSize);
+    // The directory may already exist.
+    mkdir(disk_cache_dir, 0777);
+    disk_cache_max_size = max_size > 0 ? max_size : kDefaultDiskCacheSize;
+    const char *sync = getenv("HL_MEMOIZATION_CACHE_SYNC");
+    disk_cache_sync = sync && sync[0] == '1';
+    DiskCacheIndex *index = map_disk_cache_index(user_context);
+    __atomic_store_n(&disk_cache_index, index, __ATOMIC_RELEASE);
+    debug(user_context) << "Memoization cache directory " << disk_cache_dir
+                        << (index ? " opened\n" : " could not be opened\n");
+    return index != NULL;
+}
+
+// Holds the index of the store, or NULL if there isn't one, for the
+// lifetime of a lookup or store. The first use reads the directory
+// from HL_MEMOIZATION_CACHE_DIR if halide_memoization_cache_set_disk_path
+// hasn't been called.
+struct DiskCacheIndexUse {
+    DiskCacheIndex *index;
+
+    DiskCacheIndexUse(void *user_context) {
+        if (!__atomic_load_n(&disk_cache_initialized, __ATOMIC_ACQUIRE)) {
+            ScopedMutexLock lock(&disk_cache_lock);
+            if (!disk_cache_initialized) {
+                const char *dir = getenv("HL_MEMOIZATION_CACHE_DIR");
+                if (dir && *dir) {
+                    open_disk_cache(user_context, dir, 0);
+                }
+                __atomic_store_n(&disk_cache_initialized, true, __ATOMIC_RELEASE);
+            }
+        }
+        // Counted before the index is read, so close_disk_cache either
+        // waits for us or we see it gone.
+        __atomic_fetch_add(&disk_cache_users, 1, __ATOMIC_SEQ_CST);
+        index = __atomic_load_n(&disk_cache_index, __ATOMIC_SEQ_CST);
+    }
+
+    ~DiskCacheIndexUse() {
+        __atomic_fetch_sub(&disk_cache_users, 1, __ATOMIC_SEQ_CST);
+    }
+};
+
+WEAK DiskCacheSlot *find_disk_cache_slot(DiskCacheIndex *index, uint64_t name) {
+    for (uint32_t i = 0; i < kDiskCacheIndexSlots; i++) {
+        if (__atomic_load_n(&index->slots[i].name, __ATOMIC_ACQUIRE) == name) {
+            return &index->slots[i];
+        }
+    }
+    return NULL;
+}
+
+WEAK int64_t disk_cache_now() {
+    return time(NULL);
+}
+
+WEAK void touch_disk_cache_slot(DiskCacheIndex *index, uint64_t name) {
+    DiskCacheSlot *slot = find_disk_cache_slot(index, name);
+    if (slot) {
+        __atomic_store_n(&slot->last_used, disk_cache_now(), __ATOMIC_RELAXED);
+    }
+}
+
+// Free a slot and delete its file, unless another process beat us to it.
+WEAK void remove_disk_cache_slot(DiskCacheSlot *slot) {
+    uint64_t name = __atomic_load_n(&slot->name, __ATOMIC_ACQUIRE);
+    if (name != 0 &&
+        __atomic_compare_exchange_n(&slot->name, &name, (uint64_t)0, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        char path[kDiskCachePathSize];
+        if (disk_cache_path(path, name, ".hlc")) {
+            remove(path);
+        }
+    }
+}
+
+// The least recently used slot in use other than keep, or NULL.
+WEAK DiskCacheSlot *oldest_disk_cache_slot(DiskCacheIndex *index, const DiskCacheSlot *keep) {
+    DiskCacheSlot *oldest = NULL;
+    int64_t oldest_time = 0;
+    for (uint32_t i = 0; i < kDiskCacheIndexSlots; i++) {
+        DiskCacheSlot *slot = &index->slots[i];
+        if (slot == keep || __atomic_load_n(&slot->name, __ATOMIC_ACQUIRE) == 0) {
+            continue;
+        }
+        int64_t t = __atomic_load_n(&slot->last_used, __ATOMIC_RELAXED);
+        if (oldest == NULL || t < oldest_time) {
+            oldest = slot;
+            oldest_time = t;
+        }
+    }
+    return oldest;
+}
+
+WEAK DiskCacheSlot *claim_disk_cache_slot(DiskCacheIndex *index, uint64_t name, uint64_t bytes) {
+    DiskCacheSlot *slot = find_disk_cache_slot(index, name);
+    for (int attempt = 0; slot == NULL && attempt < 4; attempt++) {
+        for (uint32_t i = 0; slot == NULL && i < kDiskCacheIndexSlots; i++) {
+            uint64_t expected = 0;
+            if (__atomic_load_n(&index->slots[i].name, __ATOMIC_RELAXED) == 0 &&
+                __atomic_compare_exchange_n(&index->slots[i].name, &expected, name,
+                                            false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                slot = &index->slots[i];
+            }
+        }
+        if (slot == NULL) {
+            // The index is full, so drop the least recently used file.
+            DiskCacheSlot *oldest = oldest_disk_cache_slot(index, NULL);
+            if (oldest) {
+                remove_disk_cache_slot(oldest);
+            }
+        }
+    }
+    if (slot) {
+        __atomic_store_n(&slot->bytes, bytes, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->last_used, disk_cache_now(), __ATOMIC_RELAXED);
+    }
+    return slot;
+}
+
+// Delete the least recently used files until the store fits in its
+// size limit.
+WEAK void trim_disk_cache(DiskCacheIndex *index, const DiskCacheSlot *keep) {
+    while (true) {
+        uint64_t total = 0;
+        for (uint32_t i = 0; i < kDiskCacheIndexSlots; i++) {
+            if (__atomic_load_n(&index->slots[i].name, __ATOMIC_ACQUIRE) != 0) {
+                total += __atomic_load_n(&index->slots[i].bytes, __ATOMIC_RELAXED);
+            }
+        }
+        if (total <= (uint64_t)disk_cache_max_size) {
+            return;
+        }
+        DiskCacheSlot *oldest = oldest_disk_cache_slot(index, keep);
+        if (oldest == NULL) {
+            return;
+        }
+        remove_disk_cache_slot(oldest);
+    }
+}
+
+// Check a mapped file holds the result for this key and these buffers,
+// and if so copy its contents into the buffers.
+WEAK bool read_disk_cache_file(const uint8_t *data, size_t bytes,
+                               const uint8_t *cache_key, int32_t size,
+                               const halide_buffer_t *computed_bounds,
+                               int32_t tuple_count, halide_buffer_t **tuple_buffers,
+                               int64_t *compute_time) {
+    int32_t dimensions = computed_bounds->dimensions;
+    size_t metadata_bytes = disk_cache_metadata_bytes(size, dimensions, tuple_count);
+    if (bytes < metadata_bytes) {
+        return false;
+    }
+
+    DiskCacheFileHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != kDiskCacheMagic ||
+        header.version != kDiskCacheVersion ||
+        header.key_size != (uint32_t)size ||
+        header.tuple_count != (uint32_t)tuple_count ||
+        header.dimensions != dimensions ||
+        header.payload_offset != metadata_bytes ||
+        header.payload_offset + header.payload_bytes != bytes) {
+        return false;
+    }
+
+    size_t offset = sizeof(header);
+    if (memcmp(data + offset, cache_key, size) != 0) {
+        return false;
+    }
+    offset += disk_cache_align(size, 8);
+
+    halide_dimension_t dim;
+    for (int32_t i = 0; i < dimensions; i++) {
+        memcpy(&dim, data + offset, sizeof(dim));
+        if (dim != computed_bounds->dim[i]) {
+            return false;
+        }
+        offset += sizeof(dim);
+    }
+
+    uint64_t payload_bytes = 0;
+    for (int32_t i = 0; i < tuple_count; i++) {
+        const halide_buffer_t *buf = tuple_buffers[i];
+        DiskCacheTuple tuple;
+        memcpy(&tuple, data + offset, sizeof(tuple));
+        offset += sizeof(tuple);
+        if (tuple.code != buf->type.code ||
+            tuple.bits != buf->type.bits ||
+            tuple.lanes != buf->type.lanes ||
+            tuple.bytes != buf->size_in_bytes()) {
+            return false;
+        }
+        for (int32_t j = 0; j < dimensions; j++) {
+            memcpy(&dim, data + offset, sizeof(dim));
+            if (dim != buf->dim[j]) {
+                return false;
+            }
+            offset += sizeof(dim);
+        }
+        payload_bytes += disk_cache_align(tuple.bytes, kDiskCachePayloadAlignment);
+    }
+    if (payload_bytes != header.payload_bytes) {
+        return false;
+    }
+
+    // Catch files damaged after they were written. The checksum is
+    // built the same way halide_memoization_disk_cache_store builds it.
+    const uint8_t *payload = data + header.payload_offset;
+    uint64_t checksum = 0;
+    for (int32_t i = 0; i < tuple_count; i++) {
+        size_t buf_bytes = tuple_buffers[i]->size_in_bytes();
+        size_t padding = disk_cache_align(buf_bytes, kDiskCachePayloadAlignment) - buf_bytes;
+        checksum = disk_cache_hash(checksum, payload, buf_bytes);
+        checksum = disk_cache_hash(checksum, payload + buf_bytes, padding);
+        payload += buf_bytes + padding;
+    }
+    if (checksum != header.checksum) {
+        return false;
+    }
+
+    payload = data + header.payload_offset;
+    for (int32_t i = 0; i < tuple_count; i++) {
+        halide_buffer_t *buf = tuple_buffers[i];
+        size_t buf_bytes = buf->size_in_bytes();
+        memcpy(buf->host, payload, buf_bytes);
+        payload += disk_cache_align(buf_bytes, kDiskCachePayloadAlignment);
+    }
+    *compute_time = header.compute_time;
+    return true;
+}
+
+WEAK bool write_all(void *f, const void *data, size_t bytes) {
+    return bytes == 0 || fwrite(data, bytes, 1, f) == 1;
+}
+
+WEAK int halide_memoization_disk_cache_lookup(void *user_context, const uint8_t *cache_key, int32_t size,
+                                              const halide_buffer_t *computed_bounds,
+                                              int32_t tuple_count, halide_buffer_t **tuple_buffers,
+                                              int64_t *compute_time) {
+    DiskCacheIndexUse use(user_context);
+    DiskCacheIndex *index = use.index;
+    if (!index) {
+        return 1;
+    }
+    DiskCacheKey key(user_context, cache_key, size);
+    if (!key.key) {
+        return 1;
+    }
+
+    uint64_t name = disk_cache_name(key.key, key.size, computed_bounds, tuple_count);
+    char path[kDiskCachePathSize];
+    if (!disk_cache_path(path, name, ".hlc")) {
+        return 1;
+    }
+    void *f = fopen(path, "rb");
+    if (!f) {
+        return 1;
+    }
+    long bytes = -1;
+    if (fseek(f, 0, SEEK_END) == 0) {
+        bytes = ftell(f);
+    }
+    void *mapping = MAP_FAILED;
+    if (bytes >= (long)sizeof(DiskCacheFileHeader)) {
+        mapping = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fileno(f), 0);
+    }
+    fclose(f);
+    if (mapping == MAP_FAILED) {
+        return 1;
+    }
+
+    bool hit = read_disk_cache_file((const uint8_t *)mapping, bytes, key.key, key.size,
+                                    computed_bounds, tuple_count, tuple_buffers, compute_time);
+    munmap(mapping, bytes);
+    if (!hit) {
+        // The file is damaged, from another version, or for a key with
+        // the same hash. Delete it so the result can be stored again.
+        debug(user_context) << "Removing stale memoization cache file " << path << "\n";
+        DiskCacheSlot *slot = find_disk_cache_slot(index, name);
+        if (slot) {
+            remove_disk_cache_slot(slot);
+        } else {
+            remove(path);
+        }
+        return 1;
+    }
+    touch_disk_cache_slot(index, name);
+    return 0;
+}
+
+WEAK bool halide_memoization_disk_cache_store(void *user_context, const uint8_t *cache_key, int32_t size,
+                                              const halide_buffer_t *computed_bounds,
+                                              int32_t tuple_count, halide_buffer_t **tuple_buffers,
+                                              int64_t compute_time) {
+    DiskCacheIndexUse use(user_context);
+    DiskCacheIndex *index = use.index;
+    if (!index) {
+        return false;
+    }
+
+    // Only results that are on the host can be written.
+    for (int32_t i = 0; i < tuple_count; i++) {
+        if (tuple_buffers[i]->host == NULL || tuple_buffers[i]->device_dirty()) {
+            return false;
+        }
+    }
+
+    DiskCacheKey key(user_context, cache_key, size);
+    if (!key.key) {
+        return false;
+    }
+
+    uint64_t name = disk_cache_name(key.key, key.size, computed_bounds, tuple_count);
+    char path[kDiskCachePathSize];
+    if (!disk_cache_path(path, name, ".hlc")) {
+        return false;
+    }
+    void *existing = fopen(path, "rb");
+    if (existing) {
+        // Another process already wrote this result.
+        fclose(existing);
+        touch_disk_cache_slot(index, name);
+        return false;
+    }
+
+    int32_t dimensions = computed_bounds->dimensions;
+    size_t metadata_bytes = disk_cache_metadata_bytes(key.size, dimensions, tuple_count);
+    // The padding after each buffer is zero, and is covered by the
+    // checksum like the rest of the payload.
+    static const uint8_t zeros[kDiskCachePayloadAlignment] = {0};
+    uint64_t payload_bytes = 0;
+    uint64_t checksum = 0;
+    for (int32_t i = 0; i < tuple_count; i++) {
+        size_t buf_bytes = tuple_buffers[i]->size_in_bytes();
+        size_t padding = disk_cache_align(buf_bytes, kDiskCachePayloadAlignment) - buf_bytes;
+        checksum = disk_cache_hash(checksum, tuple_buffers[i]->host, buf_bytes);
+        checksum = disk_cache_hash(checksum, zeros, padding);
+        payload_bytes += buf_bytes + padding;
+    }
+    uint64_t file_bytes = metadata_bytes + payload_bytes;
+    if (file_bytes > (uint64_t)disk_cache_max_size) {
+        return false;
+    }
+
+    uint8_t *metadata = (uint8_t *)halide_malloc(user_context, metadata_bytes);
+    if (!metadata) {
+        return false;
+    }
+    memset(metadata, 0, metadata_bytes);
+    DiskCacheFileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = kDiskCacheMagic;
+    header.version = kDiskCacheVersion;
+    header.key_size = key.size;
+    header.tuple_count = tuple_count;
+    header.dimensions = dimensions;
+    header.compute_time = compute_time;
+    header.payload_offset = metadata_bytes;
+    header.payload_bytes = payload_bytes;
+    header.checksum = checksum;
+    memcpy(metadata, &header, sizeof(header));
+    size_t offset = sizeof(header);
+    memcpy(metadata + offset, key.key, key.size);
+    offset += disk_cache_align(key.size, 8);
+    memcpy(metadata + offset, computed_bounds->dim, sizeof(halide_dimension_t) * dimensions);
+    offset += sizeof(halide_dimension_t) * dimensions;
+    for (int32_t i = 0; i < tuple_count; i++) {
+        const halide_buffer_t *buf = tuple_buffers[i];
+        DiskCacheTuple tuple;
+        memset(&tuple, 0, sizeof(tuple));
+        tuple.code = buf->type.code;
+        tuple.bits = buf->type.bits;
+        tuple.lanes = buf->type.lanes;
+        tuple.bytes = buf->size_in_bytes();
+        memcpy(metadata + offset, &tuple, sizeof(tuple));
+        offset += sizeof(tuple);
+        memcpy(metadata + offset, buf->dim, sizeof(halide_dimension_t) * dimensions);
+        offset += sizeof(halide_dimension_t) * dimensions;
+    }
+
+    // Write to a temporary file and rename it into place, so that a
+    // crash can never leave a partially written file under the final
+    // name. Files damaged by losing power are caught by the checksum,
+    // so flushing them to disk is left to HL_MEMOIZATION_CACHE_SYNC=1.
+    char temp_path[kDiskCachePathSize];
+    char *end = temp_path + sizeof(temp_path) - 1;
+    char *dst = halide_string_to_string(temp_path, end, path);
+    dst = halide_string_to_string(dst, end, ".");
+    dst = halide_int64_to_string(dst, end, getpid(), 1);
+    dst = halide_string_to_string(dst, end, ".");
+    dst = halide_uint64_to_string(dst, end, __atomic_fetch_add(&disk_cache_temp_counter, 1, __ATOMIC_RELAXED), 1);
+    dst = halide_string_to_string(dst, end, ".tmp");
+    bool written = false;
+    void *f = dst < end ? fopen(temp_path, "wb") : NULL;
+    if (f) {
+        written = write_all(f, metadata, metadata_bytes);
+        for (int32_t i = 0; written && i < tuple_count; i++) {
+            size_t buf_bytes = tuple_buffers[i]->size_in_bytes();
+            size_t padding = disk_cache_align(buf_bytes, kDiskCachePayloadAlignment) - buf_bytes;
+            written = write_all(f, tuple_buffers[i]->host, buf_bytes) &&
+                      write_all(f, zeros, padding);
+        }
+        written = written && fflush(f) == 0 && (!disk_cache_sync || fsync(fileno(f)) == 0);
+        written = fclose(f) == 0 && written;
+    }
+    halide_free(user_context, metadata);
+    if (!written || rename(temp_path, path) != 0) {
+        if (f) {
+            remove(temp_path);
+        }
+        debug(user_context) << "Could not write memoization cache file " << path << "\n";
+        return false;
+    }
+
+    if (disk_cache_sync) {
+        // Make the rename itself durable.
+        void *dir = fopen(disk_cache_dir, "r");
+        if (dir) {
+            fsync(fileno(dir));
+            fclose(dir);
+        }
+    }
+
+    DiskCacheSlot *slot = claim_disk_cache_slot(index, name, file_bytes);
+    if (!slot) {
+        // Files that aren't in the index wouldn't count towards the size limit.
+        remove(path);
+        return false;
+    }
+    trim_disk_cache(index, slot);
+    return true;
+}
+
+WEAK void halide_memoization_disk_cache_cleanup() {
+    ScopedMutexLock lock(&disk_cache_lock);
+    close_disk_cache();
+    __atomic_store_n(&disk_cache_initialized, false, __ATOMIC_RELEASE);
+}
+
+}}} // namespace Halide::Runtime::Internal
+
+extern "C" {
+
+WEAK int halide_memoization_cache_set_disk_path(void *user_context, const char *path, int64_t max_size) {
+    ScopedMutexLock lock(&disk_cache_lock);
+    __atomic_store_n(&disk_cache_initialized, true, __ATOMIC_RELEASE);
+    if (path == NULL) {
+        close_disk_cache();
+        return 0;
+    }
+    if (!open_disk_cache(user_context, path, max_size)) {
+        error(user_context) << "Could not use " << path << " as a memoization cache directory\n";
+        return halide_error_code_generic_error;
+    }
+    return 0;
+}
+
+}
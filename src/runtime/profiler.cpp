@@ -1,5 +1,6 @@
 #include "HalideRuntime.h"
 #include "printer.h"
+#include "runtime_internal.h"
 #include "scoped_mutex_lock.h"
 
 // Note: The profiler thread may out-live any valid user_context, or
@@ -9,7 +10,7 @@
 extern "C" {
 // Returns the address of the global halide_profiler state
 WEAK halide_profiler_state *halide_profiler_get_state() {
-    static halide_profiler_state s = {{{0}}, 1, 0, 0, 0, 0, NULL, NULL};
+    static halide_profiler_state s = {{{0}}, 1, 0, 0, 0, 0, NULL, NULL, NULL};
     return &s;
 }
 }
@@ -60,13 +61,18 @@ WEAK halide_profiler_pipeline_stats *find_or_create_pipeline(const char *pipelin
         p->funcs[i].stack_peak = 0;
         p->funcs[i].active_threads_numerator = 0;
         p->funcs[i].active_threads_denominator = 0;
+        p->funcs[i].cycles = 0;
+        p->funcs[i].instructions = 0;
+        p->funcs[i].llc_misses = 0;
+        p->funcs[i].branch_misses = 0;
     }
     s->first_free_id += num_funcs;
     s->pipelines = p;
     return p;
 }
 
-WEAK void bill_func(halide_profiler_state *s, int func_id, uint64_t time, int active_threads) {
+// Returns the pipeline billed, if any.
+WEAK halide_profiler_pipeline_stats *bill_func(halide_profiler_state *s, int func_id, uint64_t time, int active_threads) {
     halide_profiler_pipeline_stats *p_prev = NULL;
     for (halide_profiler_pipeline_stats *p = s->pipelines; p;
          p = (halide_profiler_pipeline_stats *)(p->next)) {
@@ -85,11 +91,43 @@ WEAK void bill_func(halide_profiler_state *s, int func_id, uint64_t time, int ac
             p->samples++;
             p->active_threads_numerator += active_threads;
             p->active_threads_denominator += 1;
-            return;
+            return p;
         }
         p_prev = p;
     }
     // Someone must have called reset_state while a kernel was running. Do nothing.
+    return NULL;
+}
+
+// Bill time to the current Func of every running pipeline
+// invocation. Must be called with the state locked, so that no
+// invocation can leave the list meanwhile.
+WEAK void bill_running_instances(halide_profiler_state *s, uint64_t time) {
+    halide_profiler_pipeline_stats *remote = NULL;
+    if (s->get_remote_profiler_state) {
+        // Execution has disappeared into remote code running on an
+        // accelerator (e.g. Hexagon DSP). Bill the remote Func
+        // instead of the host Func that launched it.
+        int func, active_threads;
+        s->get_remote_profiler_state(&func, &active_threads);
+        if (func >= 0) {
+            remote = bill_func(s, func, time, active_threads);
+        }
+    }
+
+    for (halide_profiler_instance_state *instance = s->instances; instance;
+         instance = (halide_profiler_instance_state *)(instance->next)) {
+        if (remote && instance->pipeline == remote) {
+            // We can't tell which invocation of the pipeline is
+            // offloading, so skip the first one.
+            remote = NULL;
+            continue;
+        }
+        int func = instance->current_func;
+        if (func >= 0) {
+            bill_func(s, func, time, instance->active_threads);
+        }
+    }
 }
 
 WEAK void sampling_profiler_thread(void *) {
@@ -103,23 +141,13 @@ WEAK void sampling_profiler_thread(void *) {
         uint64_t t1 = halide_current_time_ns(NULL);
         uint64_t t = t1;
         while (1) {
-            int func, active_threads;
-            if (s->get_remote_profiler_state) {
-                // Execution has disappeared into remote code running
-                // on an accelerator (e.g. Hexagon DSP)
-                s->get_remote_profiler_state(&func, &active_threads);
-            } else {
-                func = s->current_func;
-                active_threads = s->active_threads;
-            }
             uint64_t t_now = halide_current_time_ns(NULL);
-            if (func == halide_profiler_please_stop) {
+            if (s->current_func == halide_profiler_please_stop) {
                 break;
-            } else if (func >= 0) {
-                // Assume all time since I was last awake is due to
-                // the currently running func.
-                bill_func(s, func, t_now - t, active_threads);
             }
+            // Assume all time since I was last awake is due to the
+            // Funcs currently running.
+            bill_running_instances(s, t_now - t);
             t = t_now;
 
             // Release the lock, sleep, reacquire.
@@ -133,6 +161,26 @@ WEAK void sampling_profiler_thread(void *) {
     halide_mutex_unlock(&s->lock);
 }
 
+// Must be called with the state locked. Returns NULL if allocating
+// space to track the statistics failed.
+WEAK halide_profiler_pipeline_stats *start_pipeline(void *user_context,
+                                                    halide_profiler_state *s,
+                                                    const char *pipeline_name,
+                                                    int num_funcs,
+                                                    const uint64_t *func_names) {
+    if (!s->sampling_thread) {
+        halide_start_clock(user_context);
+        s->sampling_thread = halide_spawn_thread(sampling_profiler_thread, NULL);
+    }
+
+    halide_profiler_pipeline_stats *p =
+        find_or_create_pipeline(pipeline_name, num_funcs, func_names);
+    if (p) {
+        p->runs++;
+    }
+    return p;
+}
+
 }}}
 
 namespace {
@@ -178,22 +226,94 @@ WEAK int halide_profiler_pipeline_start(void *user_context,
 
     ScopedMutexLock lock(&s->lock);
 
-    if (!s->sampling_thread) {
-        halide_start_clock(user_context);
-        s->sampling_thread = halide_spawn_thread(sampling_profiler_thread, NULL);
+    halide_profiler_pipeline_stats *p =
+        start_pipeline(user_context, s, pipeline_name, num_funcs, func_names);
+    if (!p) {
+        return halide_error_out_of_memory(user_context);
     }
+    return p->first_func_id;
+}
+
+// As above, but also adds the given instance state to the list the
+// profiler thread samples, until halide_profiler_instance_end.
+WEAK int halide_profiler_instance_start(void *user_context,
+                                        const char *pipeline_name,
+                                        int num_funcs,
+                                        const uint64_t *func_names,
+                                        void *instance_state) {
+    halide_profiler_state *s = halide_profiler_get_state();
+
+    ScopedMutexLock lock(&s->lock);
 
     halide_profiler_pipeline_stats *p =
-        find_or_create_pipeline(pipeline_name, num_funcs, func_names);
+        start_pipeline(user_context, s, pipeline_name, num_funcs, func_names);
     if (!p) {
-        // Allocating space to track the statistics failed.
         return halide_error_out_of_memory(user_context);
     }
-    p->runs++;
+
+    halide_profiler_instance_state *instance = (halide_profiler_instance_state *)instance_state;
+    instance->current_func = p->first_func_id;
+    instance->active_threads = 0;
+    instance->count_events = halide_perf_counters_enabled() ? 1 : 0;
+    instance->pipeline = p;
+    instance->next = s->instances;
+    s->instances = instance;
 
     return p->first_func_id;
 }
 
+WEAK void halide_profiler_instance_end(void *user_context, void *instance_state) {
+    halide_profiler_instance_state *instance = (halide_profiler_instance_state *)instance_state;
+    if (instance->count_events) {
+        // In case the pipeline bailed out early, stop billing this
+        // thread's counters to it.
+        halide_profiler_count_events(instance, halide_profiler_outside_of_halide);
+    }
+
+    halide_profiler_state *s = halide_profiler_get_state();
+    ScopedMutexLock lock(&s->lock);
+
+    halide_profiler_instance_state **prev = &s->instances;
+    while (*prev) {
+        if (*prev == instance_state) {
+            *prev = (halide_profiler_instance_state *)((*prev)->next);
+            return;
+        }
+        prev = (halide_profiler_instance_state **)(&(*prev)->next);
+    }
+}
+
+// Called by a thread of a pipeline invocation that reads hardware
+// performance counters, whenever it starts work on a different Func
+// (or stops work, if func is negative). The counts since the thread's
+// last call go to the Func it was working on.
+WEAK void halide_profiler_count_events(halide_profiler_instance_state *instance, int func) {
+    uint64_t values[perf_counter_count];
+    perf_counter_thread_state *t = halide_perf_counters_read(values);
+    if (!t) {
+        return;
+    }
+
+    // The invocation is still running, so its pipeline's stats can't
+    // have been freed. They are updated without grabbing the lock, as
+    // for the memory stats below.
+    halide_profiler_pipeline_stats *p = instance->pipeline;
+    if (t->instance == instance && p &&
+        t->func >= p->first_func_id && t->func < p->first_func_id + p->num_funcs) {
+        halide_profiler_func_stats *f = p->funcs + t->func - p->first_func_id;
+        __sync_add_and_fetch(&f->cycles, values[perf_counter_cycles] - t->last[perf_counter_cycles]);
+        __sync_add_and_fetch(&f->instructions, values[perf_counter_instructions] - t->last[perf_counter_instructions]);
+        __sync_add_and_fetch(&f->llc_misses, values[perf_counter_llc_misses] - t->last[perf_counter_llc_misses]);
+        __sync_add_and_fetch(&f->branch_misses, values[perf_counter_branch_misses] - t->last[perf_counter_branch_misses]);
+    }
+
+    for (int i = 0; i < perf_counter_count; i++) {
+        t->last[i] = values[i];
+    }
+    t->instance = func >= 0 ? instance : NULL;
+    t->func = func;
+}
+
 WEAK void halide_profiler_stack_peak_update(void *user_context,
                                             void *pipeline_state,
                                             uint64_t *f_values) {
@@ -280,6 +400,101 @@ WEAK void halide_profiler_memory_free(void *user_context,
     __sync_sub_and_fetch(&f_stats->memory_current, decr);
 }
 
+WEAK int halide_profiler_report_json_unlocked(void *user_context, halide_profiler_state *s, const char *filename) {
+    // Each pipeline and func goes on its own line. Names are the only
+    // fields without a bound on their length, so the line buffer is
+    // sized for the longest one with every character escaped.
+    size_t longest_name = 0;
+    for (halide_profiler_pipeline_stats *p = s->pipelines; p;
+         p = (halide_profiler_pipeline_stats *)(p->next)) {
+        longest_name = max(longest_name, strlen(p->name));
+        for (int i = 0; i < p->num_funcs; i++) {
+            longest_name = max(longest_name, strlen(p->funcs[i].name));
+        }
+    }
+    size_t buf_size = 6 * longest_name + 1024;
+    char *buf = (char *)halide_malloc(user_context, buf_size);
+    if (!buf) {
+        return -1;
+    }
+    char *end = buf + buf_size;
+
+    void *f = fopen(filename, "w");
+    if (!f) {
+        halide_free(user_context, buf);
+        return -1;
+    }
+
+    // Times are in nanoseconds, summed over all runs. A line that fills
+    // the buffer was cut short, and fails the report.
+    bool success = fwrite("{\"pipelines\": [", 15, 1, f) == 1;
+    bool first_pipeline = true;
+    for (halide_profiler_pipeline_stats *p = s->pipelines; p;
+         p = (halide_profiler_pipeline_stats *)(p->next)) {
+        if (!p->runs) continue;
+        char *dst = buf;
+        dst = halide_string_to_string(dst, end, first_pipeline ? "\n  " : ",\n  ");
+        dst = halide_string_to_string(dst, end, "{\"name\": ");
+        dst = halide_json_string_to_string(dst, end, p->name);
+        dst = halide_string_to_string(dst, end, ", \"time_ns\": ");
+        dst = halide_uint64_to_string(dst, end, p->time, 1);
+        dst = halide_string_to_string(dst, end, ", \"runs\": ");
+        dst = halide_int64_to_string(dst, end, p->runs, 1);
+        dst = halide_string_to_string(dst, end, ", \"samples\": ");
+        dst = halide_int64_to_string(dst, end, p->samples, 1);
+        dst = halide_string_to_string(dst, end, ", \"average_threads\": ");
+        dst = halide_double_to_string(dst, end, p->active_threads_numerator / (p->active_threads_denominator + 1e-10), 0);
+        dst = halide_string_to_string(dst, end, ", \"heap_allocations\": ");
+        dst = halide_int64_to_string(dst, end, p->num_allocs, 1);
+        dst = halide_string_to_string(dst, end, ", \"memory_peak\": ");
+        dst = halide_uint64_to_string(dst, end, p->memory_peak, 1);
+        dst = halide_string_to_string(dst, end, ", \"memory_total\": ");
+        dst = halide_uint64_to_string(dst, end, p->memory_total, 1);
+        dst = halide_string_to_string(dst, end, ",\n   \"funcs\": [");
+        success = success && dst < end && fwrite(buf, dst - buf, 1, f) == 1;
+        first_pipeline = false;
+
+        for (int i = 0; i < p->num_funcs; i++) {
+            halide_profiler_func_stats *fs = p->funcs + i;
+            dst = buf;
+            dst = halide_string_to_string(dst, end, i == 0 ? "\n    " : ",\n    ");
+            dst = halide_string_to_string(dst, end, "{\"name\": ");
+            dst = halide_json_string_to_string(dst, end, fs->name);
+            dst = halide_string_to_string(dst, end, ", \"time_ns\": ");
+            dst = halide_uint64_to_string(dst, end, fs->time, 1);
+            dst = halide_string_to_string(dst, end, ", \"percent\": ");
+            dst = halide_double_to_string(dst, end, p->time ? (100.0 * fs->time) / p->time : 0.0, 0);
+            dst = halide_string_to_string(dst, end, ", \"average_threads\": ");
+            dst = halide_double_to_string(dst, end, fs->active_threads_numerator / (fs->active_threads_denominator + 1e-10), 0);
+            dst = halide_string_to_string(dst, end, ", \"heap_allocations\": ");
+            dst = halide_int64_to_string(dst, end, fs->num_allocs, 1);
+            dst = halide_string_to_string(dst, end, ", \"memory_peak\": ");
+            dst = halide_uint64_to_string(dst, end, fs->memory_peak, 1);
+            dst = halide_string_to_string(dst, end, ", \"memory_total\": ");
+            dst = halide_uint64_to_string(dst, end, fs->memory_total, 1);
+            dst = halide_string_to_string(dst, end, ", \"stack_peak\": ");
+            dst = halide_uint64_to_string(dst, end, fs->stack_peak, 1);
+            if (fs->cycles) {
+                dst = halide_string_to_string(dst, end, ", \"cycles\": ");
+                dst = halide_uint64_to_string(dst, end, fs->cycles, 1);
+                dst = halide_string_to_string(dst, end, ", \"instructions\": ");
+                dst = halide_uint64_to_string(dst, end, fs->instructions, 1);
+                dst = halide_string_to_string(dst, end, ", \"llc_misses\": ");
+                dst = halide_uint64_to_string(dst, end, fs->llc_misses, 1);
+                dst = halide_string_to_string(dst, end, ", \"branch_misses\": ");
+                dst = halide_uint64_to_string(dst, end, fs->branch_misses, 1);
+            }
+            dst = halide_string_to_string(dst, end, "}");
+            success = success && dst < end && fwrite(buf, dst - buf, 1, f) == 1;
+        }
+        success = success && fwrite("]}", 2, 1, f) == 1;
+    }
+    success = success && fwrite("\n]}\n", 4, 1, f) == 1;
+    success = (fclose(f) == 0) && success;
+    halide_free(user_context, buf);
+    return success ? 0 : -2;
+}
+
 WEAK void halide_profiler_report_unlocked(void *user_context, halide_profiler_state *s) {
 
     char line_buf[1024];
@@ -312,7 +527,7 @@ WEAK void halide_profiler_report_unlocked(void *user_context, halide_profiler_st
         if (!print_f_states) {
             for (int i = 0; i < p->num_funcs; i++) {
                 halide_profiler_func_stats *fs = p->funcs + i;
-                if (fs->stack_peak) {
+                if (fs->stack_peak || fs->cycles) {
                     print_f_states = true;
                     break;
                 }
@@ -374,12 +589,39 @@ WEAK void halide_profiler_report_unlocked(void *user_context, halide_profiler_st
                 if (fs->stack_peak > 0) {
                     sstr << " stack: " << fs->stack_peak;
                 }
+                if (fs->cycles) {
+                    sstr << " ipc: " << (float)fs->instructions / fs->cycles;
+                    sstr.erase(4);
+                    sstr << " llc misses: " << fs->llc_misses
+                         << " branch misses: " << fs->branch_misses;
+                }
                 sstr << "\n";
 
                 halide_print(user_context, sstr.str());
             }
         }
     }
+
+    halide_pool_allocator_stats_t pool;
+    halide_pool_allocator_stats(&pool);
+    uint64_t pool_allocs = pool.hits + pool.misses + pool.oversized;
+    if (pool_allocs) {
+        sstr.clear();
+        sstr << "pool allocator: " << pool_allocs << " heap allocations"
+             << "  reused: " << pool.hits
+             << " (" << (int)((100 * pool.hits) / pool_allocs) << "%)"
+             << "  new: " << pool.misses
+             << "  oversized: " << pool.oversized
+             << "  free bytes held: " << pool.idle_bytes << "\n";
+        halide_print(user_context, sstr.str());
+    }
+
+    const char *json_file = getenv("HL_PROFILER_JSON");
+    if (json_file && *json_file) {
+        if (halide_profiler_report_json_unlocked(user_context, s, json_file) != 0) {
+            error(user_context) << "Could not write profile to " << json_file << "\n";
+        }
+    }
 }
 
 WEAK void halide_profiler_report(void *user_context) {
@@ -388,22 +630,69 @@ WEAK void halide_profiler_report(void *user_context) {
     halide_profiler_report_unlocked(user_context, s);
 }
 
+WEAK int halide_profiler_report_json(void *user_context, const char *filename) {
+    halide_profiler_state *s = halide_profiler_get_state();
+    ScopedMutexLock lock(&s->lock);
+    return halide_profiler_report_json_unlocked(user_context, s, filename);
+}
+
 
 WEAK void halide_profiler_reset_unlocked(halide_profiler_state *s) {
+    // Pipelines still running elsewhere keep their stats (and their
+    // func ids), but start counting again from zero.
+    halide_profiler_pipeline_stats *running = NULL;
+    s->first_free_id = 0;
     while (s->pipelines) {
         halide_profiler_pipeline_stats *p = s->pipelines;
         s->pipelines = (halide_profiler_pipeline_stats *)(p->next);
-        free(p->funcs);
-        free(p);
+
+        int instances = 0;
+        for (halide_profiler_instance_state *instance = s->instances; instance;
+             instance = (halide_profiler_instance_state *)(instance->next)) {
+            instances += (instance->pipeline == p) ? 1 : 0;
+        }
+        if (!instances) {
+            free(p->funcs);
+            free(p);
+            continue;
+        }
+
+        // Memory still allocated stays allocated.
+        p->runs = instances;
+        p->time = 0;
+        p->samples = 0;
+        p->memory_peak = p->memory_current;
+        p->memory_total = 0;
+        p->num_allocs = 0;
+        p->active_threads_numerator = 0;
+        p->active_threads_denominator = 0;
+        for (int i = 0; i < p->num_funcs; i++) {
+            halide_profiler_func_stats *f = p->funcs + i;
+            f->time = 0;
+            f->memory_peak = f->memory_current;
+            f->memory_total = 0;
+            f->num_allocs = 0;
+            f->active_threads_numerator = 0;
+            f->active_threads_denominator = 0;
+            f->cycles = 0;
+            f->instructions = 0;
+            f->llc_misses = 0;
+            f->branch_misses = 0;
+        }
+        p->next = running;
+        running = p;
+        if (p->first_func_id + p->num_funcs > s->first_free_id) {
+            s->first_free_id = p->first_func_id + p->num_funcs;
+        }
     }
-    s->first_free_id = 0;
+    s->pipelines = running;
 }
 
 WEAK void halide_profiler_reset() {
-    // WARNING: Do not call this method while any other halide
-    // pipeline is running; halide_profiler_memory_allocate/free and
+    // halide_profiler_memory_allocate/free and
     // halide_profiler_stack_peak_update update the profiler pipeline's
-    // state without grabbing the global profiler state's lock.
+    // state without grabbing the global profiler state's lock, so the
+    // stats of running pipelines must not be freed here.
     halide_profiler_state *s = halide_profiler_get_state();
     ScopedMutexLock lock(&s->lock);
     halide_profiler_reset_unlocked(s);
@@ -2,6 +2,8 @@
 
 extern "C" {
 
+WEAK void halide_profiler_count_events(halide_profiler_instance_state *instance, int func);
+
 WEAK __attribute__((always_inline)) int halide_profiler_set_current_func(halide_profiler_state *state, int tok, int t) {
     // Use empty volatile asm blocks to prevent code motion. Otherwise
     // llvm reorders or elides the stores.
@@ -28,4 +30,40 @@ WEAK __attribute__((always_inline)) int halide_profiler_decr_active_threads(hali
     return ret;
 }
 
+// The same, for the state of a single pipeline invocation.
+WEAK __attribute__((always_inline)) int halide_profiler_instance_set_current_func(halide_profiler_instance_state *instance, int tok, int t) {
+    volatile int *ptr = &(instance->current_func);
+    asm volatile ("":::);
+    *ptr = tok + t;
+    asm volatile ("":::);
+    if (instance->count_events) {
+        halide_profiler_count_events(instance, tok + t);
+    }
+    return 0;
+}
+
+WEAK __attribute__((always_inline)) int halide_profiler_instance_incr_active_threads(halide_profiler_instance_state *instance) {
+    volatile int *ptr = &(instance->active_threads);
+    asm volatile ("":::);
+    int ret = __sync_fetch_and_add(ptr, 1);
+    asm volatile ("":::);
+    if (instance->count_events) {
+        // This thread is starting work on whatever the invocation is
+        // computing.
+        halide_profiler_count_events(instance, instance->current_func);
+    }
+    return ret;
+}
+
+WEAK __attribute__((always_inline)) int halide_profiler_instance_decr_active_threads(halide_profiler_instance_state *instance) {
+    volatile int *ptr = &(instance->active_threads);
+    asm volatile ("":::);
+    int ret = __sync_fetch_and_sub(ptr, 1);
+    asm volatile ("":::);
+    if (instance->count_events) {
+        halide_profiler_count_events(instance, halide_profiler_outside_of_halide);
+    }
+    return ret;
+}
+
 }
@@ -108,13 +108,16 @@ extern "C" __attribute__((used)) void *halide_runtime_api_functions[] = {
     (void *)&halide_hexagon_wrap_device_handle,
     (void *)&halide_int64_to_string,
     (void *)&halide_join_thread,
+    (void *)&halide_json_string_to_string,
     (void *)&halide_load_library,
     (void *)&halide_malloc,
     (void *)&halide_matlab_call_pipeline,
     (void *)&halide_memoization_cache_cleanup,
     (void *)&halide_memoization_cache_lookup,
     (void *)&halide_memoization_cache_release,
+    (void *)&halide_memoization_cache_set_disk_path,
     (void *)&halide_memoization_cache_set_size,
+    (void *)&halide_memoization_cache_stats,
     (void *)&halide_memoization_cache_store,
     (void *)&halide_metal_acquire_context,
     (void *)&halide_metal_detach_buffer,
@@ -155,13 +158,21 @@ extern "C" __attribute__((used)) void *halide_runtime_api_functions[] = {
     (void *)&halide_openglcompute_initialize_kernels,
     (void *)&halide_openglcompute_run,
     (void *)&halide_pointer_to_string,
+    (void *)&halide_pool_allocator_release_unused,
+    (void *)&halide_pool_allocator_set_limit,
+    (void *)&halide_pool_allocator_stats,
+    (void *)&halide_pool_free,
+    (void *)&halide_pool_malloc,
     (void *)&halide_print,
     (void *)&halide_profiler_get_pipeline_state,
     (void *)&halide_profiler_get_state,
+    (void *)&halide_profiler_instance_end,
+    (void *)&halide_profiler_instance_start,
     (void *)&halide_profiler_memory_allocate,
     (void *)&halide_profiler_memory_free,
     (void *)&halide_profiler_pipeline_start,
     (void *)&halide_profiler_report,
+    (void *)&halide_profiler_report_json,
     (void *)&halide_profiler_reset,
     (void *)&halide_profiler_stack_peak_update,
     (void *)&halide_qurt_hvx_lock,
@@ -185,6 +196,7 @@ extern "C" __attribute__((used)) void *halide_runtime_api_functions[] = {
     (void *)&halide_set_error_handler,
     (void *)&halide_set_gpu_device,
     (void *)&halide_set_num_threads,
+    (void *)&halide_set_thread_affinity,
     (void *)&halide_set_trace_file,
     (void *)&halide_shutdown_thread_pool,
     (void *)&halide_shutdown_trace,
@@ -99,6 +99,7 @@ WEAK char *halide_string_to_string(char *dst, char *end, const char *arg);
 WEAK char *halide_double_to_string(char *dst, char *end, double arg, int scientific);
 WEAK char *halide_int64_to_string(char *dst, char *end, int64_t arg, int digits);
 WEAK char *halide_uint64_to_string(char *dst, char *end, uint64_t arg, int digits);
+WEAK char *halide_json_string_to_string(char *dst, char *end, const char *arg);
 WEAK char *halide_pointer_to_string(char *dst, char *end, const void *arg);
 WEAK char *halide_buffer_to_string(char *dst, char *end, const halide_buffer_t *arg);
 WEAK char *halide_type_to_string(char *dst, char *end, const halide_type_t *arg);
@@ -134,6 +135,14 @@ WEAK int halide_profiler_pipeline_start(void *user_context,
                                         const char *pipeline_name,
                                         int num_funcs,
                                         const uint64_t *func_names);
+// The instance is declared as void* for the same reason.
+WEAK int halide_profiler_instance_start(void *user_context,
+                                        const char *pipeline_name,
+                                        int num_funcs,
+                                        const uint64_t *func_names,
+                                        void *instance);
+WEAK void halide_profiler_instance_end(void *user_context, void *instance);
+WEAK void halide_profiler_count_events(struct halide_profiler_instance_state *instance, int func);
 WEAK int halide_host_cpu_count();
 
 WEAK int halide_device_and_host_malloc(void *user_context, struct halide_buffer_t *buf,
@@ -203,6 +212,52 @@ extern WEAK __attribute__((always_inline)) int halide_malloc_alignment();
 
 void halide_thread_yield();
 
+// Placement of the thread pool's workers, implemented per OS. Read the
+// topology of the host for a halide_thread_affinity_t, and return the
+// number of NUMA nodes workers are spread over.
+int halide_init_thread_placement(int affinity);
+// Pin the calling thread, which is the given worker of the pool.
+void halide_place_worker_thread(int worker);
+// The NUMA node of the cpu the calling thread is running on.
+int halide_current_numa_node();
+
+// The persistent tier of the memoization cache, implemented per OS.
+// Fill the buffers of a result that missed in memory from disk,
+// returning 0 and the time the result originally took to compute if
+// it was there, and 1 otherwise.
+int halide_memoization_disk_cache_lookup(void *user_context, const uint8_t *cache_key, int32_t size,
+                                         const halide_buffer_t *computed_bounds,
+                                         int32_t tuple_count, halide_buffer_t **tuple_buffers,
+                                         int64_t *compute_time);
+// Write a computed result to disk. Returns true if a file was written.
+bool halide_memoization_disk_cache_store(void *user_context, const uint8_t *cache_key, int32_t size,
+                                         const halide_buffer_t *computed_bounds,
+                                         int32_t tuple_count, halide_buffer_t **tuple_buffers,
+                                         int64_t compute_time);
+void halide_memoization_disk_cache_cleanup();
+
+// Hardware performance counters of the calling thread, read by the
+// profiler at each Func transition. Implemented per OS.
+enum {
+    perf_counter_cycles,
+    perf_counter_instructions,
+    perf_counter_llc_misses,
+    perf_counter_branch_misses,
+    perf_counter_count
+};
+// The counters at a thread's last Func transition, and the pipeline
+// invocation and Func they are being billed to.
+struct perf_counter_thread_state {
+    uint64_t last[perf_counter_count];
+    void *instance;
+    int func;
+};
+// Whether the user asked for counters and they can be read.
+bool halide_perf_counters_enabled();
+// Read the calling thread's counters, opening them on first use.
+// Returns that thread's state, or NULL if its counters can't be read.
+perf_counter_thread_state *halide_perf_counters_read(uint64_t *values);
+
 }}}
 
 using namespace Halide::Runtime::Internal;
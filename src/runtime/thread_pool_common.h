@@ -21,6 +21,21 @@ int gettid() {
 
 namespace Halide { namespace Runtime { namespace Internal {
 
+// A contiguous block of the iterations of a job run by the
+// work-stealing scheduler. Each worker on the job takes chunks from
+// the front of its own range, and steals from the back of the others
+// once its own range is empty.
+struct work_range {
+    halide_mutex mutex;
+    int begin, end;
+    // The number of workers on this range, protected by the work
+    // queue lock, and the NUMA node whose workers prefer it.
+    int workers, node;
+    // Keep ranges on separate cache lines, so that workers taking
+    // iterations from their own range don't contend with each other.
+    char padding[64 - sizeof(halide_mutex) - 4 * sizeof(int)];
+};
+
 struct work {
     halide_parallel_task_t task;
 
@@ -41,6 +56,16 @@ struct work {
     // which condition variable is the owner sleeping on. NULL if it isn't sleeping.
     bool owner_is_sleeping;
 
+    // Non-NULL if the job is run by the work-stealing scheduler. The
+    // iterations are spread over the ranges, and workers joining the
+    // job are handed the range with the fewest workers on their node.
+    work_range *ranges;
+    int num_ranges;
+    // The iterations not yet claimed by any worker. Only changed
+    // atomically, as workers claim iterations without holding the
+    // work queue lock.
+    int unclaimed;
+
     bool make_runnable() {
         for (; next_semaphore < task.num_semaphores; next_semaphore++) {
             if (!halide_default_semaphore_try_acquire(task.semaphores[next_semaphore].semaphore,
@@ -73,6 +98,16 @@ WEAK int clamp_num_threads(int threads) {
     return threads;
 }
 
+WEAK int default_thread_affinity() {
+    char *affinity_str = getenv("HL_THREAD_AFFINITY");
+    if (affinity_str && !strcmp(affinity_str, "cores")) {
+        return halide_thread_affinity_cores;
+    } else if (affinity_str && !strcmp(affinity_str, "nodes")) {
+        return halide_thread_affinity_nodes;
+    }
+    return halide_thread_affinity_none;
+}
+
 WEAK int default_desired_num_threads() {
     int desired_num_threads = 0;
     char *threads_str = getenv("HL_NUM_THREADS");
@@ -96,6 +131,11 @@ struct work_queue_t {
     // The desired number threads doing work (HL_NUM_THREADS).
     int desired_threads_working;
 
+    // Where workers are placed (HL_THREAD_AFFINITY), and whether that
+    // has been decided yet.
+    int affinity;
+    bool affinity_chosen;
+
     // All fields after this must be zero in the initial state. See assert_zeroed
     // Field serves both to mark the offset in struct and as layout padding.
     int zero_marker;
@@ -106,6 +146,9 @@ struct work_queue_t {
     // The number threads created
     int threads_created;
 
+    // The number of NUMA nodes the workers are spread over.
+    int num_nodes;
+
     // Workers sleep on one of two condition variables, to make it
     // easier to wake up the right number if a small number of tasks
     // are enqueued. There are A-team workers and B-team workers. The
@@ -142,7 +185,7 @@ struct work_queue_t {
 
     // Used to check initial state is correct.
     void assert_zeroed() const {
-        // Assert that all fields except the mutex and desired hreads count are zeroed.
+        // Assert that all fields except the mutex, desired threads count and placement are zeroed.
         const char *bytes = ((const char *)&this->zero_marker);
         const char *limit = ((const char *)this) + sizeof(work_queue_t);
         while (bytes < limit && *bytes == 0) {
@@ -154,7 +197,7 @@ struct work_queue_t {
     // Return the work queue to initial state. Must be called while locked
     // and queue will remain locked.
     void reset() {
-        // Ensure all fields except the mutex and desired hreads count are zeroed.
+        // Ensure all fields except the mutex, desired threads count and placement are zeroed.
         char *bytes = ((char *)&this->zero_marker);
         char *limit = ((char *)this) + sizeof(work_queue_t);
         memset(bytes, 0, limit - bytes);
@@ -190,6 +233,174 @@ WEAK void dump_job_state() {
 #define dump_job_state()
 #endif
 
+// Spread the iterations of a job over num_ranges ranges for the
+// work-stealing scheduler. Consecutive ranges belong to the same NUMA
+// node, so each node gets the same block of iterations every time a
+// loop of the same size runs.
+WEAK void split_into_ranges(work *job, work_range *ranges, int num_ranges) {
+    memset(ranges, 0, sizeof(work_range) * num_ranges);
+    int64_t min = job->task.min, extent = job->task.extent;
+    for (int i = 0; i < num_ranges; i++) {
+        ranges[i].begin = (int)(min + (extent * i) / num_ranges);
+        ranges[i].end = (int)(min + (extent * (i + 1)) / num_ranges);
+        ranges[i].node = (i * work_queue.num_nodes) / num_ranges;
+    }
+    job->ranges = ranges;
+    job->num_ranges = num_ranges;
+    job->unclaimed = job->task.extent;
+}
+
+// Pick the range a worker joining the job starts on: the one with the
+// fewest workers among those of the worker's node, if there are any.
+// Must be called with the work queue locked.
+WEAK int join_range(work *job) {
+    int node = work_queue.num_nodes > 1 ? halide_current_numa_node() : 0;
+    int best = -1;
+    bool best_is_local = false;
+    for (int i = 0; i < job->num_ranges; i++) {
+        bool local = job->ranges[i].node == node;
+        if (best < 0 || (local && !best_is_local) ||
+            (local == best_is_local && job->ranges[i].workers < job->ranges[best].workers)) {
+            best = i;
+            best_is_local = local;
+        }
+    }
+    job->ranges[best].workers++;
+    return best;
+}
+
+// Take a chunk of iterations from the front of a range. The chunks
+// shrink as the range empties, so that there is still something left
+// to steal near the end of the job.
+WEAK bool claim_chunk(work_range *range, int *begin, int *end) {
+    halide_mutex_lock(&range->mutex);
+    int remaining = range->end - range->begin;
+    if (remaining > 0) {
+        int chunk = remaining / 4;
+        if (chunk < 1) {
+            chunk = 1;
+        }
+        *begin = range->begin;
+        *end = range->begin + chunk;
+        range->begin += chunk;
+    }
+    halide_mutex_unlock(&range->mutex);
+    return remaining > 0;
+}
+
+// Take the back half of the first non-empty range after this worker's
+// own one, looking at the ranges of the same NUMA node first.
+WEAK bool steal_range(work *job, int own, int *begin, int *end) {
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 1; i < job->num_ranges; i++) {
+            work_range *victim = job->ranges + (own + i) % job->num_ranges;
+            if ((victim->node == job->ranges[own].node) != (pass == 0)) {
+                continue;
+            }
+            halide_mutex_lock(&victim->mutex);
+            int remaining = victim->end - victim->begin;
+            if (remaining > 0) {
+                *begin = victim->end - (remaining + 1) / 2;
+                *end = victim->end;
+                victim->end = *begin;
+            }
+            halide_mutex_unlock(&victim->mutex);
+            if (remaining > 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Throw away the iterations left in every range once the job has failed.
+WEAK void drain_ranges(work *job) {
+    for (int i = 0; i < job->num_ranges; i++) {
+        work_range *range = job->ranges + i;
+        halide_mutex_lock(&range->mutex);
+        int remaining = range->end - range->begin;
+        range->begin = range->end;
+        halide_mutex_unlock(&range->mutex);
+        Synchronization::atomic_fetch_add_acquire_release(&job->unclaimed, -remaining);
+    }
+}
+
+WEAK int run_iterations(work *job, int begin, int end) {
+    Synchronization::atomic_fetch_add_acquire_release(&job->unclaimed, begin - end);
+    if (job->task_fn) {
+        for (int i = begin; i < end; i++) {
+            int result = halide_do_task(job->user_context, job->task_fn, i, job->task.closure);
+            if (result != 0) {
+                return result;
+            }
+        }
+        return 0;
+    } else {
+        return halide_do_loop_task(job->user_context, job->task.fn, begin, end - begin,
+                                   job->task.closure, job);
+    }
+}
+
+// Work on a job run by the work-stealing scheduler until none of its
+// iterations are left to claim. Called without the work queue lock held.
+WEAK int work_on_ranges(work *job, int own) {
+    work_range *own_range = job->ranges + own;
+    while (true) {
+        int exit_status;
+        Synchronization::atomic_load_relaxed(&job->exit_status, &exit_status);
+        if (exit_status != 0) {
+            drain_ranges(job);
+            return 0;
+        }
+
+        int begin, end;
+        if (claim_chunk(own_range, &begin, &end)) {
+            int result = run_iterations(job, begin, end);
+            if (result != 0) {
+                drain_ranges(job);
+                return result;
+            }
+        } else if (steal_range(job, own, &begin, &end)) {
+            // Make the stolen iterations our own, so that they can be
+            // stolen again. Another worker sharing this range may
+            // have refilled it in the meantime, in which case just
+            // run them.
+            halide_mutex_lock(&own_range->mutex);
+            bool empty = own_range->begin == own_range->end;
+            if (empty) {
+                own_range->begin = begin;
+                own_range->end = end;
+            }
+            halide_mutex_unlock(&own_range->mutex);
+            if (!empty) {
+                int result = run_iterations(job, begin, end);
+                if (result != 0) {
+                    drain_ranges(job);
+                    return result;
+                }
+            }
+        } else {
+            int unclaimed;
+            Synchronization::atomic_load_acquire(&job->unclaimed, &unclaimed);
+            if (unclaimed == 0) {
+                return 0;
+            }
+            // Some iterations are on their way from one range to
+            // another.
+            halide_thread_yield();
+        }
+    }
+}
+
+WEAK bool has_unclaimed_work(work *job) {
+    if (!job->ranges) {
+        return true;
+    }
+    int unclaimed;
+    Synchronization::atomic_load_acquire(&job->unclaimed, &unclaimed);
+    return unclaimed > 0;
+}
+
 WEAK void worker_thread(void *);
 
 WEAK void worker_thread_already_locked(work *owned_job) {
@@ -252,7 +463,7 @@ WEAK void worker_thread_already_locked(work *owned_job) {
             if (!can_use_this_thread_stack) {
                 log_message("Cannot run job " << job->task.name << " on this thread.");
             }              
-            bool can_add_worker = (!job->task.serial || (job->active_workers == 0));
+            bool can_add_worker = (!job->task.serial || (job->active_workers == 0)) && has_unclaimed_work(job);
             if (!can_add_worker) {
                 log_message("Cannot add worker to job " << job->task.name);
             }              
@@ -343,6 +554,25 @@ WEAK void worker_thread_already_locked(work *owned_job) {
                 job->next_job = work_queue.jobs;
                 work_queue.jobs = job;
             }
+        } else if (job->ranges) {
+            // Join the job on one of its ranges, and claim
+            // iterations without holding the lock.
+            int own = join_range(job);
+            halide_mutex_unlock(&work_queue.mutex);
+            result = work_on_ranges(job, own);
+            halide_mutex_lock(&work_queue.mutex);
+            job->ranges[own].workers--;
+
+            // The first worker to leave once everything has been
+            // claimed takes the job off the stack.
+            if (job->task.extent != 0 && !has_unclaimed_work(job)) {
+                prev_ptr = &work_queue.jobs;
+                while (*prev_ptr != job) {
+                    prev_ptr = &(*prev_ptr)->next_job;
+                }
+                *prev_ptr = job->next_job;
+                job->task.extent = 0;
+            }
         } else {
             // Claim a task from it.
             work myjob = *job;
@@ -415,6 +645,13 @@ WEAK void worker_thread(void *arg) {
     halide_mutex_unlock(&work_queue.mutex);
 }
 
+// The entry point of the pool's workers. The argument is the index of
+// the worker.
+WEAK void placed_worker_thread(void *arg) {
+    halide_place_worker_thread((int)(intptr_t)arg);
+    worker_thread(NULL);
+}
+
 WEAK void enqueue_work_already_locked(int num_jobs, work *jobs, work *task_parent) {
     if (!work_queue.initialized) {
         work_queue.assert_zeroed();
@@ -426,6 +663,11 @@ WEAK void enqueue_work_already_locked(int num_jobs, work *jobs, work *task_paren
             work_queue.desired_threads_working = default_desired_num_threads();
         }
         work_queue.desired_threads_working = clamp_num_threads(work_queue.desired_threads_working);
+        if (!work_queue.affinity_chosen) {
+            work_queue.affinity = default_thread_affinity();
+            work_queue.affinity_chosen = true;
+        }
+        work_queue.num_nodes = halide_init_thread_placement(work_queue.affinity);
         work_queue.initialized = true;
     }
 
@@ -485,8 +727,9 @@ WEAK void enqueue_work_already_locked(int num_jobs, work *jobs, work *task_paren
             // We might need to make some new threads, if work_queue.desired_threads_working has
             // increased, or if there aren't enough threads to complete this new task.
             work_queue.a_team_size++;
-            work_queue.threads[work_queue.threads_created++] =
-                halide_spawn_thread(worker_thread, NULL);
+            work_queue.threads[work_queue.threads_created] =
+                halide_spawn_thread(placed_worker_thread, (void *)(intptr_t)work_queue.threads_created);
+            work_queue.threads_created++;
         }
         log_message("enqueue_work_already_locked top level job " << jobs[0].task.name << " with min_threads " << min_threads << " work_queue.threads_created " << work_queue.threads_created << " work_queue.threads_reserved " << work_queue.threads_reserved);
         if (job_has_acquires || job_may_block) {
@@ -543,40 +786,16 @@ WEAK void enqueue_work_already_locked(int num_jobs, work *jobs, work *task_paren
     }
 }
 
-WEAK halide_do_task_t custom_do_task = halide_default_do_task;
-WEAK halide_do_loop_task_t custom_do_loop_task = halide_default_do_loop_task;
-WEAK halide_do_par_for_t custom_do_par_for = halide_default_do_par_for;
-WEAK halide_do_parallel_tasks_t custom_do_parallel_tasks = halide_default_do_parallel_tasks;
-WEAK halide_semaphore_init_t custom_semaphore_init = halide_default_semaphore_init;
-WEAK halide_semaphore_try_acquire_t custom_semaphore_try_acquire = halide_default_semaphore_try_acquire;
-WEAK halide_semaphore_release_t custom_semaphore_release = halide_default_semaphore_release;
- 
-}}}  // namespace Halide::Runtime::Internal
-
-using namespace Halide::Runtime::Internal;
-
-extern "C" {
-
-namespace {
-__attribute__((destructor))
-WEAK void halide_thread_pool_cleanup() {
-    halide_shutdown_thread_pool();
-}
-}
-
-WEAK int halide_default_do_task(void *user_context, halide_task_t f, int idx,
-                                uint8_t *closure) {
-    return f(user_context, idx, closure);
-}
-
-WEAK int halide_default_do_loop_task(void *user_context, halide_loop_task_t f,
-                                     int min, int extent, uint8_t *closure,
-                                     void *task_parent) {
-  return f(user_context, min, extent, closure, task_parent);
+// The number of ranges to split a job into for the work-stealing
+// scheduler: one per thread that could work on it. Threads created
+// later share ranges with the others.
+WEAK int num_work_ranges(work *job) {
+    int num_ranges = work_queue.threads_created + 1;
+    return num_ranges < job->task.extent ? num_ranges : job->task.extent;
 }
 
-WEAK int halide_default_do_par_for(void *user_context, halide_task_t f,
-                                   int min, int size, uint8_t *closure) {
+WEAK int run_par_for(void *user_context, halide_task_t f,
+                     int min, int size, uint8_t *closure, bool work_stealing) {
     if (size <= 0) {
         return 0;
     }
@@ -600,16 +819,21 @@ WEAK int halide_default_do_par_for(void *user_context, halide_task_t f,
     job.siblings = &job; // guarantees no other job points to the same siblings.
     job.sibling_count = 0;
     job.parent_job = NULL;
+    job.ranges = NULL;
     halide_mutex_lock(&work_queue.mutex);
     enqueue_work_already_locked(1, &job, NULL);
+    if (work_stealing) {
+        int num_ranges = num_work_ranges(&job);
+        split_into_ranges(&job, (work_range *)__builtin_alloca(sizeof(work_range) * num_ranges), num_ranges);
+    }
     worker_thread_already_locked(&job);
     halide_mutex_unlock(&work_queue.mutex);
     return job.exit_status;
 }
 
-WEAK int halide_default_do_parallel_tasks(void *user_context, int num_tasks,
-                                          struct halide_parallel_task_t *tasks,
-                                          void *task_parent) {
+WEAK int run_parallel_tasks(void *user_context, int num_tasks,
+                            struct halide_parallel_task_t *tasks,
+                            void *task_parent, bool work_stealing) {
     work *jobs = (work *)__builtin_alloca(sizeof(work) * num_tasks);
 
     for (int i = 0; i < num_tasks; i++) {
@@ -626,6 +850,7 @@ WEAK int halide_default_do_parallel_tasks(void *user_context, int num_tasks,
         jobs[i].next_semaphore = 0;
         jobs[i].owner_is_sleeping = false;
         jobs[i].parent_job = (work *)task_parent;
+        jobs[i].ranges = NULL;
     }
 
     if (num_tasks == 0) {
@@ -634,6 +859,16 @@ WEAK int halide_default_do_parallel_tasks(void *user_context, int num_tasks,
 
     halide_mutex_lock(&work_queue.mutex);
     enqueue_work_already_locked(num_tasks, jobs, (work *)task_parent);
+    if (work_stealing) {
+        // Jobs that acquire semaphores or run serially still claim
+        // one iteration at a time under the lock.
+        for (int i = 0; i < num_tasks; i++) {
+            if (!jobs[i].task.serial && jobs[i].task.num_semaphores == 0) {
+                int num_ranges = num_work_ranges(jobs + i);
+                split_into_ranges(jobs + i, (work_range *)__builtin_alloca(sizeof(work_range) * num_ranges), num_ranges);
+            }
+        }
+    }
     int exit_status = 0;
     for (int i = 0; i < num_tasks; i++) {
         // It doesn't matter what order we join the tasks in, because
@@ -647,6 +882,60 @@ WEAK int halide_default_do_parallel_tasks(void *user_context, int num_tasks,
     return exit_status;
 }
 
+WEAK halide_do_task_t custom_do_task = halide_default_do_task;
+WEAK halide_do_loop_task_t custom_do_loop_task = halide_default_do_loop_task;
+WEAK halide_do_par_for_t custom_do_par_for = halide_default_do_par_for;
+WEAK halide_do_parallel_tasks_t custom_do_parallel_tasks = halide_default_do_parallel_tasks;
+WEAK halide_semaphore_init_t custom_semaphore_init = halide_default_semaphore_init;
+WEAK halide_semaphore_try_acquire_t custom_semaphore_try_acquire = halide_default_semaphore_try_acquire;
+WEAK halide_semaphore_release_t custom_semaphore_release = halide_default_semaphore_release;
+ 
+}}}  // namespace Halide::Runtime::Internal
+
+using namespace Halide::Runtime::Internal;
+
+extern "C" {
+
+namespace {
+__attribute__((destructor))
+WEAK void halide_thread_pool_cleanup() {
+    halide_shutdown_thread_pool();
+}
+}
+
+WEAK int halide_default_do_task(void *user_context, halide_task_t f, int idx,
+                                uint8_t *closure) {
+    return f(user_context, idx, closure);
+}
+
+WEAK int halide_default_do_loop_task(void *user_context, halide_loop_task_t f,
+                                     int min, int extent, uint8_t *closure,
+                                     void *task_parent) {
+  return f(user_context, min, extent, closure, task_parent);
+}
+
+WEAK int halide_default_do_par_for(void *user_context, halide_task_t f,
+                                   int min, int size, uint8_t *closure) {
+    return run_par_for(user_context, f, min, size, closure, false);
+}
+
+WEAK int halide_default_do_parallel_tasks(void *user_context, int num_tasks,
+                                          struct halide_parallel_task_t *tasks,
+                                          void *task_parent) {
+    return run_parallel_tasks(user_context, num_tasks, tasks, task_parent, false);
+}
+
+WEAK int halide_work_stealing_do_par_for(void *user_context, halide_task_t f,
+                                         int min, int size, uint8_t *closure) {
+    return run_par_for(user_context, f, min, size, closure, true);
+}
+
+WEAK int halide_work_stealing_do_parallel_tasks(void *user_context, int num_tasks,
+                                                struct halide_parallel_task_t *tasks,
+                                                void *task_parent) {
+    return run_parallel_tasks(user_context, num_tasks, tasks, task_parent, true);
+}
+
 WEAK int halide_set_num_threads(int n) {
     if (n < 0) {
         halide_error(NULL, "halide_set_num_threads: must be >= 0.");
@@ -664,6 +953,18 @@ WEAK int halide_set_num_threads(int n) {
     return old;
 }
 
+WEAK halide_thread_affinity_t halide_set_thread_affinity(halide_thread_affinity_t affinity) {
+    halide_mutex_lock(&work_queue.mutex);
+    if (!work_queue.affinity_chosen) {
+        work_queue.affinity = default_thread_affinity();
+    }
+    halide_thread_affinity_t old = (halide_thread_affinity_t)work_queue.affinity;
+    work_queue.affinity = affinity;
+    work_queue.affinity_chosen = true;
+    halide_mutex_unlock(&work_queue.mutex);
+    return old;
+}
+
 WEAK void halide_shutdown_thread_pool() {
     if (work_queue.initialized) {
         // Wake everyone up and tell them the party's over and it's time
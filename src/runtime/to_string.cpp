@@ -228,6 +228,31 @@ WEAK char *halide_double_to_string(char *dst, char *end, double arg, int scienti
     return dst;
 }
 
+// Write a string as a quoted JSON string literal.
+WEAK char *halide_json_string_to_string(char *dst, char *end, const char *arg) {
+    const char *hex_digits = "0123456789abcdef";
+    dst = halide_string_to_string(dst, end, "\"");
+    for (; *arg; arg++) {
+        char c = *arg;
+        char escaped[7] = {0};
+        if (c == '"' || c == '\\') {
+            escaped[0] = '\\';
+            escaped[1] = c;
+        } else if ((unsigned char)c < 0x20) {
+            escaped[0] = '\\';
+            escaped[1] = 'u';
+            escaped[2] = '0';
+            escaped[3] = '0';
+            escaped[4] = hex_digits[(c >> 4) & 15];
+            escaped[5] = hex_digits[c & 15];
+        } else {
+            escaped[0] = c;
+        }
+        dst = halide_string_to_string(dst, end, escaped);
+    }
+    return halide_string_to_string(dst, end, "\"");
+}
+
 WEAK char *halide_pointer_to_string(char *dst, char *end, const void *arg) {
     const char *hex_digits = "0123456789abcdef";
     char buf[20] = {0};
@@ -6,140 +6,533 @@ extern "C" {
 
 typedef int32_t (*trace_fn)(void *, const halide_trace_event_t *);
 
+extern int fseek(void *, long, int);
+extern long ftell(void *);
+extern int getpid();
+
 }
 
 namespace Halide { namespace Runtime { namespace Internal {
 
-// A spinlock that allows for shared and exclusive access. It's
-// equivalent to a reader-writer lock, but in my case the "readers"
-// will actually be writing simultaneously to the trace buffer, so
-// that's a bad name. We use the __sync primitives used elsewhere in
-// the runtime for atomic work. They are well supported by clang.
-class SharedExclusiveSpinLock {
-    volatile uint32_t lock;
-
-    // Covers a single bit indicating one owner has exclusive
-    // access. The waiting bit can be set while the exclusive bit is
-    // set, but the bits masked by shared_mask must be zero while this
-    // bit is set.
-    const static uint32_t exclusive_held_mask = 0x80000000;
-
-    // Set to indicate a thread needs to acquire exclusive
-    // access. Other fields of the lock may be set, but no shared
-    // access request will proceed while this bit is set.
-    const static uint32_t exclusive_waiting_mask = 0x40000000;
-
-    // Count of threads currently holding shared access. Must be zero
-    // if the exclusive bit is set. Cannot increase if the waiting bit
-    // is set.
-    const static uint32_t shared_mask = 0x3fffffff;
-
-public:
-    __attribute__((always_inline)) void acquire_shared() {
-        while (1) {
-            uint32_t x = lock & shared_mask;
-            if (__sync_bool_compare_and_swap(&lock, x, x + 1)) {
-                return;
-            }
-        }
+// Trace packets are written to per-thread chunks, which a writer
+// thread appends to the trace file as they fill up, so that threads
+// tracing at the same time don't contend for one buffer. The file is
+// therefore only in order per thread. Packet ids are handed out in the
+// order events are traced, so readers can restore the overall order
+// (see PacketSequencer in util/HalideTraceUtils.h).
+const static uint32_t trace_chunk_size = 64 * 1024;
+
+struct TraceChunk {
+    TraceChunk *next;
+    // The file the chunk is destined for. halide_get_trace_file may
+    // return a different one per user_context.
+    int fd;
+    uint32_t cursor;
+    uint8_t buf[trace_chunk_size];
+};
+
+// The runtime has no thread-local storage that works in both JIT and
+// AOT code, so, as in the pool allocator, threads are told apart by
+// their stacks. Threads that hash to the same slot share its chunk,
+// which is what the lock is for. It's almost never contended.
+const static int kTraceSlotBits = 6;
+
+struct __attribute__((aligned(64))) TraceSlot {
+    volatile int lock;
+    TraceChunk *chunk;
+    // What the writer thread saw last time it looked, to tell when
+    // the slot's threads have gone idle.
+    TraceChunk *seen_chunk;
+    uint32_t seen_cursor;
+};
+
+// If the writer falls this far behind, tracing threads wait for it.
+const static int kMaxTraceChunks = 256;
+
+struct TraceWriter {
+    halide_mutex lock;
+    // Signalled when chunks are queued, and when they have been written.
+    halide_cond cond;
+    TraceChunk *queue_head, *queue_tail;
+    TraceChunk *free_chunks;
+    int num_chunks;
+    // The number of chunks queued or being written.
+    int pending;
+    bool started, stop;
+    halide_thread *thread;
+};
+
+WEAK TraceSlot trace_slots[1 << kTraceSlotBits];
+WEAK TraceWriter trace_writer;
+
+WEAK int halide_trace_file = -1; // -1 indicates uninitialized
+WEAK int halide_trace_file_lock = 0;
+WEAK bool halide_trace_file_initialized = false;
+WEAK void *halide_trace_file_internally_opened = NULL;
+// Whether HL_TRACE_FILE names a .json file, in which case the trace is
+// written as Chrome trace events instead of binary packets.
+WEAK bool halide_trace_file_is_json = false;
+
+WEAK void write_trace_chunk(void *user_context, TraceChunk *c) {
+    bool success = (c->cursor == (uint32_t)write(c->fd, c->buf, c->cursor));
+    c->cursor = 0;
+    halide_assert(user_context, success && "Could not write to trace file");
+}
+
+// Hand a full chunk to the writer thread, or write it out here if
+// there isn't one. Must be called with the writer's lock held.
+WEAK void submit_trace_chunk_locked(void *user_context, TraceChunk *c) {
+    if (!trace_writer.thread) {
+        write_trace_chunk(user_context, c);
+        c->next = trace_writer.free_chunks;
+        trace_writer.free_chunks = c;
+        return;
+    }
+    c->next = NULL;
+    if (trace_writer.queue_tail) {
+        trace_writer.queue_tail->next = c;
+    } else {
+        trace_writer.queue_head = c;
     }
+    trace_writer.queue_tail = c;
+    trace_writer.pending++;
+    halide_cond_broadcast(&trace_writer.cond);
+}
 
-     __attribute__((always_inline)) void release_shared() {
-        __sync_fetch_and_sub(&lock, 1);
+// Hand the writer the chunks of threads that haven't traced anything
+// since it last looked. Otherwise an idle thread would hold on to its
+// packets, and readers putting the packets back in order would have
+// to wait for them. The writer looks each time it writes a chunk, so
+// this only needs another thread to be tracing; whatever is left when
+// every thread has gone quiet is written when the pipeline ends. Must
+// be called without the writer's lock held.
+WEAK void take_idle_trace_chunks() {
+    for (int i = 0; i < (1 << kTraceSlotBits); i++) {
+        TraceSlot *s = trace_slots + i;
+        // A slot in use isn't idle.
+        if (__sync_lock_test_and_set(&s->lock, 1)) {
+            continue;
+        }
+        TraceChunk *c = s->chunk;
+        TraceChunk *idle = NULL;
+        if (c && c->cursor && c == s->seen_chunk && c->cursor == s->seen_cursor) {
+            idle = c;
+            s->chunk = NULL;
+            c = NULL;
+        }
+        s->seen_chunk = c;
+        s->seen_cursor = c ? c->cursor : 0;
+        __sync_lock_release(&s->lock);
+        if (idle) {
+            halide_mutex_lock(&trace_writer.lock);
+            submit_trace_chunk_locked(NULL, idle);
+            halide_mutex_unlock(&trace_writer.lock);
+        }
     }
+}
 
-    __attribute__((always_inline)) void acquire_exclusive() {
-        while (1) {
-            // If multiple threads are trying to acquire exclusive
-            // ownership, we may need to rerequest exclusive waiting
-            // while we spin, as it gets unset whenever a thread
-            // acquires exclusive ownership.
-            __sync_fetch_and_or(&lock, exclusive_waiting_mask);
-            if (__sync_bool_compare_and_swap(&lock, exclusive_waiting_mask, exclusive_held_mask)) {
-                return;
+WEAK void trace_writer_main(void *) {
+    halide_mutex_lock(&trace_writer.lock);
+    while (true) {
+        TraceChunk *c = trace_writer.queue_head;
+        if (!c) {
+            if (trace_writer.stop) {
+                break;
             }
+            halide_cond_wait(&trace_writer.cond, &trace_writer.lock);
+            continue;
         }
+        trace_writer.queue_head = c->next;
+        if (!trace_writer.queue_head) {
+            trace_writer.queue_tail = NULL;
+        }
+
+        // This is the only thread writing to the file while it runs.
+        halide_mutex_unlock(&trace_writer.lock);
+        write_trace_chunk(NULL, c);
+        take_idle_trace_chunks();
+        halide_mutex_lock(&trace_writer.lock);
+
+        c->next = trace_writer.free_chunks;
+        trace_writer.free_chunks = c;
+        trace_writer.pending--;
+        halide_cond_broadcast(&trace_writer.cond);
     }
+    halide_mutex_unlock(&trace_writer.lock);
+}
 
-    __attribute__((always_inline)) void release_exclusive() {
-        __sync_fetch_and_and(&lock, ~exclusive_held_mask);
+// Get an empty chunk. Must be called with the writer's lock held.
+WEAK TraceChunk *get_trace_chunk_locked(void *user_context, int fd) {
+    if (!trace_writer.started) {
+        // If threads can't be spawned on this platform, chunks are
+        // written out by whichever thread fills them.
+        trace_writer.started = true;
+        trace_writer.thread = halide_spawn_thread(trace_writer_main, NULL);
+    }
+    while (!trace_writer.free_chunks && trace_writer.num_chunks >= kMaxTraceChunks) {
+        halide_cond_wait(&trace_writer.cond, &trace_writer.lock);
     }
+    TraceChunk *c = trace_writer.free_chunks;
+    if (c) {
+        trace_writer.free_chunks = c->next;
+    } else {
+        c = (TraceChunk *)malloc(sizeof(TraceChunk));
+        halide_assert(user_context, c && "Could not allocate trace buffer");
+        trace_writer.num_chunks++;
+    }
+    c->next = NULL;
+    c->fd = fd;
+    c->cursor = 0;
+    return c;
+}
 
-    SharedExclusiveSpinLock() : lock(0) {}
-};
+WEAK TraceSlot *trace_slot_for_this_thread() {
+    int marker;
+    uint64_t stack = (uint64_t)(uintptr_t)&marker >> 16;
+    return trace_slots + ((stack * 0x9e3779b97f4a7c15ULL) >> (64 - kTraceSlotBits));
+}
 
-const static int buffer_size = 1024 * 1024;
-
-class TraceBuffer {
-    SharedExclusiveSpinLock lock;
-    uint32_t cursor, overage;
-    uint8_t buf[buffer_size];
-
-    // Attempt to atomically acquire space in the buffer to write a
-    // packet. Returns NULL if the buffer was full.
-    __attribute__((always_inline)) halide_trace_packet_t *try_acquire_packet(void *user_context, uint32_t size) {
-        lock.acquire_shared();
-        halide_assert(user_context, size <= buffer_size);
-        uint32_t my_cursor = __sync_fetch_and_add(&cursor, size);
-        if (my_cursor + size > sizeof(buf)) {
-            // Don't try to back it out: instead, just allow this request to fail
-            // (along with all subsequent requests) and record the 'overage'
-            // that was added and should be ignored; then, in the next flush,
-            // remove the overage.
-            __sync_fetch_and_add(&overage, size);
-            lock.release_shared();
-            return NULL;
+// Acquire space for a packet in this thread's chunk, handing the
+// chunk to the writer first if it's full. The slot stays locked until
+// the packet is released.
+WEAK uint8_t *acquire_trace_packet(void *user_context, int fd, uint32_t size, TraceSlot **slot) {
+    halide_assert(user_context, size <= trace_chunk_size);
+    TraceSlot *s = trace_slot_for_this_thread();
+    while (__sync_lock_test_and_set(&s->lock, 1)) { }
+    TraceChunk *c = s->chunk;
+    while (!c || c->fd != fd || c->cursor + size > trace_chunk_size) {
+        // Getting a new chunk may mean waiting for the writer, so let
+        // the other threads of the slot carry on in the meantime.
+        s->chunk = NULL;
+        __sync_lock_release(&s->lock);
+        halide_mutex_lock(&trace_writer.lock);
+        if (c) {
+            submit_trace_chunk_locked(user_context, c);
+        }
+        TraceChunk *fresh = get_trace_chunk_locked(user_context, fd);
+        halide_mutex_unlock(&trace_writer.lock);
+        while (__sync_lock_test_and_set(&s->lock, 1)) { }
+        if (!s->chunk) {
+            s->chunk = fresh;
         } else {
-            return (halide_trace_packet_t *)(buf + my_cursor);
+            // Another thread of the slot got one first, so use theirs
+            // if it has room.
+            halide_mutex_lock(&trace_writer.lock);
+            fresh->next = trace_writer.free_chunks;
+            trace_writer.free_chunks = fresh;
+            halide_cond_broadcast(&trace_writer.cond);
+            halide_mutex_unlock(&trace_writer.lock);
         }
+        c = s->chunk;
     }
+    uint8_t *packet = c->buf + c->cursor;
+    c->cursor += size;
+    *slot = s;
+    return packet;
+}
+
+WEAK void release_trace_packet(TraceSlot *slot) {
+    __sync_lock_release(&slot->lock);
+}
 
-public:
-
-    // Wait for all writers to finish with their packets, stall any
-    // new writers, and flush the buffer to the fd.
-    __attribute__((always_inline)) void flush(void *user_context, int fd) {
-        lock.acquire_exclusive();
-        bool success = true;
-        if (cursor) {
-            cursor -= overage;
-            success = (cursor == (uint32_t)write(fd, buf, cursor));
-            cursor = 0;
-            overage = 0;
+// Write out everything traced so far, and wait until it's in the
+// files.
+WEAK void flush_trace(void *user_context) {
+    for (int i = 0; i < (1 << kTraceSlotBits); i++) {
+        TraceSlot *s = trace_slots + i;
+        TraceChunk *c = NULL;
+        {
+            ScopedSpinLock lock(&s->lock);
+            if (s->chunk && s->chunk->cursor) {
+                c = s->chunk;
+                s->chunk = NULL;
+            }
+        }
+        if (c) {
+            halide_mutex_lock(&trace_writer.lock);
+            submit_trace_chunk_locked(user_context, c);
+            halide_mutex_unlock(&trace_writer.lock);
         }
-        lock.release_exclusive();
-        halide_assert(user_context, success && "Could not write to trace file");
     }
+    halide_mutex_lock(&trace_writer.lock);
+    while (trace_writer.pending) {
+        halide_cond_wait(&trace_writer.cond, &trace_writer.lock);
+    }
+    halide_mutex_unlock(&trace_writer.lock);
+}
 
-    // Acquire and return a packet's worth of space in the trace
-    // buffer, flushing the trace buffer to the given fd to make space
-    // if necessary. The region acquired is protected from other
-    // threads writing or reading to it, so it must be released before
-    // a flush can occur.
-    __attribute__((always_inline)) halide_trace_packet_t *acquire_packet(void *user_context, int fd, uint32_t size) {
-        halide_trace_packet_t *packet = NULL;
-        while (!(packet = try_acquire_packet(user_context, size))) {
-            // Couldn't acquire space to write a packet. Flush and try again.
-            flush(user_context, fd);
+// Flush the trace, stop the writer thread, and free the chunks.
+WEAK void shutdown_trace_writer() {
+    flush_trace(NULL);
+    halide_mutex_lock(&trace_writer.lock);
+    halide_thread *thread = trace_writer.thread;
+    trace_writer.stop = true;
+    halide_cond_broadcast(&trace_writer.cond);
+    halide_mutex_unlock(&trace_writer.lock);
+    if (thread) {
+        halide_join_thread(thread);
+    }
+
+    for (int i = 0; i < (1 << kTraceSlotBits); i++) {
+        TraceSlot *s = trace_slots + i;
+        ScopedSpinLock lock(&s->lock);
+        if (s->chunk) {
+            free(s->chunk);
+            s->chunk = NULL;
         }
-        return packet;
+    }
+    while (trace_writer.free_chunks) {
+        TraceChunk *c = trace_writer.free_chunks;
+        trace_writer.free_chunks = c->next;
+        free(c);
+    }
+    trace_writer.num_chunks = 0;
+    trace_writer.thread = NULL;
+    trace_writer.started = false;
+    trace_writer.stop = false;
+}
+
+// Write an event as one element of a JSON array of Chrome trace
+// events. Realizations, productions and consumptions become async
+// begin/end events identified by the id of the begin event, which the
+// end event has as its parent, so events on different threads pair up
+// without knowing which thread is which. Loads and stores are left
+// out: there are far too many of them for a timeline, and the binary
+// format still records them. Trace files are appended to, so the
+// events of each run go under the id of the process that traced them,
+// which keeps runs apart even though their ids all start at 1.
+WEAK int json_trace_pid = 0;
+
+WEAK void write_json_trace_event(void *user_context, int fd, const halide_trace_event_t *e, int32_t id) {
+    const char *categories[] = {"load", "store",
+                                "realization", "realization",
+                                "produce", "produce",
+                                "consume", "consume",
+                                "pipeline", "pipeline",
+                                "tag"};
+    const char *phase;
+    switch (e->event) {
+    case halide_trace_begin_pipeline:
+    case halide_trace_begin_realization:
+    case halide_trace_produce:
+    case halide_trace_consume:
+        phase = "b";
+        break;
+    case halide_trace_end_pipeline:
+    case halide_trace_end_realization:
+    case halide_trace_end_produce:
+    case halide_trace_end_consume:
+        phase = "e";
+        id = e->parent_id;
+        break;
+    case halide_trace_tag:
+        // An instant event on the pipeline.
+        phase = "n";
+        id = e->parent_id;
+        break;
+    default:
+        return;
     }
 
-    // Release a packet, allowing it to be written out with flush
-    __attribute__((always_inline)) void release_packet(halide_trace_packet_t *) {
-        // Need a memory barrier to guarantee all the writes are done.
-        __sync_synchronize();
-        lock.release_shared();
+    uint64_t ns = halide_current_time_ns(user_context);
+    if (!json_trace_pid) {
+        json_trace_pid = getpid();
+    }
+
+    char line[4096];
+    char *dst = line, *end = line + sizeof(line);
+    dst = halide_string_to_string(dst, end, "{\"name\":");
+    dst = halide_json_string_to_string(dst, end, e->func);
+    dst = halide_string_to_string(dst, end, ",\"cat\":\"");
+    dst = halide_string_to_string(dst, end, categories[e->event]);
+    dst = halide_string_to_string(dst, end, "\",\"ph\":\"");
+    dst = halide_string_to_string(dst, end, phase);
+    dst = halide_string_to_string(dst, end, "\",\"id\":");
+    dst = halide_int64_to_string(dst, end, id, 1);
+    dst = halide_string_to_string(dst, end, ",\"pid\":");
+    dst = halide_int64_to_string(dst, end, json_trace_pid, 1);
+    dst = halide_string_to_string(dst, end, ",\"tid\":0,\"ts\":");
+    dst = halide_uint64_to_string(dst, end, ns / 1000, 1);
+    dst = halide_string_to_string(dst, end, ".");
+    dst = halide_uint64_to_string(dst, end, ns % 1000, 3);
+    if (e->event == halide_trace_tag) {
+        dst = halide_string_to_string(dst, end, ",\"args\":{\"tag\":");
+        dst = halide_json_string_to_string(dst, end, e->trace_tag ? e->trace_tag : "");
+        dst = halide_string_to_string(dst, end, "}");
+    } else if (*phase == 'b' && e->coordinates && e->dimensions) {
+        // The mins and extents of the region.
+        dst = halide_string_to_string(dst, end, ",\"args\":{\"bounds\":[");
+        for (int i = 0; i < e->dimensions; i++) {
+            if (i > 0) {
+                dst = halide_string_to_string(dst, end, ",");
+            }
+            dst = halide_int64_to_string(dst, end, e->coordinates[i], 1);
+        }
+        dst = halide_string_to_string(dst, end, "]}");
     }
+    dst = halide_string_to_string(dst, end, "},\n");
+
+    // The line may have been truncated, but then it isn't valid JSON
+    // anyway.
+    uint32_t size = (uint32_t)(dst - line);
+    TraceSlot *slot;
+    uint8_t *packet = acquire_trace_packet(user_context, fd, size, &slot);
+    memcpy(packet, line, size);
+    release_trace_packet(slot);
+
+    if (e->event == halide_trace_end_pipeline) {
+        flush_trace(user_context);
+    }
+}
 
-    TraceBuffer() : cursor(0), overage(0) {}
+// Loads and stores of Funcs traced with TraceFilter::aggregate come
+// with this tag. Rather than recording each one, we keep the count, min
+// and max of their values per parent event (a production or a
+// consumption), and emit them as a tag event when it ends. As with the
+// trace slots, each thread hashes to its own copy of an aggregate, and
+// the copies are merged when they're emitted.
+const static int kMaxTraceAggregates = 1024;
+
+struct TraceAggregate {
+    volatile int lock;
+    bool used;
+    halide_trace_event_code_t event;
+    int32_t parent_id, value_index;
+    int slot;
+    const char *func;
+    uint64_t count;
+    double min, max;
 };
 
-WEAK TraceBuffer *halide_trace_buffer = NULL;
-WEAK int halide_trace_file = -1; // -1 indicates uninitialized
-WEAK int halide_trace_file_lock = 0;
-WEAK bool halide_trace_file_initialized = false;
-WEAK void *halide_trace_file_internally_opened = NULL;
+WEAK TraceAggregate trace_aggregates[kMaxTraceAggregates];
+WEAK int trace_aggregates_used = 0;
+
+WEAK bool is_aggregate_trace_event(const halide_trace_event_t *e) {
+    return ((e->event == halide_trace_load || e->event == halide_trace_store) &&
+            e->trace_tag && strcmp(e->trace_tag, "aggregate") == 0);
+}
+
+WEAK double trace_value_as_double(const halide_trace_event_t *e, int lane) {
+    int bits = 8;
+    while (bits < e->type.bits) bits <<= 1;
+    if (e->type.code == halide_type_int) {
+        if (bits == 8) return ((int8_t *)(e->value))[lane];
+        if (bits == 16) return ((int16_t *)(e->value))[lane];
+        if (bits == 32) return ((int32_t *)(e->value))[lane];
+        return (double)((int64_t *)(e->value))[lane];
+    } else if (e->type.code == halide_type_uint) {
+        if (bits == 8) return ((uint8_t *)(e->value))[lane];
+        if (bits == 16) return ((uint16_t *)(e->value))[lane];
+        if (bits == 32) return ((uint32_t *)(e->value))[lane];
+        return (double)((uint64_t *)(e->value))[lane];
+    } else if (e->type.code == halide_type_float) {
+        if (bits == 16) return halide_float16_bits_to_double(((uint16_t *)(e->value))[lane]);
+        if (bits == 32) return ((float *)(e->value))[lane];
+        return ((double *)(e->value))[lane];
+    }
+    // Handles are only counted.
+    return 0;
+}
+
+WEAK bool trace_aggregate_matches(const TraceAggregate *a, const halide_trace_event_t *e, int slot) {
+    return (a->func == e->func &&
+            a->event == e->event &&
+            a->parent_id == e->parent_id &&
+            a->value_index == e->value_index &&
+            a->slot == slot);
+}
+
+// Fold a load or store into its aggregate. Returns false if the table
+// is too full to take it, in which case it's traced like any other.
+WEAK bool aggregate_trace_event(const halide_trace_event_t *e) {
+    int slot = (int)(trace_slot_for_this_thread() - trace_slots);
+    uint32_t h = ((uint32_t)e->parent_id * 0x9e3779b1u) ^ ((uint32_t)e->value_index << 8) ^ (uint32_t)slot;
+    h ^= (uint32_t)(uintptr_t)e->func;
+    h *= 0x85ebca6bu;
+    for (int probe = 0; probe < 32; probe++) {
+        TraceAggregate *a = trace_aggregates + ((h + probe) % kMaxTraceAggregates);
+        ScopedSpinLock lock(&a->lock);
+        if (!a->used) {
+            a->used = true;
+            a->func = e->func;
+            a->event = e->event;
+            a->parent_id = e->parent_id;
+            a->value_index = e->value_index;
+            a->slot = slot;
+            a->count = 0;
+            __sync_fetch_and_add(&trace_aggregates_used, 1);
+        } else if (!trace_aggregate_matches(a, e, slot)) {
+            continue;
+        }
+        for (int i = 0; i < e->type.lanes; i++) {
+            double v = trace_value_as_double(e, i);
+            if (a->count == 0 || v < a->min) a->min = v;
+            if (a->count == 0 || v > a->max) a->max = v;
+            a->count++;
+        }
+        return true;
+    }
+    return false;
+}
+
+// Emit the aggregates of the events whose parent just ended.
+WEAK void flush_trace_aggregates(void *user_context, int32_t parent_id) {
+    if (!__atomic_load_n(&trace_aggregates_used, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    for (int i = 0; i < kMaxTraceAggregates; i++) {
+        TraceAggregate merged;
+        {
+            TraceAggregate *a = trace_aggregates + i;
+            ScopedSpinLock lock(&a->lock);
+            if (!a->used || a->parent_id != parent_id) {
+                continue;
+            }
+            merged.func = a->func;
+            merged.event = a->event;
+            merged.value_index = a->value_index;
+            merged.count = a->count;
+            merged.min = a->min;
+            merged.max = a->max;
+            a->used = false;
+        }
+        int freed = 1;
+
+        // Merge in the other threads' copies.
+        for (int j = i + 1; j < kMaxTraceAggregates; j++) {
+            TraceAggregate *a = trace_aggregates + j;
+            ScopedSpinLock lock(&a->lock);
+            if (a->used &&
+                a->func == merged.func &&
+                a->event == merged.event &&
+                a->parent_id == parent_id &&
+                a->value_index == merged.value_index) {
+                if (a->min < merged.min) merged.min = a->min;
+                if (a->max > merged.max) merged.max = a->max;
+                merged.count += a->count;
+                a->used = false;
+                freed++;
+            }
+        }
+        __sync_fetch_and_sub(&trace_aggregates_used, freed);
+
+        char buf[256];
+        Printer<StringStreamPrinter, sizeof(buf)> ss(user_context, buf);
+        ss << "aggregate " << (merged.event == halide_trace_load ? "load" : "store")
+           << " count " << merged.count
+           << " min " << merged.min
+           << " max " << merged.max;
+
+        halide_trace_event_t tag;
+        memset(&tag, 0, sizeof(tag));
+        tag.func = merged.func;
+        tag.event = halide_trace_tag;
+        tag.parent_id = parent_id;
+        tag.value_index = merged.value_index;
+        tag.trace_tag = ss.str();
+        halide_default_trace(user_context, &tag);
+    }
+}
 
 }}}
 
@@ -148,11 +541,25 @@ extern "C" {
 WEAK int32_t halide_default_trace(void *user_context, const halide_trace_event_t *e) {
     static int32_t ids = 1;
 
+    if (is_aggregate_trace_event(e) && aggregate_trace_event(e)) {
+        return 0;
+    }
+
+    if (e->event == halide_trace_end_realization ||
+        e->event == halide_trace_end_produce ||
+        e->event == halide_trace_end_consume ||
+        e->event == halide_trace_end_pipeline) {
+        flush_trace_aggregates(user_context, e->parent_id);
+    }
+
     int32_t my_id = __sync_fetch_and_add(&ids, 1);
 
-    // If we're dumping to a file, use a binary format
+    // If we're dumping to a file, use a binary format, or Chrome's
+    // JSON trace format if the file is a .json file.
     int fd = halide_get_trace_file(user_context);
-    if (fd > 0) {
+    if (fd > 0 && halide_trace_file_is_json) {
+        write_json_trace_event(user_context, fd, e, my_id);
+    } else if (fd > 0) {
         // Compute the total packet size
         uint32_t value_bytes = (uint32_t)(e->type.lanes * e->type.bytes());
         uint32_t header_bytes = (uint32_t)sizeof(halide_trace_packet_t);
@@ -162,8 +569,10 @@ WEAK int32_t halide_default_trace(void *user_context, const halide_trace_event_t
         uint32_t total_size_without_padding = header_bytes + value_bytes + coords_bytes + name_bytes + trace_tag_bytes;
         uint32_t total_size = (total_size_without_padding + 3) & ~3;
 
-        // Claim some space to write to in the trace buffer
-        halide_trace_packet_t *packet = halide_trace_buffer->acquire_packet(user_context, fd, total_size);
+        // Claim some space to write to in this thread's trace buffer
+        TraceSlot *slot;
+        halide_trace_packet_t *packet =
+            (halide_trace_packet_t *)acquire_trace_packet(user_context, fd, total_size, &slot);
 
         if (total_size > 4096) {
             print(NULL) << total_size << "\n";
@@ -187,12 +596,12 @@ WEAK int32_t halide_default_trace(void *user_context, const halide_trace_event_t
         memcpy((void *)packet->trace_tag(), e->trace_tag ? e->trace_tag : "", trace_tag_bytes);
 
         // Release it
-        halide_trace_buffer->release_packet(packet);
+        release_trace_packet(slot);
 
-        // We should also flush the trace buffer if we hit an event
+        // We should also flush the trace buffers if we hit an event
         // that might be the end of the trace.
         if (e->event == halide_trace_end_pipeline) {
-            halide_trace_buffer->flush(user_context, fd);
+            flush_trace(user_context);
         }
 
     } else {
@@ -333,11 +742,19 @@ WEAK int halide_get_trace_file(void *user_context) {
         if (trace_file_name) {
             void *file = fopen(trace_file_name, "ab");
             halide_assert(user_context, file && "Failed to open trace file\n");
+            size_t len = strlen(trace_file_name);
+            halide_trace_file_is_json = len >= 5 && !strncmp(trace_file_name + len - 5, ".json", 5);
+            if (halide_trace_file_is_json) {
+                halide_start_clock(user_context);
+                // Chrome accepts an array of events with no closing
+                // bracket, so traces can be appended to.
+                fseek(file, 0, 2 /* SEEK_END */);
+                if (ftell(file) == 0) {
+                    write(fileno(file), "[\n", 2);
+                }
+            }
             halide_set_trace_file(fileno(file));
             halide_trace_file_internally_opened = file;
-            if (!halide_trace_buffer) {
-                halide_trace_buffer = (TraceBuffer *)malloc(sizeof(TraceBuffer));
-            }
         } else {
             halide_set_trace_file(0);
         }
@@ -350,14 +767,12 @@ WEAK int32_t halide_trace(void *user_context, const halide_trace_event_t *e) {
 }
 
 WEAK int halide_shutdown_trace() {
+    shutdown_trace_writer();
     if (halide_trace_file_internally_opened) {
         int ret = fclose(halide_trace_file_internally_opened);
         halide_trace_file = 0;
         halide_trace_file_initialized = false;
         halide_trace_file_internally_opened = NULL;
-        if (halide_trace_buffer) {
-            free(halide_trace_buffer);
-        }
         return ret;
     } else {
         return 0;
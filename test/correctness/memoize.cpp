@@ -99,6 +99,29 @@ int main(int argc, char **argv) {
         assert(call_count == 1);
     }
 
+    {
+        // The cache counts the second realize as a hit.
+        call_count = 0;
+        Func count_calls;
+        count_calls.define_extern("count_calls", {}, UInt(8), 2);
+
+        Func f, g;
+        Var x, y;
+        f(x, y) = count_calls(x, y);
+        f.compute_root().memoize();
+        g(x, y) = f(x, y);
+
+        halide_memoization_cache_stats_t before = Internal::JITSharedRuntime::memoization_cache_stats();
+        Buffer<uint8_t> out1 = g.realize(32, 32);
+        Buffer<uint8_t> out2 = g.realize(32, 32);
+        halide_memoization_cache_stats_t after = Internal::JITSharedRuntime::memoization_cache_stats();
+
+        assert(call_count == 1);
+        assert(after.hits >= before.hits + 1);
+        assert(after.misses >= before.misses + 1);
+        assert(after.current_size <= after.max_size);
+    }
+
     {
         call_count = 0;
         Param<int32_t> coord;
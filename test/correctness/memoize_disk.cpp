@@ -0,0 +1,164 @@
+#include "Halide.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <dirent.h>
+#endif
+
+using namespace Halide;
+
+#ifdef _WIN32
+#define DLLEXPORT __declspec(dllexport)
+#else
+#define DLLEXPORT
+#endif
+
+int call_count = 0;
+
+extern "C" DLLEXPORT int count_calls_disk(int32_t seed, halide_buffer_t *out) {
+    if (!out->is_bounds_query()) {
+        call_count++;
+        Halide::Runtime::Buffer<int32_t> buf(*out);
+        buf.for_each_element([&](int x, int y) {
+            buf(x, y) = x + 3 * y + seed;
+        });
+    }
+    return 0;
+}
+
+int check(const Buffer<int32_t> &out, int seed) {
+    for (int y = 0; y < out.height(); y++) {
+        for (int x = 0; x < out.width(); x++) {
+            int correct = 2 * (x + 3 * y + seed);
+            if (out(x, y) != correct) {
+                printf("out(%d, %d) = %d instead of %d\n", x, y, out(x, y), correct);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Pipelines built separately, in this process or another, share results
+// on disk as long as their Funcs have the same names and definitions.
+Func make_pipeline(Param<int32_t> seed, int scale) {
+    Func count_calls("count_calls");
+    count_calls.define_extern("count_calls_disk", {seed}, Int(32), 2);
+
+    Func f("cached"), g("out");
+    Var x("x"), y("y");
+    f(x, y) = count_calls(x, y) * scale;
+    f.compute_root().memoize();
+    g(x, y) = f(x, y) * (2 / scale);
+    return g;
+}
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+    printf("Skipping correctness_memoize_disk on Windows, which has no disk tier.\n");
+    return 0;
+#else
+    if (argc > 1 && std::string(argv[1]) == "--store") {
+        // Run by the test below to fill the cache from another process.
+        Param<int32_t> seed("seed");
+        seed.set(23);
+        Buffer<int32_t> out = make_pipeline(seed, 1).realize(64, 64);
+        return check(out, 23);
+    }
+
+    // The runtime reads the directory the first time a memoized Func
+    // misses in memory.
+    std::string dir = Internal::dir_make_temp();
+    setenv("HL_MEMOIZATION_CACHE_DIR", dir.c_str(), 1);
+
+    Param<int32_t> seed("seed");
+    Func g = make_pipeline(seed, 1);
+
+    seed.set(17);
+    Buffer<int32_t> out = g.realize(64, 64);
+    if (check(out, 17)) return -1;
+    out = g.realize(64, 64);
+    if (check(out, 17)) return -1;
+    if (call_count != 1) {
+        printf("Expected one call before flushing memory, got %d\n", call_count);
+        return -1;
+    }
+
+    // Evict everything held in memory. The result should now come back
+    // from disk instead of being recomputed.
+    Internal::JITSharedRuntime::memoization_cache_set_size(1);
+    Internal::JITSharedRuntime::memoization_cache_set_size(0);
+    out = g.realize(64, 64);
+    if (check(out, 17)) return -1;
+    if (call_count != 1) {
+        printf("Expected the result to be read from disk, but it was computed %d times\n", call_count);
+        return -1;
+    }
+
+    halide_memoization_cache_stats_t stats = Internal::JITSharedRuntime::memoization_cache_stats();
+    if (stats.disk_writes < 1 || stats.disk_hits < 1) {
+        printf("Unexpected disk counters: %d writes, %d hits\n",
+               (int)stats.disk_writes, (int)stats.disk_hits);
+        return -1;
+    }
+
+    // A different key is not on disk.
+    seed.set(5);
+    out = g.realize(64, 64);
+    if (check(out, 5)) return -1;
+    if (call_count != 2) {
+        printf("Expected a new key to be computed, got %d calls\n", call_count);
+        return -1;
+    }
+
+    // A pipeline compiled again gets a different key in memory, but the
+    // same one on disk.
+    seed.set(17);
+    Func g2 = make_pipeline(seed, 1);
+    out = g2.realize(64, 64);
+    if (check(out, 17)) return -1;
+    if (call_count != 2) {
+        printf("Expected a recompiled pipeline to read from disk, got %d calls\n", call_count);
+        return -1;
+    }
+
+    // One with the same names but a different definition must not.
+    Func g3 = make_pipeline(seed, 2);
+    out = g3.realize(64, 64);
+    if (check(out, 17)) return -1;
+    if (call_count != 3) {
+        printf("Expected a different definition to be computed, got %d calls\n", call_count);
+        return -1;
+    }
+
+    // Results written by another process are read back here.
+    std::string command = std::string(argv[0]) + " --store";
+    if (system(command.c_str()) != 0) {
+        printf("Running %s failed\n", command.c_str());
+        return -1;
+    }
+    seed.set(23);
+    out = g.realize(64, 64);
+    if (check(out, 23)) return -1;
+    if (call_count != 3) {
+        printf("Expected a result stored by another process, got %d calls\n", call_count);
+        return -1;
+    }
+
+    DIR *d = opendir(dir.c_str());
+    if (d) {
+        while (struct dirent *e = readdir(d)) {
+            std::string name = e->d_name;
+            if (name != "." && name != "..") {
+                Internal::file_unlink(dir + "/" + name);
+            }
+        }
+        closedir(d);
+    }
+    Internal::dir_rmdir(dir);
+
+    printf("Success!\n");
+    return 0;
+#endif
+}
@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include "Halide.h"
+
+using namespace Halide;
+
+// Allocate heap temporaries from the size-class pool, on many threads
+// and for many different sizes, and check nothing gets mixed up, and
+// that the allocations really went through the pool.
+
+int main(int argc, char **argv) {
+    Func f, g, h;
+    Var x, y;
+
+    f(x, y) = x * 3 + y;
+    g(x, y) = f(x, y) + f(x + 1, y);
+    h(x, y) = g(x, y) * 2;
+
+    // f is allocated on the heap once per row of g, on whichever
+    // thread computes that row; g once per realization.
+    g.compute_root().parallel(y);
+    f.compute_at(g, y);
+
+    Target t = get_jit_target_from_environment().with_feature(Target::PoolAllocator);
+    h.compile_jit(t);
+
+    halide_pool_allocator_stats_t before = Internal::JITSharedRuntime::pool_allocator_stats();
+    uint64_t allocations = 0;
+    for (int i = 0; i < 50; i++) {
+        int w = 16 + 37 * i, ht = 8 + (i % 7);
+        // One f per row, and one g.
+        allocations += ht + 1;
+        Buffer<int> out = h.realize(w, ht);
+        for (int yy = 0; yy < ht; yy++) {
+            for (int xx = 0; xx < w; xx++) {
+                int correct = 2 * ((xx * 3 + yy) + ((xx + 1) * 3 + yy));
+                if (out(xx, yy) != correct) {
+                    printf("out(%d, %d) = %d instead of %d\n", xx, yy, out(xx, yy), correct);
+                    return -1;
+                }
+            }
+        }
+    }
+
+    // Every allocation is counted, and rows of f on a thread can reuse
+    // the block freed by its previous row.
+    halide_pool_allocator_stats_t after = Internal::JITSharedRuntime::pool_allocator_stats();
+    uint64_t hits = after.hits - before.hits;
+    uint64_t misses = after.misses - before.misses;
+    if (hits + misses < allocations || after.oversized != before.oversized) {
+        printf("The pool served %llu hits, %llu misses and %llu oversized allocations, "
+               "out of at least %llu\n",
+               (unsigned long long)hits, (unsigned long long)misses,
+               (unsigned long long)(after.oversized - before.oversized),
+               (unsigned long long)allocations);
+        return -1;
+    }
+    if (hits == 0) {
+        printf("The pool never reused a block, with %llu misses\n", (unsigned long long)misses);
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
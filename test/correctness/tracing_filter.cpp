@@ -0,0 +1,123 @@
+#include "Halide.h"
+#include <stdio.h>
+#include <string.h>
+
+using namespace Halide;
+
+// Trace a sample of the stores, or only those in a box, or just their
+// aggregates, and check the filtered ones never reach halide_trace.
+
+int stores = 0, lanes_outside = 0;
+
+int my_trace(void *user_context, const halide_trace_event_t *e) {
+    if (e->event == halide_trace_store) {
+        stores++;
+        // Vectors get traced if any of their lanes are in the box
+        // below. The coordinates are all the xs, then all the ys.
+        bool any_inside = false;
+        for (int i = 0; i < e->type.lanes; i++) {
+            int x = e->coordinates[i], y = e->coordinates[e->type.lanes + i];
+            any_inside |= (x >= 8 && x < 24 && y >= 2 && y < 6);
+        }
+        if (!any_inside) {
+            lanes_outside++;
+        }
+    }
+    return 0;
+}
+
+int aggregate_count = 0;
+float aggregate_min = 0, aggregate_max = 0;
+
+void my_print(void *user_context, const char *msg) {
+    const char *p = strstr(msg, "aggregate store");
+    if (p) {
+        sscanf(p, "aggregate store count %d min %f max %f",
+               &aggregate_count, &aggregate_min, &aggregate_max);
+    }
+}
+
+int main(int argc, char **argv) {
+    Var x, y;
+
+    // A box.
+    {
+        Func f;
+        f(x, y) = x + y;
+        TraceFilter filter;
+        filter.region = {{8, 16}, {2, 4}};
+        f.trace_stores(filter);
+        f.set_custom_trace(&my_trace);
+        stores = 0;
+        f.realize(64, 64);
+        if (stores != 16 * 4 || lanes_outside) {
+            printf("Traced %d stores, %d outside the box, instead of %d\n",
+                   stores, lanes_outside, 16 * 4);
+            return -1;
+        }
+    }
+
+    // A box that doesn't line up with the vectors.
+    {
+        Func f;
+        f(x, y) = x + y;
+        TraceFilter filter;
+        filter.region = {{8, 16}, {2, 4}};
+        f.trace_stores(filter);
+        f.vectorize(x, 16);
+        f.set_custom_trace(&my_trace);
+        stores = 0;
+        f.realize(64, 64);
+        if (stores != 2 * 4 || lanes_outside) {
+            printf("Traced %d vector stores, %d outside the box, instead of %d\n",
+                   stores, lanes_outside, 2 * 4);
+            return -1;
+        }
+    }
+
+    // A sample.
+    {
+        Func f;
+        f(x, y) = x + y;
+        TraceFilter filter;
+        filter.sample_every = 8;
+        f.trace_stores(filter);
+        f.set_custom_trace(&my_trace);
+        stores = 0;
+        f.realize(128, 128);
+        int expected = 128 * 128 / 8;
+        if (stores < expected / 2 || stores > expected * 2) {
+            printf("Traced %d stores instead of roughly %d\n", stores, expected);
+            return -1;
+        }
+
+        // The same ones each time.
+        int first = stores;
+        stores = 0;
+        f.realize(128, 128);
+        if (stores != first) {
+            printf("Traced %d stores, then %d\n", first, stores);
+            return -1;
+        }
+    }
+
+    // Aggregates, which the default trace handler prints as tags.
+    {
+        Func f;
+        f(x, y) = x + y;
+        TraceFilter filter;
+        filter.aggregate = true;
+        f.trace_stores(filter);
+        f.vectorize(x, 8).parallel(y);
+        f.set_custom_print(&my_print);
+        f.realize(64, 32);
+        if (aggregate_count != 64 * 32 || aggregate_min != 0 || aggregate_max != 63 + 31) {
+            printf("Aggregate of the stores was count %d min %f max %f\n",
+                   aggregate_count, aggregate_min, aggregate_max);
+            return -1;
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include "Halide.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <fstream>
+#include <sstream>
+
+using namespace Halide;
+
+// Write a trace in the Chrome trace event format by giving
+// HL_TRACE_FILE a .json extension.
+
+int count(const std::string &haystack, const std::string &needle) {
+    int n = 0;
+    for (size_t pos = haystack.find(needle); pos != std::string::npos;
+         pos = haystack.find(needle, pos + 1)) {
+        n++;
+    }
+    return n;
+}
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+    printf("Skipping correctness_tracing_json on Windows.\n");
+    return 0;
+#else
+    Internal::TemporaryFile trace_file("tracing_json", ".json");
+    // The runtime opens the trace file the first time anything is
+    // traced.
+    setenv("HL_TRACE_FILE", trace_file.pathname().c_str(), 1);
+
+    Func f("f"), g("g");
+    Var x, y;
+    f(x, y) = x + y;
+    g(x, y) = f(x, y) + f(x + 1, y);
+    f.compute_at(g, y);
+    f.trace_realizations();
+    g.trace_realizations();
+    // Loads and stores are too fine-grained for a timeline, so they
+    // are left out.
+    f.trace_loads();
+    g.trace_stores();
+
+    Buffer<int> out = g.realize(10, 4);
+
+    std::ifstream in(trace_file.pathname().c_str());
+    std::stringstream ss;
+    ss << in.rdbuf();
+    std::string trace = ss.str();
+
+    if (trace.compare(0, 2, "[\n") != 0) {
+        printf("Trace doesn't start a JSON array:\n%s\n", trace.c_str());
+        return -1;
+    }
+
+    // One realization of g, and one of f per row of g, each with a
+    // begin and an end.
+    int g_realizations = count(trace, "{\"name\":\"g\",\"cat\":\"realization\"");
+    int f_realizations = count(trace, "{\"name\":\"f\",\"cat\":\"realization\"");
+    if (g_realizations != 2 || f_realizations != 8) {
+        printf("Expected 2 and 8 realization events of g and f, got %d and %d:\n%s\n",
+               g_realizations, f_realizations, trace.c_str());
+        return -1;
+    }
+    if (count(trace, "\"ph\":\"b\"") != count(trace, "\"ph\":\"e\"")) {
+        printf("Unmatched begin and end events:\n%s\n", trace.c_str());
+        return -1;
+    }
+    if (count(trace, "\"cat\":\"load\"") || count(trace, "\"cat\":\"store\"")) {
+        printf("Loads and stores should not be in the trace:\n%s\n", trace.c_str());
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+#endif
+}
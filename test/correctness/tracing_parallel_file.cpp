@@ -0,0 +1,91 @@
+#include "Halide.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <set>
+
+using namespace Halide;
+
+// Trace a parallel pipeline to a file. Each thread buffers its own
+// packets, so they may be out of order in the file, but their ids
+// should say what order they were traced in.
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+    printf("Skipping correctness_tracing_parallel_file on Windows.\n");
+    return 0;
+#else
+    Internal::TemporaryFile trace_file("tracing_parallel_file", ".bin");
+    setenv("HL_TRACE_FILE", trace_file.pathname().c_str(), 1);
+
+    const int W = 100, H = 64;
+    Func f("f");
+    Var x, y;
+    f(x, y) = x + y * 1000;
+    f.parallel(y).trace_stores();
+    f.realize(W, H);
+
+    FILE *file = fopen(trace_file.pathname().c_str(), "rb");
+    if (!file) {
+        printf("Could not open %s\n", trace_file.pathname().c_str());
+        return -1;
+    }
+
+    struct {
+        halide_trace_packet_t header;
+        uint8_t payload[4096];
+    } p;
+    std::set<int> ids;
+    std::vector<bool> stored(W * H, false);
+    int begin_id = -1, end_parent_id = -1, first_store_id = -1;
+    while (fread(&p.header, sizeof(p.header), 1, file) == 1) {
+        size_t payload_size = p.header.size - sizeof(p.header);
+        if (payload_size > sizeof(p.payload) ||
+            fread(p.payload, 1, payload_size, file) != payload_size) {
+            printf("Truncated packet\n");
+            return -1;
+        }
+        if (!ids.insert(p.header.id).second) {
+            printf("Id %d appears more than once\n", p.header.id);
+            return -1;
+        }
+        if (p.header.event == halide_trace_begin_pipeline) {
+            begin_id = p.header.id;
+        } else if (p.header.event == halide_trace_end_pipeline) {
+            end_parent_id = p.header.parent_id;
+        } else if (p.header.event == halide_trace_store) {
+            int xx = p.header.coordinates()[0], yy = p.header.coordinates()[1];
+            int value = *(const int *)p.header.value();
+            if (value != xx + yy * 1000 || stored[xx + yy * W]) {
+                printf("Bad store packet at %d, %d: %d\n", xx, yy, value);
+                return -1;
+            }
+            stored[xx + yy * W] = true;
+            if (first_store_id < 0 || p.header.id < first_store_id) {
+                first_store_id = p.header.id;
+            }
+        }
+    }
+    fclose(file);
+
+    for (int i = 0; i < W * H; i++) {
+        if (!stored[i]) {
+            printf("No store packet for %d, %d\n", i % W, i / W);
+            return -1;
+        }
+    }
+    if (begin_id < 0 || end_parent_id != begin_id || begin_id > first_store_id) {
+        printf("Bad pipeline packets: begin %d, end parent %d, first store %d\n",
+               begin_id, end_parent_id, first_store_id);
+        return -1;
+    }
+    // Every packet traced has an id, with no gaps.
+    if (*ids.rbegin() - *ids.begin() + 1 != (int)ids.size()) {
+        printf("Ids range from %d to %d, but there are %d packets\n",
+               *ids.begin(), *ids.rbegin(), (int)ids.size());
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+#endif
+}
@@ -0,0 +1,42 @@
+#include <stdio.h>
+#include "HalideRuntime.h"
+#include "HalideBuffer.h"
+#include "multitarget_rfactor.h"
+
+using namespace Halide::Runtime;
+
+int main(int argc, char **argv) {
+    const int W = 32, H = 256;
+    Buffer<int32_t> input(W, H);
+    input.for_each_element([&](int x, int y) {
+        input(x, y) = (x * 3 + y * 5) % 7;
+    });
+
+    int32_t total = 0;
+    for (int y = 0; y < H; y++) {
+        total += input(0, y);
+    }
+
+    // Run it a few times. Every run should give the reference result.
+    for (int run = 0; run < 4; run++) {
+        Buffer<int32_t> output(W);
+        if (multitarget_rfactor(input, output) != 0) {
+            printf("Error at multitarget_rfactor\n");
+            return -1;
+        }
+        for (int x = 0; x < W; x++) {
+            int32_t col_sum = 0;
+            for (int y = 0; y < H; y++) {
+                col_sum += input(x, y);
+            }
+            const int32_t expected = col_sum * 2 + total;
+            if (output(x) != expected) {
+                printf("Error on run %d at %d: expected %d, got %d\n", run, x, expected, output(x));
+                return -1;
+            }
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,41 @@
+#include "Halide.h"
+
+namespace {
+
+// Each sub-target of a multitarget build is lowered on its own thread,
+// and both the RVar reorder and the rfactor below have to prove the
+// update is associative, which goes through the shared tables of
+// associative ops.
+class MultitargetRfactor : public Halide::Generator<MultitargetRfactor> {
+public:
+    Input<Buffer<int32_t>> input{"input", 2};
+    Output<Buffer<int32_t>> output{"output", 1};
+
+    void generate() {
+        Var x("x"), u("u");
+
+        RDom r(0, 16, 0, 16, "r");
+        Func col_sum("col_sum");
+        col_sum(x) = 0;
+        col_sum(x) += input(x, r.x + 16 * r.y);
+
+        RDom k(0, 256, "k");
+        Func total("total");
+        total() = 0;
+        total() += input(0, k);
+
+        output(x) = col_sum(x) * 2 + total();
+
+        col_sum.compute_root();
+        col_sum.update().reorder(r.y, r.x);
+
+        RVar ko("ko"), ki("ki");
+        total.compute_root();
+        total.update().split(k, ko, ki, 16);
+        total.update().rfactor(ki, u).compute_root();
+    }
+};
+
+}  // namespace
+
+HALIDE_REGISTER_GENERATOR(MultitargetRfactor, multitarget_rfactor)
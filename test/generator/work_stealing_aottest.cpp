@@ -0,0 +1,53 @@
+#include "HalideRuntime.h"
+#include "HalideBuffer.h"
+
+#include <stdio.h>
+
+#include "work_stealing.h"
+
+using namespace Halide::Runtime;
+
+int main(int argc, char **argv) {
+    halide_set_custom_parallel_runtime(
+        halide_work_stealing_do_par_for, halide_default_do_task,
+        halide_default_do_loop_task, halide_work_stealing_do_parallel_tasks,
+        halide_default_semaphore_init, halide_default_semaphore_try_acquire,
+        halide_default_semaphore_release);
+
+    Buffer<int> out(64, 64, 8);
+
+    for (int i = 0; i < 200; i++) {
+        if (i == 100) {
+            // Run the rest with workers pinned to cores, which spreads
+            // the ranges of each loop over the NUMA nodes.
+            halide_shutdown_thread_pool();
+            halide_set_thread_affinity(halide_thread_affinity_cores);
+        }
+
+        // Vary the size of the pool, so that some loops are split
+        // over more ranges than there are workers.
+        halide_set_num_threads(1 + i % 16);
+        out.fill(0);
+        int ret = work_stealing(out);
+        if (ret) {
+            printf("Non zero exit code: %d\n", ret);
+            return -1;
+        }
+
+        for (int z = 0; z < out.dim(2).extent(); z++) {
+            for (int y = 0; y < out.dim(1).extent(); y++) {
+                for (int x = 0; x < out.dim(0).extent(); x++) {
+                    int correct = (x + y * z) + (x + 1 + y * z) + (x % 7 == 0 ? 2016 * x : 0);
+                    if (out(x, y, z) != correct) {
+                        printf("out(%d, %d, %d) = %d instead of %d\n",
+                               x, y, z, out(x, y, z), correct);
+                        return -1;
+                    }
+                }
+            }
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,29 @@
+#include "Halide.h"
+
+namespace {
+
+class WorkStealing : public Halide::Generator<WorkStealing> {
+public:
+    Output<Buffer<int>> output{"output", 3};
+
+    void generate() {
+        // Nested parallel loops of uneven cost, fed by an async
+        // producer that synchronizes with them through semaphores.
+        Var x, y, z;
+
+        Func producer, consumer;
+        producer(x, y, z) = x + y * z;
+        consumer(x, y, z) = producer(x, y, z) + producer(x + 1, y, z);
+
+        RDom r(0, 64);
+        output(x, y, z) = consumer(x, y, z) + select(x % 7 == 0, sum(r * x), 0);
+
+        producer.compute_at(output, y).store_at(output, z).async();
+        consumer.compute_at(output, y);
+        output.parallel(z).parallel(y, 4);
+    }
+};
+
+}  // namespace
+
+HALIDE_REGISTER_GENERATOR(WorkStealing, work_stealing)
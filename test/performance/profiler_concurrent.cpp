@@ -0,0 +1,89 @@
+#include "Halide.h"
+#include <stdio.h>
+#include <thread>
+
+using namespace Halide;
+
+// Two pipelines run at the same time on different threads should each
+// have their time billed to their own Funcs.
+
+int percentage[2] = {0, 0};
+
+template<int i>
+void my_print(void *, const char *msg) {
+    const char *pattern = i == 0 ? " a13: %fms (%d" : " b13: %fms (%d";
+    float this_ms;
+    int this_percentage;
+    if (sscanf(msg, pattern, &this_ms, &this_percentage) == 2) {
+        percentage[i] = this_percentage;
+    }
+}
+
+Func make_pipeline(const std::string &prefix) {
+    // A long chain of finely-interleaved Funcs, of which one is very expensive.
+    Func f[30];
+    Var c, x;
+    for (int i = 0; i < 30; i++) {
+        f[i] = Func(prefix + std::to_string(i));
+        if (i == 0) {
+            f[i](c, x) = cast<float>(x + c);
+        } else if (i == 13) {
+            Expr e = f[i-1](c, x);
+            for (int j = 0; j < 200; j++) {
+                e = sin(e);
+            }
+            f[i](c, x) = e;
+        } else {
+            f[i](c, x) = f[i-1](c, x)*2.0f;
+        }
+    }
+
+    Func out(prefix + "_out");
+    out(c, x) = 0.0f;
+    RDom r(0, 100);
+    out(c, x) += r*f[29](c, x);
+
+    out.compute_root();
+    out.update().reorder(c, x, r);
+    for (int i = 0; i < 30; i++) {
+        f[i].compute_at(out, x);
+    }
+    return out;
+}
+
+int main(int argc, char **argv) {
+    Target t = get_jit_target_from_environment().with_feature(Target::Profile);
+
+    Func a = make_pipeline("a"), b = make_pipeline("b");
+    a.set_custom_print(&my_print<0>);
+    b.set_custom_print(&my_print<1>);
+    a.compile_jit(t);
+    b.compile_jit(t);
+
+    // Each realization reports and resets the profiler when it's
+    // done, while the other pipeline is still running.
+    std::thread ta([&]() {
+        for (int i = 0; i < 5; i++) {
+            a.realize(10, 1000, t);
+        }
+    });
+    std::thread tb([&]() {
+        for (int i = 0; i < 5; i++) {
+            b.realize(10, 1000, t);
+        }
+    });
+    ta.join();
+    tb.join();
+
+    for (int i = 0; i < 2; i++) {
+        if (percentage[i] < 40) {
+            printf("Percentage of runtime spent in %c13: %d\n"
+                   "This is suspiciously low. It should be more like 66%%\n",
+                   "ab"[i], percentage[i]);
+            return -1;
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
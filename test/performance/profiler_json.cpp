@@ -0,0 +1,58 @@
+#include "Halide.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <fstream>
+#include <sstream>
+
+using namespace Halide;
+
+// Write the profile as JSON, for dashboards and regression tracking,
+// by setting HL_PROFILER_JSON.
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+    printf("Skipping performance_profiler_json on Windows.\n");
+    return 0;
+#else
+    Internal::TemporaryFile profile_file("profiler_json", ".json");
+    setenv("HL_PROFILER_JSON", profile_file.pathname().c_str(), 1);
+
+    Func f("expensive"), g("cheap"), out("profiler_json_out");
+    Var x, y;
+    f(x, y) = cast<float>(x + y);
+    for (int i = 0; i < 100; i++) {
+        f(x, y) = sin(f(x, y));
+    }
+    g(x, y) = f(x, y) * 2.0f;
+    out(x, y) = g(x, y) + g(x + 1, y);
+    f.compute_root();
+    g.compute_root();
+
+    // The report, and with it the JSON file, is written at the end of
+    // the realization.
+    Target t = get_jit_target_from_environment().with_feature(Target::Profile);
+    out.realize(1000, 100, t);
+
+    std::ifstream in(profile_file.pathname().c_str());
+    std::stringstream ss;
+    ss << in.rdbuf();
+    std::string profile = ss.str();
+
+    const char *expected[] = {
+        "{\"pipelines\": [",
+        "{\"name\": \"profiler_json_out\", \"time_ns\": ",
+        "{\"name\": \"expensive\", \"time_ns\": ",
+        "{\"name\": \"cheap\", \"time_ns\": ",
+        "\"percent\": ",
+    };
+    for (const char *e : expected) {
+        if (profile.find(e) == std::string::npos) {
+            printf("Did not find %s in the profile:\n%s\n", e, profile.c_str());
+            return -1;
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+#endif
+}
@@ -0,0 +1,73 @@
+#include "Halide.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace Halide;
+
+// Read hardware performance counters at every Func transition of a
+// profiled pipeline. Many machines (and most virtual machines) don't
+// let user code read them, in which case the report just leaves them
+// out.
+
+bool counted = false;
+float ipc = 0;
+void my_print(void *, const char *msg) {
+    const char *p = strstr(msg, "fn13:");
+    if (!p) return;
+    p = strstr(p, "ipc: ");
+    if (p && sscanf(p, "ipc: %f", &ipc) == 1) {
+        counted = true;
+    }
+}
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+    printf("Skipping performance_profiler_perf_counters on Windows.\n");
+    return 0;
+#else
+    // The runtime checks this once, before the first profiled
+    // pipeline runs.
+    setenv("HL_PROFILER_PERF_COUNTERS", "1", 1);
+
+    Func f[20];
+    Var c, x;
+    for (int i = 0; i < 20; i++) {
+        f[i] = Func("fn" + std::to_string(i));
+        if (i == 0) {
+            f[i](c, x) = cast<float>(x + c);
+        } else if (i == 13) {
+            Expr e = f[i-1](c, x);
+            for (int j = 0; j < 100; j++) {
+                e = sin(e);
+            }
+            f[i](c, x) = e;
+        } else {
+            f[i](c, x) = f[i-1](c, x)*2.0f;
+        }
+    }
+
+    Func out;
+    out(c, x) = f[19](c, x);
+    out.set_custom_print(&my_print);
+    out.compute_root().parallel(x, 16);
+    for (int i = 0; i < 20; i++) {
+        f[i].compute_at(out, x);
+    }
+
+    Target t = get_jit_target_from_environment().with_feature(Target::Profile);
+    Buffer<float> im = out.realize(10, 100000, t);
+
+    if (!counted) {
+        printf("No hardware counters on this machine.\n");
+    } else if (ipc <= 0) {
+        printf("fn13 ran %f instructions per cycle\n", ipc);
+        return -1;
+    } else {
+        printf("fn13 ran %f instructions per cycle\n", ipc);
+    }
+
+    printf("Success!\n");
+    return 0;
+#endif
+}
@@ -366,9 +366,14 @@ int main(int argc, char * const *argv) {
         pair.second.allocate();
     }
 
+    // The first pass only finds the bounds of each Func, so it didn't
+    // matter which order the packets came in. This one keeps the last
+    // value stored to each site, so restore the order they were
+    // traced in.
+    PacketSequencer sequencer;
     for (;;) {
         Packet p;
-        if (!p.read_from_filedesc(file_desc)) {
+        if (!p.read_in_order_from_filedesc(file_desc, sequencer)) {
             printf("[INFO] Finished pass 2 after %d packets.\n", packet_count);
             if (file_desc != nullptr) {
                 fclose(file_desc);
@@ -29,6 +29,16 @@ bool Packet::read_from_filedesc(FILE *fdesc){
     return true;
 }
 
+bool Packet::read_in_order_from_filedesc(FILE *fdesc, PacketSequencer &sequencer) {
+    while (!sequencer.pop(this, false)) {
+        if (!read_from_filedesc(fdesc)) {
+            return sequencer.pop(this, true);
+        }
+        sequencer.push(this);
+    }
+    return true;
+}
+
 bool Packet::read(void *d, size_t size, FILE *fdesc) {
     uint8_t *dst = (uint8_t *)d;
     if (!size) return true;
@@ -3,7 +3,10 @@
 
 #include "HalideRuntime.h"
 #include <stdio.h>
+#include <algorithm>
 #include <cstring>
+#include <queue>
+#include <vector>
 
 namespace Halide {
 namespace Internal {
@@ -60,6 +63,89 @@ T value_as(halide_type_t type, const halide_scalar_value_t& value) {
     return (T) 0;
 }
 
+// The runtime writes packets to the trace in per-thread chunks, so
+// the packets of a parallel pipeline are only in order per
+// thread. Packet ids are handed out in the order events are traced,
+// starting from one, so this puts the packets back in that order. If
+// an id never turns up (e.g. because the trace was started partway
+// through), it gives up on it once window packets are waiting.
+//
+// Each run of a program appends to the trace file, after everything
+// from the runs before it, and numbers its packets from one again. A
+// run ends at the first id repeated within it. Its packets all come
+// before those of the next run, which are sequenced separately.
+class PacketSequencer {
+    struct Entry {
+        uint64_t run;
+        int32_t id;
+        uint64_t arrival;
+        std::vector<uint8_t> bytes;
+
+        bool operator<(const Entry &other) const {
+            // Earliest run, then earliest id, at the top of the
+            // priority queue.
+            if (run != other.run) {
+                return run > other.run;
+            }
+            return id != other.id ? id > other.id : arrival > other.arrival;
+        }
+    };
+
+    std::priority_queue<Entry> waiting;
+    // The run being read, and the ids read from it so far.
+    uint64_t run = 0;
+    std::vector<bool> seen;
+    // The run being popped, and the id expected next from it.
+    uint64_t popping_run = 0;
+    int32_t next_id = 1;
+    uint64_t arrivals = 0;
+    size_t window;
+
+public:
+    PacketSequencer(size_t window = 1 << 20) : window(window) {}
+
+    // Add a packet read from the trace.
+    void push(const halide_trace_packet_t *p) {
+        if (p->id >= 0) {
+            size_t id = (size_t)p->id;
+            if (id < seen.size() && seen[id]) {
+                run++;
+                seen.clear();
+            }
+            if (id >= seen.size()) {
+                seen.resize(std::max(id + 1, 2 * seen.size()));
+            }
+            seen[id] = true;
+        }
+        const uint8_t *begin = (const uint8_t *)p;
+        waiting.push(Entry{run, p->id, arrivals++, std::vector<uint8_t>(begin, begin + p->size)});
+    }
+
+    // Get the next packet in order, if it has been pushed. Once the
+    // whole trace has been pushed, pass at_end to get the rest. The
+    // packet is copied into p, which must be as large as the buffer
+    // it was read into.
+    bool pop(halide_trace_packet_t *p, bool at_end) {
+        if (waiting.empty()) {
+            return false;
+        }
+        const Entry &e = waiting.top();
+        if (e.run != popping_run) {
+            popping_run = e.run;
+            next_id = 1;
+        }
+        // Nothing more can turn up for the runs before the one being read.
+        bool run_complete = e.run < run;
+        if (e.id != next_id && !run_complete && !at_end && waiting.size() < window) {
+            return false;
+        }
+        memcpy((void *)p, e.bytes.data(), e.bytes.size());
+        next_id = e.id + 1;
+        waiting.pop();
+        return true;
+    }
+};
+
 // A struct representing a single Halide tracing packet.
 struct Packet : public halide_trace_packet_t {
     // Not all of this will be used, but this
@@ -89,6 +175,10 @@ struct Packet : public halide_trace_packet_t {
     // Grab a packet from a particular fctl file descriptor. Returns false when end is reached.
     bool read_from_filedesc(FILE *fdesc);
 
+    // Grab the next packet in the order they were traced, using
+    // sequencer to reorder them. Returns false when end is reached.
+    bool read_in_order_from_filedesc(FILE *fdesc, PacketSequencer &sequencer);
+
 private:
     // Do a blocking read of some number of bytes from a unistd file descriptor.
     bool read(void *d, size_t size, FILE *fdesc);
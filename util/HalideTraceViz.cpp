@@ -24,6 +24,7 @@
 
 #include "inconsolata.h"
 #include "HalideRuntime.h"
+#include "HalideTraceUtils.h"
 
 #include "halide_trace_config.h"
 
@@ -174,6 +175,17 @@ struct PacketAndPayload : public halide_trace_packet_t {
         }
         return true;
     }
+
+    // Read the next packet in the order they were traced.
+    bool read_in_order(Internal::PacketSequencer &sequencer) {
+        while (!sequencer.pop(this, false)) {
+            if (!read()) {
+                return sequencer.pop(this, true);
+            }
+            sequencer.push(this);
+        }
+        return true;
+    }
 };
 
 // -------------------------------------------------------------
@@ -1086,6 +1098,9 @@ int run(bool ignore_trace_tags, FlagProcessor flag_processor) {
     };
     std::map<uint32_t, PipelineInfo> pipeline_info;
 
+    // Packets from different threads arrive in chunks.
+    Internal::PacketSequencer sequencer;
+
     int layout_order = 0;
     std::list<std::pair<Label, int>> labels_being_drawn;
     size_t end_counter = 0;
@@ -1144,7 +1159,7 @@ int run(bool ignore_trace_tags, FlagProcessor flag_processor) {
 
         // Read a tracing packet
         PacketAndPayload p;
-        if (!p.read()) {
+        if (!p.read_in_order(sequencer)) {
             end_counter++;
             continue;
         }